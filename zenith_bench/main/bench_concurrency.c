@@ -0,0 +1,167 @@
+// bench_concurrency.c
+//
+// Readers against the receive path. One task stores readings as fast as it can while reader tasks query history and
+// rollups in a loop, the way the UI and the console do. Every view a reader gets is checked for tearing, and the
+// ingest rate is compared with and without the readers.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "nvs_flash.h"
+
+#include "zenith_registry.h"
+#include "zenith_bench.h"
+
+#define BENCH_CONCURRENCY_NODES 8
+#define BENCH_CONCURRENCY_READERS 3
+#define BENCH_CONCURRENCY_RUN_MS 2000
+#define BENCH_CONCURRENCY_EPOCH 1700000000
+#define BENCH_CONCURRENCY_HISTORY 256   // Room for a compressed ring's worth of readings
+
+static const char *TAG = "bench-concurrency";
+
+typedef struct bench_concurrency_s {
+    zenith_registry_handle_t registry;
+    SemaphoreHandle_t done;     // Given by every task on its way out
+    volatile bool stop;
+    uint32_t writes;            // store_datapoints calls
+    uint32_t reads[ BENCH_CONCURRENCY_READERS ];
+    uint32_t torn[ BENCH_CONCURRENCY_READERS ];
+} bench_concurrency_t;
+
+typedef struct bench_concurrency_reader_s {
+    bench_concurrency_t *bench;
+    size_t id;
+} bench_concurrency_reader_t;
+
+// Reading i of a node has timestamp epoch + i, a temperature of i % 65536 and a humidity of 1. A whole view of the
+// temperature ring counts up by one in both, and every humidity rollup has a mean of exactly 1.
+static void _bench_concurrency_writer( void *arg ) {
+    bench_concurrency_t *bench = arg;
+    zenith_mac_address_t macs[ BENCH_CONCURRENCY_NODES ];
+    for ( size_t n = 0; n < BENCH_CONCURRENCY_NODES; n++ )
+        bench_mac( n, macs[ n ] );
+
+    for ( uint32_t i = 0; !bench->stop; i++ ) {
+        zenith_datapoint_t datapoints[] = {
+            { ZENITH_DATAPOINT_TEMPERATURE, ( float ) ( i % 65536 ) },
+            { ZENITH_DATAPOINT_HUMIDITY, 1.0f },
+        };
+        time_t timestamps[] = { BENCH_CONCURRENCY_EPOCH + i, BENCH_CONCURRENCY_EPOCH + i };
+        for ( size_t n = 0; n < BENCH_CONCURRENCY_NODES; n++ )
+            ESP_ERROR_CHECK( zenith_registry_store_datapoints( bench->registry, macs[ n ], datapoints, timestamps, 2 ) );
+        bench->writes += BENCH_CONCURRENCY_NODES;
+    }
+
+    xSemaphoreGive( bench->done );
+    vTaskDelete( NULL );
+}
+
+static bool _bench_concurrency_history_whole( const zenith_reading_t *history, size_t count ) {
+    for ( size_t i = 0; i < count; i++ ) {
+        uint32_t reading = history[ i ].timestamp - BENCH_CONCURRENCY_EPOCH;
+        if ( history[ i ].value != ( float ) ( reading % 65536 ) )
+            return false;
+        if ( i && history[ i ].timestamp != history[ i - 1 ].timestamp + 1 )
+            return false;
+    }
+    return true;
+}
+
+static bool _bench_concurrency_rollups_whole( const zenith_rollup_t *rollups, size_t count ) {
+    for ( size_t i = 0; i < count; i++ )
+        if ( rollups[ i ].min != 1.0f || rollups[ i ].max != 1.0f || rollups[ i ].mean != 1.0f )
+            return false;
+    return true;
+}
+
+static void _bench_concurrency_reader( void *arg ) {
+    bench_concurrency_reader_t *reader = arg;
+    bench_concurrency_t *bench = reader->bench;
+    zenith_reading_t *history = malloc( BENCH_CONCURRENCY_HISTORY * sizeof( zenith_reading_t ) );
+    zenith_rollup_t rollups[ ZENITH_ROLLUP_5MIN_BUCKETS ];
+    zenith_mac_address_t mac;
+
+    // Rings are indexed by the datapoint type the node sent
+    for ( uint32_t i = 0; history && !bench->stop; i++ ) {
+        bench_mac( i % BENCH_CONCURRENCY_NODES, mac );
+
+        size_t count = BENCH_CONCURRENCY_HISTORY;
+        if ( zenith_registry_get_history( bench->registry, mac, ( zenith_sensor_type_t ) ZENITH_DATAPOINT_TEMPERATURE, history, &count ) == ESP_OK
+                && !_bench_concurrency_history_whole( history, count ) )
+            bench->torn[ reader->id ]++;
+
+        count = ZENITH_ROLLUP_5MIN_BUCKETS;
+        if ( zenith_registry_get_rollups( bench->registry, mac, ( zenith_sensor_type_t ) ZENITH_DATAPOINT_HUMIDITY, ZENITH_ROLLUP_5MIN, rollups, &count ) == ESP_OK
+                && !_bench_concurrency_rollups_whole( rollups, count ) )
+            bench->torn[ reader->id ]++;
+
+        bench->reads[ reader->id ] += 2;
+    }
+
+    free( history );
+    xSemaphoreGive( bench->done );
+    vTaskDelete( NULL );
+}
+
+// Runs the writer and some readers for BENCH_CONCURRENCY_RUN_MS on a fresh registry
+static void _bench_concurrency_run( bench_concurrency_t *bench, size_t readers ) {
+    bench_concurrency_reader_t reader_args[ BENCH_CONCURRENCY_READERS ];
+    memset( bench, 0, sizeof( *bench ) );
+    ESP_ERROR_CHECK( nvs_flash_erase() );
+    ESP_ERROR_CHECK( nvs_flash_init() );
+    ESP_ERROR_CHECK( zenith_registry_new( &bench->registry ) );
+    bench->done = xSemaphoreCreateCounting( BENCH_CONCURRENCY_READERS + 1, 0 );
+    if ( !bench->done )
+        abort();
+
+    xTaskCreate( _bench_concurrency_writer, "bench_writer", 4096, bench, tskIDLE_PRIORITY + 1, NULL );
+    for ( size_t r = 0; r < readers; r++ ) {
+        reader_args[ r ] = ( bench_concurrency_reader_t ) { bench, r };
+        xTaskCreate( _bench_concurrency_reader, "bench_reader", 4096, &reader_args[ r ], tskIDLE_PRIORITY + 1, NULL );
+    }
+
+    vTaskDelay( pdMS_TO_TICKS( BENCH_CONCURRENCY_RUN_MS ) );
+    bench->stop = true;
+    for ( size_t t = 0; t < readers + 1; t++ )
+        xSemaphoreTake( bench->done, portMAX_DELAY );
+
+    vSemaphoreDelete( bench->done );
+    zenith_registry_delete( bench->registry );
+}
+
+void bench_concurrency( void ) {
+    bench_concurrency_t *bench = malloc( sizeof( bench_concurrency_t ) );
+    if ( !bench )
+        abort();
+
+    _bench_concurrency_run( bench, 0 );
+    uint32_t alone = bench->writes;
+
+    _bench_concurrency_run( bench, BENCH_CONCURRENCY_READERS );
+    uint32_t reads = 0;
+    uint32_t torn = 0;
+    for ( size_t r = 0; r < BENCH_CONCURRENCY_READERS; r++ ) {
+        reads += bench->reads[ r ];
+        torn += bench->torn[ r ];
+    }
+
+    printf( "---- Readers against ingest, %u nodes, %u ms ----\n", ( unsigned ) BENCH_CONCURRENCY_NODES, ( unsigned ) BENCH_CONCURRENCY_RUN_MS );
+    printf( "Ingest alone:       %.1f k calls/s\n", alone / ( double ) BENCH_CONCURRENCY_RUN_MS );
+    printf( "With %u readers:     %.1f k calls/s, %u queries, %u torn views\n", ( unsigned ) BENCH_CONCURRENCY_READERS,
+            bench->writes / ( double ) BENCH_CONCURRENCY_RUN_MS, ( unsigned ) reads, ( unsigned ) torn );
+
+    // A torn view means the ring seqlock let a reader copy a ring mid write
+    if ( torn ) {
+        ESP_LOGE( TAG, "%u of %u queries saw a half written ring", ( unsigned ) torn, ( unsigned ) reads );
+        fflush( stdout );
+        abort();
+    }
+
+    free( bench );
+}
@@ -0,0 +1,145 @@
+// bench_gorilla.c
+//
+// Gorilla compressed ring blocks against the plain entry array: append and decode rates, and how many readings a
+// ring's worth of memory holds, for a few made up signals.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "zenith_registry.h"
+#include "zenith_registry_gorilla.h"
+#include "zenith_bench.h"
+
+#define BENCH_GORILLA_READINGS 100000
+#define BENCH_GORILLA_INTERVAL_S 30     // Node report interval
+
+typedef enum bench_gorilla_signal_e {
+    BENCH_GORILLA_IDLE = 0,     // Steady interval, value never changes
+    BENCH_GORILLA_TEMPERATURE,  // Slow drift at the AHT30's 0.01 degree resolution, +-1 s jitter
+    BENCH_GORILLA_HUMIDITY,     // 0.1 % steps with some noise, +-1 s jitter
+    BENCH_GORILLA_NOISE,        // Random floats and intervals, the worst case
+    BENCH_GORILLA_SIGNALS
+} bench_gorilla_signal_t;
+
+static const char *bench_gorilla_signal_names[] = { "idle", "temperature", "humidity", "noise" };
+
+/// @brief Daily swing, 0 at midnight up to amplitude at noon and back
+static int32_t _bench_gorilla_daily( int32_t offset, int32_t amplitude ) {
+    int32_t phase = offset % 86400;
+    return ( phase < 43200 ? phase : 86400 - phase ) * amplitude / 43200;
+}
+
+static void _bench_gorilla_generate( bench_gorilla_signal_t signal, int32_t *offsets, float *values ) {
+    int32_t offset = 0;
+    for ( size_t i = 0; i < BENCH_GORILLA_READINGS; i++ ) {
+        switch ( signal ) {
+            case BENCH_GORILLA_IDLE:
+                offset += BENCH_GORILLA_INTERVAL_S;
+                values[ i ] = 21.5f;
+                break;
+            case BENCH_GORILLA_TEMPERATURE:
+                offset += BENCH_GORILLA_INTERVAL_S - 1 + rand() % 3;
+                values[ i ] = ( 1950 + _bench_gorilla_daily( offset, 300 ) ) / 100.0f;
+                break;
+            case BENCH_GORILLA_HUMIDITY:
+                offset += BENCH_GORILLA_INTERVAL_S - 1 + rand() % 3;
+                values[ i ] = ( 400 + _bench_gorilla_daily( offset, 100 ) + rand() % 5 - 2 ) / 10.0f;
+                break;
+            default:
+                offset += rand() % 100000;
+                values[ i ] = ( float ) rand() / ( float ) ( rand() + 1 );
+                break;
+        }
+        offsets[ i ] = offset;
+    }
+}
+
+static void _bench_gorilla_signal( bench_gorilla_signal_t signal ) {
+    int32_t *offsets = malloc( BENCH_GORILLA_READINGS * sizeof( int32_t ) );
+    float *values = malloc( BENCH_GORILLA_READINGS * sizeof( float ) );
+    zenith_reading_t *decoded = malloc( BENCH_GORILLA_READINGS * sizeof( zenith_reading_t ) );
+    // Worst case is a reading per block
+    zenith_gorilla_block_t *blocks = malloc( BENCH_GORILLA_READINGS * sizeof( zenith_gorilla_block_t ) );
+    zenith_ring_entry_t entries[ ZENITH_RING_CAPACITY ];
+    if ( !offsets || !values || !decoded || !blocks )
+        abort();
+
+    _bench_gorilla_generate( signal, offsets, values );
+
+    // Raw ring, like _ringbuffer_store. Decode goes through a full ring every ZENITH_RING_CAPACITY readings.
+    int64_t start = bench_now_ns();
+    size_t head = 0;
+    for ( size_t i = 0; i < BENCH_GORILLA_READINGS; i++ ) {
+        entries[ head ].offset = offsets[ i ];
+        entries[ head ].value = values[ i ];
+        head = ( head + 1 ) % ZENITH_RING_CAPACITY;
+    }
+    int64_t raw_append_ns = bench_now_ns() - start;
+
+    start = bench_now_ns();
+    for ( size_t i = 0; i < BENCH_GORILLA_READINGS; i++ ) {
+        const zenith_ring_entry_t *entry = &entries[ i % ZENITH_RING_CAPACITY ];
+        decoded[ i ].value = entry->value;
+        decoded[ i ].timestamp = 1700000000 + entry->offset;
+    }
+    int64_t raw_decode_ns = bench_now_ns() - start;
+
+    // Gorilla blocks, all kept so decode reads every reading once
+    start = bench_now_ns();
+    size_t block_count = 1;
+    zenith_gorilla_block_reset( &blocks[ 0 ] );
+    for ( size_t i = 0; i < BENCH_GORILLA_READINGS; i++ ) {
+        if ( !zenith_gorilla_block_append( &blocks[ block_count - 1 ], offsets[ i ], values[ i ] ) ) {
+            zenith_gorilla_block_reset( &blocks[ block_count ] );
+            zenith_gorilla_block_append( &blocks[ block_count++ ], offsets[ i ], values[ i ] );
+        }
+    }
+    int64_t gorilla_append_ns = bench_now_ns() - start;
+
+    start = bench_now_ns();
+    size_t n = 0;
+    for ( size_t b = 0; b < block_count; b++ ) {
+        zenith_gorilla_reader_t reader;
+        int32_t offset;
+        zenith_gorilla_reader_init( &reader, &blocks[ b ] );
+        while ( zenith_gorilla_reader_next( &reader, &offset, &decoded[ n ].value ) )
+            decoded[ n++ ].timestamp = 1700000000 + offset;
+    }
+    int64_t gorilla_decode_ns = bench_now_ns() - start;
+
+    if ( n != BENCH_GORILLA_READINGS )
+        abort();
+    for ( size_t i = 0; i < n; i++ )
+        if ( decoded[ i ].value != values[ i ] || decoded[ i ].timestamp != 1700000000 + offsets[ i ] )
+            abort();
+
+    size_t bits = 0;
+    for ( size_t b = 0; b < block_count; b++ )
+        bits += blocks[ b ].bits;
+    double per_block = ( double ) BENCH_GORILLA_READINGS / block_count;
+
+    // A compressed ring holds ZENITH_RING_BLOCKS blocks, but the block being written is on average half full
+    printf( "%12s %10.1f %10.1f %12.1f %12.1f %10.1f %10u %12.0f\n",
+            bench_gorilla_signal_names[ signal ],
+            ( double ) raw_append_ns / BENCH_GORILLA_READINGS, ( double ) raw_decode_ns / BENCH_GORILLA_READINGS,
+            ( double ) gorilla_append_ns / BENCH_GORILLA_READINGS, ( double ) gorilla_decode_ns / BENCH_GORILLA_READINGS,
+            ( double ) bits / BENCH_GORILLA_READINGS,
+            ( unsigned ) ZENITH_RING_CAPACITY, per_block * ( ZENITH_RING_BLOCKS - 0.5 ) );
+
+    free( blocks );
+    free( decoded );
+    free( values );
+    free( offsets );
+}
+
+void bench_gorilla( void ) {
+    printf( "---- Ring storage, ns per reading. Raw ring %u bytes, compressed ring %u bytes ----\n",
+            ( unsigned ) ( ZENITH_RING_CAPACITY * sizeof( zenith_ring_entry_t ) ),
+            ( unsigned ) ( ZENITH_RING_BLOCKS * sizeof( zenith_gorilla_block_t ) ) );
+    printf( "%12s %10s %10s %12s %12s %10s %10s %12s\n",
+            "signal", "raw add", "raw read", "gorilla add", "gorilla read", "bits", "raw ring", "gorilla ring" );
+    srand( 1 );
+    for ( bench_gorilla_signal_t signal = 0; signal < BENCH_GORILLA_SIGNALS; signal++ )
+        _bench_gorilla_signal( signal );
+}
@@ -0,0 +1,78 @@
+// bench_log.c
+//
+// The flash log on a file: append rate with the log wrapping, the scan when it's opened, and queries that the time
+// index can and can't narrow down.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "zenith_log.h"
+#include "zenith_bench.h"
+
+#define BENCH_LOG_PATH "bench_log.bin"
+#define BENCH_LOG_SIZE ( 1024 * 1024 )  // Same as the core's history partition
+#define BENCH_LOG_NODES 100
+#define BENCH_LOG_READINGS 200000       // Wraps the log a few times
+#define BENCH_LOG_INTERVAL_S 30         // Node report interval
+#define BENCH_LOG_QUERY_RUNS 20
+
+static bool _bench_log_count( const zenith_log_record_t *record, void *context ) {
+    ( *( size_t * ) context )++;
+    return true;
+}
+
+static void _bench_log_query( zenith_log_handle_t log, const char *name, const uint8_t *mac, time_t from, time_t to ) {
+    size_t found = 0;
+    int64_t start = bench_now_ns();
+    for ( int run = 0; run < BENCH_LOG_QUERY_RUNS; run++ )
+        ESP_ERROR_CHECK( zenith_log_query( log, mac, from, to, _bench_log_count, &found ) );
+    int64_t query_ns = ( bench_now_ns() - start ) / BENCH_LOG_QUERY_RUNS;
+
+    printf( "%24s %10u %12.1f\n", name, ( unsigned ) ( found / BENCH_LOG_QUERY_RUNS ), query_ns / 1000.0 );
+}
+
+void bench_log( void ) {
+    unlink( BENCH_LOG_PATH );
+    zenith_log_storage_handle_t storage = NULL;
+    zenith_log_handle_t log = NULL;
+    ESP_ERROR_CHECK( zenith_log_storage_new_file( BENCH_LOG_PATH, BENCH_LOG_SIZE, &storage ) );
+    ESP_ERROR_CHECK( zenith_log_new( storage, &log ) );
+
+    // Every node reports once per interval, one reading each
+    time_t first = 1700000000;
+    uint8_t mac[ 6 ];
+    int64_t start = bench_now_ns();
+    for ( uint32_t i = 0; i < BENCH_LOG_READINGS; i++ ) {
+        bench_mac( i % BENCH_LOG_NODES, mac );
+        ESP_ERROR_CHECK( zenith_log_append( log, mac, 0, first + ( i / BENCH_LOG_NODES ) * BENCH_LOG_INTERVAL_S, 20.0f + i % 100 / 10.0f ) );
+    }
+    int64_t append_ns = bench_now_ns() - start;
+    ESP_ERROR_CHECK( zenith_log_flush( log ) );
+
+    zenith_log_stats_t stats;
+    ESP_ERROR_CHECK( zenith_log_get_stats( log, &stats ) );
+    ESP_ERROR_CHECK( zenith_log_delete( log ) );
+
+    start = bench_now_ns();
+    ESP_ERROR_CHECK( zenith_log_new( storage, &log ) );
+    int64_t open_ns = bench_now_ns() - start;
+
+    printf( "---- Flash log on a file, %u KB, %u nodes ----\n", ( unsigned ) ( BENCH_LOG_SIZE / 1024 ), ( unsigned ) BENCH_LOG_NODES );
+    printf( "Append:             %.1f ns per reading, %u readings, %u segment erases\n",
+            ( double ) append_ns / BENCH_LOG_READINGS, ( unsigned ) BENCH_LOG_READINGS, ( unsigned ) stats.erases );
+    printf( "Kept:               %u readings, %u s of history\n",
+            ( unsigned ) stats.records, ( unsigned ) ( stats.newest_timestamp - stats.oldest_timestamp ) );
+    printf( "Open and scan:      %.1f us\n", open_ns / 1000.0 );
+
+    printf( "%24s %10s %12s\n", "query", "readings", "us" );
+    bench_mac( 42, mac );
+    _bench_log_query( log, "everything", NULL, 0, stats.newest_timestamp );
+    _bench_log_query( log, "one node", mac, 0, stats.newest_timestamp );
+    _bench_log_query( log, "last hour", NULL, stats.newest_timestamp - 3600, stats.newest_timestamp );
+    _bench_log_query( log, "one node, last hour", mac, stats.newest_timestamp - 3600, stats.newest_timestamp );
+
+    ESP_ERROR_CHECK( zenith_log_delete( log ) );
+    zenith_log_storage_delete( storage );
+    unlink( BENCH_LOG_PATH );
+}
@@ -0,0 +1,261 @@
+// bench_now.c
+//
+// The zenith_now send path over the loopback transport: time per call of send_data, send_ack and send_pairing, and the
+// heap allocations they make. Packets are built in place on the caller's stack, so there should be none - the
+// allocator is wrapped at link time (see main/CMakeLists.txt) to count them, and the bench fails if it finds any.
+//
+// Then the receive side over a bad link: DATA frames to zenith_now dropped, reordered and duplicated. Every frame that
+// gets through has to reach rx_cb exactly once, every duplicate has to be counted, and a late ack for one packet must
+// not end the wait for another. Any miss aborts.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_err.h"
+
+#include "zenith_now.h"
+#include "zenith_data.h"
+#include "zenith_bench.h"
+
+#define BENCH_NOW_CALLS 20000
+#define BENCH_NOW_DATAPOINTS 3
+#define BENCH_NOW_LINK_FRAMES 24    // Fewer than ZENITH_NOW_SEQUENCE_WINDOW, so a reordered frame is never taken for a restart
+#define BENCH_NOW_LINK_WAIT_MS 1000
+
+static const char *TAG = "bench-now";
+
+static const uint8_t bench_now_core_mac[ ZENITH_NOW_MAC_LEN ] = { 0x02, 'Z', 'B', 0x00, 0x00, 0x01 };
+static const uint8_t bench_now_peer_mac[ ZENITH_NOW_MAC_LEN ] = { 0x02, 'Z', 'B', 0x00, 0x00, 0x02 };
+
+static atomic_bool bench_now_counting = false;
+static atomic_uint bench_now_allocations = 0;
+static atomic_uint bench_now_frames = 0;
+static uint16_t bench_now_link_first = 0;   // Sequence of the first frame the link test sends
+static atomic_uint bench_now_link_seen[ BENCH_NOW_LINK_FRAMES ];    // Times rx_cb got each of its frames
+
+// Linked in with -Wl,--wrap, so every malloc, calloc and realloc in the program comes through here
+void *__real_malloc( size_t size );
+void *__real_calloc( size_t count, size_t size );
+void *__real_realloc( void *ptr, size_t size );
+
+void *__wrap_malloc( size_t size ) {
+    if ( atomic_load( &bench_now_counting ) )
+        atomic_fetch_add( &bench_now_allocations, 1 );
+    return __real_malloc( size );
+}
+
+void *__wrap_calloc( size_t count, size_t size ) {
+    if ( atomic_load( &bench_now_counting ) )
+        atomic_fetch_add( &bench_now_allocations, 1 );
+    return __real_calloc( count, size );
+}
+
+void *__wrap_realloc( void *ptr, size_t size ) {
+    if ( atomic_load( &bench_now_counting ) )
+        atomic_fetch_add( &bench_now_allocations, 1 );
+    return __real_realloc( ptr, size );
+}
+
+/// @brief The peer just counts what arrives - it's the sending side we measure
+static void _bench_now_peer_recv( zenith_now_transport_handle_t transport, const uint8_t *src_mac, const uint8_t *data, int len ) {
+    atomic_fetch_add( &bench_now_frames, 1 );
+}
+
+static void _bench_now_peer_send( zenith_now_transport_handle_t transport, const uint8_t *dest_mac, zenith_now_send_status_t status ) {
+}
+
+/// @brief zenith_now's receive callback - counts the link test's frames by sequence
+static void _bench_now_rx( const uint8_t *mac_addr, const zenith_now_packet_t *packet ) {
+    if ( packet->header.type != ZENITH_PACKET_DATA || memcmp( mac_addr, bench_now_peer_mac, ZENITH_NOW_MAC_LEN ) != 0 )
+        return;
+    uint16_t index = packet->header.sequence - bench_now_link_first;
+    if ( index < BENCH_NOW_LINK_FRAMES )
+        atomic_fetch_add( &bench_now_link_seen[ index ], 1 );
+}
+
+static void _bench_now_fail( const char *what, unsigned detail ) {
+    ESP_LOGE( TAG, "%s (%u)", what, detail );
+    fflush( stdout );
+    abort();
+}
+
+/// @brief Sends the peer's ack for one of our packets, as a node would - only that sequence in the window
+static void _bench_now_peer_ack( zenith_now_transport_handle_t peer, uint16_t sequence ) {
+    uint8_t buffer[ sizeof( zenith_now_packet_header_t ) + sizeof( zenith_now_payload_ack_t ) ];
+    zenith_now_packet_builder_t builder;
+    zenith_now_payload_ack_t ack = {
+        .ack_for_type = ZENITH_PACKET_DATA,
+        .sequence = sequence,
+        .window = 1,
+    };
+    ESP_ERROR_CHECK( zenith_now_builder_init( &builder, buffer, sizeof( buffer ), ZENITH_PACKET_ACK ) );
+    ESP_ERROR_CHECK( zenith_now_builder_append( &builder, &ack, sizeof( ack ) ) );
+    ESP_ERROR_CHECK( peer->send( peer, bench_now_core_mac, buffer, builder.length ) );
+}
+
+/// @brief Sends one of our own data packets to the peer
+/// @return its sequence number
+static uint16_t _bench_now_core_data( void ) {
+    uint8_t buffer[ ZENITH_NOW_MAX_PACKET_SIZE ];
+    zenith_now_packet_builder_t builder;
+    ESP_ERROR_CHECK( zenith_now_builder_init( &builder, buffer, sizeof( buffer ), ZENITH_PACKET_DATA ) );
+    ESP_ERROR_CHECK( zenith_now_builder_begin_record( &builder, 0 ) );
+    ESP_ERROR_CHECK( zenith_now_builder_add_datapoint( &builder, ZENITH_DATAPOINT_TEMPERATURE, 21.5f ) );
+    ESP_ERROR_CHECK( zenith_now_send_packet( bench_now_peer_mac, builder.packet ) );
+    return builder.packet->header.sequence;
+}
+
+/// @brief DATA frames from the peer over a link that drops, reorders and duplicates them, then a late ack
+static void _bench_now_link( zenith_now_transport_handle_t peer ) {
+    static uint8_t frames[ BENCH_NOW_LINK_FRAMES ][ ZENITH_NOW_MAX_PACKET_SIZE ];
+    size_t lengths[ BENCH_NOW_LINK_FRAMES ];
+    for ( size_t i = 0; i < BENCH_NOW_LINK_FRAMES; i++ ) {
+        zenith_now_packet_builder_t builder;
+        ESP_ERROR_CHECK( zenith_now_builder_init( &builder, frames[ i ], sizeof( frames[ i ] ), ZENITH_PACKET_DATA ) );
+        ESP_ERROR_CHECK( zenith_now_builder_begin_record( &builder, 0 ) );
+        ESP_ERROR_CHECK( zenith_now_builder_add_datapoint( &builder, ZENITH_DATAPOINT_TEMPERATURE, 20.0f + i ) );
+        lengths[ i ] = builder.length;
+        if ( i == 0 )
+            bench_now_link_first = builder.packet->header.sequence;
+        atomic_store( &bench_now_link_seen[ i ], 0 );
+    }
+
+    // Every fifth frame is lost, pairs go out swapped, and every fourth frame that gets through comes again - once
+    // right away, once after everything else, like a retransmit whose ack got lost
+    zenith_now_stats_t before;
+    ESP_ERROR_CHECK( zenith_now_get_stats( &before ) );
+    ESP_ERROR_CHECK( peer->add_peer( peer, bench_now_core_mac ) );
+    unsigned sent = 0;
+    unsigned duplicates = 0;
+    for ( size_t pair = 0; pair < BENCH_NOW_LINK_FRAMES; pair += 2 ) {
+        for ( size_t k = 0; k < 2; k++ ) {
+            size_t i = pair + 1 - k;
+            if ( i % 5 == 3 )
+                continue;
+            ESP_ERROR_CHECK( peer->send( peer, bench_now_core_mac, frames[ i ], lengths[ i ] ) );
+            sent++;
+            if ( i % 4 == 1 ) {
+                ESP_ERROR_CHECK( peer->send( peer, bench_now_core_mac, frames[ i ], lengths[ i ] ) );
+                duplicates++;
+            }
+        }
+    }
+    for ( size_t i = 1; i < BENCH_NOW_LINK_FRAMES; i += 4 ) {
+        if ( i % 5 == 3 )
+            continue;
+        ESP_ERROR_CHECK( peer->send( peer, bench_now_core_mac, frames[ i ], lengths[ i ] ) );
+        duplicates++;
+    }
+
+    // The frames are handled on zenith_now's task
+    zenith_now_stats_t after = { 0 };
+    for ( int waited = 0; waited < BENCH_NOW_LINK_WAIT_MS; waited += 10 ) {
+        vTaskDelay( pdMS_TO_TICKS( 10 ) );
+        ESP_ERROR_CHECK( zenith_now_get_stats( &after ) );
+        if ( after.rx_duplicates - before.rx_duplicates >= duplicates && after.rx_pool_in_use == 0 )
+            break;
+    }
+    for ( size_t i = 0; i < BENCH_NOW_LINK_FRAMES; i++ ) {
+        unsigned seen = atomic_load( &bench_now_link_seen[ i ] );
+        if ( seen != ( i % 5 == 3 ? 0 : 1 ) )
+            _bench_now_fail( i % 5 == 3 ? "A dropped frame reached rx_cb" : "A frame didn't reach rx_cb exactly once", seen );
+    }
+    if ( after.rx_duplicates - before.rx_duplicates != duplicates )
+        _bench_now_fail( "rx_duplicates doesn't match the duplicates sent", ( unsigned ) ( after.rx_duplicates - before.rx_duplicates ) );
+
+    // Two of our packets in flight, and the ack for the first one turns up while we wait for the second
+    uint16_t first = _bench_now_core_data();
+    uint16_t second = _bench_now_core_data();
+    _bench_now_peer_ack( peer, first );
+    esp_err_t late = zenith_now_wait_for_ack_sequence( bench_now_peer_mac, second, 100 );
+    if ( late != ESP_ERR_TIMEOUT )
+        _bench_now_fail( "A late ack for another packet ended the wait", ( unsigned ) late );
+    if ( zenith_now_wait_for_ack_sequence( bench_now_peer_mac, first, 100 ) != ESP_OK )
+        _bench_now_fail( "The acked packet wasn't seen as acked", first );
+    _bench_now_peer_ack( peer, second );
+    if ( zenith_now_wait_for_ack_sequence( bench_now_peer_mac, second, 100 ) != ESP_OK )
+        _bench_now_fail( "The second packet's own ack didn't end the wait", second );
+
+    printf( "---- zenith_now receive over a lossy loopback ----\n" );
+    printf( "%u frames sent, %u dropped, %u duplicates counted, late ack ignored\n", sent + duplicates,
+            ( unsigned ) ( BENCH_NOW_LINK_FRAMES - sent ), ( unsigned ) ( after.rx_duplicates - before.rx_duplicates ) );
+}
+
+static esp_err_t _bench_now_send_data( const zenith_now_payload_data_t *payload ) {
+    return zenith_now_send_data( bench_now_peer_mac, payload );
+}
+
+static esp_err_t _bench_now_send_ack( const zenith_now_payload_data_t *payload ) {
+    return zenith_now_send_ack( bench_now_peer_mac, ZENITH_PACKET_DATA );
+}
+
+static esp_err_t _bench_now_send_pairing( const zenith_now_payload_data_t *payload ) {
+    return zenith_now_send_pairing( bench_now_peer_mac );
+}
+
+/// @return heap allocations made by the calls
+static unsigned _bench_now_call( const char *name, esp_err_t ( *send )( const zenith_now_payload_data_t * ), const zenith_now_payload_data_t *payload ) {
+    // The first send adds the peer to the transport's peer list - that one may allocate
+    ESP_ERROR_CHECK( send( payload ) );
+    vTaskDelay( pdMS_TO_TICKS( 10 ) );
+
+    atomic_store( &bench_now_allocations, 0 );
+    atomic_store( &bench_now_counting, true );
+    int64_t start = bench_now_ns();
+    for ( int i = 0; i < BENCH_NOW_CALLS; i++ )
+        ESP_ERROR_CHECK( send( payload ) );
+    int64_t call_ns = ( bench_now_ns() - start ) / BENCH_NOW_CALLS;
+    // The send statuses are handled on zenith_now's task - let it catch up before we stop counting
+    vTaskDelay( pdMS_TO_TICKS( 50 ) );
+    atomic_store( &bench_now_counting, false );
+
+    unsigned allocations = atomic_load( &bench_now_allocations );
+    printf( "%16s %10.1f %12u\n", name, ( double ) call_ns, allocations );
+    return allocations;
+}
+
+void bench_now( void ) {
+    zenith_now_transport_handle_t core = NULL;
+    zenith_now_transport_handle_t peer = NULL;
+    zenith_now_transport_loopback_config_t loopback_config = { 0 };
+
+    memcpy( loopback_config.mac, bench_now_core_mac, ZENITH_NOW_MAC_LEN );
+    ESP_ERROR_CHECK( zenith_now_transport_new_loopback( &loopback_config, &core ) );
+    memcpy( loopback_config.mac, bench_now_peer_mac, ZENITH_NOW_MAC_LEN );
+    ESP_ERROR_CHECK( zenith_now_transport_new_loopback( &loopback_config, &peer ) );
+    ESP_ERROR_CHECK( peer->initialize( peer, _bench_now_peer_recv, _bench_now_peer_send ) );
+
+    zenith_now_config_t config = {
+        .transport = core,
+        .rx_cb = _bench_now_rx,
+        .auto_ack = ZENITH_NOW_AUTO_ACK_DATA,
+    };
+    ESP_ERROR_CHECK( zenith_now_init( &config ) );
+
+    uint8_t storage[ sizeof( zenith_now_payload_data_t ) + BENCH_NOW_DATAPOINTS * sizeof( zenith_datapoint_t ) ];
+    zenith_now_payload_data_t *payload = ( zenith_now_payload_data_t * ) storage;
+    payload->num_datapoints = BENCH_NOW_DATAPOINTS;
+    payload->datapoints[ 0 ] = ( zenith_datapoint_t ) { ZENITH_DATAPOINT_TEMPERATURE, 21.5f };
+    payload->datapoints[ 1 ] = ( zenith_datapoint_t ) { ZENITH_DATAPOINT_HUMIDITY, 45.0f };
+    payload->datapoints[ 2 ] = ( zenith_datapoint_t ) { ZENITH_DATAPOINT_PRESSURE, 1013.2f };
+
+    printf( "---- zenith_now send over loopback, ns per call ----\n" );
+    printf( "%16s %10s %12s\n", "call", "ns", "allocations" );
+    unsigned allocations = 0;
+    allocations += _bench_now_call( "send_data", _bench_now_send_data, payload );
+    allocations += _bench_now_call( "send_ack", _bench_now_send_ack, payload );
+    allocations += _bench_now_call( "send_pairing", _bench_now_send_pairing, payload );
+    printf( "Frames received:    %u\n", ( unsigned ) atomic_load( &bench_now_frames ) );
+
+    if ( allocations ) {
+        ESP_LOGE( TAG, "The send path allocated %u times, it should build packets in place", allocations );
+        fflush( stdout );
+        abort();
+    }
+
+    _bench_now_link( peer );
+}
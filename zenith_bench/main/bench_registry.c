@@ -0,0 +1,628 @@
+// bench_registry.c
+//
+// Cost of finding a node by mac as the registry grows. The linear scan is what the registry did before the mac index,
+// for comparison. The query benches check their results against a brute force answer too, and abort on a mismatch.
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "nvs_flash.h"
+
+#include "zenith_registry.h"
+#include "zenith_log_storage.h"
+#include "zenith_bench.h"
+
+#define BENCH_REGISTRY_LOOKUPS 200000
+#define BENCH_REGISTRY_INGEST_NODES 100
+#define BENCH_REGISTRY_INGEST_CALLS 1000000
+#define BENCH_REGISTRY_NEW_NODES 20     // Nodes reporting for the first time, on top of the registry size
+#define BENCH_REGISTRY_STORM_NODES 200
+#define BENCH_REGISTRY_STORM_ROUNDS 5   // Every node pairs this many times, like nodes rebooting after a power cut
+#define BENCH_REGISTRY_SUBSCRIBERS 3
+#define BENCH_REGISTRY_RANGE_READINGS 1000      // Plenty to fill a ring, compressed or not
+#define BENCH_REGISTRY_RANGE_INTERVAL_S 30
+#define BENCH_REGISTRY_RANGE_QUERIES 100000
+#define BENCH_REGISTRY_STATS_HOURS 26           // Of readings behind the windows
+#define BENCH_REGISTRY_STATS_QUERIES 100000
+#define BENCH_REGISTRY_STATS_TOLERANCE 1e-4     // Relative, for the mean and variance - the rollups keep floats
+#define BENCH_REGISTRY_CHECKPOINT_PATH "bench_checkpoint.bin"
+#define BENCH_REGISTRY_CHECKPOINT_SIZE ( 512 * 1024 )   // Same as the core's checkpoint partition
+#define BENCH_REGISTRY_CHECKPOINT_NODES 60              // Three rings each
+#define BENCH_REGISTRY_CHECKPOINT_READINGS 500          // Per ring, enough to fill the rollups
+#define BENCH_REGISTRY_VIEW_READINGS 512                // More than any ring holds, compressed or not
+#define BENCH_REGISTRY_EXPORT_NODES 100                 // Three rings each
+#define BENCH_REGISTRY_EXPORT_CHUNK 512                 // Same as tools/registry_backup.py sends to the console
+
+static const char *TAG = "bench-registry";
+
+static const size_t bench_registry_sizes[] = { 10, 100, 1000 };
+
+/// @brief Reports a query that disagrees with the brute force answer and stops
+static void _bench_registry_fail( const char *what, unsigned detail ) {
+    ESP_LOGE( TAG, "%s (%u)", what, detail );
+    fflush( stdout );
+    abort();
+}
+
+/// @brief The old _index_of_mac
+static int _linear_index_of_mac( const zenith_mac_address_t *macs, size_t count, const zenith_mac_address_t mac ) {
+    for ( size_t i = 0; i < count; i++ )
+        if ( memcmp( macs[ i ], mac, ZENITH_MAC_ADDR_LEN ) == 0 )
+            return i;
+    return -1;
+}
+
+static void _bench_registry_size( size_t nodes ) {
+    zenith_registry_handle_t registry = NULL;
+    ESP_ERROR_CHECK( nvs_flash_erase() );
+    ESP_ERROR_CHECK( nvs_flash_init() );
+    ESP_ERROR_CHECK( zenith_registry_new( &registry ) );
+
+    zenith_mac_address_t *macs = malloc( nodes * sizeof( zenith_mac_address_t ) );
+    uint32_t *order = malloc( BENCH_REGISTRY_LOOKUPS * sizeof( uint32_t ) );
+    if ( !macs || !order )
+        abort();
+
+    zenith_datapoint_t datapoint = { ZENITH_DATAPOINT_TEMPERATURE, 21.5f };
+    for ( size_t i = 0; i < nodes; i++ ) {
+        zenith_node_info_t info;
+        bench_mac( i, info.mac );
+        memcpy( macs[ i ], info.mac, ZENITH_MAC_ADDR_LEN );
+        ESP_ERROR_CHECK( zenith_registry_store_node_info( registry, &info ) );
+        ESP_ERROR_CHECK( zenith_registry_store_datapoints( registry, info.mac, &datapoint, NULL, 1 ) );
+    }
+
+    // Same random order of nodes for every variant
+    srand( 1 );
+    for ( size_t i = 0; i < BENCH_REGISTRY_LOOKUPS; i++ )
+        order[ i ] = rand() % nodes;
+
+    volatile int sink = 0;
+    int64_t start = bench_now_ns();
+    for ( size_t i = 0; i < BENCH_REGISTRY_LOOKUPS; i++ )
+        sink += _linear_index_of_mac( macs, nodes, macs[ order[ i ] ] );
+    int64_t linear_ns = bench_now_ns() - start;
+
+    zenith_node_info_t info;
+    start = bench_now_ns();
+    for ( size_t i = 0; i < BENCH_REGISTRY_LOOKUPS; i++ )
+        sink += zenith_registry_get_node_info( registry, macs[ order[ i ] ], &info );
+    int64_t info_ns = bench_now_ns() - start;
+
+    start = bench_now_ns();
+    for ( size_t i = 0; i < BENCH_REGISTRY_LOOKUPS; i++ )
+        sink += zenith_registry_store_datapoints( registry, macs[ order[ i ] ], &datapoint, NULL, 1 );
+    int64_t store_ns = bench_now_ns() - start;
+
+    // First report from a node allocates its runtime data and rings
+    start = bench_now_ns();
+    for ( size_t i = 0; i < BENCH_REGISTRY_NEW_NODES; i++ ) {
+        zenith_mac_address_t mac;
+        bench_mac( nodes + i, mac );
+        sink += zenith_registry_store_datapoints( registry, mac, &datapoint, NULL, 1 );
+    }
+    int64_t first_ns = bench_now_ns() - start;
+
+    printf( "%8u %16.1f %16.1f %20.1f %16.1f\n", ( unsigned ) nodes,
+            ( double ) linear_ns / BENCH_REGISTRY_LOOKUPS, ( double ) info_ns / BENCH_REGISTRY_LOOKUPS, ( double ) store_ns / BENCH_REGISTRY_LOOKUPS,
+            ( double ) first_ns / BENCH_REGISTRY_NEW_NODES );
+
+    free( order );
+    free( macs );
+    zenith_registry_delete( registry );
+}
+
+/// @brief store_datapoints throughput with a full packet's worth of readings per call, like core_rx_callback does
+static void _bench_registry_ingest( void ) {
+    zenith_registry_handle_t registry = NULL;
+    ESP_ERROR_CHECK( nvs_flash_erase() );
+    ESP_ERROR_CHECK( nvs_flash_init() );
+    ESP_ERROR_CHECK( zenith_registry_new( &registry ) );
+
+    zenith_mac_address_t macs[ BENCH_REGISTRY_INGEST_NODES ];
+    zenith_datapoint_t datapoints[] = {
+        { ZENITH_DATAPOINT_TEMPERATURE, 21.5f },
+        { ZENITH_DATAPOINT_HUMIDITY, 45.0f },
+        { ZENITH_DATAPOINT_PRESSURE, 1013.2f },
+    };
+    size_t per_call = sizeof( datapoints ) / sizeof( datapoints[ 0 ] );
+    time_t timestamps[] = { 1000, 1000, 1000 };
+
+    for ( size_t i = 0; i < BENCH_REGISTRY_INGEST_NODES; i++ ) {
+        bench_mac( i, macs[ i ] );
+        ESP_ERROR_CHECK( zenith_registry_store_datapoints( registry, macs[ i ], datapoints, timestamps, per_call ) );
+    }
+
+    int64_t start = bench_now_ns();
+    for ( size_t i = 0; i < BENCH_REGISTRY_INGEST_CALLS; i++ )
+        zenith_registry_store_datapoints( registry, macs[ i % BENCH_REGISTRY_INGEST_NODES ], datapoints, timestamps, per_call );
+    int64_t elapsed_ns = bench_now_ns() - start;
+
+    size_t total = BENCH_REGISTRY_INGEST_CALLS * per_call;
+    printf( "---- Registry ingest, %u nodes, %u datapoints per call ----\n", ( unsigned ) BENCH_REGISTRY_INGEST_NODES, ( unsigned ) per_call );
+    printf( "%.1f ns per call, %.1f ns per datapoint, %.2f M datapoints/s\n",
+            ( double ) elapsed_ns / BENCH_REGISTRY_INGEST_CALLS, ( double ) elapsed_ns / total, total * 1e3 / elapsed_ns );
+
+    zenith_registry_delete( registry );
+}
+
+// Blocks for a tick, like a UI redraw waiting for the display
+static void _bench_registry_slow_subscriber( const zenith_registry_event_info_t *event, void *context ) {
+    vTaskDelay( 1 );
+}
+
+/// @brief Ingest with slow subscribers. The events go to the registry's event task, so ingest should cost about the
+///        same as with none, and readings for a node that already has an event waiting are folded into it.
+static void _bench_registry_events( void ) {
+    zenith_registry_handle_t registry = NULL;
+    ESP_ERROR_CHECK( nvs_flash_erase() );
+    ESP_ERROR_CHECK( nvs_flash_init() );
+    ESP_ERROR_CHECK( zenith_registry_new( &registry ) );
+
+    zenith_registry_subscriber_handle_t subscribers[ BENCH_REGISTRY_SUBSCRIBERS ];
+    zenith_registry_filter_t filters[ BENCH_REGISTRY_SUBSCRIBERS ] = {
+        { 0 },                                                          // Everything, like the UI
+        { .sensor_types = 1u << ZENITH_DATAPOINT_TEMPERATURE },         // Alerting on temperature
+        { .match_mac = true },                                          // One node's exporter
+    };
+    bench_mac( 42, filters[ 2 ].mac );
+    for ( size_t i = 0; i < BENCH_REGISTRY_SUBSCRIBERS; i++ )
+        ESP_ERROR_CHECK( zenith_registry_subscribe( registry, &filters[ i ], _bench_registry_slow_subscriber, NULL, &subscribers[ i ] ) );
+
+    zenith_mac_address_t macs[ BENCH_REGISTRY_INGEST_NODES ];
+    zenith_datapoint_t datapoints[] = {
+        { ZENITH_DATAPOINT_TEMPERATURE, 21.5f },
+        { ZENITH_DATAPOINT_HUMIDITY, 45.0f },
+        { ZENITH_DATAPOINT_PRESSURE, 1013.2f },
+    };
+    size_t per_call = sizeof( datapoints ) / sizeof( datapoints[ 0 ] );
+    time_t timestamps[] = { 1000, 1000, 1000 };
+    for ( size_t i = 0; i < BENCH_REGISTRY_INGEST_NODES; i++ )
+        bench_mac( i, macs[ i ] );
+
+    int64_t start = bench_now_ns();
+    for ( size_t i = 0; i < BENCH_REGISTRY_INGEST_CALLS; i++ )
+        zenith_registry_store_datapoints( registry, macs[ i % BENCH_REGISTRY_INGEST_NODES ], datapoints, timestamps, per_call );
+    int64_t elapsed_ns = bench_now_ns() - start;
+
+    zenith_registry_event_stats_t stats;
+    ESP_ERROR_CHECK( zenith_registry_get_event_stats( registry, &stats ) );
+    printf( "---- Registry ingest with %u subscribers taking a tick per event ----\n", ( unsigned ) BENCH_REGISTRY_SUBSCRIBERS );
+    printf( "%.1f ns per call. %u events queued, %u coalesced, %u deferred, %u callbacks, queue high water %u\n",
+            ( double ) elapsed_ns / BENCH_REGISTRY_INGEST_CALLS, ( unsigned ) stats.posted, ( unsigned ) stats.coalesced,
+            ( unsigned ) stats.deferred, ( unsigned ) stats.delivered, ( unsigned ) stats.queue_high_water );
+
+    zenith_registry_delete( registry );
+}
+
+/// @brief A chart refresh: the last 5 minutes of a full ring, by filtering all of get_history and by range query
+/// @brief Checks get_history_range for t0..t1 against filtering the whole history
+static void _bench_registry_check_range( zenith_registry_handle_t registry, const zenith_mac_address_t mac, zenith_sensor_type_t type,
+                                         const zenith_reading_t *history, size_t count, time_t t0, time_t t1, zenith_reading_t *range ) {
+    size_t expected = 0;
+    for ( size_t i = 0; i < count; i++ )
+        if ( history[ i ].timestamp >= t0 && history[ i ].timestamp <= t1 )
+            expected++;
+
+    size_t counted = 0;
+    ESP_ERROR_CHECK( zenith_registry_get_history_range( registry, mac, type, t0, t1, NULL, &counted ) );
+    size_t found = count;
+    ESP_ERROR_CHECK( zenith_registry_get_history_range( registry, mac, type, t0, t1, range, &found ) );
+    if ( counted != expected || found != expected )
+        _bench_registry_fail( "get_history_range found another number of readings than the filter", ( unsigned ) ( t1 - t0 ) );
+
+    for ( size_t i = 0, k = 0; i < count; i++ ) {
+        if ( history[ i ].timestamp < t0 || history[ i ].timestamp > t1 )
+            continue;
+        if ( range[ k ].timestamp != history[ i ].timestamp || range[ k ].value != history[ i ].value )
+            _bench_registry_fail( "get_history_range returned another reading than the filter", ( unsigned ) k );
+        k++;
+    }
+}
+
+static void _bench_registry_range( void ) {
+    zenith_registry_handle_t registry = NULL;
+    ESP_ERROR_CHECK( nvs_flash_erase() );
+    ESP_ERROR_CHECK( nvs_flash_init() );
+    ESP_ERROR_CHECK( zenith_registry_new( &registry ) );
+
+    // Rings are indexed by the datapoint type the node sent
+    zenith_sensor_type_t type = ( zenith_sensor_type_t ) ZENITH_DATAPOINT_TEMPERATURE;
+    zenith_mac_address_t mac;
+    bench_mac( 42, mac );
+    time_t now = 1700000000;
+    for ( size_t i = 0; i < BENCH_REGISTRY_RANGE_READINGS; i++ ) {
+        zenith_datapoint_t datapoint = { ZENITH_DATAPOINT_TEMPERATURE, 21.0f + i % 8 / 4.0f };
+        now += BENCH_REGISTRY_RANGE_INTERVAL_S;
+        ESP_ERROR_CHECK( zenith_registry_store_datapoints( registry, mac, &datapoint, &now, 1 ) );
+    }
+
+    size_t size = 0;
+    ESP_ERROR_CHECK( zenith_registry_get_history( registry, mac, type, NULL, &size ) );
+    zenith_reading_t *history = malloc( size * sizeof( zenith_reading_t ) );
+    zenith_reading_t *range = malloc( size * sizeof( zenith_reading_t ) );
+    if ( !history || !range )
+        abort();
+    time_t t0 = now - 5 * 60;
+
+    size_t found = 0;
+    int64_t start = bench_now_ns();
+    for ( size_t q = 0; q < BENCH_REGISTRY_RANGE_QUERIES; q++ ) {
+        size_t count = size;
+        ESP_ERROR_CHECK( zenith_registry_get_history( registry, mac, type, history, &count ) );
+        found = 0;
+        for ( size_t i = 0; i < count; i++ )
+            if ( history[ i ].timestamp >= t0 && history[ i ].timestamp <= now )
+                range[ found++ ] = history[ i ];
+    }
+    int64_t scan_ns = ( bench_now_ns() - start ) / BENCH_REGISTRY_RANGE_QUERIES;
+
+    start = bench_now_ns();
+    for ( size_t q = 0; q < BENCH_REGISTRY_RANGE_QUERIES; q++ ) {
+        found = size;
+        ESP_ERROR_CHECK( zenith_registry_get_history_range( registry, mac, type, t0, now, range, &found ) );
+    }
+    int64_t range_ns = ( bench_now_ns() - start ) / BENCH_REGISTRY_RANGE_QUERIES;
+
+    printf( "---- Registry history of the last 5 minutes, %u readings in the ring ----\n", ( unsigned ) size );
+    printf( "Filter get_history: %.1f ns, get_history_range: %.1f ns, %u readings\n", ( double ) scan_ns, ( double ) range_ns, ( unsigned ) found );
+
+    // Every range from one reading to another, on the readings and half an interval outside them. The ring has wrapped
+    // many times over, so some of these span its wrap point - and, compressed, every boundary between blocks.
+    size_t count = size;
+    ESP_ERROR_CHECK( zenith_registry_get_history( registry, mac, type, history, &count ) );
+    time_t half = BENCH_REGISTRY_RANGE_INTERVAL_S / 2;
+    for ( size_t i = 0; i < count; i++ ) {
+        for ( size_t j = i; j < count; j++ ) {
+            _bench_registry_check_range( registry, mac, type, history, count, history[ i ].timestamp, history[ j ].timestamp, range );
+            _bench_registry_check_range( registry, mac, type, history, count, history[ i ].timestamp - half, history[ j ].timestamp + half, range );
+        }
+    }
+    _bench_registry_check_range( registry, mac, type, history, count, 0, now + 1, range );
+    _bench_registry_check_range( registry, mac, type, history, count, now + 1, now + 3600, range );
+
+    free( range );
+    free( history );
+    zenith_registry_delete( registry );
+}
+
+/// @brief Checks window stats against all the readings stored since stats->start, in doubles and two passes. The
+///        window is rounded to whole periods, so start says which readings are in it - the clock can tick over a
+///        period meanwhile.
+static void _bench_registry_check_window( const zenith_window_stats_t *stats, const time_t *timestamps, const float *values, size_t readings, uint32_t window_s ) {
+    uint32_t count = 0;
+    float min = 0;
+    float max = 0;
+    double sum = 0;
+    for ( size_t i = 0; i < readings; i++ ) {
+        if ( timestamps[ i ] < stats->start )
+            continue;
+        min = ( !count || values[ i ] < min ) ? values[ i ] : min;
+        max = ( !count || values[ i ] > max ) ? values[ i ] : max;
+        sum += values[ i ];
+        count++;
+    }
+    double mean = count ? sum / count : 0;
+    double squares = 0;
+    for ( size_t i = 0; i < readings; i++ )
+        if ( timestamps[ i ] >= stats->start )
+            squares += ( values[ i ] - mean ) * ( values[ i ] - mean );
+    double variance = count > 1 ? squares / ( count - 1 ) : 0;
+
+    if ( stats->count != count || stats->min != min || stats->max != max )
+        _bench_registry_fail( "Window stats count, min or max disagree with the readings", window_s );
+    if ( fabs( stats->mean - mean ) > BENCH_REGISTRY_STATS_TOLERANCE * fabs( mean ) )
+        _bench_registry_fail( "Window stats mean disagrees with the readings", window_s );
+    if ( fabs( stats->variance - variance ) > BENCH_REGISTRY_STATS_TOLERANCE * variance )
+        _bench_registry_fail( "Window stats variance disagrees with the readings", window_s );
+}
+
+/// @brief Window stats for the display: 1 h and 24 h of a node reporting every 30 s, merged from the rollups
+static void _bench_registry_window_stats( void ) {
+    zenith_registry_handle_t registry = NULL;
+    ESP_ERROR_CHECK( nvs_flash_erase() );
+    ESP_ERROR_CHECK( nvs_flash_init() );
+    ESP_ERROR_CHECK( zenith_registry_new( &registry ) );
+
+    // The windows end now, so the readings do too. A slow drift and some noise.
+    zenith_sensor_type_t type = ( zenith_sensor_type_t ) ZENITH_DATAPOINT_TEMPERATURE;
+    zenith_mac_address_t mac;
+    bench_mac( 42, mac );
+    size_t readings = BENCH_REGISTRY_STATS_HOURS * 3600 / BENCH_REGISTRY_RANGE_INTERVAL_S;
+    time_t *timestamps = malloc( readings * sizeof( time_t ) );
+    float *values = malloc( readings * sizeof( float ) );
+    if ( !timestamps || !values )
+        abort();
+    time_t now = time( NULL );
+    for ( size_t i = 0; i < readings; i++ ) {
+        timestamps[ i ] = now - ( time_t ) ( readings - 1 - i ) * BENCH_REGISTRY_RANGE_INTERVAL_S;
+        values[ i ] = 20.0f + i / 240.0f + i % 7 / 10.0f;
+        zenith_datapoint_t datapoint = { ZENITH_DATAPOINT_TEMPERATURE, values[ i ] };
+        ESP_ERROR_CHECK( zenith_registry_store_datapoints( registry, mac, &datapoint, &timestamps[ i ], 1 ) );
+    }
+
+    printf( "---- Registry window stats, a reading every %u s ----\n", ( unsigned ) BENCH_REGISTRY_RANGE_INTERVAL_S );
+    printf( "%8s %10s %10s %10s %12s %10s\n", "window", "ns", "readings", "mean", "variance", "rate/h" );
+    const uint32_t windows[] = { 3600, 24 * 3600 };
+    for ( size_t w = 0; w < sizeof( windows ) / sizeof( windows[ 0 ] ); w++ ) {
+        zenith_window_stats_t stats;
+        int64_t start = bench_now_ns();
+        for ( size_t q = 0; q < BENCH_REGISTRY_STATS_QUERIES; q++ )
+            ESP_ERROR_CHECK( zenith_registry_get_window_stats( registry, mac, type, windows[ w ], &stats ) );
+        int64_t query_ns = ( bench_now_ns() - start ) / BENCH_REGISTRY_STATS_QUERIES;
+        printf( "%7uh %10.1f %10u %10.2f %12.4f %10.3f\n", ( unsigned ) ( windows[ w ] / 3600 ), ( double ) query_ns,
+                ( unsigned ) stats.count, stats.mean, stats.variance, stats.rate );
+        _bench_registry_check_window( &stats, timestamps, values, readings, windows[ w ] );
+    }
+
+    free( values );
+    free( timestamps );
+    zenith_registry_delete( registry );
+}
+
+/// @brief A pairing storm: how long store_node_info holds up the receive path, and how many NVS writes it costs
+static void _bench_registry_pairing_storm( void ) {
+    zenith_registry_handle_t registry = NULL;
+    ESP_ERROR_CHECK( nvs_flash_erase() );
+    ESP_ERROR_CHECK( nvs_flash_init() );
+    ESP_ERROR_CHECK( zenith_registry_new( &registry ) );
+
+    int64_t worst_ns = 0;
+    int64_t start = bench_now_ns();
+    for ( size_t round = 0; round < BENCH_REGISTRY_STORM_ROUNDS; round++ ) {
+        for ( size_t i = 0; i < BENCH_REGISTRY_STORM_NODES; i++ ) {
+            zenith_node_info_t info;
+            bench_mac( i, info.mac );
+            int64_t call_start = bench_now_ns();
+            ESP_ERROR_CHECK( zenith_registry_store_node_info( registry, &info ) );
+            int64_t call_ns = bench_now_ns() - call_start;
+            if ( call_ns > worst_ns )
+                worst_ns = call_ns;
+        }
+    }
+    int64_t elapsed_ns = bench_now_ns() - start;
+
+    // The save happens once the storm has been quiet for a while - flush stands in for the wait
+    start = bench_now_ns();
+    ESP_ERROR_CHECK( zenith_registry_flush( registry ) );
+    int64_t flush_ns = bench_now_ns() - start;
+
+    zenith_registry_persist_stats_t stats;
+    ESP_ERROR_CHECK( zenith_registry_get_persist_stats( registry, &stats ) );
+    size_t calls = BENCH_REGISTRY_STORM_NODES * BENCH_REGISTRY_STORM_ROUNDS;
+    printf( "---- Pairing storm, %u nodes pairing %u times ----\n", ( unsigned ) BENCH_REGISTRY_STORM_NODES, ( unsigned ) BENCH_REGISTRY_STORM_ROUNDS );
+    printf( "store_node_info: %.1f us avg, %.1f us worst\n", elapsed_ns / 1e3 / calls, worst_ns / 1e3 );
+    printf( "NVS: %u saves for %u calls - %u changes, %u unchanged re-pairs. One save takes %.1f us\n",
+            ( unsigned ) stats.saves, ( unsigned ) calls, ( unsigned ) stats.changes, ( unsigned ) stats.unchanged, flush_ns / 1e3 );
+
+    zenith_registry_delete( registry );
+}
+
+/// @brief A checkpoint of every ring, and the warm restart reading it back into an empty registry
+// What the queries return for one ring, to compare before and after a restore
+typedef struct bench_registry_view_s {
+    size_t history_count;
+    zenith_reading_t history[ BENCH_REGISTRY_VIEW_READINGS ];
+    size_t rollup_count[ ZENITH_ROLLUP_TIERS ];
+    zenith_rollup_t rollups[ ZENITH_ROLLUP_TIERS ][ ZENITH_ROLLUP_BUCKETS ];
+} bench_registry_view_t;
+
+static void _bench_registry_view( zenith_registry_handle_t registry, const zenith_mac_address_t mac, zenith_sensor_type_t type, bench_registry_view_t *view ) {
+    view->history_count = BENCH_REGISTRY_VIEW_READINGS;
+    ESP_ERROR_CHECK( zenith_registry_get_history( registry, mac, type, view->history, &view->history_count ) );
+    for ( size_t tier = 0; tier < ZENITH_ROLLUP_TIERS; tier++ ) {
+        view->rollup_count[ tier ] = ZENITH_ROLLUP_BUCKETS;
+        ESP_ERROR_CHECK( zenith_registry_get_rollups( registry, mac, type, tier, view->rollups[ tier ], &view->rollup_count[ tier ] ) );
+    }
+}
+
+/// @brief Checks that two views hold the same readings and rollups, field by field - padding can differ
+static void _bench_registry_same_view( const bench_registry_view_t *a, const bench_registry_view_t *b, unsigned ring ) {
+    if ( a->history_count != b->history_count )
+        _bench_registry_fail( "History length changed over the restore", ring );
+    for ( size_t i = 0; i < a->history_count; i++ )
+        if ( a->history[ i ].timestamp != b->history[ i ].timestamp || a->history[ i ].value != b->history[ i ].value )
+            _bench_registry_fail( "History changed over the restore", ring );
+
+    for ( size_t tier = 0; tier < ZENITH_ROLLUP_TIERS; tier++ ) {
+        if ( a->rollup_count[ tier ] != b->rollup_count[ tier ] )
+            _bench_registry_fail( "Rollup count changed over the restore", ring );
+        for ( size_t i = 0; i < a->rollup_count[ tier ]; i++ ) {
+            const zenith_rollup_t *x = &a->rollups[ tier ][ i ];
+            const zenith_rollup_t *y = &b->rollups[ tier ][ i ];
+            if ( x->start != y->start || x->min != y->min || x->max != y->max || x->mean != y->mean ||
+                 x->variance != y->variance || x->count != y->count )
+                _bench_registry_fail( "Rollups changed over the restore", ring );
+        }
+    }
+}
+
+static void _bench_registry_checkpoint( void ) {
+    zenith_registry_handle_t registry = NULL;
+    zenith_log_storage_handle_t storage = NULL;
+    unlink( BENCH_REGISTRY_CHECKPOINT_PATH );
+    ESP_ERROR_CHECK( nvs_flash_erase() );
+    ESP_ERROR_CHECK( nvs_flash_init() );
+    ESP_ERROR_CHECK( zenith_log_storage_new_file( BENCH_REGISTRY_CHECKPOINT_PATH, BENCH_REGISTRY_CHECKPOINT_SIZE, &storage ) );
+    ESP_ERROR_CHECK( zenith_registry_new( &registry ) );
+
+    zenith_datapoint_t datapoints[] = {
+        { ZENITH_DATAPOINT_TEMPERATURE, 21.5f },
+        { ZENITH_DATAPOINT_HUMIDITY, 45.0f },
+        { ZENITH_DATAPOINT_PRESSURE, 1013.2f },
+    };
+    size_t per_call = sizeof( datapoints ) / sizeof( datapoints[ 0 ] );
+    zenith_mac_address_t mac;
+    for ( size_t reading = 0; reading < BENCH_REGISTRY_CHECKPOINT_READINGS; reading++ ) {
+        time_t at = 1700000000 + reading * 60;
+        time_t timestamps[] = { at, at, at };
+        for ( size_t i = 0; i < BENCH_REGISTRY_CHECKPOINT_NODES; i++ ) {
+            bench_mac( i, mac );
+            datapoints[ 0 ].value = 20.0f + ( i + reading ) % 50 / 10.0f;
+            ESP_ERROR_CHECK( zenith_registry_store_datapoints( registry, mac, datapoints, timestamps, per_call ) );
+        }
+    }
+
+    // A few nodes, every ring of theirs, looked at before the checkpoint and again after the restore
+    static const size_t view_nodes[] = { 0, BENCH_REGISTRY_CHECKPOINT_NODES / 2, BENCH_REGISTRY_CHECKPOINT_NODES - 1 };
+    size_t view_count = sizeof( view_nodes ) / sizeof( view_nodes[ 0 ] ) * per_call;
+    bench_registry_view_t *views = malloc( 2 * view_count * sizeof( bench_registry_view_t ) );
+    if ( !views )
+        abort();
+    for ( size_t v = 0; v < view_count; v++ ) {
+        bench_mac( view_nodes[ v / per_call ], mac );
+        _bench_registry_view( registry, mac, ( zenith_sensor_type_t ) datapoints[ v % per_call ].reading_type, &views[ v ] );
+    }
+
+    ESP_ERROR_CHECK( zenith_registry_attach_checkpoint( registry, storage ) );
+    int64_t start = bench_now_ns();
+    ESP_ERROR_CHECK( zenith_registry_checkpoint( registry ) );
+    int64_t checkpoint_ns = bench_now_ns() - start;
+
+    zenith_registry_persist_stats_t stats;
+    ESP_ERROR_CHECK( zenith_registry_get_persist_stats( registry, &stats ) );
+    zenith_registry_delete( registry );
+
+    // The warm restart: a fresh registry, as after a reboot, with the checkpoint attached before any data arrives
+    ESP_ERROR_CHECK( zenith_registry_new( &registry ) );
+    start = bench_now_ns();
+    ESP_ERROR_CHECK( zenith_registry_attach_checkpoint( registry, storage ) );
+    ESP_ERROR_CHECK( zenith_registry_restore_checkpoint( registry ) );
+    int64_t restore_ns = bench_now_ns() - start;
+
+    zenith_registry_persist_stats_t restored;
+    ESP_ERROR_CHECK( zenith_registry_get_persist_stats( registry, &restored ) );
+    printf( "---- Registry checkpoint on a file, %u KB, %u nodes ----\n", ( unsigned ) ( BENCH_REGISTRY_CHECKPOINT_SIZE / 1024 ), ( unsigned ) BENCH_REGISTRY_CHECKPOINT_NODES );
+    printf( "Checkpoint:         %.1f ms, %u bytes\n", checkpoint_ns / 1e6, ( unsigned ) stats.checkpoint_bytes );
+    printf( "Restore:            %.1f ms, %u rings\n", restore_ns / 1e6, ( unsigned ) restored.rings_restored );
+
+    for ( size_t v = 0; v < view_count; v++ ) {
+        bench_mac( view_nodes[ v / per_call ], mac );
+        _bench_registry_view( registry, mac, ( zenith_sensor_type_t ) datapoints[ v % per_call ].reading_type, &views[ view_count + v ] );
+        _bench_registry_same_view( &views[ v ], &views[ view_count + v ], ( unsigned ) v );
+    }
+
+    free( views );
+    zenith_registry_delete( registry );
+    zenith_log_storage_delete( storage );
+    unlink( BENCH_REGISTRY_CHECKPOINT_PATH );
+}
+
+typedef struct bench_registry_buffer_s {
+    uint8_t *data;
+    size_t len;
+    size_t size;
+} bench_registry_buffer_t;
+
+static esp_err_t _bench_registry_buffer_write( const void *data, size_t len, void *context ) {
+    bench_registry_buffer_t *buffer = context;
+    if ( buffer->len + len > buffer->size ) {
+        size_t size = buffer->size ? buffer->size * 2 : 64 * 1024;
+        while ( size < buffer->len + len )
+            size *= 2;
+        uint8_t *grown = realloc( buffer->data, size );
+        if ( !grown )
+            return ESP_ERR_NO_MEM;
+        buffer->data = grown;
+        buffer->size = size;
+    }
+    memcpy( buffer->data + buffer->len, data, len );
+    buffer->len += len;
+    return ESP_OK;
+}
+
+/// @brief A backup of the whole registry into memory, and the restore of it into an empty registry a console line at a
+///        time. The restored registry has to export the same stream again, all but the time it was taken.
+static void _bench_registry_export( void ) {
+    static zenith_registry_checkpoint_record_t record;
+    zenith_registry_handle_t registry = NULL;
+    ESP_ERROR_CHECK( nvs_flash_erase() );
+    ESP_ERROR_CHECK( nvs_flash_init() );
+    ESP_ERROR_CHECK( zenith_registry_new( &registry ) );
+
+    zenith_datapoint_t datapoints[] = {
+        { ZENITH_DATAPOINT_TEMPERATURE, 21.5f },
+        { ZENITH_DATAPOINT_HUMIDITY, 45.0f },
+        { ZENITH_DATAPOINT_PRESSURE, 1013.2f },
+    };
+    size_t per_call = sizeof( datapoints ) / sizeof( datapoints[ 0 ] );
+    for ( size_t i = 0; i < BENCH_REGISTRY_EXPORT_NODES; i++ ) {
+        zenith_node_info_t info;
+        memset( &info, 0, sizeof( info ) );
+        bench_mac( i, info.mac );
+        ESP_ERROR_CHECK( zenith_registry_store_node_info( registry, &info ) );
+    }
+    zenith_mac_address_t mac;
+    for ( size_t reading = 0; reading < BENCH_REGISTRY_CHECKPOINT_READINGS; reading++ ) {
+        time_t at = 1700000000 + reading * 60;
+        time_t timestamps[] = { at, at, at };
+        for ( size_t i = 0; i < BENCH_REGISTRY_EXPORT_NODES; i++ ) {
+            bench_mac( i, mac );
+            datapoints[ 0 ].value = 20.0f + ( i + reading ) % 50 / 10.0f;
+            ESP_ERROR_CHECK( zenith_registry_store_datapoints( registry, mac, datapoints, timestamps, per_call ) );
+        }
+    }
+
+    bench_registry_buffer_t buffer = { 0 };
+    int64_t start = bench_now_ns();
+    ESP_ERROR_CHECK( zenith_registry_export( registry, &record, _bench_registry_buffer_write, &buffer ) );
+    int64_t export_ns = bench_now_ns() - start;
+    zenith_registry_delete( registry );
+
+    // The restore, into a registry that has never seen the nodes
+    ESP_ERROR_CHECK( nvs_flash_erase() );
+    ESP_ERROR_CHECK( nvs_flash_init() );
+    ESP_ERROR_CHECK( zenith_registry_new( &registry ) );
+    zenith_registry_import_t *import = malloc( sizeof( zenith_registry_import_t ) );
+    if ( !import )
+        abort();
+    start = bench_now_ns();
+    ESP_ERROR_CHECK( zenith_registry_import_begin( registry, import ) );
+    for ( size_t offset = 0; offset < buffer.len; offset += BENCH_REGISTRY_EXPORT_CHUNK ) {
+        size_t len = buffer.len - offset < BENCH_REGISTRY_EXPORT_CHUNK ? buffer.len - offset : BENCH_REGISTRY_EXPORT_CHUNK;
+        ESP_ERROR_CHECK( zenith_registry_import_feed( import, buffer.data + offset, len ) );
+    }
+    ESP_ERROR_CHECK( zenith_registry_import_end( import ) );
+    int64_t import_ns = bench_now_ns() - start;
+
+    bench_registry_buffer_t again = { 0 };
+    ESP_ERROR_CHECK( zenith_registry_export( registry, &record, _bench_registry_buffer_write, &again ) );
+    size_t exported_at = offsetof( zenith_registry_export_header_t, exported_at );
+    size_t rest = exported_at + sizeof( int64_t );
+    if ( again.len != buffer.len )
+        _bench_registry_fail( "Export after the import has another length", ( unsigned ) again.len );
+    if ( memcmp( again.data, buffer.data, exported_at ) != 0
+            || memcmp( again.data + rest, buffer.data + rest, buffer.len - rest ) != 0 )
+        _bench_registry_fail( "Export after the import differs from the first one", ( unsigned ) buffer.len );
+
+    printf( "---- Registry export and import, %u nodes ----\n", ( unsigned ) BENCH_REGISTRY_EXPORT_NODES );
+    printf( "Export:             %.1f ms, %u bytes, %u as base64\n", export_ns / 1e6, ( unsigned ) buffer.len, ( unsigned ) ( ( buffer.len + 2 ) / 3 * 4 ) );
+    printf( "Import:             %.1f ms, %u nodes, %u rings\n", import_ns / 1e6, ( unsigned ) import->seen.nodes, ( unsigned ) import->seen.rings );
+
+    free( import );
+    free( again.data );
+    free( buffer.data );
+    zenith_registry_delete( registry );
+}
+
+void bench_registry( void ) {
+    printf( "---- Registry lookup, ns per call ----\n" );
+    printf( "%8s %16s %16s %20s %16s\n", "nodes", "linear scan", "get_node_info", "store_datapoints", "first report" );
+    for ( size_t i = 0; i < sizeof( bench_registry_sizes ) / sizeof( bench_registry_sizes[ 0 ] ); i++ )
+        _bench_registry_size( bench_registry_sizes[ i ] );
+
+    _bench_registry_ingest();
+    _bench_registry_events();
+    _bench_registry_range();
+    _bench_registry_window_stats();
+    _bench_registry_pairing_storm();
+    _bench_registry_checkpoint();
+    _bench_registry_export();
+}
@@ -0,0 +1,178 @@
+// bench_registry_fuzz.c
+//
+// Random insert, forget, lookup and reload of nodes against a plain array of which ids should be there. Keeps the
+// registry's mac hash index honest: after every operation the registry has to agree with the array, and it still has
+// to after saving to NVS and loading into a fresh registry. Also loads a version 1 NVS blob, from before the node
+// count got 16 bits. More ids than ZENITH_REGISTRY_MAX_NODES, so the full registry gets its share of the traffic.
+// Aborts on the first disagreement.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_err.h"
+#include "nvs_flash.h"
+#include "nvs.h"
+
+#include "zenith_registry.h"
+#include "zenith_bench.h"
+
+#define BENCH_FUZZ_IDS ( ZENITH_REGISTRY_MAX_NODES + ZENITH_REGISTRY_MAX_NODES / 2 )
+#define BENCH_FUZZ_OPS 100000
+#define BENCH_FUZZ_SEED 1
+
+// Where zenith_registry.c keeps its node list
+#define BENCH_FUZZ_NVS_NAMESPACE "zenith_registry"
+#define BENCH_FUZZ_NVS_KEY "nodes"
+
+static const char *TAG = "bench-fuzz";
+
+/// @brief Reports the first disagreement with the model and stops
+static void _bench_fuzz_fail( const char *what, uint32_t id, uint32_t op ) {
+    ESP_LOGE( TAG, "%s: node %u, operation %u (seed %d)", what, ( unsigned ) id, ( unsigned ) op, BENCH_FUZZ_SEED );
+    fflush( stdout );
+    abort();
+}
+
+/// @brief Checks that the registry holds exactly the nodes the model says, by count, by lookup and by enumeration
+static void _bench_fuzz_check_all( zenith_registry_handle_t registry, const bool *present, uint32_t op ) {
+    size_t expected = 0;
+    for ( uint32_t id = 0; id < BENCH_FUZZ_IDS; id++ ) {
+        zenith_node_info_t info;
+        zenith_mac_address_t mac;
+        bench_mac( id, mac );
+        if ( ( zenith_registry_get_node_info( registry, mac, &info ) == ESP_OK ) != present[ id ] )
+            _bench_fuzz_fail( "Lookup disagrees", id, op );
+        expected += present[ id ];
+    }
+
+    size_t count = 0;
+    ESP_ERROR_CHECK( zenith_registry_get_node_count( registry, &count ) );
+    if ( count != expected )
+        _bench_fuzz_fail( "Node count disagrees", count, op );
+
+    zenith_mac_address_t *macs = malloc( ZENITH_REGISTRY_MAX_NODES * sizeof( zenith_mac_address_t ) );
+    if ( !macs )
+        abort();
+    count = ZENITH_REGISTRY_MAX_NODES;
+    ESP_ERROR_CHECK( zenith_registry_get_all_node_macs( registry, macs, &count ) );
+    if ( count != expected )
+        _bench_fuzz_fail( "Enumeration count disagrees", count, op );
+    for ( size_t i = 0; i < count; i++ ) {
+        uint32_t id = ( macs[ i ][ 3 ] << 16 ) | ( macs[ i ][ 4 ] << 8 ) | macs[ i ][ 5 ];
+        if ( id >= BENCH_FUZZ_IDS || !present[ id ] )
+            _bench_fuzz_fail( "Enumerated a node that isn't there", id, op );
+    }
+    free( macs );
+}
+
+/// @brief One random operation on a random node, checked against the model
+static void _bench_fuzz_op( zenith_registry_handle_t registry, bool *present, size_t *present_count, uint32_t op ) {
+    uint32_t id = rand() % BENCH_FUZZ_IDS;
+    zenith_node_info_t info;
+    bench_mac( id, info.mac );
+
+    switch ( rand() % 4 ) {
+        case 0: {
+            esp_err_t err = zenith_registry_store_node_info( registry, &info );
+            if ( err == ESP_OK ) {
+                *present_count += !present[ id ];
+                present[ id ] = true;
+            } else if ( present[ id ] || *present_count < ZENITH_REGISTRY_MAX_NODES ) {
+                _bench_fuzz_fail( "Insert failed with room to spare", id, op );
+            }
+            break;
+        }
+
+        case 1:
+            if ( ( zenith_registry_forget_node( registry, info.mac ) == ESP_OK ) != present[ id ] )
+                _bench_fuzz_fail( "Forget disagrees", id, op );
+            *present_count -= present[ id ];
+            present[ id ] = false;
+            break;
+
+        case 2: {
+            zenith_node_info_t out;
+            esp_err_t err = zenith_registry_get_node_info( registry, info.mac, &out );
+            if ( ( err == ESP_OK ) != present[ id ] )
+                _bench_fuzz_fail( "Lookup disagrees", id, op );
+            if ( err == ESP_OK && memcmp( out.mac, info.mac, ZENITH_MAC_ADDR_LEN ) != 0 )
+                _bench_fuzz_fail( "Lookup found the wrong node", id, op );
+            break;
+        }
+
+        default: {
+            // Readings for a known node land in its slot - for an unknown one they must not create it
+            zenith_datapoint_t datapoint = { ZENITH_DATAPOINT_TEMPERATURE, ( float ) id };
+            zenith_registry_store_datapoints( registry, info.mac, &datapoint, NULL, 1 );
+            zenith_node_info_t out;
+            if ( ( zenith_registry_get_node_info( registry, info.mac, &out ) == ESP_OK ) != present[ id ] )
+                _bench_fuzz_fail( "Readings changed the node list", id, op );
+            break;
+        }
+    }
+}
+
+/// @brief A registry saved by the version 1 firmware: one byte version, one byte count, then the macs
+static void _bench_fuzz_version_1( void ) {
+    uint8_t blob[ 2 + 3 * ZENITH_MAC_ADDR_LEN ] = { 1, 3 };
+    for ( uint32_t i = 0; i < 3; i++ )
+        bench_mac( 7 + i * 100, &blob[ 2 + i * ZENITH_MAC_ADDR_LEN ] );
+
+    nvs_handle_t nvs;
+    ESP_ERROR_CHECK( nvs_flash_erase() );
+    ESP_ERROR_CHECK( nvs_flash_init() );
+    ESP_ERROR_CHECK( nvs_open( BENCH_FUZZ_NVS_NAMESPACE, NVS_READWRITE, &nvs ) );
+    ESP_ERROR_CHECK( nvs_set_blob( nvs, BENCH_FUZZ_NVS_KEY, blob, sizeof( blob ) ) );
+    ESP_ERROR_CHECK( nvs_commit( nvs ) );
+    nvs_close( nvs );
+
+    zenith_registry_handle_t registry = NULL;
+    ESP_ERROR_CHECK( zenith_registry_new( &registry ) );
+    static bool present[ BENCH_FUZZ_IDS ];
+    memset( present, 0, sizeof( present ) );
+    present[ 7 ] = present[ 107 ] = present[ 207 ] = true;
+    _bench_fuzz_check_all( registry, present, 0 );
+    ESP_ERROR_CHECK( zenith_registry_delete( registry ) );
+}
+
+void bench_registry_fuzz( void ) {
+    static bool present[ BENCH_FUZZ_IDS ];
+    size_t present_count = 0;
+    zenith_registry_handle_t registry = NULL;
+
+    // Forgotten nodes keep their runtime data, so once ZENITH_REGISTRY_MAX_NODES ids have sent readings the rest get
+    // logged as errors - tens of thousands of them
+    esp_log_level_set( "zenith_registry", ESP_LOG_NONE );
+    ESP_ERROR_CHECK( nvs_flash_erase() );
+    ESP_ERROR_CHECK( nvs_flash_init() );
+    ESP_ERROR_CHECK( zenith_registry_new( &registry ) );
+    memset( present, 0, sizeof( present ) );
+    srand( BENCH_FUZZ_SEED );
+
+    printf( "---- Registry fuzz, %d ids, max %d nodes ----\n", BENCH_FUZZ_IDS, ZENITH_REGISTRY_MAX_NODES );
+    int64_t start = bench_now_ns();
+    for ( uint32_t op = 0; op < BENCH_FUZZ_OPS; op++ ) {
+        _bench_fuzz_op( registry, present, &present_count, op );
+        // Now and then, the whole picture
+        if ( op % ( BENCH_FUZZ_OPS / 10 ) == 0 )
+            _bench_fuzz_check_all( registry, present, op );
+    }
+    int64_t op_ns = ( bench_now_ns() - start ) / BENCH_FUZZ_OPS;
+    _bench_fuzz_check_all( registry, present, BENCH_FUZZ_OPS );
+
+    // What went to NVS has to come back the same
+    ESP_ERROR_CHECK( zenith_registry_flush( registry ) );
+    zenith_registry_handle_t reloaded = NULL;
+    ESP_ERROR_CHECK( zenith_registry_new( &reloaded ) );
+    _bench_fuzz_check_all( reloaded, present, BENCH_FUZZ_OPS );
+    ESP_ERROR_CHECK( zenith_registry_delete( reloaded ) );
+    ESP_ERROR_CHECK( zenith_registry_delete( registry ) );
+
+    _bench_fuzz_version_1();
+    esp_log_level_set( "zenith_registry", ESP_LOG_WARN );
+
+    printf( "Operations:         %d, %lld ns each\n", BENCH_FUZZ_OPS, ( long long ) op_ns );
+    printf( "Nodes at the end:   %u, reloaded and version 1 blob match\n", ( unsigned ) present_count );
+}
@@ -0,0 +1,29 @@
+// zenith_bench.c
+//
+// Micro benchmarks for the components that run on the linux target. Prints a table per benchmark and exits.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "esp_log.h"
+#include "esp_err.h"
+#include "nvs_flash.h"
+
+#include "zenith_bench.h"
+
+void app_main( void ) {
+    // Per call logging would be all we measure
+    esp_log_level_set( "*", ESP_LOG_WARN );
+
+    // Every run starts from an empty registry
+    ESP_ERROR_CHECK( nvs_flash_erase() );
+    ESP_ERROR_CHECK( nvs_flash_init() );
+
+    bench_registry();
+    bench_registry_fuzz();
+    bench_gorilla();
+    bench_log();
+    bench_concurrency();
+    bench_now();
+
+    exit( 0 );
+}
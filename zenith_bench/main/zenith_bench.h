@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+/// @brief Monotonic time in nanoseconds, for timing loops
+static inline int64_t bench_now_ns( void ) {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ( int64_t ) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/// @brief Fills in a vendor looking mac with the id in the last three bytes
+static inline void bench_mac( uint32_t id, uint8_t *mac ) {
+    mac[ 0 ] = 0x40;
+    mac[ 1 ] = 0x4c;
+    mac[ 2 ] = 0xca;
+    mac[ 3 ] = ( id >> 16 ) & 0xff;
+    mac[ 4 ] = ( id >> 8 ) & 0xff;
+    mac[ 5 ] = id & 0xff;
+}
+
+// Benchmarks
+void bench_registry( void );
+void bench_registry_fuzz( void );
+void bench_gorilla( void );
+void bench_log( void );
+void bench_concurrency( void );
+void bench_now( void );
@@ -33,5 +33,9 @@ typedef struct __attribute__((packed)) zenith_datapoints_s {
 
 typedef zenith_datapoints_t *zenith_datapoints_handle_t;
 
+/// @brief Upper bound on the number of datapoints a single zenith_now data packet can carry
+/// @details A compact encoded datapoint is at least two bytes - a tag and a one byte varint
+#define ZENITH_DATAPOINTS_MAX_PER_PACKET ( ( ZENITH_NOW_MAX_PACKET_SIZE - sizeof( zenith_now_packet_header_t ) ) / 2 )
+
 esp_err_t zenith_datapoints_new( zenith_datapoints_handle_t *datapoints_handle, uint8_t num_datapoints );
 int zenith_datapoints_calculate_size( uint8_t num_datapoints );
\ No newline at end of file
@@ -8,7 +8,6 @@
 #include "string.h"
 
 #include "zenith_data.h"
-#include "zenith_sensor.h"
 #include "zenith_now.h"
 
 static const char *TAG = "zenith_nodes";
@@ -0,0 +1,103 @@
+// zenith_log.h
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include "esp_err.h"
+#include "zenith_log_storage.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Append only log of readings on flash, so history survives a reboot.
+//
+// The storage is split into segments of one erase sector. Segments are written front to back and round robin, so
+// every sector sees the same number of erases - when the log is full the oldest segment is erased and reused. A segment
+// holds chunks of one flash page, each a header and ZENITH_LOG_CHUNK_RECORDS records. Appends collect in a chunk in RAM
+// that is written in one go when it's full, or on zenith_log_flush.
+
+#define ZENITH_LOG_SEGMENT_SIZE 4096    // Flash sector
+#define ZENITH_LOG_CHUNK_SIZE 256       // Flash page
+#define ZENITH_LOG_CHUNKS_PER_SEGMENT ( ZENITH_LOG_SEGMENT_SIZE / ZENITH_LOG_CHUNK_SIZE )
+
+#define ZENITH_LOG_CHUNK_MAGIC 0x5a4c  // "ZL"
+#define ZENITH_LOG_VERSION 1
+
+// A reading, as it's stored on flash
+typedef struct zenith_log_record_s {
+    uint8_t mac[6];
+    uint8_t type;           // zenith_sensor_type_t
+    uint8_t reserved;
+    uint32_t timestamp;     // Seconds since epoch
+    float value;
+} zenith_log_record_t;
+
+// Chunk header, at the start of every page written. A chunk with a bad crc was torn by a reset and is skipped.
+typedef struct zenith_log_chunk_header_s {
+    uint16_t magic;         // ZENITH_LOG_CHUNK_MAGIC, 0xffff while the page is erased
+    uint8_t count;          // Records in the chunk
+    uint8_t version;
+    uint16_t segment_seq;   // Sequence number of the segment, bumped every time one is started. Compared with wrap around.
+    uint16_t crc;           // crc16 of the records
+    uint32_t min_timestamp; // Oldest and newest record in the chunk - journaled readings can arrive out of order
+    uint32_t max_timestamp;
+} zenith_log_chunk_header_t;
+
+#define ZENITH_LOG_CHUNK_RECORDS ( ( ZENITH_LOG_CHUNK_SIZE - sizeof( zenith_log_chunk_header_t ) ) / sizeof( zenith_log_record_t ) )
+
+typedef struct zenith_log_s *zenith_log_handle_t;
+
+typedef struct zenith_log_stats_s {
+    size_t segments;            // In the storage
+    size_t segments_used;
+    size_t records;             // On flash, not counting torn chunks
+    size_t records_pending;     // In the RAM chunk
+    size_t chunks_torn;         // Chunks skipped for a bad crc
+    uint32_t erases;            // Segments erased since the log was opened
+    uint32_t oldest_timestamp;  // 0 when the log is empty
+    uint32_t newest_timestamp;
+} zenith_log_stats_t;
+
+/// @brief Called for every record a query finds. Return false to stop the query.
+typedef bool ( *zenith_log_query_cb_t )( const zenith_log_record_t *record, void *context );
+
+/**
+ * @brief Open the log on a storage, finding the write position and building the time index from the chunk headers
+ * @param storage where the log lives - the log doesn't own it
+ * @param out_handle the log
+ * @return ESP_OK, ESP_ERR_INVALID_ARG or ESP_ERR_NO_MEM
+ */
+esp_err_t zenith_log_new( zenith_log_storage_handle_t storage, zenith_log_handle_t *out_handle );
+
+/**
+ * @brief Flush and close the log
+ */
+esp_err_t zenith_log_delete( zenith_log_handle_t log );
+
+/**
+ * @brief Append a reading. Goes to flash when the RAM chunk fills up, which erases a segment every
+ *        ZENITH_LOG_CHUNKS_PER_SEGMENT chunks - tens of ms on a C6, on the caller's task.
+ */
+esp_err_t zenith_log_append( zenith_log_handle_t log, const uint8_t mac[6], uint8_t type, time_t timestamp, float value );
+
+/**
+ * @brief Write the RAM chunk out, even if it isn't full. The rest of its page goes unused. Call before a planned reset.
+ */
+esp_err_t zenith_log_flush( zenith_log_handle_t log );
+
+/**
+ * @brief Find the records of a node, or of every node, with from <= timestamp <= to
+ * @details Records come oldest segment first, in the order they were appended, then the ones still in RAM. Segments
+ *          and chunks outside the range are skipped on their index and headers without touching the records.
+ * @param mac node, or NULL for all of them
+ */
+esp_err_t zenith_log_query( zenith_log_handle_t log, const uint8_t *mac, time_t from, time_t to, zenith_log_query_cb_t callback, void *context );
+
+esp_err_t zenith_log_get_stats( zenith_log_handle_t log, zenith_log_stats_t *out_stats );
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,49 @@
+// zenith_log_storage.h
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+
+typedef struct zenith_log_storage_s zenith_log_storage_t;
+typedef zenith_log_storage_t *zenith_log_storage_handle_t;
+
+/// @brief Flash the log lives on.
+/// @details Behaves like NOR flash: erase sets a sector to 0xff, write can only clear bits, and the whole area is
+///          readable through one mapping. Backends embed this as their first member named base and hand out &base -
+///          same as the zenith_now transports.
+struct zenith_log_storage_s {
+    size_t size;            // Bytes, a whole number of ZENITH_LOG_SEGMENT_SIZE sectors
+    const uint8_t *data;    // The whole area, mapped for reading
+    esp_err_t ( *write )( zenith_log_storage_handle_t storage, size_t offset, const void *data, size_t len );
+    esp_err_t ( *erase )( zenith_log_storage_handle_t storage, size_t offset, size_t len ); // Sector aligned
+    void ( *del )( zenith_log_storage_handle_t storage );
+};
+
+#ifndef CONFIG_IDF_TARGET_LINUX
+/**
+ * @brief Log storage on a data partition, read through esp_partition_mmap
+ * @param label partition label, e.g. "history" in zenith_core's partitions.csv
+ * @param out_handle the storage
+ * @return ESP_OK, ESP_ERR_NOT_FOUND without the partition, or the esp_partition_mmap error
+ */
+esp_err_t zenith_log_storage_new_partition( const char *label, zenith_log_storage_handle_t *out_handle );
+#else
+/**
+ * @brief Log storage emulated by a file, for the linux target
+ * @details The file is created and erased to 0xff if it doesn't exist or has the wrong size, so a log survives between
+ *          runs like it would on flash.
+ * @param path file to keep the log in
+ * @param size bytes, a whole number of ZENITH_LOG_SEGMENT_SIZE sectors
+ * @param out_handle the storage
+ * @return ESP_OK, ESP_ERR_INVALID_ARG, ESP_ERR_NO_MEM or ESP_FAIL if the file can't be opened or mapped
+ */
+esp_err_t zenith_log_storage_new_file( const char *path, size_t size, zenith_log_storage_handle_t *out_handle );
+#endif
+
+/**
+ * @brief Free a storage created by one of the zenith_log_storage_new_*() functions
+ */
+void zenith_log_storage_delete( zenith_log_storage_handle_t storage );
@@ -0,0 +1,344 @@
+// zenith_log.c
+
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_err.h"
+#include "esp_check.h"
+#include "esp_rom_crc.h"
+
+#include "zenith_log.h"
+
+static const char *TAG = "zenith-log";
+
+_Static_assert( sizeof( zenith_log_record_t ) == 16, "Records are stored on flash as is" );
+_Static_assert( sizeof( zenith_log_chunk_header_t ) == 16, "Chunk headers are stored on flash as is" );
+
+// Time index entry for a segment, built from the chunk headers when the log is opened
+typedef struct zenith_log_segment_s {
+    uint32_t min_timestamp;
+    uint32_t max_timestamp;
+    uint16_t seq;
+    uint16_t records;
+    bool used;
+} zenith_log_segment_t;
+
+// A chunk as it's written - one flash page
+typedef struct zenith_log_chunk_s {
+    zenith_log_chunk_header_t header;
+    zenith_log_record_t records[ ZENITH_LOG_CHUNK_RECORDS ];
+} zenith_log_chunk_t;
+
+struct zenith_log_s {
+    zenith_log_storage_handle_t storage;
+    SemaphoreHandle_t lock;
+    zenith_log_segment_t *segments;
+    size_t segment_count;
+    int write_segment;          // Segment being written, -1 until the first one is started
+    size_t write_chunk;         // Next free chunk in it
+    uint16_t next_seq;
+    zenith_log_chunk_t pending; // Records waiting for a full page
+    size_t chunks_torn;
+    uint32_t erases;
+};
+
+static inline const zenith_log_chunk_t *_chunk_at( zenith_log_handle_t log, size_t segment, size_t chunk ) {
+    return ( const zenith_log_chunk_t * ) ( log->storage->data + segment * ZENITH_LOG_SEGMENT_SIZE + chunk * ZENITH_LOG_CHUNK_SIZE );
+}
+
+static inline uint16_t _chunk_crc( const zenith_log_chunk_t *chunk, uint8_t count ) {
+    return esp_rom_crc16_le( 0, ( const uint8_t * ) chunk->records, count * sizeof( zenith_log_record_t ) );
+}
+
+static inline bool _chunk_valid( const zenith_log_chunk_t *chunk ) {
+    return chunk->header.magic == ZENITH_LOG_CHUNK_MAGIC
+        && chunk->header.count <= ZENITH_LOG_CHUNK_RECORDS
+        && chunk->header.crc == _chunk_crc( chunk, chunk->header.count );
+}
+
+static inline void _segment_add( zenith_log_segment_t *segment, const zenith_log_chunk_header_t *header ) {
+    if ( !segment->records || header->min_timestamp < segment->min_timestamp )
+        segment->min_timestamp = header->min_timestamp;
+    if ( !segment->records || header->max_timestamp > segment->max_timestamp )
+        segment->max_timestamp = header->max_timestamp;
+    segment->records += header->count;
+}
+
+// Builds the time index and finds where to write next. Only chunk headers are read.
+static void _log_scan( zenith_log_handle_t log ) {
+    bool have_ref = false;
+    uint16_t ref = 0;
+    int16_t newest = 0;
+    log->write_segment = -1;
+
+    for ( size_t s = 0; s < log->segment_count; ++s ) {
+        zenith_log_segment_t *segment = &log->segments[ s ];
+        memset( segment, 0, sizeof( *segment ) );
+
+        // A segment with a torn first chunk has no seq we can trust. It's erased when the log comes round to it.
+        const zenith_log_chunk_t *first = _chunk_at( log, s, 0 );
+        if ( !_chunk_valid( first ) )
+            continue;
+
+        segment->used = true;
+        segment->seq = first->header.segment_seq;
+
+        size_t c = 0;
+        for ( ; c < ZENITH_LOG_CHUNKS_PER_SEGMENT; ++c ) {
+            const zenith_log_chunk_t *chunk = _chunk_at( log, s, c );
+            if ( chunk->header.magic == 0xffff )
+                break; // Erased - the rest of the segment is free
+            if ( _chunk_valid( chunk ) )
+                _segment_add( segment, &chunk->header );
+            else
+                log->chunks_torn++;
+        }
+
+        // Segments are started round robin, so their seqs are close together and compare fine with wrap around
+        if ( !have_ref ) {
+            ref = segment->seq;
+            have_ref = true;
+        }
+        int16_t age = ( int16_t ) ( segment->seq - ref );
+        if ( log->write_segment < 0 || age > newest ) {
+            newest = age;
+            log->write_segment = s;
+            log->write_chunk = c;
+            log->next_seq = segment->seq + 1;
+        }
+    }
+}
+
+// Erases the segment after the one being written and starts writing there, dropping what it held
+static esp_err_t _log_next_segment( zenith_log_handle_t log ) {
+    size_t s = log->write_segment < 0 ? 0 : ( log->write_segment + 1 ) % log->segment_count;
+
+    ESP_RETURN_ON_ERROR(
+        log->storage->erase( log->storage, s * ZENITH_LOG_SEGMENT_SIZE, ZENITH_LOG_SEGMENT_SIZE ),
+        TAG, "Failed to erase segment %u", ( unsigned ) s
+    );
+    log->erases++;
+
+    memset( &log->segments[ s ], 0, sizeof( zenith_log_segment_t ) );
+    log->segments[ s ].used = true;
+    log->segments[ s ].seq = log->next_seq++;
+    log->write_segment = s;
+    log->write_chunk = 0;
+    return ESP_OK;
+}
+
+// Writes the pending chunk to the next free page. Must be called with the lock held.
+static esp_err_t _log_write_pending( zenith_log_handle_t log ) {
+    zenith_log_chunk_t *chunk = &log->pending;
+    if ( !chunk->header.count )
+        return ESP_OK;
+
+    if ( log->write_segment < 0 || log->write_chunk >= ZENITH_LOG_CHUNKS_PER_SEGMENT )
+        ESP_RETURN_ON_ERROR(
+            _log_next_segment( log ),
+            TAG, "Failed to start a segment"
+        );
+
+    chunk->header.magic = ZENITH_LOG_CHUNK_MAGIC;
+    chunk->header.version = ZENITH_LOG_VERSION;
+    chunk->header.segment_seq = log->segments[ log->write_segment ].seq;
+    chunk->header.crc = _chunk_crc( chunk, chunk->header.count );
+
+    // Only the records in use - the rest of the page stays erased
+    size_t offset = log->write_segment * ZENITH_LOG_SEGMENT_SIZE + log->write_chunk * ZENITH_LOG_CHUNK_SIZE;
+    size_t len = sizeof( zenith_log_chunk_header_t ) + chunk->header.count * sizeof( zenith_log_record_t );
+    log->write_chunk++; // Whatever happens, this page is spent
+    ESP_RETURN_ON_ERROR(
+        log->storage->write( log->storage, offset, chunk, len ),
+        TAG, "Failed to write chunk at 0x%x", ( unsigned ) offset
+    );
+
+    _segment_add( &log->segments[ log->write_segment ], &chunk->header );
+    chunk->header.count = 0;
+    return ESP_OK;
+}
+
+esp_err_t zenith_log_new( zenith_log_storage_handle_t storage, zenith_log_handle_t *out_handle ) {
+    ESP_RETURN_ON_FALSE(
+        storage && out_handle && storage->size >= ZENITH_LOG_SEGMENT_SIZE && storage->size % ZENITH_LOG_SEGMENT_SIZE == 0,
+        ESP_ERR_INVALID_ARG,
+        TAG, "Invalid arguments passed to log_new"
+    );
+
+    zenith_log_handle_t log = calloc( 1, sizeof( struct zenith_log_s ) );
+    ESP_RETURN_ON_FALSE(
+        log,
+        ESP_ERR_NO_MEM,
+        TAG, "Error allocating memory for log"
+    );
+
+    log->storage = storage;
+    log->segment_count = storage->size / ZENITH_LOG_SEGMENT_SIZE;
+    log->segments = calloc( log->segment_count, sizeof( zenith_log_segment_t ) );
+    log->lock = xSemaphoreCreateMutex();
+    if ( !log->segments || !log->lock ) {
+        ESP_LOGE( TAG, "Error allocating memory for log index" );
+        free( log->segments );
+        if ( log->lock )
+            vSemaphoreDelete( log->lock );
+        free( log );
+        return ESP_ERR_NO_MEM;
+    }
+
+    _log_scan( log );
+
+    zenith_log_stats_t stats;
+    zenith_log_get_stats( log, &stats );
+    ESP_LOGI( TAG, "Opened log: %u records in %u of %u segments, %u torn chunks",
+              ( unsigned ) stats.records, ( unsigned ) stats.segments_used, ( unsigned ) stats.segments, ( unsigned ) stats.chunks_torn );
+
+    *out_handle = log;
+    return ESP_OK;
+}
+
+esp_err_t zenith_log_delete( zenith_log_handle_t log ) {
+    ESP_RETURN_ON_FALSE(
+        log,
+        ESP_ERR_INVALID_ARG,
+        TAG, "Invalid arguments passed to log_delete"
+    );
+
+    esp_err_t ret = zenith_log_flush( log );
+    vSemaphoreDelete( log->lock );
+    free( log->segments );
+    free( log );
+    return ret;
+}
+
+esp_err_t zenith_log_append( zenith_log_handle_t log, const uint8_t mac[6], uint8_t type, time_t timestamp, float value ) {
+    ESP_RETURN_ON_FALSE(
+        log && mac,
+        ESP_ERR_INVALID_ARG,
+        TAG, "Invalid arguments passed to log_append"
+    );
+
+    xSemaphoreTake( log->lock, portMAX_DELAY );
+    zenith_log_chunk_header_t *header = &log->pending.header;
+    zenith_log_record_t *record = &log->pending.records[ header->count ];
+    memcpy( record->mac, mac, sizeof( record->mac ) );
+    record->type = type;
+    record->reserved = 0;
+    record->timestamp = ( uint32_t ) timestamp;
+    record->value = value;
+
+    if ( !header->count || record->timestamp < header->min_timestamp )
+        header->min_timestamp = record->timestamp;
+    if ( !header->count || record->timestamp > header->max_timestamp )
+        header->max_timestamp = record->timestamp;
+
+    esp_err_t ret = ESP_OK;
+    if ( ++header->count == ZENITH_LOG_CHUNK_RECORDS ) {
+        ret = _log_write_pending( log );
+        header->count = 0; // Lost if the write failed, rather than jamming every append after it
+    }
+    xSemaphoreGive( log->lock );
+
+    return ret;
+}
+
+esp_err_t zenith_log_flush( zenith_log_handle_t log ) {
+    ESP_RETURN_ON_FALSE(
+        log,
+        ESP_ERR_INVALID_ARG,
+        TAG, "Invalid arguments passed to log_flush"
+    );
+
+    xSemaphoreTake( log->lock, portMAX_DELAY );
+    esp_err_t ret = _log_write_pending( log );
+    log->pending.header.count = 0;
+    xSemaphoreGive( log->lock );
+
+    return ret;
+}
+
+static inline bool _record_matches( const zenith_log_record_t *record, const uint8_t *mac, time_t from, time_t to ) {
+    return record->timestamp >= from && record->timestamp <= to
+        && ( !mac || memcmp( record->mac, mac, sizeof( record->mac ) ) == 0 );
+}
+
+static inline bool _chunk_in_range( const zenith_log_chunk_t *chunk, time_t from, time_t to ) {
+    return chunk->header.max_timestamp >= from && chunk->header.min_timestamp <= to;
+}
+
+// Runs the callback on the matching records of a chunk. Returns false when the callback wants to stop.
+static bool _query_chunk( const zenith_log_chunk_t *chunk, const uint8_t *mac, time_t from, time_t to, zenith_log_query_cb_t callback, void *context ) {
+
+    for ( size_t r = 0; r < chunk->header.count; ++r )
+        if ( _record_matches( &chunk->records[ r ], mac, from, to ) && !callback( &chunk->records[ r ], context ) )
+            return false;
+    return true;
+}
+
+esp_err_t zenith_log_query( zenith_log_handle_t log, const uint8_t *mac, time_t from, time_t to, zenith_log_query_cb_t callback, void *context ) {
+    ESP_RETURN_ON_FALSE(
+        log && callback,
+        ESP_ERR_INVALID_ARG,
+        TAG, "Invalid arguments passed to log_query"
+    );
+
+    xSemaphoreTake( log->lock, portMAX_DELAY );
+
+    // Oldest segment is the one after the write segment, round robin
+    bool more = true;
+    size_t start = log->write_segment < 0 ? 0 : log->write_segment + 1;
+    for ( size_t i = 0; more && i < log->segment_count; ++i ) {
+        size_t s = ( start + i ) % log->segment_count;
+        const zenith_log_segment_t *segment = &log->segments[ s ];
+        if ( !segment->used || !segment->records || segment->max_timestamp < from || segment->min_timestamp > to )
+            continue;
+
+        for ( size_t c = 0; more && c < ZENITH_LOG_CHUNKS_PER_SEGMENT; ++c ) {
+            const zenith_log_chunk_t *chunk = _chunk_at( log, s, c );
+            if ( chunk->header.magic == 0xffff )
+                break;
+            // Range first - the crc is only worth checking on chunks we're going to read
+            if ( _chunk_in_range( chunk, from, to ) && _chunk_valid( chunk ) )
+                more = _query_chunk( chunk, mac, from, to, callback, context );
+        }
+    }
+
+    if ( more && log->pending.header.count && _chunk_in_range( &log->pending, from, to ) )
+        _query_chunk( &log->pending, mac, from, to, callback, context );
+
+    xSemaphoreGive( log->lock );
+    return ESP_OK;
+}
+
+esp_err_t zenith_log_get_stats( zenith_log_handle_t log, zenith_log_stats_t *out_stats ) {
+    ESP_RETURN_ON_FALSE(
+        log && out_stats,
+        ESP_ERR_INVALID_ARG,
+        TAG, "Invalid arguments passed to log_get_stats"
+    );
+
+    xSemaphoreTake( log->lock, portMAX_DELAY );
+    memset( out_stats, 0, sizeof( *out_stats ) );
+    out_stats->segments = log->segment_count;
+    out_stats->records_pending = log->pending.header.count;
+    out_stats->chunks_torn = log->chunks_torn;
+    out_stats->erases = log->erases;
+
+    for ( size_t s = 0; s < log->segment_count; ++s ) {
+        const zenith_log_segment_t *segment = &log->segments[ s ];
+        if ( !segment->used )
+            continue;
+        out_stats->segments_used++;
+        if ( !segment->records )
+            continue;
+        if ( !out_stats->records || segment->min_timestamp < out_stats->oldest_timestamp )
+            out_stats->oldest_timestamp = segment->min_timestamp;
+        if ( !out_stats->records || segment->max_timestamp > out_stats->newest_timestamp )
+            out_stats->newest_timestamp = segment->max_timestamp;
+        out_stats->records += segment->records;
+    }
+    xSemaphoreGive( log->lock );
+
+    return ESP_OK;
+}
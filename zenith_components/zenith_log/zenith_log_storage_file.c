@@ -0,0 +1,113 @@
+// zenith_log_storage_file.c
+//
+// Log storage for the linux target: a file mapped into memory, behaving like NOR flash.
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "esp_log.h"
+#include "esp_err.h"
+#include "esp_check.h"
+
+#include "zenith_log.h"
+#include "zenith_log_storage.h"
+
+static const char *TAG = "zenith-log-file";
+
+typedef struct zenith_log_storage_file_s {
+    zenith_log_storage_t base;
+    uint8_t *map;
+    int fd;
+} zenith_log_storage_file_t;
+
+/// @brief Gets the backend from its storage handle. base is the first member.
+static inline zenith_log_storage_file_t *_file( zenith_log_storage_handle_t storage ) {
+    return ( zenith_log_storage_file_t * ) storage;
+}
+
+// Like flash, a write can only clear bits. Writing over data that isn't erased catches bugs instead of hiding them.
+static esp_err_t zenith_log_storage_file_write( zenith_log_storage_handle_t storage, size_t offset, const void *data, size_t len ) {
+    zenith_log_storage_file_t *file = _file( storage );
+    ESP_RETURN_ON_FALSE(
+        offset + len <= storage->size,
+        ESP_ERR_INVALID_SIZE,
+        TAG, "Write past the end"
+    );
+
+    const uint8_t *bytes = data;
+    for ( size_t i = 0; i < len; ++i )
+        file->map[ offset + i ] &= bytes[ i ];
+    return ESP_OK;
+}
+
+static esp_err_t zenith_log_storage_file_erase( zenith_log_storage_handle_t storage, size_t offset, size_t len ) {
+    zenith_log_storage_file_t *file = _file( storage );
+    ESP_RETURN_ON_FALSE(
+        offset % ZENITH_LOG_SEGMENT_SIZE == 0 && len % ZENITH_LOG_SEGMENT_SIZE == 0 && offset + len <= storage->size,
+        ESP_ERR_INVALID_ARG,
+        TAG, "Erase not sector aligned"
+    );
+
+    memset( file->map + offset, 0xff, len );
+    return ESP_OK;
+}
+
+static void zenith_log_storage_file_del( zenith_log_storage_handle_t storage ) {
+    zenith_log_storage_file_t *file = _file( storage );
+    munmap( file->map, storage->size );
+    close( file->fd );
+    free( file );
+}
+
+esp_err_t zenith_log_storage_new_file( const char *path, size_t size, zenith_log_storage_handle_t *out_handle ) {
+    ESP_RETURN_ON_FALSE(
+        path && out_handle && size && size % ZENITH_LOG_SEGMENT_SIZE == 0,
+        ESP_ERR_INVALID_ARG,
+        TAG, "Invalid arguments passed to new_file"
+    );
+
+    zenith_log_storage_file_t *file = calloc( 1, sizeof( zenith_log_storage_file_t ) );
+    ESP_RETURN_ON_FALSE(
+        file,
+        ESP_ERR_NO_MEM,
+        TAG, "Error allocating memory for storage"
+    );
+
+    // A new file, or one from a run with another size, starts out erased
+    bool fresh = false;
+    file->map = MAP_FAILED;
+    file->fd = open( path, O_RDWR | O_CREAT, 0644 );
+    struct stat st;
+    if ( file->fd >= 0 && fstat( file->fd, &st ) == 0 ) {
+        fresh = ( size_t ) st.st_size != size;
+        if ( !fresh || ftruncate( file->fd, size ) == 0 )
+            file->map = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, file->fd, 0 );
+    }
+    if ( file->map == MAP_FAILED ) {
+        ESP_LOGE( TAG, "Failed to open and map %s", path );
+        if ( file->fd >= 0 )
+            close( file->fd );
+        free( file );
+        return ESP_FAIL;
+    }
+    if ( fresh )
+        memset( file->map, 0xff, size );
+
+    file->base.size = size;
+    file->base.data = file->map;
+    file->base.write = zenith_log_storage_file_write;
+    file->base.erase = zenith_log_storage_file_erase;
+    file->base.del = zenith_log_storage_file_del;
+
+    *out_handle = &( file->base );
+    return ESP_OK;
+}
+
+void zenith_log_storage_delete( zenith_log_storage_handle_t storage ) {
+    if ( storage )
+        storage->del( storage );
+}
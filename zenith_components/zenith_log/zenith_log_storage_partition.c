@@ -0,0 +1,85 @@
+// zenith_log_storage_partition.c
+
+#include <stdlib.h>
+#include "esp_log.h"
+#include "esp_err.h"
+#include "esp_check.h"
+#include "esp_partition.h"
+
+#include "zenith_log.h"
+#include "zenith_log_storage.h"
+
+static const char *TAG = "zenith-log-partition";
+
+typedef struct zenith_log_storage_partition_s {
+    zenith_log_storage_t base;
+    const esp_partition_t *partition;
+    esp_partition_mmap_handle_t mmap_handle;
+} zenith_log_storage_partition_t;
+
+/// @brief Gets the backend from its storage handle. base is the first member.
+static inline zenith_log_storage_partition_t *_partition( zenith_log_storage_handle_t storage ) {
+    return ( zenith_log_storage_partition_t * ) storage;
+}
+
+// esp_partition_write keeps the mapping coherent - the cache is flushed for the range written
+static esp_err_t zenith_log_storage_partition_write( zenith_log_storage_handle_t storage, size_t offset, const void *data, size_t len ) {
+    return esp_partition_write( _partition( storage )->partition, offset, data, len );
+}
+
+static esp_err_t zenith_log_storage_partition_erase( zenith_log_storage_handle_t storage, size_t offset, size_t len ) {
+    return esp_partition_erase_range( _partition( storage )->partition, offset, len );
+}
+
+static void zenith_log_storage_partition_del( zenith_log_storage_handle_t storage ) {
+    zenith_log_storage_partition_t *backend = _partition( storage );
+    esp_partition_munmap( backend->mmap_handle );
+    free( backend );
+}
+
+esp_err_t zenith_log_storage_new_partition( const char *label, zenith_log_storage_handle_t *out_handle ) {
+    ESP_RETURN_ON_FALSE(
+        label && out_handle,
+        ESP_ERR_INVALID_ARG,
+        TAG, "Invalid arguments passed to new_partition"
+    );
+
+    const esp_partition_t *partition = esp_partition_find_first( ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label );
+    ESP_RETURN_ON_FALSE(
+        partition,
+        ESP_ERR_NOT_FOUND,
+        TAG, "No data partition '%s'", label
+    );
+
+    zenith_log_storage_partition_t *backend = calloc( 1, sizeof( zenith_log_storage_partition_t ) );
+    ESP_RETURN_ON_FALSE(
+        backend,
+        ESP_ERR_NO_MEM,
+        TAG, "Error allocating memory for storage"
+    );
+
+    // Whole sectors only, anything past the last one is left alone
+    const void *data = NULL;
+    size_t size = partition->size - partition->size % ZENITH_LOG_SEGMENT_SIZE;
+    esp_err_t ret = esp_partition_mmap( partition, 0, size, ESP_PARTITION_MMAP_DATA, &data, &backend->mmap_handle );
+    if ( ret != ESP_OK ) {
+        ESP_LOGE( TAG, "Failed to map partition '%s': %s", label, esp_err_to_name( ret ) );
+        free( backend );
+        return ret;
+    }
+
+    backend->partition = partition;
+    backend->base.size = size;
+    backend->base.data = data;
+    backend->base.write = zenith_log_storage_partition_write;
+    backend->base.erase = zenith_log_storage_partition_erase;
+    backend->base.del = zenith_log_storage_partition_del;
+
+    *out_handle = &( backend->base );
+    return ESP_OK;
+}
+
+void zenith_log_storage_delete( zenith_log_storage_handle_t storage ) {
+    if ( storage )
+        storage->del( storage );
+}
@@ -22,30 +22,122 @@
 /**
  * @brief Minor version number of the ZENITH-NOW protocol
  */
-#define ZENITH_NOW_MINOR_VERSION 2
+#define ZENITH_NOW_MINOR_VERSION 5
 
 /**
  * @brief Combined version number (major << 4 | minor)
  */
 #define ZENITH_NOW_VERSION ((ZENITH_NOW_MAJOR_VERSION << 4) | ZENITH_NOW_MINOR_VERSION)
 
+/**
+ * @brief Extract major / minor version from a packet version byte
+ */
+#define ZENITH_NOW_VERSION_MAJOR( version ) ( ( version ) >> 4 )
+#define ZENITH_NOW_VERSION_MINOR( version ) ( ( version ) & 0x0f )
+
+/**
+ * @brief First minor version where the data payload is a batch of timestamped records.
+ * @details Older nodes send a single zenith_datapoints_t that was sampled right before sending.
+ */
+#define ZENITH_NOW_BATCH_MINOR_VERSION 3
+
+/**
+ * @brief First minor version where the data payload starts with a zenith_now_data_encoding_t byte.
+ */
+#define ZENITH_NOW_ENCODING_MINOR_VERSION 4
+
+/**
+ * @brief First minor version where the packet header carries a sequence number, and acks carry the receive window.
+ * @details Packets from older peers get their header widened on receive (sequence 0), and are never treated as duplicates.
+ *          Packets to older peers are sent with the old 4 byte header.
+ */
+#define ZENITH_NOW_SEQUENCE_MINOR_VERSION 5
+
+/**
+ * @brief Number of sequence numbers tracked behind the highest one received, for duplicate detection and selective acks
+ */
+#define ZENITH_NOW_SEQUENCE_WINDOW 32
+
+/**
+ * @brief Number of peers we keep sequence state for when the config leaves it at 0
+ */
+#define ZENITH_NOW_DEFAULT_MAX_PEERS 32
+
+/**
+ * @brief Pairing flags
+ * @details Sent by the node in the pairing payload. The core acks with the subset it accepts, and the node only
+ *          uses what the core accepted. Nodes paired with a core that doesn't send flags stick to the float encoding.
+ */
+#define ZENITH_NOW_PAIRING_FLAG_COMPACT ( 1 << 0 ) // Node can send ZENITH_NOW_DATA_ENCODING_COMPACT
+#define ZENITH_NOW_PAIRING_FLAGS_SUPPORTED ( ZENITH_NOW_PAIRING_FLAG_COMPACT )
+
+/**
+ * @brief Packet types zenith_now acks by itself, for zenith_now_config_t.auto_ack
+ * @details Auto acks go out as soon as the event handler dequeues the packet, before rx_cb sees it. Pairing requests
+ *          are acked with every pairing flag both sides support.
+ */
+#define ZENITH_NOW_AUTO_ACK_PAIRING ( 1 << 0 )
+#define ZENITH_NOW_AUTO_ACK_DATA ( 1 << 1 )
+
 #define ZENITH_WIFI_CHANNEL 1
 #define PAIRING_ACK_BIT BIT0
 #define DATA_ACK_BIT BIT1
+#define SEQUENCE_ACK_BIT BIT2
+#define TX_STATUS_BIT BIT3          // A send callback came in, sequence waiters should recheck
+#define PAIRING_SEND_FAIL_BIT BIT4  // The last pairing packet never left the radio
+#define DATA_SEND_FAIL_BIT BIT5     // The last data packet never left the radio
+
+/**
+ * @brief Error codes
+ */
+#define ESP_ERR_ZENITH_NOW_BASE 0x9a00
+#define ESP_ERR_ZENITH_NOW_SEND_FAILED ( ESP_ERR_ZENITH_NOW_BASE + 1 ) // The MAC layer gave up on the packet, no ack is coming
+
+/**
+ * @brief Number of sent packets we track the send status of, waiting for the esp-now send callback
+ */
+#define ZENITH_NOW_TX_PENDING_MAX 8
+
+/**
+ * @brief Most events the event handler and the worker take from their queue per wake-up
+ */
+#define ZENITH_NOW_EVENT_BATCH_MAX 16
+
+/**
+ * @brief Stack of the event handler and worker tasks when the config leaves it at 0. The receive callback runs on it
+ */
+#define ZENITH_NOW_DEFAULT_TASK_STACK_SIZE 4096
 
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <time.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
 #include "freertos/event_groups.h"
 #include "freertos/task.h"
-#include "esp_now.h"
+#include "freertos/semphr.h"
 #include "esp_err.h"
-#include "esp_mac.h"
+#include "zenith_now_transport.h"
+#include "zenith_now_pool.h"
+
+// zenith_now doesn't need esp_now.h or esp_mac.h anymore, but everything that talks to it still speaks in these.
+// Spelled exactly like the IDF headers, so it doesn't matter which gets included first.
+#ifndef ESP_NOW_ETH_ALEN
+#define ESP_NOW_ETH_ALEN 6
+#endif
+#ifndef MACSTR
+#define MAC2STR(a) (a)[0], (a)[1], (a)[2], (a)[3], (a)[4], (a)[5]
+#define MACSTR "%02x:%02x:%02x:%02x:%02x:%02x"
+#endif
 
 #define ZENITH_NOW_PAYLOAD_SIZE( packet_size )  ( ( packet_size ) - sizeof( zenith_now_packet_header_t ) )
 
+/**
+ * @brief Largest zenith_now packet, header included. A buffer this size can hold any packet.
+ */
+#define ZENITH_NOW_MAX_PACKET_SIZE ZENITH_NOW_TRANSPORT_MAX_DATA_LEN
+
 /* espnow data */
 
 /// @brief Type definition for packet types
@@ -68,17 +160,67 @@ enum {
     ZENITH_PACKET_MAX
 };
 
+/// @brief Type definition for data payload encodings
+typedef uint8_t zenith_now_data_encoding_t;
+
+/**
+ * @brief Data payload encodings (protocol 1.4+)
+ * @details From 1.4 the data payload starts with one of these, and the rest of the payload is encoded accordingly.
+ */
+enum {
+    /** @brief zenith_now_payload_batch_t with float datapoints, as in 1.3 */
+    ZENITH_NOW_DATA_ENCODING_FLOAT = 0,
+    /** @brief Scaled fixed-point values, delta and varint coded. See the zenith_now README */
+    ZENITH_NOW_DATA_ENCODING_COMPACT,
+    /** @brief Maximum encoding value */
+    ZENITH_NOW_DATA_ENCODING_MAX
+};
+
+/**
+ * @brief Compact encoding datapoint tag
+ * @details Every compact datapoint starts with a tag byte: the reading type in the low bits, and the new record bit
+ *          on the first datapoint of each record. A record age delta follows the tag when the bit is set.
+ */
+#define ZENITH_NOW_COMPACT_TYPE_MASK 0x7f
+#define ZENITH_NOW_COMPACT_NEW_RECORD 0x80
+
+/**
+ * @brief Number of reading types the compact encoding keeps delta state for
+ */
+#define ZENITH_NOW_COMPACT_MAX_TYPES 8
+
 /// @brief Zenith Now data packet payload is just a zenith_datapoints_t in disguise.
+/// @note This is the single sample payload sent by protocol 1.2 and older. zenith_now_send_data still takes it, and sends it as a batch of one.
 typedef struct zenith_datapoints_s zenith_now_payload_data_t;
 
+/// @brief A single datapoint, defined in zenith_data.h
+typedef struct zenith_datapoint_s zenith_now_datapoint_t;
+
+/// @brief Zenith Now batched data payload header (protocol 1.3+).
+/// @details The data payload is a record count followed by that many records. Each record is a zenith_now_data_record_t
+///          followed by num_datapoints zenith_datapoint_t. Nodes have no real clock, so instead of a timestamp each record
+///          carries how many seconds old it was when the packet was sent. The receiver turns that back into a timestamp.
+typedef struct __attribute__((packed)) zenith_now_payload_batch_s {
+    uint8_t num_records;
+} zenith_now_payload_batch_t;
+
+/// @brief One record in a batched data payload.
+typedef struct __attribute__((packed)) zenith_now_data_record_s {
+    uint16_t age; // Seconds between sampling and sending, saturates at UINT16_MAX
+    uint8_t num_datapoints;
+} zenith_now_data_record_t;
+
 /// @brief Zenith Now ack packet payload.
 typedef struct __attribute__((packed)) zenith_now_payload_ack_s {
     zenith_now_packet_type_t ack_for_type;
+    uint8_t flags; // Pairing acks: the pairing flags the core accepted (1.4+). Check header.payload_size before reading.
+    uint16_t sequence; // Highest sequence number received from the peer (1.5+)
+    uint32_t window; // Bit i set: sequence - i has been received. Acks every packet in the window at once (1.5+)
 } zenith_now_payload_ack_t;
 
 /// @brief Zenith Now pairing packet payload.
 typedef struct __attribute__((packed)) zenith_now_payload_pairing_s {
-    uint8_t flags; //  unused - could be stuff like supported zenith now version etc. node firmware version etc.
+    uint8_t flags; // ZENITH_NOW_PAIRING_FLAG_* supported by the node
 } zenith_now_payload_pairing_t;
 
 /// @brief Zenith Now packet header.
@@ -87,8 +229,16 @@ typedef struct __attribute__((packed)) zenith_now_packet_header_s {
     zenith_now_packet_type_t type; // Packet type (1 byte)
     uint8_t version; // Packet version (1 byte)
     uint16_t payload_size; // Payload size (2 bytes)
+    uint16_t sequence; // Sender sequence number, stamped on pairing and data packets (2 bytes, 1.5+)
 } zenith_now_packet_header_t;
 
+/// @brief Zenith Now packet header before protocol 1.5.
+typedef struct __attribute__((packed)) zenith_now_legacy_packet_header_s {
+    zenith_now_packet_type_t type;
+    uint8_t version;
+    uint16_t payload_size;
+} zenith_now_legacy_packet_header_t;
+
 /// @brief Zenith Now packet.
 /// @details This structure is used to represent a Zenith Now packet. It contains the header and the payload. The payload size and format is determined by the type of packet.
 typedef struct __attribute__((packed)) zenith_now_packet_s {
@@ -98,6 +248,22 @@ typedef struct __attribute__((packed)) zenith_now_packet_s {
 
 typedef zenith_now_packet_t *zenith_now_packet_handle_t;
 
+/// @brief Zenith Now packet builder.
+/// @details Serializes a packet directly into a caller provided buffer - typically a ZENITH_NOW_MAX_PACKET_SIZE array on the
+///          stack of the sending task. The header is filled in place and payload_size is kept up to date as payload is appended,
+///          so the packet can be handed to zenith_now_send_packet at any time. Nothing on the send path allocates.
+typedef struct zenith_now_packet_builder_s {
+    zenith_now_packet_t *packet;    // The packet being built - points to the start of the buffer
+    size_t capacity;                // Usable size of the buffer
+    size_t length;                  // Bytes written so far, header included
+    size_t record_offset;           // Offset of the data record datapoints are added to, 0 if none is open
+    zenith_now_data_encoding_t encoding;    // Data packets: how datapoints are encoded
+    bool record_pending;                    // Compact: the next datapoint starts a new record
+    uint16_t record_age;                    // Compact: age of the open record
+    uint16_t last_age;                      // Compact: age of the previous record, ages are delta coded
+    int32_t last_value[ ZENITH_NOW_COMPACT_MAX_TYPES ]; // Compact: previous scaled value per reading type
+} zenith_now_packet_builder_t;
+
 /* Structures for xQueue handling */
 
 /// @brief Zenith Now event types.
@@ -110,15 +276,16 @@ typedef enum zenith_now_event_type_e {
 /// @brief Zenith Now send event.
 /// @details This structure is used to represent a send event in the Zenith Now eventqueue. It contains the destination MAC address and the status of the send operation. I'm not totally sure about how to use these yet, but maybe this is where I should start to check for acks.
 typedef struct zenith_now_send_event_s {
-    uint8_t dest_mac[ESP_NOW_ETH_ALEN];
-    esp_now_send_status_t status;
+    uint8_t dest_mac[ZENITH_NOW_MAC_LEN];
+    zenith_now_send_status_t status;
 } zenith_now_send_event_t;
 
 /// @brief Zenith Now receive event.
 /// @details This structure is used to represent a receive event in the Zenith Now eventqueue. It contains the source MAC address and a pointer to the data packet that was received.
 typedef struct zenith_now_receive_event_s {
-    uint8_t source_mac[ESP_NOW_ETH_ALEN];
+    uint8_t source_mac[ZENITH_NOW_MAC_LEN];
     zenith_now_packet_t *data_packet;
+    int64_t received_us; // When the transport handed us the packet, for the ack latency stats
 } zenith_now_receive_event_t;
 
 /// @brief Zenith Now event.
@@ -131,31 +298,134 @@ typedef struct zenith_event_s {
     };
 } zenith_now_event_t;
 
+/// @brief Send status of a packet we sent.
+typedef enum zenith_now_tx_state_e {
+    ZENITH_NOW_TX_FREE = 0,     // Slot unused
+    ZENITH_NOW_TX_PENDING,      // Handed to esp-now, waiting for the send callback
+    ZENITH_NOW_TX_SENT,         // The peer's MAC layer got it
+    ZENITH_NOW_TX_FAILED,       // The MAC layer gave up after its own retries
+} zenith_now_tx_state_t;
+
+/// @brief Zenith Now sent packet.
+/// @details the transport calls the send callback once per send, in the order they were sent. So the oldest pending
+///          packet to a mac is the one the next callback for that mac is about.
+typedef struct zenith_now_tx_pending_s {
+    uint8_t mac[ ZENITH_NOW_MAC_LEN ];
+    zenith_now_packet_type_t type;
+    uint16_t sequence;
+    zenith_now_tx_state_t state;
+    uint32_t order;             // Send counter value, lowest pending goes first
+} zenith_now_tx_pending_t;
+
 /* Callbacks */
 typedef void ( *zenith_now_receive_callback_t ) ( const uint8_t *mac_addr, const zenith_now_packet_t *packet );
-typedef void ( *zenith_now_send_callback_t ) ( const uint8_t *mac_addr, esp_now_send_status_t status );
+typedef void ( *zenith_now_send_callback_t ) ( const uint8_t *mac_addr, zenith_now_send_status_t status );
+/// @brief Gets every packet that came in since the last call, up to ZENITH_NOW_EVENT_BATCH_MAX. The packets are only valid during the call.
+typedef void ( *zenith_now_receive_batch_callback_t ) ( const zenith_now_receive_event_t *received, size_t count );
 
 
 typedef struct zenith_now_config_s {
     zenith_now_receive_callback_t rx_cb; // Receive callback
     zenith_now_send_callback_t tx_cb;   // Send callback
+    zenith_now_receive_batch_callback_t rx_batch_cb; // Receive callback taking a batch of packets. Used instead of rx_cb when set
+    uint16_t rx_pool_size; // Number of preallocated receive slots, 0 = ZENITH_NOW_DEFAULT_RX_POOL_SIZE
+    uint16_t max_peers; // Number of peers to keep sequence state for, 0 = ZENITH_NOW_DEFAULT_MAX_PEERS
+    zenith_now_transport_handle_t transport; // Link to run on, NULL = ESP-NOW. Required on the linux target
+    uint8_t auto_ack; // ZENITH_NOW_AUTO_ACK_* packet types to ack as soon as they're dequeued, 0 = rx_cb sends the acks
+    bool rx_worker; // Call rx_cb from a worker task, so slow processing doesn't hold up acks and send statuses
+    uint16_t event_queue_size; // Events the queue holds, 0 = room for every pool slot plus ZENITH_NOW_TX_PENDING_MAX send statuses
+    uint16_t task_stack_size; // Stack of the event handler and worker tasks in bytes, 0 = ZENITH_NOW_DEFAULT_TASK_STACK_SIZE. rx_cb runs on it
     // uint8_t version; // Not sure if this should be option just yet. should always be the defined version.
     // Add other options here like max queue length, debug level, etc.
 } zenith_now_config_t;
 
 
+/// @brief Zenith Now per peer sequence state.
+/// @details Receive side: a sliding window over the sequence numbers seen from the peer, used to drop retransmitted
+///          duplicates and reported back in every ack. Send side: the last window the peer acked, so several packets
+///          can be in flight and each one checked for its own ack.
+typedef struct zenith_now_peer_s {
+    uint8_t mac[ ZENITH_NOW_MAC_LEN ];
+    uint8_t version;            // Protocol version of the last packet from the peer, 0 if we never heard from it
+    bool rx_valid;              // rx_highest / rx_window are in use
+    uint16_t rx_highest;        // Highest sequence number received from the peer
+    uint32_t rx_window;         // Bit i set: rx_highest - i has been received
+    bool tx_ack_valid;          // tx_ack_highest / tx_ack_window are in use
+    uint16_t tx_ack_highest;    // Highest sequence number the peer has acked
+    uint32_t tx_ack_window;     // Bit i set: tx_ack_highest - i has been acked
+    uint32_t last_used;         // Use counter value when the peer was last touched, oldest gets evicted
+} zenith_now_peer_t;
+
+/// @brief The received packets a task is working on: the packet whose ack gets timed, and the task's batch buffers.
+/// @details The buffers live here rather than on the task's stack - the receive callback runs on that stack too.
+typedef struct zenith_now_rx_context_s {
+    TaskHandle_t task;
+    uint8_t mac[ ZENITH_NOW_MAC_LEN ];
+    int64_t received_us;        // 0 once the packet has been acked, or if there is none
+    zenith_now_event_t events[ ZENITH_NOW_EVENT_BATCH_MAX ];
+    zenith_now_receive_event_t received[ ZENITH_NOW_EVENT_BATCH_MAX ];
+} zenith_now_rx_context_t;
+
 /// @brief Zenith Now configuration.
 typedef struct zenith_now_s {
     /// @brief Store the configuration.
     zenith_now_config_t config;
     /// @brief Store the event queue.
     QueueHandle_t event_queue;
+    uint16_t event_queue_size;
     /// @brief Store the event group used for acks currently. 
     EventGroupHandle_t event_group;
     /// @brief Store the event handler task.
     TaskHandle_t task_handle;
+    /// @brief Worker task calling rx_cb when config.rx_worker is set, and its queue. Room for every pool slot, so it never fills.
+    QueueHandle_t worker_queue;
+    TaskHandle_t worker_handle;
+    /// @brief Packet being handled by the event handler and the worker.
+    zenith_now_rx_context_t rx_context[ 2 ];
+    /// @brief The link we send and receive on, and whether we created it (and have to delete it).
+    zenith_now_transport_handle_t transport;
+    bool owns_transport;
+    /// @brief Preallocated slots for received packets, so the receive path never touches the heap.
+    zenith_now_pool_t rx_pool;
+    /// @brief Sequence state per peer, and the lock protecting it.
+    zenith_now_peer_t *peers;
+    uint16_t max_peers;
+    uint32_t peer_use_counter;
+    SemaphoreHandle_t peer_lock;
+    /// @brief Packets waiting for their send callback, so waiters can bail out when the MAC layer gives up. Protected by peer_lock.
+    zenith_now_tx_pending_t tx_pending[ ZENITH_NOW_TX_PENDING_MAX ];
+    uint32_t tx_order_counter;
+    /// @brief Statistics that aren't kept by the pool.
+    uint32_t rx_duplicates;
+    uint32_t tx_failed;
+    uint32_t acks_sent;
+    uint64_t ack_latency_total_us;
+    uint32_t ack_latency_max_us;
+    uint32_t event_queue_high_water;
+    uint32_t event_wakeups;
+    uint32_t events_handled;
+    _Atomic uint32_t rx_queue_dropped;  // Counted in the transport's task
+    _Atomic uint32_t tx_status_dropped;
 } zenith_now_t;
 
+/// @brief Zenith Now runtime statistics.
+typedef struct zenith_now_stats_s {
+    uint16_t rx_pool_size;          // Number of slots in the receive pool
+    uint32_t rx_pool_in_use;        // Slots currently waiting in the event queue
+    uint32_t rx_pool_high_water;    // Most slots ever in use at once
+    uint32_t rx_pool_exhausted;     // Packets dropped because the pool was empty
+    uint32_t rx_duplicates;         // Retransmitted packets acked again but not delivered
+    uint32_t tx_failed;             // Sends the MAC layer gave up on
+    uint32_t acks_sent;             // Acks for pairing and data packets, duplicates included
+    uint32_t ack_latency_avg_us;    // Time from the transport handing us a packet to its ack going out
+    uint32_t ack_latency_max_us;
+    uint16_t event_queue_size;      // Events the queue holds
+    uint32_t event_queue_high_water; // Most events ever waiting at once
+    uint32_t event_batch_avg_x10;   // Events handled per event handler wake-up, times 10
+    uint32_t rx_queue_dropped;      // Packets dropped because the event queue was full
+    uint32_t tx_status_dropped;     // Send statuses dropped because the event queue was full
+} zenith_now_stats_t;
+
 
 /**
  * @brief Initialize the ZENITH-NOW protocol
@@ -172,11 +442,23 @@ esp_err_t zenith_now_init( const zenith_now_config_t *config );
  */
 esp_err_t zenith_now_teardown( void );
 
+// Building packets
+esp_err_t zenith_now_builder_init( zenith_now_packet_builder_t *builder, uint8_t *buffer, size_t buffer_size, zenith_now_packet_type_t packet_type );
+esp_err_t zenith_now_builder_append( zenith_now_packet_builder_t *builder, const void *data, size_t len );
+esp_err_t zenith_now_builder_set_encoding( zenith_now_packet_builder_t *builder, zenith_now_data_encoding_t encoding );
+bool zenith_now_builder_record_fits( const zenith_now_packet_builder_t *builder, uint8_t num_datapoints );
+esp_err_t zenith_now_builder_begin_record( zenith_now_packet_builder_t *builder, uint16_t age );
+esp_err_t zenith_now_builder_add_datapoint( zenith_now_packet_builder_t *builder, uint8_t reading_type, float value );
+
+// Parsing packets
+esp_err_t zenith_now_decode_data( const zenith_now_packet_t *packet, time_t now, zenith_now_datapoint_t *out_datapoints, time_t *out_timestamps, size_t *inout_count );
+
 // Sending packets
-esp_err_t zenith_now_new_packet( zenith_now_packet_type_t packet_type , uint8_t num_datapoints, zenith_now_packet_handle_t *out_packet );
 esp_err_t zenith_now_send_ack( const uint8_t *peer_mac, zenith_now_packet_type_t ack_type );
+esp_err_t zenith_now_send_pairing_ack( const uint8_t *peer_mac, uint8_t accepted_flags );
 esp_err_t zenith_now_send_pairing( const uint8_t *peer_mac );
 esp_err_t zenith_now_send_data( const uint8_t *peer_mac, const zenith_now_payload_data_t *data_payload );
+bool zenith_now_auto_acks( zenith_now_packet_type_t packet_type );
 
 // Low-level generic packet sending (if needed)
 esp_err_t zenith_now_send_packet( const uint8_t *peer_mac, const zenith_now_packet_t *packet );
@@ -186,5 +468,10 @@ esp_err_t zenith_now_add_peer( const uint8_t *peer_mac );
 esp_err_t zenith_now_remove_peer( const uint8_t *peer_mac );
 bool zenith_now_is_peer_known( const uint8_t *peer_id );
 
+// Statistics
+esp_err_t zenith_now_get_stats( zenith_now_stats_t *out_stats );
+
 // ACK waiting helper
-esp_err_t zenith_now_wait_for_ack( zenith_now_packet_type_t packet_type, uint32_t wait_ms );
\ No newline at end of file
+esp_err_t zenith_now_wait_for_ack( zenith_now_packet_type_t packet_type, uint32_t wait_ms );
+bool zenith_now_is_acked( const uint8_t *peer_mac, uint16_t sequence );
+esp_err_t zenith_now_wait_for_ack_sequence( const uint8_t *peer_mac, uint16_t sequence, uint32_t wait_ms );
\ No newline at end of file
@@ -0,0 +1,70 @@
+// zenith_now_pool.h
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include "esp_err.h"
+#include "zenith_now_transport.h"
+
+/**
+ * @brief Size of a pool slot
+ * @details Every slot can hold the largest frame a transport will ever hand us, plus a little headroom so headers from
+ *          older protocol versions can be widened in place.
+ */
+#define ZENITH_NOW_POOL_SLOT_SIZE ( ZENITH_NOW_TRANSPORT_MAX_DATA_LEN + 4 )
+
+/**
+ * @brief Number of receive slots used when the config leaves it at 0
+ */
+#define ZENITH_NOW_DEFAULT_RX_POOL_SIZE 16
+
+/**
+ * @brief Largest pool we can index - slot indexes are 16 bit and 0xffff marks the end of the free list
+ */
+#define ZENITH_NOW_POOL_MAX_SLOTS 0xfffe
+
+/// @brief One preallocated packet slot.
+typedef struct zenith_now_pool_slot_s {
+    uint8_t data[ ZENITH_NOW_POOL_SLOT_SIZE ];
+} __attribute__((aligned(4))) zenith_now_pool_slot_t;
+
+/// @brief Fixed size packet pool with a lock-free free list.
+/// @details The slab and the free list links are allocated once in zenith_now_pool_init. After that get/put never touches the heap,
+///          so it is safe to take slots in the WiFi task and hand them back from the event handler task at the same time.
+///          The head is (tag << 16) | index - the tag is bumped on every update so a stale compare-and-swap can't succeed (ABA).
+typedef struct zenith_now_pool_s {
+    zenith_now_pool_slot_t *slots;  // the slab
+    _Atomic uint16_t *next;         // free list links, one per slot
+    uint16_t capacity;              // number of slots in the slab
+    _Atomic uint32_t head;          // tagged index of the first free slot
+    _Atomic uint32_t in_use;        // slots currently handed out
+    _Atomic uint32_t high_water;    // most slots ever handed out at once
+    _Atomic uint32_t exhausted;     // number of times get found the pool empty
+} zenith_now_pool_t;
+
+/**
+ * @brief Allocate the slab and build the free list
+ * @param pool Pool to initialize
+ * @param capacity Number of slots. 0 gives ZENITH_NOW_DEFAULT_RX_POOL_SIZE
+ * @return ESP_OK, ESP_ERR_INVALID_ARG or ESP_ERR_NO_MEM
+ */
+esp_err_t zenith_now_pool_init( zenith_now_pool_t *pool, uint16_t capacity );
+
+/**
+ * @brief Free the slab. No slots can be in use when this is called.
+ */
+void zenith_now_pool_deinit( zenith_now_pool_t *pool );
+
+/**
+ * @brief Take a slot from the pool
+ * @return Pointer to ZENITH_NOW_POOL_SLOT_SIZE bytes, or NULL if the pool is exhausted
+ */
+void *zenith_now_pool_get( zenith_now_pool_t *pool );
+
+/**
+ * @brief Return a slot to the pool
+ * @param slot Pointer previously returned by zenith_now_pool_get
+ */
+void zenith_now_pool_put( zenith_now_pool_t *pool, void *slot );
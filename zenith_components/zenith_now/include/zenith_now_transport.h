@@ -0,0 +1,79 @@
+// zenith_now_transport.h
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+
+/**
+ * @brief Length of a transport address. Same as a mac address, whatever the backend.
+ */
+#define ZENITH_NOW_MAC_LEN 6
+
+/**
+ * @brief Largest frame a transport has to carry. Matches ESP_NOW_MAX_DATA_LEN, so packets built for one backend fit all of them.
+ */
+#define ZENITH_NOW_TRANSPORT_MAX_DATA_LEN 250
+
+typedef struct zenith_now_transport_s zenith_now_transport_t;
+typedef zenith_now_transport_t *zenith_now_transport_handle_t;
+
+/// @brief Outcome of a send, as reported by the link layer.
+typedef enum zenith_now_send_status_e {
+    ZENITH_NOW_SEND_SUCCESS = 0,    // The peer's link layer got the frame
+    ZENITH_NOW_SEND_FAIL,           // The link layer gave up on the frame
+} zenith_now_send_status_t;
+
+/// @brief Called by the transport for every frame received. May run in a driver task - copy the data and get out.
+typedef void ( *zenith_now_transport_recv_cb_t )( zenith_now_transport_handle_t transport, const uint8_t *src_mac, const uint8_t *data, int len );
+/// @brief Called by the transport exactly once per successful send(), in the order the frames were sent.
+typedef void ( *zenith_now_transport_send_cb_t )( zenith_now_transport_handle_t transport, const uint8_t *dest_mac, zenith_now_send_status_t status );
+
+/// @brief Zenith Now transport.
+/// @details The link zenith_now runs on. Backends embed this as their first member named base, fill in the functions
+///          in their zenith_now_transport_new_*() and hand out &base - same as the zenith_sensor drivers.
+struct zenith_now_transport_s {
+    esp_err_t ( *initialize )( zenith_now_transport_handle_t transport, zenith_now_transport_recv_cb_t recv_cb, zenith_now_transport_send_cb_t send_cb ); // Bring up the link and register the callbacks
+    esp_err_t ( *deinitialize )( zenith_now_transport_handle_t transport );
+    esp_err_t ( *send )( zenith_now_transport_handle_t transport, const uint8_t *dest_mac, const uint8_t *data, int len ); // Queue a frame, send_cb reports how it went
+    esp_err_t ( *add_peer )( zenith_now_transport_handle_t transport, const uint8_t *mac );
+    esp_err_t ( *remove_peer )( zenith_now_transport_handle_t transport, const uint8_t *mac );
+    bool ( *is_peer_known )( zenith_now_transport_handle_t transport, const uint8_t *mac );
+    esp_err_t ( *get_mac )( zenith_now_transport_handle_t transport, uint8_t *out_mac ); // Our own address
+    void ( *del )( zenith_now_transport_handle_t transport ); // Free the backend
+};
+
+#ifndef CONFIG_IDF_TARGET_LINUX
+/**
+ * @brief Create the ESP-NOW transport. This is what zenith_now uses when the config doesn't name a transport.
+ * @details initialize() brings up NVS, WiFi on ZENITH_WIFI_CHANNEL and esp-now.
+ * @param out_handle the transport
+ * @return ESP_OK, or ESP_ERR_NO_MEM
+ */
+esp_err_t zenith_now_transport_new_espnow( zenith_now_transport_handle_t *out_handle );
+#endif
+
+/// @brief Loopback transport configuration.
+typedef struct zenith_now_transport_loopback_config_s {
+    uint8_t mac[ ZENITH_NOW_MAC_LEN ];  // Address of this endpoint on the loopback bus
+    uint8_t loss_percent;               // Frames dropped on purpose, reported as ZENITH_NOW_SEND_FAIL. 0 for a perfect link
+} zenith_now_transport_loopback_config_t;
+
+/**
+ * @brief Create a loopback transport endpoint.
+ * @details All loopback endpoints in the process share one bus. send() hands the frame straight to the receive
+ *          callback of the endpoint with the destination mac, or every other endpoint for the broadcast address, and
+ *          then reports the status like esp-now would. Works on the linux target, so core and node logic can run
+ *          without a radio.
+ * @param config endpoint address and link quality
+ * @param out_handle the transport
+ * @return ESP_OK, ESP_ERR_INVALID_ARG or ESP_ERR_NO_MEM
+ */
+esp_err_t zenith_now_transport_new_loopback( const zenith_now_transport_loopback_config_t *config, zenith_now_transport_handle_t *out_handle );
+
+/**
+ * @brief Free a transport created by one of the zenith_now_transport_new_*() functions. Deinitializes it first.
+ */
+esp_err_t zenith_now_transport_delete( zenith_now_transport_handle_t transport );
@@ -2,15 +2,15 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <math.h>
 #include "esp_log.h"
 #include "esp_err.h"
 #include "esp_check.h"
-#include "esp_wifi.h"
-#include "esp_now.h"
 #include "freertos/event_groups.h"
-#include "esp_mac.h"
-#include "nvs_flash.h"
-#include "esp_check.h"
+#include "esp_attr.h"
+#ifndef CONFIG_IDF_TARGET_LINUX
+#include "esp_timer.h"
+#endif
 
 #include "zenith_private.h"
 #include "zenith_data.h"
@@ -29,52 +29,33 @@ static zenith_now_t zenith_now_instance = {
     .task_handle = NULL,
 };
 
-/// @brief Initializes WiFi with parameters needed for Zenith Now
-/// @return ESP_OK on success
-/// @todo Add error handling and cleanup
-esp_err_t zenith_now_configure_wifi( void ){
-    esp_err_t ret = ESP_OK;
-    ESP_LOGD( TAG, "zenith_now_configure_wifi()" );
-
-    ESP_RETURN_ON_ERROR(
-        esp_netif_init(),
-        TAG, "Error initializing netif"
-    );
-
-    ESP_RETURN_ON_ERROR(
-        esp_event_loop_create_default(),
-        TAG, "Error creating event loop"
-    );
-
-    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-    ESP_RETURN_ON_ERROR(
-        esp_wifi_init( &cfg ),
-        TAG, "Error initializing WiFi"
-    );
-
-    ESP_RETURN_ON_ERROR(
-        esp_wifi_set_storage( WIFI_STORAGE_RAM ), // Set this to WIFI_STORAGE_FLASH?
-        TAG, "Error setting WiFi storage"
-    );
-
-    ESP_RETURN_ON_ERROR(
-        esp_wifi_set_mode( WIFI_MODE_STA ), // Set this to WIFI_MODE_APSTA?
-        TAG, "Error setting WiFi mode"
-    );
-
-    ESP_RETURN_ON_ERROR(
-        esp_wifi_start(),
-        TAG, "Error starting WiFi"
-    );
+// Next sequence number to send. In RTC memory so nodes keep counting through deep sleep.
+RTC_DATA_ATTR static _Atomic uint16_t zenith_now_tx_sequence = 0;
+
+/// @brief Microsecond timestamp for the ack latency stats
+static int64_t _now_us( void ) {
+#ifdef CONFIG_IDF_TARGET_LINUX
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ( int64_t ) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+    return esp_timer_get_time();
+#endif
+}
 
-    ESP_RETURN_ON_ERROR(
-        esp_wifi_set_channel( ZENITH_WIFI_CHANNEL, WIFI_SECOND_CHAN_NONE), 
-        TAG, "Error setting WiFi power save"
+/// @brief Frees a transport, whichever backend it is
+/// @param transport transport from one of the zenith_now_transport_new_*() functions
+/// @return ESP_OK, or ESP_ERR_INVALID_ARG on NULL
+esp_err_t zenith_now_transport_delete( zenith_now_transport_handle_t transport ) {
+    ESP_RETURN_ON_FALSE(
+        transport,
+        ESP_ERR_INVALID_ARG,
+        TAG, "transport is NULL"
     );
 
-    // If I want long range esp-now:
-    // ESP_ERROR_CHECK( esp_wifi_set_protocol(ESP_IF_WIFI_STA, WIFI_PROTOCOL_11B|WIFI_PROTOCOL_11G|WIFI_PROTOCOL_11N|WIFI_PROTOCOL_LR) );
-    return ret;
+    transport->deinitialize( transport );
+    transport->del( transport );
+    return ESP_OK;
 }
 
 /// @brief Converts packet type to string - probably made during early debug phase.
@@ -91,50 +72,12 @@ const char *zenith_now_packet_type_to_str(zenith_now_packet_type_t packet_type)
     }
 }
 
-int get_payload_size( const zenith_now_packet_t *data_packet ) {
-    int payload_size = 0;
-    switch ( data_packet->header.type ) {
-        case ZENITH_PACKET_PAIRING:
-            ESP_LOGD( TAG, "Pairing packet" );
-            payload_size = sizeof( zenith_now_payload_pairing_t );
-            break;
-        case ZENITH_PACKET_DATA:
-            ESP_LOGD( TAG, "Data packet" );
-            
-            zenith_now_payload_data_t *data_payload = ( zenith_now_payload_data_t * ) data_packet->payload;
-            payload_size = sizeof( zenith_now_payload_data_t ) + sizeof(zenith_datapoint_t) * data_payload->num_datapoints;
-            break;
-        case ZENITH_PACKET_ACK:
-            ESP_LOGD( TAG, "Ack packet" );
-            payload_size = sizeof( zenith_now_payload_ack_t );
-            break;
-        default:
-            ESP_LOGE( TAG, "Unimplemented packet type" );
-            return ESP_ERR_INVALID_ARG;
-    }
-    return payload_size;
-}
-
 /// @brief Add peer to zenith now
 /// @param mac address to add
 /// @return ESP_OK, or underlying error value
 esp_err_t zenith_now_add_peer( const uint8_t *mac ) {
     ESP_LOGD( TAG, "zenith_now_add_peer()" );
-
-    esp_err_t ret = ESP_OK; //It's ok to try and add existing peers
-
-    if ( !esp_now_is_peer_exist( mac ) ) {
-        esp_now_peer_info_t peer = {
-            .peer_addr = { 0 }, 
-            .channel = ZENITH_WIFI_CHANNEL, 
-            .encrypt = false, 
-            .ifidx = ESP_IF_WIFI_STA
-        };
-        memcpy( peer.peer_addr, mac, ESP_NOW_ETH_ALEN );
-        ret = esp_now_add_peer( &peer );
-    }
-
-    return ret;
+    return zenith_now_instance.transport->add_peer( zenith_now_instance.transport, mac ); //It's ok to try and add existing peers
 }
 
 /// @brief Removes a peer from zenith_now
@@ -142,195 +85,964 @@ esp_err_t zenith_now_add_peer( const uint8_t *mac ) {
 /// @return ESP_OK, or underlying error value
 esp_err_t zenith_now_remove_peer( const uint8_t *mac ) {
     ESP_LOGD( TAG, "zenith_now_remove_peer()" );
+    return zenith_now_instance.transport->remove_peer( zenith_now_instance.transport, mac ); //It's ok to try and remove non-existant peers
+}
 
-    esp_err_t ret = ESP_OK; //It's ok to try and remove non-existant peers
+bool zenith_now_is_peer_known( const uint8_t *peer_id ) {
+    ESP_LOGD( TAG, "zenith_now_is_peer_known()" );
+    return zenith_now_instance.transport->is_peer_known( zenith_now_instance.transport, peer_id );
+}
 
-    if ( esp_now_is_peer_exist( mac ) )
-        ret = esp_now_del_peer( mac );
+/// @brief Gets the sequence state of a peer. Must be called with peer_lock held.
+/// @param create take over the least recently used slot if the peer is unknown
+/// @return the peer, or NULL if unknown and create is false
+static zenith_now_peer_t *_peer_get( const uint8_t *mac, bool create ) {
+    zenith_now_peer_t *oldest = NULL;
+
+    for ( uint16_t i = 0; i < zenith_now_instance.max_peers; i++ ) {
+        zenith_now_peer_t *peer = &zenith_now_instance.peers[ i ];
+        if ( peer->last_used && memcmp( peer->mac, mac, ZENITH_NOW_MAC_LEN ) == 0 ) {
+            peer->last_used = ++zenith_now_instance.peer_use_counter;
+            return peer;
+        }
+        if ( !oldest || peer->last_used < oldest->last_used )
+            oldest = peer;
+    }
 
-    return ret;
+    if ( !create || !oldest )
+        return NULL;
+
+    memset( oldest, 0, sizeof( *oldest ) );
+    memcpy( oldest->mac, mac, ZENITH_NOW_MAC_LEN );
+    oldest->last_used = ++zenith_now_instance.peer_use_counter;
+    return oldest;
 }
 
-bool zenith_now_is_peer_known( const uint8_t *peer_id ) {
-    ESP_LOGD( TAG, "zenith_now_is_peer_known()" );
-    return esp_now_is_peer_exist( peer_id );
+/// @brief Checks if a sequence number is inside a window, and if its bit is set
+static bool _window_contains( uint16_t highest, uint32_t window, uint16_t sequence ) {
+    uint16_t behind = ( uint16_t ) ( highest - sequence );
+    return behind < ZENITH_NOW_SEQUENCE_WINDOW && ( window & ( 1UL << behind ) );
+}
+
+/// @brief Records a received sequence number in the peer's receive window
+/// @details Sequence numbers further behind than the window are taken as the peer starting over - a node that lost its
+///          RTC memory - rather than as ancient duplicates.
+/// @return true if the sequence number is new, false if it is a duplicate
+static bool _rx_window_update( zenith_now_peer_t *peer, uint16_t sequence ) {
+    if ( !peer->rx_valid ) {
+        peer->rx_valid = true;
+        peer->rx_highest = sequence;
+        peer->rx_window = 1;
+        return true;
+    }
+
+    int16_t ahead = ( int16_t ) ( sequence - peer->rx_highest );
+    if ( ahead > 0 ) {
+        peer->rx_window = ( ahead >= ZENITH_NOW_SEQUENCE_WINDOW ) ? 0 : peer->rx_window << ahead;
+        peer->rx_window |= 1;
+        peer->rx_highest = sequence;
+        return true;
+    }
+
+    if ( -ahead >= ZENITH_NOW_SEQUENCE_WINDOW ) {
+        ESP_LOGD( TAG, "Sequence %u far behind %u, restarting window", sequence, peer->rx_highest );
+        peer->rx_highest = sequence;
+        peer->rx_window = 1;
+        return true;
+    }
+
+    if ( peer->rx_window & ( 1UL << -ahead ) )
+        return false;
+
+    peer->rx_window |= 1UL << -ahead;
+    return true;
+}
+
+/// @brief Records an ack window received from a peer
+static void _tx_ack_update( zenith_now_peer_t *peer, uint16_t sequence, uint32_t window ) {
+    if ( peer->tx_ack_valid && ( int16_t ) ( sequence - peer->tx_ack_highest ) < 0 ) {
+        // Older ack arriving late - merge what it knows into our newer window
+        uint16_t behind = peer->tx_ack_highest - sequence;
+        if ( behind < ZENITH_NOW_SEQUENCE_WINDOW )
+            peer->tx_ack_window |= window << behind;
+        return;
+    }
+
+    peer->tx_ack_valid = true;
+    peer->tx_ack_highest = sequence;
+    peer->tx_ack_window = window;
+}
+
+/// @brief Takes the next sequence number for an outgoing packet
+/// @details The counter lives in RTC memory so a node keeps counting across deep sleep, and its core doesn't take the
+///          packets after a wake for duplicates.
+static uint16_t _next_tx_sequence( void ) {
+    return ( uint16_t ) atomic_fetch_add( &zenith_now_tx_sequence, 1 );
+}
+
+/// @brief Starts tracking the send status of a packet. Must be called with peer_lock held.
+/// @details A retransmit reuses the slot of the original. When all slots are pending the oldest is taken over - its
+///          waiter then just falls back to the ack timeout.
+static zenith_now_tx_pending_t *_tx_pending_track( const uint8_t *mac, const zenith_now_packet_t *packet ) {
+    zenith_now_tx_pending_t *slot = NULL;
+
+    for ( uint8_t i = 0; i < ZENITH_NOW_TX_PENDING_MAX; i++ ) {
+        zenith_now_tx_pending_t *entry = &zenith_now_instance.tx_pending[ i ];
+        if ( entry->state != ZENITH_NOW_TX_FREE && entry->sequence == packet->header.sequence &&
+             memcmp( entry->mac, mac, ZENITH_NOW_MAC_LEN ) == 0 ) {
+            slot = entry;
+            break;
+        }
+        // Prefer free slots, then finished ones, then the oldest
+        if ( !slot || ( entry->state != ZENITH_NOW_TX_PENDING && slot->state == ZENITH_NOW_TX_PENDING ) ||
+             ( ( entry->state == ZENITH_NOW_TX_PENDING ) == ( slot->state == ZENITH_NOW_TX_PENDING ) && entry->order < slot->order ) )
+            slot = entry;
+    }
+
+    memcpy( slot->mac, mac, ZENITH_NOW_MAC_LEN );
+    slot->type = packet->header.type;
+    slot->sequence = packet->header.sequence;
+    slot->state = ZENITH_NOW_TX_PENDING;
+    slot->order = ++zenith_now_instance.tx_order_counter;
+    return slot;
+}
+
+/// @brief Finds the tracked send of a packet. Must be called with peer_lock held.
+static zenith_now_tx_pending_t *_tx_pending_find( const uint8_t *mac, uint16_t sequence ) {
+    for ( uint8_t i = 0; i < ZENITH_NOW_TX_PENDING_MAX; i++ ) {
+        zenith_now_tx_pending_t *entry = &zenith_now_instance.tx_pending[ i ];
+        if ( entry->state != ZENITH_NOW_TX_FREE && entry->sequence == sequence &&
+             memcmp( entry->mac, mac, ZENITH_NOW_MAC_LEN ) == 0 )
+            return entry;
+    }
+    return NULL;
+}
+
+/// @brief Matches a send callback to the oldest pending packet to that mac, and wakes up anyone waiting for its ack
+static void _handle_send_status( const uint8_t *mac, zenith_now_send_status_t status ) {
+    zenith_now_tx_pending_t *oldest = NULL;
+    EventBits_t bits = TX_STATUS_BIT;
+
+    xSemaphoreTake( zenith_now_instance.peer_lock, portMAX_DELAY );
+    for ( uint8_t i = 0; i < ZENITH_NOW_TX_PENDING_MAX; i++ ) {
+        zenith_now_tx_pending_t *entry = &zenith_now_instance.tx_pending[ i ];
+        if ( entry->state == ZENITH_NOW_TX_PENDING && memcmp( entry->mac, mac, ZENITH_NOW_MAC_LEN ) == 0 &&
+             ( !oldest || entry->order < oldest->order ) )
+            oldest = entry;
+    }
+
+    if ( status != ZENITH_NOW_SEND_SUCCESS ) {
+        zenith_now_instance.tx_failed++;
+        if ( oldest && oldest->type == ZENITH_PACKET_PAIRING )
+            bits |= PAIRING_SEND_FAIL_BIT;
+        else if ( oldest && oldest->type == ZENITH_PACKET_DATA )
+            bits |= DATA_SEND_FAIL_BIT;
+    }
+    if ( oldest )
+        oldest->state = ( status == ZENITH_NOW_SEND_SUCCESS ) ? ZENITH_NOW_TX_SENT : ZENITH_NOW_TX_FAILED;
+    xSemaphoreGive( zenith_now_instance.peer_lock );
+
+    xEventGroupSetBits( zenith_now_instance.event_group, bits );
+}
+
+/// @brief Checks if a packet we sent has been acked by the peer
+/// @param peer_mac the peer the packet was sent to
+/// @param sequence header.sequence of the packet
+/// @return true if the latest ack window from the peer covers the sequence number
+bool zenith_now_is_acked( const uint8_t *peer_mac, uint16_t sequence ) {
+    bool acked = false;
+
+    if ( !peer_mac || !zenith_now_instance.peer_lock )
+        return false;
+
+    xSemaphoreTake( zenith_now_instance.peer_lock, portMAX_DELAY );
+    zenith_now_peer_t *peer = _peer_get( peer_mac, false );
+    if ( peer && peer->tx_ack_valid )
+        acked = _window_contains( peer->tx_ack_highest, peer->tx_ack_window, sequence );
+    xSemaphoreGive( zenith_now_instance.peer_lock );
+
+    return acked;
+}
+
+/// @brief Waits until the peer acks a specific packet
+/// @details Several packets can be in flight - send them all, then wait for each. An ack for another packet never
+///          satisfies the wait, so a late ack can't be mistaken for the one we're waiting for.
+/// @param peer_mac the peer the packet was sent to
+/// @param sequence header.sequence of the packet
+/// @param wait_ms Timeout
+/// @return ESP_OK if the packet was acked, ESP_ERR_ZENITH_NOW_SEND_FAILED as soon as the MAC layer gives up on the packet,
+///         ESP_ERR_TIMEOUT if timed out
+esp_err_t zenith_now_wait_for_ack_sequence( const uint8_t *peer_mac, uint16_t sequence, uint32_t wait_ms ) {
+    ESP_LOGD( TAG, "zenith_now_wait_for_ack_sequence()" );
+    ESP_RETURN_ON_FALSE(
+        peer_mac,
+        ESP_ERR_INVALID_ARG,
+        TAG, "peer_mac is NULL"
+    );
+
+    TickType_t start = xTaskGetTickCount();
+    TickType_t timeout = pdMS_TO_TICKS( wait_ms );
+
+    while ( !zenith_now_is_acked( peer_mac, sequence ) ) {
+        // The ack can still beat the send callback, so only give up on a failed send after checking for it
+        xSemaphoreTake( zenith_now_instance.peer_lock, portMAX_DELAY );
+        zenith_now_tx_pending_t *tx = _tx_pending_find( peer_mac, sequence );
+        bool failed = tx && tx->state == ZENITH_NOW_TX_FAILED;
+        xSemaphoreGive( zenith_now_instance.peer_lock );
+        if ( failed )
+            return ESP_ERR_ZENITH_NOW_SEND_FAILED;
+
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if ( elapsed >= timeout )
+            return ESP_ERR_TIMEOUT;
+        // Any ack or send callback wakes us up, then we check if it was about our packet
+        xEventGroupWaitBits( zenith_now_instance.event_group, SEQUENCE_ACK_BIT | TX_STATUS_BIT, pdTRUE, pdFALSE, timeout - elapsed );
+    }
+
+    return ESP_OK;
 }
 
 /// @brief Waits for ack with timeout
 /// @param packet_type Type of packet to await ack for
 /// @param wait_ms Timeout
-/// @return ESP_OK if ack was received, ESP_ERR_TIMEOUT if timed out
+/// @return ESP_OK if ack was received, ESP_ERR_ZENITH_NOW_SEND_FAILED if the last packet of that type failed to send,
+///         ESP_ERR_TIMEOUT if timed out
 esp_err_t zenith_now_wait_for_ack( zenith_now_packet_type_t packet_type, uint32_t wait_ms ) {
     ESP_LOGD( TAG, "zenith_now_wait_for_ack()" );
 
     EventBits_t event_bit = 0;
+    EventBits_t fail_bit = 0;
 
     switch ( packet_type ) {
         case ZENITH_PACKET_PAIRING:
             event_bit = PAIRING_ACK_BIT;
+            fail_bit = PAIRING_SEND_FAIL_BIT;
             break;
 
         case ZENITH_PACKET_DATA:
             event_bit = DATA_ACK_BIT;
+            fail_bit = DATA_SEND_FAIL_BIT;
             break;
 
         default:
             ESP_LOGE( TAG, "Illegal packet type for ACK" );
             return ESP_ERR_INVALID_ARG;
     }
-    return 
-        ( xEventGroupWaitBits( zenith_now_instance.event_group, event_bit, pdTRUE, pdFALSE, pdMS_TO_TICKS( wait_ms ) ) > 0 ) 
-        ? ESP_OK 
-        : ESP_ERR_TIMEOUT;
+
+    // Don't sit out the whole timeout if the MAC layer already told us the packet never arrived
+    EventBits_t bits = xEventGroupWaitBits( zenith_now_instance.event_group, event_bit | fail_bit, pdTRUE, pdFALSE, pdMS_TO_TICKS( wait_ms ) );
+    if ( bits & event_bit )
+        return ESP_OK;
+    if ( bits & fail_bit )
+        return ESP_ERR_ZENITH_NOW_SEND_FAILED;
+    return ESP_ERR_TIMEOUT;
 }
 
-/// @brief Sends a zenith_now packet over esp-now
-/// @param peer_mac Peer to send to
-/// @param data_payload the payload for the data packet
-/// @return ESP_OK, or underlying error value
-esp_err_t zenith_now_send_data( const uint8_t *peer_mac, const zenith_now_payload_data_t *data_payload ) {
-    esp_err_t ret = ESP_OK;
-    ESP_LOGD(TAG, "zenith_now_send_data()");
+/// @brief Gets a snapshot of the zenith_now statistics
+/// @param out_stats where to store the statistics
+/// @return ESP_OK, or ESP_ERR_INVALID_ARG on NULL pointer
+esp_err_t zenith_now_get_stats( zenith_now_stats_t *out_stats ) {
     ESP_RETURN_ON_FALSE(
-        data_payload,
+        out_stats,
         ESP_ERR_INVALID_ARG,
-        TAG, "data_payload is NULL"
+        TAG, "out_stats is NULL"
+    );
+
+    zenith_now_pool_t *pool = &zenith_now_instance.rx_pool;
+    out_stats->rx_pool_size = pool->capacity;
+    out_stats->rx_pool_in_use = atomic_load( &pool->in_use );
+    out_stats->rx_pool_high_water = atomic_load( &pool->high_water );
+    out_stats->rx_pool_exhausted = atomic_load( &pool->exhausted );
+    out_stats->rx_duplicates = zenith_now_instance.rx_duplicates;
+    out_stats->tx_failed = zenith_now_instance.tx_failed;
+    out_stats->acks_sent = zenith_now_instance.acks_sent;
+    out_stats->ack_latency_avg_us = zenith_now_instance.acks_sent ? zenith_now_instance.ack_latency_total_us / zenith_now_instance.acks_sent : 0;
+    out_stats->ack_latency_max_us = zenith_now_instance.ack_latency_max_us;
+    out_stats->event_queue_size = zenith_now_instance.event_queue_size;
+    out_stats->event_queue_high_water = zenith_now_instance.event_queue_high_water;
+    out_stats->event_batch_avg_x10 = zenith_now_instance.event_wakeups ? ( uint64_t ) zenith_now_instance.events_handled * 10 / zenith_now_instance.event_wakeups : 0;
+    out_stats->rx_queue_dropped = atomic_load( &zenith_now_instance.rx_queue_dropped );
+    out_stats->tx_status_dropped = atomic_load( &zenith_now_instance.tx_status_dropped );
+
+    return ESP_OK;
+}
+
+/// @brief Fixed-point scale per reading type for the compact encoding. 0 means the type can't be sent compact.
+static const int32_t zenith_now_compact_scale[ ZENITH_NOW_COMPACT_MAX_TYPES ] = {
+    [ ZENITH_DATAPOINT_TEMPERATURE ] = 100,  // 0.01 °C
+    [ ZENITH_DATAPOINT_HUMIDITY ] = 100,     // 0.01 %RH
+    [ ZENITH_DATAPOINT_PRESSURE ] = 100,     // 0.01 hPa
+};
+
+/// @brief Writes value as a LEB128 varint
+/// @return number of bytes written, at most 10
+static size_t _varint_encode( uint64_t value, uint8_t *out ) {
+    size_t len = 0;
+    do {
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
+        out[ len++ ] = byte | ( value ? 0x80 : 0 );
+    } while ( value );
+    return len;
+}
+
+/// @brief Reads a LEB128 varint, bounds checked
+/// @return ESP_OK, or ESP_ERR_INVALID_SIZE if the varint runs past end or is too long
+static esp_err_t _varint_decode( const uint8_t *data, size_t size, size_t *inout_offset, uint64_t *out_value ) {
+    uint64_t value = 0;
+    size_t offset = *inout_offset;
+
+    for ( int shift = 0; shift < 64; shift += 7 ) {
+        if ( offset >= size )
+            return ESP_ERR_INVALID_SIZE;
+        uint8_t byte = data[ offset++ ];
+        value |= ( uint64_t ) ( byte & 0x7f ) << shift;
+        if ( !( byte & 0x80 ) ) {
+            *inout_offset = offset;
+            *out_value = value;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_INVALID_SIZE;
+}
+
+/// @brief Zigzag maps signed to unsigned so small negative deltas stay small varints
+static inline uint64_t _zigzag_encode( int64_t value ) {
+    return ( ( uint64_t ) value << 1 ) ^ ( uint64_t ) ( value >> 63 );
+}
+
+static inline int64_t _zigzag_decode( uint64_t value ) {
+    return ( int64_t ) ( value >> 1 ) ^ -( int64_t ) ( value & 1 );
+}
+
+/// @brief Gets the batch header of a float encoded data packet being built
+static inline zenith_now_payload_batch_t *_builder_batch( zenith_now_packet_builder_t *builder ) {
+    return ( zenith_now_payload_batch_t * ) ( builder->packet->payload + sizeof( zenith_now_data_encoding_t ) );
+}
+
+/// @brief Starts building a packet of the given type in a caller provided buffer
+/// @details The header is filled in place and nothing is allocated. Data packets start out float encoded with the record
+///          count zeroed, so records can be added with zenith_now_builder_begin_record right away.
+/// @param builder builder state to initialize
+/// @param buffer where the packet is serialized. ZENITH_NOW_MAX_PACKET_SIZE bytes is always enough
+/// @param buffer_size size of buffer
+/// @param packet_type type of packet to build
+/// @return ESP_OK, ESP_ERR_INVALID_ARG or ESP_ERR_INVALID_SIZE if the buffer can't hold the fixed part of the packet
+esp_err_t zenith_now_builder_init( zenith_now_packet_builder_t *builder, uint8_t *buffer, size_t buffer_size, zenith_now_packet_type_t packet_type ) {
+    ESP_RETURN_ON_FALSE(
+        builder && buffer,
+        ESP_ERR_INVALID_ARG,
+        TAG, "NULL pointer passed to zenith_now_builder_init"
     );
 
-    size_t payload_size = sizeof( zenith_now_payload_data_t ) + sizeof( zenith_datapoint_t ) * data_payload->num_datapoints;
-    size_t packet_size = sizeof( zenith_now_packet_t ) + payload_size;
-    ESP_LOGD( TAG, "Createing packet\tsize: %d type: %d", packet_size, ZENITH_PACKET_DATA );
+    ESP_RETURN_ON_FALSE(
+        packet_type >= ZENITH_PACKET_PAIRING && packet_type < ZENITH_PACKET_MAX,
+        ESP_ERR_INVALID_ARG,
+        TAG, "Unimplemented packet type %d", packet_type
+    );
 
-    zenith_now_packet_t *data_packet = calloc( 1, packet_size);
     ESP_RETURN_ON_FALSE(
-        data_packet,
-        ESP_ERR_NO_MEM,
-        TAG, "Error allocating memory for data packet"
+        buffer_size >= sizeof( zenith_now_packet_header_t ),
+        ESP_ERR_INVALID_SIZE,
+        TAG, "Buffer too small for packet header"
     );
 
-    data_packet->header.type = ZENITH_PACKET_DATA;
-    data_packet->header.payload_size = payload_size;
-    data_packet->header.version = ZENITH_NOW_VERSION;
+    memset( builder, 0, sizeof( *builder ) );
+    builder->packet = ( zenith_now_packet_t * ) buffer;
+    builder->capacity = buffer_size > ZENITH_NOW_MAX_PACKET_SIZE ? ZENITH_NOW_MAX_PACKET_SIZE : buffer_size;
+    builder->length = sizeof( zenith_now_packet_header_t );
 
-    memcpy( data_packet->payload, data_payload, payload_size );
+    builder->packet->header.type = packet_type;
+    builder->packet->header.version = ZENITH_NOW_VERSION;
+    builder->packet->header.payload_size = 0;
+    // Pairing and data packets get acked, so they need a sequence number. Retransmit the same buffer to keep it.
+    builder->packet->header.sequence = ( packet_type == ZENITH_PACKET_ACK ) ? 0 : _next_tx_sequence();
 
-    ESP_LOGD(TAG, "sending this packet:");
-    ESP_LOG_BUFFER_HEX_LEVEL( TAG, ( uint8_t * ) data_packet, packet_size, ESP_LOG_DEBUG );
-    ret = zenith_now_send_packet( peer_mac, data_packet );
+    if ( packet_type == ZENITH_PACKET_DATA )
+        ESP_RETURN_ON_ERROR(
+            zenith_now_builder_set_encoding( builder, ZENITH_NOW_DATA_ENCODING_FLOAT ),
+            TAG, "Buffer too small for data payload"
+        );
 
-    free( data_packet );
-    return ret;
+    return ESP_OK;
 }
 
-/// @brief Sends an ack to the peer for the packet type supplied
-/// @param peer_addr the mac address to send to
-/// @param packet_type the packet type to ack
-/// @return ESP_OK
-esp_err_t zenith_now_send_ack( const uint8_t *peer_mac, zenith_now_packet_type_t ack_type ) {
-    esp_err_t ret = ESP_OK;
-    ESP_LOGD(TAG, "zenith_now_send_ack()");
+/// @brief Appends raw payload bytes to the packet being built
+/// @return ESP_OK, or ESP_ERR_INVALID_SIZE if the packet would grow past the buffer
+esp_err_t zenith_now_builder_append( zenith_now_packet_builder_t *builder, const void *data, size_t len ) {
+    ESP_RETURN_ON_FALSE(
+        builder && builder->packet && ( data || len == 0 ),
+        ESP_ERR_INVALID_ARG,
+        TAG, "NULL pointer passed to zenith_now_builder_append"
+    );
 
-    size_t payload_size = sizeof( zenith_now_payload_ack_t );
-    size_t packet_size = sizeof( zenith_now_packet_t ) + payload_size;
-    ESP_LOGD( TAG, "Createing packet\tsize: %d type: %d", packet_size, ack_type );
+    ESP_RETURN_ON_FALSE(
+        builder->length + len <= builder->capacity,
+        ESP_ERR_INVALID_SIZE,
+        TAG, "Packet full: %u + %u > %u", ( unsigned ) builder->length, ( unsigned ) len, ( unsigned ) builder->capacity
+    );
 
-    zenith_now_packet_t *ack = calloc( 1, packet_size);
+    memcpy( ( uint8_t * ) builder->packet + builder->length, data, len );
+    builder->length += len;
+    builder->packet->header.payload_size = builder->length - sizeof( zenith_now_packet_header_t );
+
+    return ESP_OK;
+}
+
+/// @brief Selects the datapoint encoding of a data packet. Must be called before the first record is added.
+/// @details Only use ZENITH_NOW_DATA_ENCODING_COMPACT with a core that accepted ZENITH_NOW_PAIRING_FLAG_COMPACT.
+/// @return ESP_OK, ESP_ERR_INVALID_STATE if this is not an empty data packet, or ESP_ERR_NOT_SUPPORTED for unknown encodings
+esp_err_t zenith_now_builder_set_encoding( zenith_now_packet_builder_t *builder, zenith_now_data_encoding_t encoding ) {
     ESP_RETURN_ON_FALSE(
-        ack,
-        ESP_ERR_NO_MEM,
-        TAG, "Error allocating memory for ack packet"
+        builder && builder->packet,
+        ESP_ERR_INVALID_ARG,
+        TAG, "NULL pointer passed to zenith_now_builder_set_encoding"
     );
 
-    ack->header.type = ZENITH_PACKET_ACK;
-    ack->header.payload_size = payload_size;
-    ack->header.version = ZENITH_NOW_VERSION;
+    ESP_RETURN_ON_FALSE(
+        builder->packet->header.type == ZENITH_PACKET_DATA && builder->record_offset == 0,
+        ESP_ERR_INVALID_STATE,
+        TAG, "Encoding can only be set on an empty data packet"
+    );
 
-    (( zenith_now_payload_ack_t * ) ack->payload)->ack_for_type = ack_type;
+    ESP_RETURN_ON_FALSE(
+        encoding < ZENITH_NOW_DATA_ENCODING_MAX,
+        ESP_ERR_NOT_SUPPORTED,
+        TAG, "Unknown data encoding %d", encoding
+    );
 
-    ESP_LOGD(TAG, "sending this packet to ack:");
-    ESP_LOG_BUFFER_HEX_LEVEL( TAG, ( uint8_t * ) ack, packet_size, ESP_LOG_DEBUG );
-    ret = zenith_now_send_packet( peer_mac, ack);
+    // Start the payload over
+    builder->length = sizeof( zenith_now_packet_header_t );
+    builder->packet->header.payload_size = 0;
+    builder->encoding = encoding;
 
-    free(ack);
-    return ret;
+    ESP_RETURN_ON_ERROR(
+        zenith_now_builder_append( builder, &encoding, sizeof( encoding ) ),
+        TAG, "Buffer too small for data payload"
+    );
+
+    if ( encoding == ZENITH_NOW_DATA_ENCODING_FLOAT ) {
+        // Float payload continues with the record count
+        zenith_now_payload_batch_t batch = { .num_records = 0 };
+        ESP_RETURN_ON_ERROR(
+            zenith_now_builder_append( builder, &batch, sizeof( batch ) ),
+            TAG, "Buffer too small for data payload"
+        );
+    }
+
+    return ESP_OK;
 }
 
-/// @brief Currently you can only pair with Zenith Core. This is typically used by the Zenith Node when it needs to pair.
-esp_err_t zenith_now_send_pairing( const uint8_t *peer_mac ) {
-    esp_err_t ret = ESP_OK;
-    ESP_LOGD(TAG, "zenith_now_send_pairing()");
+/// @brief Checks if a record with num_datapoints datapoints is guaranteed to fit in the packet
+/// @details Exact for the float encoding. For the compact encoding it assumes worst case varints, so it can report false
+///          when the record would actually have fitted.
+bool zenith_now_builder_record_fits( const zenith_now_packet_builder_t *builder, uint8_t num_datapoints ) {
+    if ( !builder || !builder->packet )
+        return false;
+
+    size_t needed;
+    if ( builder->encoding == ZENITH_NOW_DATA_ENCODING_COMPACT )
+        needed = 3 + num_datapoints * 11; // age varint (max 3 for uint16) + tag and value varint (max 10) per datapoint
+    else
+        needed = sizeof( zenith_now_data_record_t ) + num_datapoints * sizeof( zenith_datapoint_t );
+
+    return builder->length + needed <= builder->capacity;
+}
+
+/// @brief Starts a new record in a data packet being built. Following datapoints are added to this record.
+/// @param age how many seconds ago the datapoints in the record were sampled
+/// @return ESP_OK, ESP_ERR_INVALID_STATE if this is not a data packet, or ESP_ERR_INVALID_SIZE if the packet is full
+esp_err_t zenith_now_builder_begin_record( zenith_now_packet_builder_t *builder, uint16_t age ) {
+    ESP_RETURN_ON_FALSE(
+        builder && builder->packet,
+        ESP_ERR_INVALID_ARG,
+        TAG, "NULL pointer passed to zenith_now_builder_begin_record"
+    );
+
+    ESP_RETURN_ON_FALSE(
+        builder->packet->header.type == ZENITH_PACKET_DATA,
+        ESP_ERR_INVALID_STATE,
+        TAG, "Records can only be added to data packets"
+    );
+
+    if ( builder->encoding == ZENITH_NOW_DATA_ENCODING_COMPACT ) {
+        // Compact records have no header of their own - the age goes out with the first datapoint
+        builder->record_pending = true;
+        builder->record_age = age;
+        builder->record_offset = builder->length;
+        return ESP_OK;
+    }
+
+    zenith_now_payload_batch_t *batch = _builder_batch( builder );
+    ESP_RETURN_ON_FALSE(
+        batch->num_records < UINT8_MAX,
+        ESP_ERR_INVALID_SIZE,
+        TAG, "Too many records"
+    );
+
+    zenith_now_data_record_t record = {
+        .age = age,
+        .num_datapoints = 0,
+    };
+    size_t record_offset = builder->length;
+    ESP_RETURN_ON_ERROR(
+        zenith_now_builder_append( builder, &record, sizeof( record ) ),
+        TAG, "No room for record"
+    );
+    builder->record_offset = record_offset;
+    batch->num_records++;
+
+    return ESP_OK;
+}
+
+/// @brief Appends a compact encoded datapoint. Nothing is written if it doesn't fit.
+static esp_err_t _builder_add_compact_datapoint( zenith_now_packet_builder_t *builder, uint8_t reading_type, float value ) {
+    ESP_RETURN_ON_FALSE(
+        reading_type < ZENITH_NOW_COMPACT_MAX_TYPES && zenith_now_compact_scale[ reading_type ],
+        ESP_ERR_NOT_SUPPORTED,
+        TAG, "Reading type %d has no compact encoding", reading_type
+    );
+
+    // INT32_MAX isn't a float - it rounds up to 2^31, which doesn't fit. Compare against the powers of two instead.
+    float scaled_value = value * zenith_now_compact_scale[ reading_type ];
+    ESP_RETURN_ON_FALSE(
+        isfinite( scaled_value ) && scaled_value >= -2147483648.0f && scaled_value < 2147483648.0f,
+        ESP_ERR_INVALID_ARG,
+        TAG, "Value %f out of range for compact encoding", value
+    );
+    int32_t scaled = ( int32_t ) lroundf( scaled_value );
+
+    uint8_t encoded[ 1 + 10 + 10 ];
+    size_t len = 0;
+    encoded[ len++ ] = reading_type | ( builder->record_pending ? ZENITH_NOW_COMPACT_NEW_RECORD : 0 );
+    if ( builder->record_pending )
+        len += _varint_encode( _zigzag_encode( ( int64_t ) builder->record_age - builder->last_age ), &encoded[ len ] );
+    len += _varint_encode( _zigzag_encode( ( int64_t ) scaled - builder->last_value[ reading_type ] ), &encoded[ len ] );
 
-    size_t payload_size = sizeof( zenith_now_payload_pairing_t );
-    size_t packet_size = sizeof( zenith_now_packet_t ) + payload_size;
-    ESP_LOGD( TAG, "Createing packet\tsize: %d type: %d", packet_size, ZENITH_PACKET_PAIRING );
+    ESP_RETURN_ON_ERROR(
+        zenith_now_builder_append( builder, encoded, len ),
+        TAG, "No room for datapoint"
+    );
+
+    // Only move the delta state once the datapoint is in the packet
+    if ( builder->record_pending ) {
+        builder->last_age = builder->record_age;
+        builder->record_pending = false;
+    }
+    builder->last_value[ reading_type ] = scaled;
 
-    zenith_now_packet_t *pairing = calloc( 1, packet_size);
+    return ESP_OK;
+}
+
+/// @brief Appends a datapoint to the open record of a data packet being built
+/// @return ESP_OK, ESP_ERR_INVALID_STATE if no record is open, ESP_ERR_INVALID_SIZE if the packet is full, or
+///         ESP_ERR_NOT_SUPPORTED if the packet is compact encoded and the reading type has no compact encoding
+esp_err_t zenith_now_builder_add_datapoint( zenith_now_packet_builder_t *builder, uint8_t reading_type, float value ) {
     ESP_RETURN_ON_FALSE(
-        pairing,
+        builder && builder->packet,
+        ESP_ERR_INVALID_ARG,
+        TAG, "NULL pointer passed to zenith_now_builder_add_datapoint"
+    );
+
+    ESP_RETURN_ON_FALSE(
+        builder->packet->header.type == ZENITH_PACKET_DATA && builder->record_offset,
+        ESP_ERR_INVALID_STATE,
+        TAG, "Datapoints can only be added to an open data record"
+    );
+
+    if ( builder->encoding == ZENITH_NOW_DATA_ENCODING_COMPACT )
+        return _builder_add_compact_datapoint( builder, reading_type, value );
+
+    zenith_now_data_record_t *record = ( zenith_now_data_record_t * ) ( ( uint8_t * ) builder->packet + builder->record_offset );
+    ESP_RETURN_ON_FALSE(
+        record->num_datapoints < UINT8_MAX,
+        ESP_ERR_INVALID_SIZE,
+        TAG, "Too many datapoints"
+    );
+
+    zenith_datapoint_t datapoint = {
+        .reading_type = reading_type,
+        .value = value,
+    };
+    ESP_RETURN_ON_ERROR(
+        zenith_now_builder_append( builder, &datapoint, sizeof( datapoint ) ),
+        TAG, "No room for datapoint"
+    );
+    record->num_datapoints++;
+
+    return ESP_OK;
+}
+
+/// @brief Decodes the single sample payload of protocol 1.2 and older
+static esp_err_t _decode_legacy_data( const uint8_t *payload, size_t payload_size, time_t now, zenith_datapoint_t *out_datapoints, time_t *out_timestamps, size_t *inout_count ) {
+    const zenith_datapoints_t *data = ( const zenith_datapoints_t * ) payload;
+    ESP_RETURN_ON_FALSE(
+        payload_size >= sizeof( zenith_datapoints_t ) &&
+        payload_size >= sizeof( zenith_datapoints_t ) + data->num_datapoints * sizeof( zenith_datapoint_t ),
+        ESP_ERR_INVALID_SIZE,
+        TAG, "Truncated data payload"
+    );
+    ESP_RETURN_ON_FALSE(
+        data->num_datapoints <= *inout_count,
         ESP_ERR_NO_MEM,
-        TAG, "Error allocating memory for pairing packet"
+        TAG, "Too many datapoints: %d", data->num_datapoints
     );
 
-    pairing->header.type = ZENITH_PACKET_PAIRING;
-    pairing->header.payload_size = payload_size;
-    pairing->header.version = ZENITH_NOW_VERSION;
+    size_t count = 0;
+    for ( ; count < data->num_datapoints; count++ ) {
+        out_datapoints[ count ] = data->datapoints[ count ];
+        out_timestamps[ count ] = now; // Sampled just before it was sent
+    }
+
+    *inout_count = count;
+    return ESP_OK;
+}
 
-    (( zenith_now_payload_pairing_t * ) pairing->payload)->flags = 0;
+/// @brief Decodes a float encoded batch of records
+static esp_err_t _decode_batch_data( const uint8_t *payload, size_t payload_size, time_t now, zenith_datapoint_t *out_datapoints, time_t *out_timestamps, size_t *inout_count ) {
+    ESP_RETURN_ON_FALSE(
+        payload_size >= sizeof( zenith_now_payload_batch_t ),
+        ESP_ERR_INVALID_SIZE,
+        TAG, "Truncated batch payload"
+    );
 
-    ESP_LOGD(TAG, "sending this packet to pair: "MACSTR, MAC2STR(peer_mac));
-    ESP_LOG_BUFFER_HEX_LEVEL( TAG, ( uint8_t * ) pairing, packet_size, ESP_LOG_DEBUG );
-    ret = zenith_now_send_packet( peer_mac, pairing);
+    const zenith_now_payload_batch_t *batch = ( const zenith_now_payload_batch_t * ) payload;
+    size_t offset = sizeof( zenith_now_payload_batch_t );
+    size_t count = 0;
 
-    free(pairing);
-    return ret;
+    for ( uint8_t r = 0; r < batch->num_records; r++ ) {
+        ESP_RETURN_ON_FALSE(
+            offset + sizeof( zenith_now_data_record_t ) <= payload_size,
+            ESP_ERR_INVALID_SIZE,
+            TAG, "Truncated record %d", r
+        );
+        const zenith_now_data_record_t *record = ( const zenith_now_data_record_t * ) ( payload + offset );
+        offset += sizeof( zenith_now_data_record_t );
+
+        ESP_RETURN_ON_FALSE(
+            offset + record->num_datapoints * sizeof( zenith_datapoint_t ) <= payload_size,
+            ESP_ERR_INVALID_SIZE,
+            TAG, "Truncated datapoints in record %d", r
+        );
+        ESP_RETURN_ON_FALSE(
+            count + record->num_datapoints <= *inout_count,
+            ESP_ERR_NO_MEM,
+            TAG, "Too many datapoints in batch"
+        );
+
+        for ( uint8_t i = 0; i < record->num_datapoints; i++ ) {
+            memcpy( &out_datapoints[ count ], payload + offset, sizeof( zenith_datapoint_t ) );
+            out_timestamps[ count ] = now - record->age;
+            offset += sizeof( zenith_datapoint_t );
+            count++;
+        }
+    }
+
+    *inout_count = count;
+    return ESP_OK;
 }
 
+/// @brief Adds a decoded delta to compact delta state, which stays in the int32 range the builder works in
+/// @return false if the delta is bigger than any two int32 values apart, or takes the state out of range
+static bool _compact_accumulate( int64_t *state, uint64_t raw ) {
+    int64_t delta = _zigzag_decode( raw );
+    // Checked before adding, so a hostile varint can't overflow the sum
+    if ( delta > ( int64_t ) UINT32_MAX || delta < -( int64_t ) UINT32_MAX )
+        return false;
+    int64_t sum = *state + delta;
+    if ( sum < INT32_MIN || sum > INT32_MAX )
+        return false;
+    *state = sum;
+    return true;
+}
 
-esp_err_t zenith_now_new_packet( zenith_now_packet_type_t packet_type , uint8_t num_datapoints, zenith_now_packet_handle_t *out_packet ) {
-    ESP_LOGD( TAG, "zenith_now_new_packet()" );
-    esp_err_t ret = ESP_OK;
+/// @brief Decodes a compact encoded stream of datapoints
+static esp_err_t _decode_compact_data( const uint8_t *payload, size_t payload_size, time_t now, zenith_datapoint_t *out_datapoints, time_t *out_timestamps, size_t *inout_count ) {
+    int64_t last_value[ ZENITH_NOW_COMPACT_MAX_TYPES ] = { 0 };
+    int64_t age = 0;
+    bool in_record = false;
+    size_t offset = 0;
+    size_t count = 0;
+
+    while ( offset < payload_size ) {
+        uint8_t tag = payload[ offset++ ];
+        uint8_t reading_type = tag & ZENITH_NOW_COMPACT_TYPE_MASK;
+        uint64_t raw;
+
+        ESP_RETURN_ON_FALSE(
+            reading_type < ZENITH_NOW_COMPACT_MAX_TYPES && zenith_now_compact_scale[ reading_type ],
+            ESP_ERR_INVALID_RESPONSE,
+            TAG, "Unknown compact reading type %d", reading_type
+        );
 
-    size_t payload_size = 0;
-    switch ( packet_type ) {
-        case ZENITH_PACKET_PAIRING:
-            ESP_LOGD( TAG, "Pairing packet" );
-            payload_size = sizeof( zenith_now_payload_pairing_t );
-            break;
-        case ZENITH_PACKET_DATA:
-            ESP_LOGD( TAG, "Data packet" );
-            payload_size = sizeof( zenith_now_payload_data_t ) + sizeof( zenith_datapoint_t ) * num_datapoints;
-            break;
-        case ZENITH_PACKET_ACK:
-            ESP_LOGD( TAG, "Ack packet" );
-            payload_size = sizeof( zenith_now_payload_ack_t );
-            break;
-        default:
+        if ( tag & ZENITH_NOW_COMPACT_NEW_RECORD ) {
             ESP_RETURN_ON_ERROR(
-                ESP_ERR_INVALID_ARG,
-                TAG, "Unimplemented packet type"
+                _varint_decode( payload, payload_size, &offset, &raw ),
+                TAG, "Truncated record age"
             );
-            break;
+            ESP_RETURN_ON_FALSE(
+                _compact_accumulate( &age, raw ),
+                ESP_ERR_INVALID_RESPONSE,
+                TAG, "Record age out of range"
+            );
+            in_record = true;
+        }
+        ESP_RETURN_ON_FALSE(
+            in_record,
+            ESP_ERR_INVALID_RESPONSE,
+            TAG, "Compact datapoint outside of a record"
+        );
+
+        ESP_RETURN_ON_ERROR(
+            _varint_decode( payload, payload_size, &offset, &raw ),
+            TAG, "Truncated compact value"
+        );
+        ESP_RETURN_ON_FALSE(
+            _compact_accumulate( &last_value[ reading_type ], raw ),
+            ESP_ERR_INVALID_RESPONSE,
+            TAG, "Compact value out of range"
+        );
+
+        ESP_RETURN_ON_FALSE(
+            count < *inout_count,
+            ESP_ERR_NO_MEM,
+            TAG, "Too many datapoints in batch"
+        );
+        out_datapoints[ count ].reading_type = reading_type;
+        out_datapoints[ count ].value = ( zenith_sensor_datatype_t ) last_value[ reading_type ] / zenith_now_compact_scale[ reading_type ];
+        out_timestamps[ count ] = now - age;
+        count++;
     }
 
-    size_t packet_size = sizeof( zenith_now_packet_t ) + payload_size;
+    *inout_count = count;
+    return ESP_OK;
+}
 
-    zenith_now_packet_t *packet = calloc( 1, packet_size );
+/// @brief Decodes a data packet into datapoints with timestamps
+/// @details Handles every data payload we have had: the single sample payload of 1.2 and older, the float batch of 1.3,
+///          and from 1.4 the encoding byte followed by a float batch or compact datapoints. Record ages are turned into
+///          timestamps relative to now. The packet is bounds checked against header.payload_size.
+/// @param packet the data packet
+/// @param now time the packet was received
+/// @param out_datapoints where to store the datapoints
+/// @param out_timestamps where to store the timestamp of each datapoint
+/// @param inout_count in: room in the output arrays, out: number of datapoints decoded
+/// @return ESP_OK, ESP_ERR_INVALID_SIZE or ESP_ERR_INVALID_RESPONSE if the packet is malformed, ESP_ERR_NOT_SUPPORTED for
+///         unknown encodings, or ESP_ERR_NO_MEM if the output arrays are too small
+esp_err_t zenith_now_decode_data( const zenith_now_packet_t *packet, time_t now, zenith_datapoint_t *out_datapoints, time_t *out_timestamps, size_t *inout_count ) {
     ESP_RETURN_ON_FALSE(
-        packet,
-        ESP_ERR_NO_MEM,
-        TAG, "Error allocating memory for packet"
+        packet && out_datapoints && out_timestamps && inout_count,
+        ESP_ERR_INVALID_ARG,
+        TAG, "NULL pointer passed to zenith_now_decode_data"
+    );
+
+    ESP_RETURN_ON_FALSE(
+        packet->header.type == ZENITH_PACKET_DATA,
+        ESP_ERR_INVALID_ARG,
+        TAG, "Not a data packet"
+    );
+
+    const uint8_t *payload = packet->payload;
+    size_t payload_size = packet->header.payload_size;
+    uint8_t minor_version = ZENITH_NOW_VERSION_MINOR( packet->header.version );
+    size_t capacity = *inout_count;
+
+    *inout_count = 0;
+
+    if ( minor_version < ZENITH_NOW_BATCH_MINOR_VERSION )
+        ESP_RETURN_ON_ERROR(
+            _decode_legacy_data( payload, payload_size, now, out_datapoints, out_timestamps, &capacity ),
+            TAG, "Error decoding legacy data payload"
+        );
+    else if ( minor_version < ZENITH_NOW_ENCODING_MINOR_VERSION )
+        ESP_RETURN_ON_ERROR(
+            _decode_batch_data( payload, payload_size, now, out_datapoints, out_timestamps, &capacity ),
+            TAG, "Error decoding batch data payload"
+        );
+    else {
+        ESP_RETURN_ON_FALSE(
+            payload_size >= sizeof( zenith_now_data_encoding_t ),
+            ESP_ERR_INVALID_SIZE,
+            TAG, "Truncated data payload"
+        );
+        zenith_now_data_encoding_t encoding = payload[ 0 ];
+        payload += sizeof( zenith_now_data_encoding_t );
+        payload_size -= sizeof( zenith_now_data_encoding_t );
+
+        switch ( encoding ) {
+            case ZENITH_NOW_DATA_ENCODING_FLOAT:
+                ESP_RETURN_ON_ERROR(
+                    _decode_batch_data( payload, payload_size, now, out_datapoints, out_timestamps, &capacity ),
+                    TAG, "Error decoding float data payload"
+                );
+                break;
+            case ZENITH_NOW_DATA_ENCODING_COMPACT:
+                ESP_RETURN_ON_ERROR(
+                    _decode_compact_data( payload, payload_size, now, out_datapoints, out_timestamps, &capacity ),
+                    TAG, "Error decoding compact data payload"
+                );
+                break;
+            default:
+                ESP_LOGE( TAG, "Unknown data encoding %d", encoding );
+                return ESP_ERR_NOT_SUPPORTED;
+        }
+    }
+
+    *inout_count = capacity;
+    return ESP_OK;
+}
+
+/// @brief Sends a zenith_now data packet over esp-now
+/// @details The datapoints are sent as a batch with a single record that was sampled now.
+/// @param peer_mac Peer to send to
+/// @param data_payload the payload for the data packet
+/// @return ESP_OK, or underlying error value
+esp_err_t zenith_now_send_data( const uint8_t *peer_mac, const zenith_now_payload_data_t *data_payload ) {
+    ESP_LOGD(TAG, "zenith_now_send_data()");
+    ESP_RETURN_ON_FALSE(
+        data_payload,
+        ESP_ERR_INVALID_ARG,
+        TAG, "data_payload is NULL"
     );
-    packet->header.type = packet_type;
-    packet->header.payload_size = payload_size;
-    packet->header.version = ZENITH_NOW_VERSION;
 
-    *out_packet = packet;
+    uint8_t buffer[ ZENITH_NOW_MAX_PACKET_SIZE ]; // Scratch buffer on the calling task's stack
+    zenith_now_packet_builder_t builder;
+    ESP_RETURN_ON_ERROR(
+        zenith_now_builder_init( &builder, buffer, sizeof( buffer ), ZENITH_PACKET_DATA ),
+        TAG, "Error building data packet"
+    );
+    ESP_RETURN_ON_ERROR(
+        zenith_now_builder_begin_record( &builder, 0 ),
+        TAG, "Error building data packet"
+    );
+
+    for ( uint8_t i = 0; i < data_payload->num_datapoints; i++ )
+        ESP_RETURN_ON_ERROR(
+            zenith_now_builder_add_datapoint( &builder, data_payload->datapoints[ i ].reading_type, data_payload->datapoints[ i ].value ),
+            TAG, "Error adding datapoint %d", i
+        );
+
+    ESP_LOGD(TAG, "sending this packet:");
+    ESP_LOG_BUFFER_HEX_LEVEL( TAG, buffer, builder.length, ESP_LOG_DEBUG );
+    return zenith_now_send_packet( peer_mac, builder.packet );
+}
+
+/// @brief Times the first ack a task sends for the packet it's handling
+/// @details Only the event handler and the worker handle received packets. Acks sent from anywhere else, or a second
+///          ack for the same packet, aren't counted.
+static void _record_ack_latency( const uint8_t *peer_mac ) {
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    for ( int i = 0; i < 2; i++ ) {
+        zenith_now_rx_context_t *context = &zenith_now_instance.rx_context[ i ];
+        if ( context->task != task || !context->received_us || memcmp( context->mac, peer_mac, ZENITH_NOW_MAC_LEN ) != 0 )
+            continue;
+
+        uint32_t latency = _now_us() - context->received_us;
+        context->received_us = 0;
+
+        // Both tasks can get here at once - the stats are only ever read as a rough snapshot
+        xSemaphoreTake( zenith_now_instance.peer_lock, portMAX_DELAY );
+        zenith_now_instance.acks_sent++;
+        zenith_now_instance.ack_latency_total_us += latency;
+        if ( latency > zenith_now_instance.ack_latency_max_us )
+            zenith_now_instance.ack_latency_max_us = latency;
+        xSemaphoreGive( zenith_now_instance.peer_lock );
+        return;
+    }
+}
+
+/// @brief Builds and sends an ack packet
+static esp_err_t _send_ack( const uint8_t *peer_mac, zenith_now_packet_type_t ack_type, uint8_t flags ) {
+    uint8_t buffer[ sizeof( zenith_now_packet_header_t ) + sizeof( zenith_now_payload_ack_t ) ];
+    zenith_now_packet_builder_t builder;
+    zenith_now_payload_ack_t ack = {
+        .ack_for_type = ack_type,
+        .flags = flags,
+    };
+
+    // Report everything we've seen from the peer, so one ack covers all packets in flight
+    xSemaphoreTake( zenith_now_instance.peer_lock, portMAX_DELAY );
+    zenith_now_peer_t *peer = _peer_get( peer_mac, false );
+    if ( peer && peer->rx_valid ) {
+        ack.sequence = peer->rx_highest;
+        ack.window = peer->rx_window;
+    }
+    xSemaphoreGive( zenith_now_instance.peer_lock );
+    ESP_RETURN_ON_ERROR(
+        zenith_now_builder_init( &builder, buffer, sizeof( buffer ), ZENITH_PACKET_ACK ),
+        TAG, "Error building ack packet"
+    );
+    ESP_RETURN_ON_ERROR(
+        zenith_now_builder_append( &builder, &ack, sizeof( ack ) ),
+        TAG, "Error building ack packet"
+    );
 
+    ESP_LOGD(TAG, "sending this packet to ack:");
+    ESP_LOG_BUFFER_HEX_LEVEL( TAG, buffer, builder.length, ESP_LOG_DEBUG );
+    esp_err_t ret = zenith_now_send_packet( peer_mac, builder.packet );
+    if ( ret == ESP_OK )
+        _record_ack_latency( peer_mac );
     return ret;
 }
+
+/// @brief Sends an ack to the peer for the packet type supplied
+/// @param peer_addr the mac address to send to
+/// @param packet_type the packet type to ack
+/// @return ESP_OK
+esp_err_t zenith_now_send_ack( const uint8_t *peer_mac, zenith_now_packet_type_t ack_type ) {
+    ESP_LOGD(TAG, "zenith_now_send_ack()");
+    return _send_ack( peer_mac, ack_type, 0 );
+}
+
+/// @brief Acks a pairing request, telling the node which of its pairing flags we accept
+/// @param peer_mac the node to ack
+/// @param accepted_flags the ZENITH_NOW_PAIRING_FLAG_* the node may use from now on
+/// @return ESP_OK, or underlying error value
+esp_err_t zenith_now_send_pairing_ack( const uint8_t *peer_mac, uint8_t accepted_flags ) {
+    ESP_LOGD(TAG, "zenith_now_send_pairing_ack()");
+    return _send_ack( peer_mac, ZENITH_PACKET_PAIRING, accepted_flags & ZENITH_NOW_PAIRING_FLAGS_SUPPORTED );
+}
+
+/// @brief Tells the receive callback whether zenith_now already acked packets of this type
+/// @param packet_type the packet type
+/// @return true if config.auto_ack covers the type - rx_cb must not ack it again
+bool zenith_now_auto_acks( zenith_now_packet_type_t packet_type ) {
+    switch ( packet_type ) {
+        case ZENITH_PACKET_PAIRING:
+            return zenith_now_instance.config.auto_ack & ZENITH_NOW_AUTO_ACK_PAIRING;
+        case ZENITH_PACKET_DATA:
+            return zenith_now_instance.config.auto_ack & ZENITH_NOW_AUTO_ACK_DATA;
+        default:
+            return false;
+    }
+}
+
+/// @brief Currently you can only pair with Zenith Core. This is typically used by the Zenith Node when it needs to pair.
+esp_err_t zenith_now_send_pairing( const uint8_t *peer_mac ) {
+    ESP_LOGD(TAG, "zenith_now_send_pairing()");
+
+    uint8_t buffer[ sizeof( zenith_now_packet_header_t ) + sizeof( zenith_now_payload_pairing_t ) ];
+    zenith_now_packet_builder_t builder;
+    zenith_now_payload_pairing_t pairing = {
+        .flags = ZENITH_NOW_PAIRING_FLAGS_SUPPORTED,
+    };
+    ESP_RETURN_ON_ERROR(
+        zenith_now_builder_init( &builder, buffer, sizeof( buffer ), ZENITH_PACKET_PAIRING ),
+        TAG, "Error building pairing packet"
+    );
+    ESP_RETURN_ON_ERROR(
+        zenith_now_builder_append( &builder, &pairing, sizeof( pairing ) ),
+        TAG, "Error building pairing packet"
+    );
+
+    ESP_LOGD(TAG, "sending this packet to pair: "MACSTR, MAC2STR(peer_mac));
+    ESP_LOG_BUFFER_HEX_LEVEL( TAG, buffer, builder.length, ESP_LOG_DEBUG );
+    return zenith_now_send_packet( peer_mac, builder.packet );
+}
+
 /// @brief Sends zenith_now packets over esp-now, and heals the esp-now peer list
 /// @param peer_addr mac address we want to send to
-/// @param data_packet the zenith_now packet we want to send
+/// @param data_packet the zenith_now packet we want to send. header.payload_size decides how much is sent
 /// @return ESP_OK, otherwise passed on error values.
 esp_err_t zenith_now_send_packet( const uint8_t *peer_mac, const zenith_now_packet_t *packet ) {
 
@@ -343,105 +1055,331 @@ esp_err_t zenith_now_send_packet( const uint8_t *peer_mac, const zenith_now_pack
         TAG, "NULL pointer passed to zenith_now_send_packet"
     );
 
-    if ( !esp_now_is_peer_exist( peer_mac ) )
+    size_t packet_size = sizeof( zenith_now_packet_header_t ) + packet->header.payload_size;
+    ESP_RETURN_ON_FALSE(
+        packet_size <= ZENITH_NOW_MAX_PACKET_SIZE,
+        ESP_ERR_INVALID_SIZE,
+        TAG, "Packet too large: %u", ( unsigned ) packet_size
+    );
+
+    if ( !zenith_now_is_peer_known( peer_mac ) )
         ESP_RETURN_ON_ERROR(
             zenith_now_add_peer( peer_mac ),
-            TAG, "Error adding esp_now peer during send"
+            TAG, "Error adding peer during send"
         );
 
-    size_t payload_size = get_payload_size( packet );
-    size_t packet_size = sizeof( zenith_now_packet_t ) + payload_size;
+    // Peers older than 1.5 expect the short header
+    xSemaphoreTake( zenith_now_instance.peer_lock, portMAX_DELAY );
+    zenith_now_peer_t *peer = _peer_get( peer_mac, false );
+    bool legacy_peer = peer && peer->version && ZENITH_NOW_VERSION_MINOR( peer->version ) < ZENITH_NOW_SEQUENCE_MINOR_VERSION;
+    // Acked packets get their send status tracked, so waiting for the ack can stop early if the send fails
+    zenith_now_tx_pending_t *tx = NULL;
+    if ( packet->header.type == ZENITH_PACKET_PAIRING || packet->header.type == ZENITH_PACKET_DATA )
+        tx = _tx_pending_track( peer_mac, packet );
+    xSemaphoreGive( zenith_now_instance.peer_lock );
+
+    if ( packet->header.type == ZENITH_PACKET_PAIRING )
+        xEventGroupClearBits( zenith_now_instance.event_group, PAIRING_SEND_FAIL_BIT );
+    else if ( packet->header.type == ZENITH_PACKET_DATA )
+        xEventGroupClearBits( zenith_now_instance.event_group, DATA_SEND_FAIL_BIT );
+
+    if ( legacy_peer ) {
+        uint8_t legacy_packet[ ZENITH_NOW_MAX_PACKET_SIZE ];
+        zenith_now_legacy_packet_header_t *legacy_header = ( zenith_now_legacy_packet_header_t * ) legacy_packet;
+        legacy_header->type = packet->header.type;
+        legacy_header->version = packet->header.version;
+        legacy_header->payload_size = packet->header.payload_size;
+        memcpy( legacy_packet + sizeof( *legacy_header ), packet->payload, packet->header.payload_size );
+        ret = zenith_now_instance.transport->send( zenith_now_instance.transport, peer_mac, legacy_packet, sizeof( *legacy_header ) + packet->header.payload_size );
+    } else {
+        ret = zenith_now_instance.transport->send( zenith_now_instance.transport, peer_mac, ( const uint8_t * ) packet, packet_size );
+    }
 
-    ret = esp_now_send( peer_mac, ( const uint8_t * ) packet, packet_size );
+    // No send callback is coming for a packet the transport refused
+    if ( ret != ESP_OK && tx ) {
+        xSemaphoreTake( zenith_now_instance.peer_lock, portMAX_DELAY );
+        tx->state = ZENITH_NOW_TX_FREE;
+        xSemaphoreGive( zenith_now_instance.peer_lock );
+    }
 
     return ret;
 }
 
-/// @brief Callback for ESP-NOW send. Posts "sent event" to the event queue.
+/// @brief Transport send callback. Posts "sent event" to the event queue.
+/// @param transport the transport that sent the packet
 /// @param mac_addr mac address packet was sent to
 /// @param status status of the send
-static void zenith_now_espnow_send_cb( const uint8_t *mac_addr, esp_now_send_status_t status ) {
-    ESP_LOGD( TAG, "zenith_now_espnow_send_cb()" );
+static void zenith_now_transport_send_cb( zenith_now_transport_handle_t transport, const uint8_t *mac_addr, zenith_now_send_status_t status ) {
+    ESP_LOGD( TAG, "zenith_now_transport_send_cb()" );
     zenith_now_event_t event = {
         .type = SEND_EVENT, 
         .send.status = status
     };
-    memcpy( &event.send.dest_mac, mac_addr, ESP_NOW_ETH_ALEN );
-    xQueueSend( zenith_now_instance.event_queue, &event, 0 ); // Should perhaps wait some tics, but there shouldn't be many packets in the queue and there's room for 10.
+    memcpy( &event.send.dest_mac, mac_addr, ZENITH_NOW_MAC_LEN );
+    // Can't block the driver's task. A lost status leaves its packet pending, and the ack wait times out as before.
+    if ( xQueueSend( zenith_now_instance.event_queue, &event, 0 ) != pdTRUE )
+        atomic_fetch_add( &zenith_now_instance.tx_status_dropped, 1 );
 }
 
-/// @brief Callback for ESP-NOW Receive. Post "receive event" to the event queue.
-/// @param recv_info from and to addresses
+/// @brief Transport receive callback. Post "receive event" to the event queue.
+/// @param transport the transport the packet came in on
+/// @param src_mac address of the sender
 /// @param data packet data bytestream
 /// @param len length of packet data bytestream
-static void zenith_now_espnow_recv_cb( const esp_now_recv_info_t *recv_info, const uint8_t *data, int len ) {
-    ESP_LOGD(TAG, "zenith_now_espnow_recv_cb");
+static void zenith_now_transport_recv_cb( zenith_now_transport_handle_t transport, const uint8_t *src_mac, const uint8_t *data, int len ) {
+    ESP_LOGD(TAG, "zenith_now_transport_recv_cb");
+
+    if ( len < ( int ) sizeof( zenith_now_legacy_packet_header_t ) || len > ZENITH_NOW_TRANSPORT_MAX_DATA_LEN ) {
+        ESP_LOGD( TAG, "Dropping packet with invalid length %d", len );
+        return;
+    }
+
+    const zenith_now_legacy_packet_header_t *legacy_header = ( const zenith_now_legacy_packet_header_t * ) data;
+    bool legacy = ZENITH_NOW_VERSION_MINOR( legacy_header->version ) < ZENITH_NOW_SEQUENCE_MINOR_VERSION;
+    if ( !legacy && len < ( int ) sizeof( zenith_now_packet_header_t ) ) {
+        ESP_LOGD( TAG, "Dropping packet with invalid length %d", len );
+        return;
+    }
 
-    zenith_now_packet_t *packet = malloc( len ); // Free'd in the event handler
+    zenith_now_packet_t *packet = zenith_now_pool_get( &zenith_now_instance.rx_pool ); // Returned to the pool in the event handler
     if ( !packet ) {
-        ESP_LOGE( TAG, "Failed to allocate memory for received packet" );
+        ESP_LOGD( TAG, "Receive pool exhausted, dropping packet" );
         return;
     }
-    // Copy the the packet   
-    memcpy( packet, data, len );
+    // Copy the the packet, widening old headers so the rest of zenith_now only deals with one layout
+    if ( legacy ) {
+        packet->header.type = legacy_header->type;
+        packet->header.version = legacy_header->version;
+        packet->header.payload_size = legacy_header->payload_size;
+        packet->header.sequence = 0;
+        memcpy( packet->payload, data + sizeof( *legacy_header ), len - sizeof( *legacy_header ) );
+    } else {
+        memcpy( packet, data, len );
+    }
+
+    // Never trust payload_size beyond what we actually received
+    size_t received_payload = len - ( legacy ? sizeof( zenith_now_legacy_packet_header_t ) : sizeof( zenith_now_packet_header_t ) );
+    if ( packet->header.payload_size > received_payload )
+        packet->header.payload_size = received_payload;
 
-    ESP_LOGD( TAG, "Received packet type: %d from: "MACSTR, packet->header.type, MAC2STR( recv_info->src_addr ) );
+    ESP_LOGD( TAG, "Received packet type: %d from: "MACSTR, packet->header.type, MAC2STR( src_mac ) );
     ESP_LOG_BUFFER_HEX_LEVEL( TAG, ( uint8_t * ) data, len, ESP_LOG_DEBUG );
 
     zenith_now_event_t event = {
         .type = RECEIVE_EVENT, 
         .receive.data_packet = packet,
+        .receive.received_us = _now_us(),
     };
-    memcpy( &event.receive.source_mac, recv_info->src_addr, ESP_NOW_ETH_ALEN );
-    xQueueSend( zenith_now_instance.event_queue, &event, 0 ); // Should perhaps wait some tics, but there shouldn't be many packets in the queue and there's room for 10.
+    memcpy( &event.receive.source_mac, src_mac, ZENITH_NOW_MAC_LEN );
+    // The default queue fits every pool slot plus every pending send, so this only happens with a smaller configured queue
+    if ( xQueueSend( zenith_now_instance.event_queue, &event, 0 ) != pdTRUE ) {
+        atomic_fetch_add( &zenith_now_instance.rx_queue_dropped, 1 );
+        zenith_now_pool_put( &zenith_now_instance.rx_pool, packet ); // Queue full - the slot would leak otherwise
+    }
 }
 
-/// @brief The zenith_now event handler task. Handles the events that get posted to the queue by the esp_now_callbacks.
-/// @details calls user callbacks and sets event group ack flags.
-/// @param pvParameters Currently unused - just pass NULL.
-/// @todo add task to name, as this is the task that cointains the event handler.
-static void zenith_now_event_handler( void *pvParameters ) {
-    ESP_LOGD( TAG, "zenith_now_event_handler()" );
-    zenith_now_event_t event;
-    while ( xQueueReceive( zenith_now_instance.event_queue, &event, portMAX_DELAY ) == pdTRUE ) {
-        switch ( event.type ) {
-            case SEND_EVENT:
-                // IDGAF about success - user callback can deal with it
-                if ( zenith_now_instance.config.tx_cb )
-                zenith_now_instance.config.tx_cb ( event.send.dest_mac, event.send.status );
-                break;
-            case RECEIVE_EVENT:
-                if ( event.receive.data_packet->header.type == ZENITH_PACKET_ACK) {
-                    zenith_now_payload_ack_t *ack_payload = ( zenith_now_payload_ack_t * ) event.receive.data_packet->payload;
-                    switch ( ack_payload->ack_for_type ) {
-                
-                        case ZENITH_PACKET_DATA:
-                            xEventGroupSetBits(zenith_now_instance.event_group, DATA_ACK_BIT);
-                            break;
-
-                        case ZENITH_PACKET_PAIRING:
-                            xEventGroupSetBits(zenith_now_instance.event_group, PAIRING_ACK_BIT);
-                            break;
-
-                        default:
-                            ESP_LOGE(TAG, "ACK unsupported for packet type %d", ack_payload->ack_for_type);
-                            break;
-
+/// @brief Updates the sequence state of the peer that sent a packet
+/// @details Tracks the peer version, records ack windows, restarts the receive window on pairing and checks data packets
+///          for duplicates. Peers older than 1.5 have no sequence numbers, and never produce duplicates.
+/// @return false if the packet is a duplicate that should not be delivered again
+static bool _handle_sequence( const uint8_t *mac, const zenith_now_packet_t *packet ) {
+    bool deliver = true;
+    bool has_sequence = ZENITH_NOW_VERSION_MINOR( packet->header.version ) >= ZENITH_NOW_SEQUENCE_MINOR_VERSION;
+
+    xSemaphoreTake( zenith_now_instance.peer_lock, portMAX_DELAY );
+    zenith_now_peer_t *peer = _peer_get( mac, true );
+    if ( peer ) {
+        peer->version = packet->header.version;
+
+        if ( has_sequence ) {
+            switch ( packet->header.type ) {
+                case ZENITH_PACKET_ACK:
+                    if ( packet->header.payload_size >= sizeof( zenith_now_payload_ack_t ) ) {
+                        const zenith_now_payload_ack_t *ack = ( const zenith_now_payload_ack_t * ) packet->payload;
+                        _tx_ack_update( peer, ack->sequence, ack->window );
                     }
-                }
+                    break;
+
+                case ZENITH_PACKET_PAIRING:
+                    // A pairing node may have lost its RTC memory and started counting over
+                    peer->rx_valid = false;
+                    _rx_window_update( peer, packet->header.sequence );
+                    break;
 
-                // Hand the packet over to the user callback
-                if ( zenith_now_instance.config.rx_cb )
-                    zenith_now_instance.config.rx_cb( event.receive.source_mac, event.receive.data_packet );
+                case ZENITH_PACKET_DATA:
+                    deliver = _rx_window_update( peer, packet->header.sequence );
+                    break;
+
+                default:
+                    break;
+            }
+        }
+    }
+    xSemaphoreGive( zenith_now_instance.peer_lock );
+
+    if ( has_sequence && packet->header.type == ZENITH_PACKET_ACK )
+        xEventGroupSetBits( zenith_now_instance.event_group, SEQUENCE_ACK_BIT );
+
+    return deliver;
+}
+
+/// @brief Acks a packet straight away if config.auto_ack covers it
+/// @details Only packets from our own major version get acked - the rx_cb would turn anything else away.
+static void _auto_ack( const uint8_t *mac, const zenith_now_packet_t *packet ) {
+    if ( !zenith_now_auto_acks( packet->header.type ) || ZENITH_NOW_VERSION_MAJOR( packet->header.version ) != ZENITH_NOW_MAJOR_VERSION )
+        return;
+
+    esp_err_t ret;
+    if ( packet->header.type == ZENITH_PACKET_PAIRING ) {
+        uint8_t pairing_flags = 0;
+        if ( packet->header.payload_size >= sizeof( zenith_now_payload_pairing_t ) )
+            pairing_flags = ( ( const zenith_now_payload_pairing_t * ) packet->payload )->flags;
+        ret = zenith_now_send_pairing_ack( mac, pairing_flags );
+    } else {
+        ret = zenith_now_send_ack( mac, packet->header.type );
+    }
+
+    // The node retransmits, and we ack the duplicate
+    if ( ret != ESP_OK )
+        ESP_LOGW( TAG, "Could not ack %s from "MACSTR, zenith_now_packet_type_to_str( packet->header.type ), MAC2STR( mac ) );
+}
 
-                // Free the data packet created in the receive callback
-                free( event.receive.data_packet );
+/// @brief Takes whatever is waiting in a queue without blocking
+/// @return number of events taken, at most max
+static size_t _queue_drain( QueueHandle_t queue, zenith_now_event_t *events, size_t max ) {
+    size_t count = 0;
+    while ( count < max && xQueueReceive( queue, &events[ count ], 0 ) == pdTRUE )
+        count++;
+    return count;
+}
+
+/// @brief Hands a batch of received packets to the receive callback and returns their slots to the pool
+/// @param context the calling task's rx_context, so an ack sent from rx_cb gets timed
+static void _deliver( zenith_now_rx_context_t *context, const zenith_now_receive_event_t *received, size_t count ) {
+    if ( zenith_now_instance.config.rx_batch_cb ) {
+        zenith_now_instance.config.rx_batch_cb( received, count );
+    } else if ( zenith_now_instance.config.rx_cb ) {
+        for ( size_t i = 0; i < count; i++ ) {
+            memcpy( context->mac, received[ i ].source_mac, ZENITH_NOW_MAC_LEN );
+            context->received_us = zenith_now_auto_acks( received[ i ].data_packet->header.type ) ? 0 : received[ i ].received_us;
+            zenith_now_instance.config.rx_cb( received[ i ].source_mac, received[ i ].data_packet );
+        }
+        context->received_us = 0;
+    }
+
+    // Return the slots taken in the receive callback
+    for ( size_t i = 0; i < count; i++ )
+        zenith_now_pool_put( &zenith_now_instance.rx_pool, received[ i ].data_packet );
+}
+
+/// @brief The zenith_now worker task. Runs the receive callback on the packets the event handler passes on, when config.rx_worker is set.
+static void zenith_now_worker( void *pvParameters ) {
+    zenith_now_rx_context_t *context = &zenith_now_instance.rx_context[ 1 ];
+    zenith_now_event_t *events = context->events;
+    zenith_now_receive_event_t *received = context->received;
+
+    context->task = xTaskGetCurrentTaskHandle();
+    while ( xQueueReceive( zenith_now_instance.worker_queue, &events[ 0 ], portMAX_DELAY ) == pdTRUE ) {
+        size_t count = 1 + _queue_drain( zenith_now_instance.worker_queue, &events[ 1 ], ZENITH_NOW_EVENT_BATCH_MAX - 1 );
+        for ( size_t i = 0; i < count; i++ )
+            received[ i ] = events[ i ].receive;
+        _deliver( context, received, count );
+    }
+}
+
+/// @brief Does the protocol work on a received packet: sequence, ack bits and auto ack
+/// @param context the event handler's rx_context, so acks sent here get timed
+/// @return true if the packet should go on to the receive callback. If not, its slot is already back in the pool.
+static bool _handle_receive( zenith_now_rx_context_t *context, const zenith_now_receive_event_t *receive ) {
+    // Acks sent while handling this packet are timed from when it arrived
+    memcpy( context->mac, receive->source_mac, ZENITH_NOW_MAC_LEN );
+    context->received_us = receive->received_us;
+
+    if ( !_handle_sequence( receive->source_mac, receive->data_packet ) ) {
+        // Retransmit of something we already delivered - the ack must have been lost, so send it again
+        zenith_now_instance.rx_duplicates++;
+        zenith_now_send_ack( receive->source_mac, receive->data_packet->header.type );
+        context->received_us = 0;
+        zenith_now_pool_put( &zenith_now_instance.rx_pool, receive->data_packet );
+        return false;
+    }
+
+    if ( receive->data_packet->header.type == ZENITH_PACKET_ACK) {
+        zenith_now_payload_ack_t *ack_payload = ( zenith_now_payload_ack_t * ) receive->data_packet->payload;
+        switch ( ack_payload->ack_for_type ) {
+    
+            case ZENITH_PACKET_DATA:
+                xEventGroupSetBits(zenith_now_instance.event_group, DATA_ACK_BIT);
+                break;
+
+            case ZENITH_PACKET_PAIRING:
+                xEventGroupSetBits(zenith_now_instance.event_group, PAIRING_ACK_BIT);
                 break;
+
             default:
-                ESP_LOGE(TAG, "Unknown event type");
+                ESP_LOGE(TAG, "ACK unsupported for packet type %d", ack_payload->ack_for_type);
                 break;
+
+        }
+    }
+
+    // Ack before the application gets to spend time on the packet
+    _auto_ack( receive->source_mac, receive->data_packet );
+    context->received_us = 0;
+    return true;
+}
+
+/// @brief The zenith_now event handler task. Handles the events that get posted to the queue by the transport callbacks.
+/// @details calls user callbacks and sets event group ack flags. Every wake-up drains the whole queue (up to
+///          ZENITH_NOW_EVENT_BATCH_MAX events), so a burst from many nodes costs one context switch, not one per packet.
+/// @param pvParameters Currently unused - just pass NULL.
+/// @todo add task to name, as this is the task that cointains the event handler.
+static void zenith_now_event_handler( void *pvParameters ) {
+    ESP_LOGD( TAG, "zenith_now_event_handler()" );
+    zenith_now_rx_context_t *context = &zenith_now_instance.rx_context[ 0 ];
+    zenith_now_event_t *events = context->events;
+    zenith_now_receive_event_t *received = context->received;
+
+    context->task = xTaskGetCurrentTaskHandle();
+    while ( xQueueReceive( zenith_now_instance.event_queue, &events[ 0 ], portMAX_DELAY ) == pdTRUE ) {
+        uint32_t waiting = 1 + uxQueueMessagesWaiting( zenith_now_instance.event_queue );
+        if ( waiting > zenith_now_instance.event_queue_high_water )
+            zenith_now_instance.event_queue_high_water = waiting;
+
+        size_t count = 1 + _queue_drain( zenith_now_instance.event_queue, &events[ 1 ], ZENITH_NOW_EVENT_BATCH_MAX - 1 );
+        size_t delivered = 0;
+        zenith_now_instance.event_wakeups++;
+        zenith_now_instance.events_handled += count;
+
+        for ( size_t i = 0; i < count; i++ ) {
+            zenith_now_event_t *event = &events[ i ];
+            switch ( event->type ) {
+                case SEND_EVENT:
+                    // Let anyone waiting for an ack know if the packet never made it
+                    _handle_send_status( event->send.dest_mac, event->send.status );
+                    if ( zenith_now_instance.config.tx_cb )
+                    zenith_now_instance.config.tx_cb ( event->send.dest_mac, event->send.status );
+                    break;
+                case RECEIVE_EVENT:
+                    if ( _handle_receive( context, &event->receive ) )
+                        received[ delivered++ ] = event->receive;
+                    break;
+                default:
+                    ESP_LOGE(TAG, "Unknown event type");
+                    break;
+            }
+        }
+
+        // Hand the packets over to the receive callback, here or on the worker
+        if ( delivered && zenith_now_instance.worker_queue ) {
+            for ( size_t i = 0; i < delivered; i++ ) {
+                zenith_now_event_t event = { .type = RECEIVE_EVENT, .receive = received[ i ] };
+                xQueueSend( zenith_now_instance.worker_queue, &event, portMAX_DELAY ); // Can't be full, it has room for every slot
+            }
+        } else if ( delivered ) {
+            _deliver( context, received, delivered );
         }
-        ESP_LOGD(TAG, "Event handled");
+        ESP_LOGD(TAG, "%u events handled", ( unsigned ) count);
     }
 }
 
@@ -452,8 +1390,31 @@ esp_err_t zenith_now_init( const zenith_now_config_t *config ) {
     esp_err_t ret;
 
     memcpy( &zenith_now_instance.config, config, sizeof( zenith_now_config_t ) );
+    uint32_t stack_size = config->task_stack_size ? config->task_stack_size : ZENITH_NOW_DEFAULT_TASK_STACK_SIZE;
 
-    zenith_now_instance.event_queue = xQueueCreate( 10, sizeof( zenith_now_event_t ) );
+    ESP_RETURN_ON_ERROR(
+        zenith_now_pool_init( &zenith_now_instance.rx_pool, config->rx_pool_size ),
+        TAG, "Error creating receive pool"
+    );
+
+    zenith_now_instance.max_peers = config->max_peers ? config->max_peers : ZENITH_NOW_DEFAULT_MAX_PEERS;
+    zenith_now_instance.peers = calloc( zenith_now_instance.max_peers, sizeof( zenith_now_peer_t ) );
+    ESP_RETURN_ON_FALSE(
+        zenith_now_instance.peers,
+        ESP_ERR_NO_MEM,
+        TAG, "Error allocating peer table"
+    );
+
+    zenith_now_instance.peer_lock = xSemaphoreCreateMutex();
+    ESP_RETURN_ON_FALSE(
+        zenith_now_instance.peer_lock,
+        ESP_ERR_NO_MEM,
+        TAG, "Error creating peer lock"
+    );
+
+    // Default: room for a receive event per pool slot and a send status per tracked send, so nothing is dropped for lack of queue
+    zenith_now_instance.event_queue_size = config->event_queue_size ? config->event_queue_size : zenith_now_instance.rx_pool.capacity + ZENITH_NOW_TX_PENDING_MAX;
+    zenith_now_instance.event_queue = xQueueCreate( zenith_now_instance.event_queue_size, sizeof( zenith_now_event_t ) );
     ESP_RETURN_ON_FALSE(
         zenith_now_instance.event_queue,
         ESP_ERR_NO_MEM,
@@ -467,44 +1428,46 @@ esp_err_t zenith_now_init( const zenith_now_config_t *config ) {
         TAG, "Error creating event group"
     );
 
-    // Initialize default NVS partition
-    ret = nvs_flash_init();
-    if ( ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND )
-    {
-        // Itsa fucked - erase and retry
-        ESP_ERROR_CHECK( nvs_flash_erase() );
-        ret = nvs_flash_init();
+    // Bring up the link - ESP-NOW unless the config brings its own
+    zenith_now_instance.transport = config->transport;
+    zenith_now_instance.owns_transport = false;
+    if ( !zenith_now_instance.transport ) {
+#ifdef CONFIG_IDF_TARGET_LINUX
+        ESP_LOGE( TAG, "No radio on the linux target, pass a transport in the config" );
+        return ESP_ERR_NOT_SUPPORTED;
+#else
+        ESP_RETURN_ON_ERROR(
+            zenith_now_transport_new_espnow( &zenith_now_instance.transport ),
+            TAG, "Error creating ESP-NOW transport"
+        );
+        zenith_now_instance.owns_transport = true;
+#endif
     }
-    ESP_RETURN_ON_ERROR(
-        ret,
-        TAG, "Error initializing NVS"
-    );
 
-    // Configure WiFi
     ESP_RETURN_ON_ERROR(
-        zenith_now_configure_wifi(),
-        TAG, "Error configuring WiFi"
+        zenith_now_instance.transport->initialize( zenith_now_instance.transport, zenith_now_transport_recv_cb, zenith_now_transport_send_cb ),
+        TAG, "Error initializing transport"
     );
 
-    // Initialize zenith now
-    ret = esp_now_init();
-    ESP_RETURN_ON_ERROR(
-        ret,
-        TAG, "Error configuring zenith_now"
-    );
-
-    // add the callbacks
-    ESP_RETURN_ON_ERROR(
-        esp_now_register_recv_cb (zenith_now_espnow_recv_cb ),
-        TAG, "Error registering zenith_now receive callback"
-    );  
-    ESP_RETURN_ON_ERROR(
-        esp_now_register_send_cb( zenith_now_espnow_send_cb ),
-        TAG, "Error registering zenith_now send callback"
-    );  
+    // Application processing gets its own task, so it can take its time without holding up the event handler
+    if ( config->rx_worker ) {
+        zenith_now_instance.worker_queue = xQueueCreate( zenith_now_instance.rx_pool.capacity, sizeof( zenith_now_event_t ) );
+        ESP_RETURN_ON_FALSE(
+            zenith_now_instance.worker_queue,
+            ESP_ERR_NO_MEM,
+            TAG, "Error creating worker queue"
+        );
+        ESP_RETURN_ON_FALSE(
+            xTaskCreate( zenith_now_worker, "zn_worker", stack_size, &zenith_now_instance, tskIDLE_PRIORITY, &zenith_now_instance.worker_handle ) == pdPASS,
+            ESP_FAIL,
+            TAG, "Error creating zenith_now_worker task"
+        );
+    }
 
     // Create event handler - How do I keep up communictaion? I guess the caller should do it, but perhaps the zenith_now could handle data in and out itself by modifying the registry on data receipt?
-    ret = xTaskCreate( zenith_now_event_handler, "zn_events", 4096, &zenith_now_instance, tskIDLE_PRIORITY, &zenith_now_instance.task_handle ) == pdPASS ? ESP_OK : ESP_FAIL; // 2k stack - er det nok? nei, men kankje fire er.
+    // With a worker, acks and send statuses go ahead of the application work
+    UBaseType_t priority = config->rx_worker ? tskIDLE_PRIORITY + 1 : tskIDLE_PRIORITY;
+    ret = xTaskCreate( zenith_now_event_handler, "zn_events", stack_size, &zenith_now_instance, priority, &zenith_now_instance.task_handle ) == pdPASS ? ESP_OK : ESP_FAIL;
     ESP_RETURN_ON_ERROR(
         ret,
         TAG, "Error creating zenith_now_event_handler task"
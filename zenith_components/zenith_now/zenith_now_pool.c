@@ -0,0 +1,114 @@
+// zenith_now_pool.c
+
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_err.h"
+#include "esp_check.h"
+
+#include "zenith_now_pool.h"
+
+#define POOL_NIL 0xffff
+#define POOL_INDEX( head ) ( ( uint16_t ) ( ( head ) & 0xffff ) )
+#define POOL_HEAD( tag, index ) ( ( ( uint32_t ) ( tag ) << 16 ) | ( index ) )
+#define POOL_NEXT_TAG( head ) ( ( ( head ) >> 16 ) + 1 )
+
+static const char *TAG = "zenith-now-pool";
+
+esp_err_t zenith_now_pool_init( zenith_now_pool_t *pool, uint16_t capacity ) {
+    ESP_RETURN_ON_FALSE(
+        pool,
+        ESP_ERR_INVALID_ARG,
+        TAG, "pool is NULL"
+    );
+
+    if ( capacity == 0 )
+        capacity = ZENITH_NOW_DEFAULT_RX_POOL_SIZE;
+
+    ESP_RETURN_ON_FALSE(
+        capacity <= ZENITH_NOW_POOL_MAX_SLOTS,
+        ESP_ERR_INVALID_ARG,
+        TAG, "Pool capacity %u too large", capacity
+    );
+
+    memset( pool, 0, sizeof( *pool ) );
+
+    pool->slots = calloc( capacity, sizeof( zenith_now_pool_slot_t ) );
+    pool->next = calloc( capacity, sizeof( *pool->next ) );
+    if ( !pool->slots || !pool->next ) {
+        zenith_now_pool_deinit( pool );
+        ESP_LOGE( TAG, "Failed to allocate pool of %u slots", capacity );
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Chain all slots: 0 -> 1 -> ... -> capacity-1 -> NIL
+    for ( uint16_t i = 0; i < capacity; i++ )
+        atomic_init( &pool->next[ i ], ( i + 1 < capacity ) ? i + 1 : POOL_NIL );
+
+    pool->capacity = capacity;
+    atomic_init( &pool->head, POOL_HEAD( 0, 0 ) );
+    atomic_init( &pool->in_use, 0 );
+    atomic_init( &pool->high_water, 0 );
+    atomic_init( &pool->exhausted, 0 );
+
+    ESP_LOGD( TAG, "Pool initialized with %u slots of %u bytes", capacity, ZENITH_NOW_POOL_SLOT_SIZE );
+    return ESP_OK;
+}
+
+void zenith_now_pool_deinit( zenith_now_pool_t *pool ) {
+    if ( !pool )
+        return;
+
+    free( pool->slots );
+    free( ( void * ) pool->next );
+    pool->slots = NULL;
+    pool->next = NULL;
+    pool->capacity = 0;
+}
+
+void *zenith_now_pool_get( zenith_now_pool_t *pool ) {
+    uint32_t head = atomic_load_explicit( &pool->head, memory_order_acquire );
+    uint16_t index;
+
+    do {
+        index = POOL_INDEX( head );
+        if ( index == POOL_NIL ) {
+            atomic_fetch_add_explicit( &pool->exhausted, 1, memory_order_relaxed );
+            return NULL;
+        }
+        // If someone else pops this slot before us the tag changes and the CAS fails, so a stale next is harmless
+        uint16_t next = atomic_load_explicit( &pool->next[ index ], memory_order_relaxed );
+        if ( atomic_compare_exchange_weak_explicit( &pool->head, &head, POOL_HEAD( POOL_NEXT_TAG( head ), next ),
+                                                    memory_order_acq_rel, memory_order_acquire ) )
+            break;
+    } while ( true );
+
+    // Keep track of the high water mark
+    uint32_t in_use = atomic_fetch_add_explicit( &pool->in_use, 1, memory_order_relaxed ) + 1;
+    uint32_t high_water = atomic_load_explicit( &pool->high_water, memory_order_relaxed );
+    while ( in_use > high_water &&
+            !atomic_compare_exchange_weak_explicit( &pool->high_water, &high_water, in_use, memory_order_relaxed, memory_order_relaxed ) )
+        ;
+
+    return pool->slots[ index ].data;
+}
+
+void zenith_now_pool_put( zenith_now_pool_t *pool, void *slot ) {
+    if ( !slot )
+        return;
+
+    zenith_now_pool_slot_t *pool_slot = ( zenith_now_pool_slot_t * ) slot;
+    if ( pool_slot < pool->slots || pool_slot >= pool->slots + pool->capacity ) {
+        ESP_LOGE( TAG, "Slot %p does not belong to the pool", slot );
+        return;
+    }
+    uint16_t index = ( uint16_t ) ( pool_slot - pool->slots );
+
+    uint32_t head = atomic_load_explicit( &pool->head, memory_order_relaxed );
+    do {
+        atomic_store_explicit( &pool->next[ index ], POOL_INDEX( head ), memory_order_relaxed );
+    } while ( !atomic_compare_exchange_weak_explicit( &pool->head, &head, POOL_HEAD( POOL_NEXT_TAG( head ), index ),
+                                                      memory_order_release, memory_order_relaxed ) );
+
+    atomic_fetch_sub_explicit( &pool->in_use, 1, memory_order_relaxed );
+}
@@ -0,0 +1,199 @@
+// zenith_now_transport_espnow.c
+
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_err.h"
+#include "esp_check.h"
+#include "esp_wifi.h"
+#include "esp_now.h"
+#include "esp_mac.h"
+#include "nvs_flash.h"
+
+#include "zenith_now.h"
+#include "zenith_now_transport.h"
+
+static const char *TAG = "zenith-now-espnow";
+
+typedef struct zenith_now_transport_espnow_s {
+    zenith_now_transport_t base;
+    zenith_now_transport_recv_cb_t recv_cb;
+    zenith_now_transport_send_cb_t send_cb;
+} zenith_now_transport_espnow_t;
+
+// esp-now callbacks carry no context, and there is only one radio anyway
+static zenith_now_transport_espnow_t *espnow_instance = NULL;
+
+/// @brief Initializes WiFi with parameters needed for Zenith Now
+/// @return ESP_OK on success
+/// @todo Add error handling and cleanup
+static esp_err_t _configure_wifi( void ){
+    esp_err_t ret = ESP_OK;
+    ESP_LOGD( TAG, "_configure_wifi()" );
+
+    ESP_RETURN_ON_ERROR(
+        esp_netif_init(),
+        TAG, "Error initializing netif"
+    );
+
+    ESP_RETURN_ON_ERROR(
+        esp_event_loop_create_default(),
+        TAG, "Error creating event loop"
+    );
+
+    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    ESP_RETURN_ON_ERROR(
+        esp_wifi_init( &cfg ),
+        TAG, "Error initializing WiFi"
+    );
+
+    ESP_RETURN_ON_ERROR(
+        esp_wifi_set_storage( WIFI_STORAGE_RAM ), // Set this to WIFI_STORAGE_FLASH?
+        TAG, "Error setting WiFi storage"
+    );
+
+    ESP_RETURN_ON_ERROR(
+        esp_wifi_set_mode( WIFI_MODE_STA ), // Set this to WIFI_MODE_APSTA?
+        TAG, "Error setting WiFi mode"
+    );
+
+    ESP_RETURN_ON_ERROR(
+        esp_wifi_start(),
+        TAG, "Error starting WiFi"
+    );
+
+    ESP_RETURN_ON_ERROR(
+        esp_wifi_set_channel( ZENITH_WIFI_CHANNEL, WIFI_SECOND_CHAN_NONE),
+        TAG, "Error setting WiFi power save"
+    );
+
+    // If I want long range esp-now:
+    // ESP_ERROR_CHECK( esp_wifi_set_protocol(ESP_IF_WIFI_STA, WIFI_PROTOCOL_11B|WIFI_PROTOCOL_11G|WIFI_PROTOCOL_11N|WIFI_PROTOCOL_LR) );
+    return ret;
+}
+
+static void _espnow_send_cb( const uint8_t *mac_addr, esp_now_send_status_t status ) {
+    if ( espnow_instance && espnow_instance->send_cb )
+        espnow_instance->send_cb( &espnow_instance->base, mac_addr, ( status == ESP_NOW_SEND_SUCCESS ) ? ZENITH_NOW_SEND_SUCCESS : ZENITH_NOW_SEND_FAIL );
+}
+
+static void _espnow_recv_cb( const esp_now_recv_info_t *recv_info, const uint8_t *data, int len ) {
+    if ( espnow_instance && espnow_instance->recv_cb )
+        espnow_instance->recv_cb( &espnow_instance->base, recv_info->src_addr, data, len );
+}
+
+static esp_err_t zenith_now_transport_espnow_initialize( zenith_now_transport_handle_t transport, zenith_now_transport_recv_cb_t recv_cb, zenith_now_transport_send_cb_t send_cb ) {
+    zenith_now_transport_espnow_t *espnow = __containerof( transport, zenith_now_transport_espnow_t, base );
+    esp_err_t ret;
+
+    espnow->recv_cb = recv_cb;
+    espnow->send_cb = send_cb;
+    espnow_instance = espnow;
+
+    // Initialize default NVS partition
+    ret = nvs_flash_init();
+    if ( ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND )
+    {
+        // Itsa fucked - erase and retry
+        ESP_ERROR_CHECK( nvs_flash_erase() );
+        ret = nvs_flash_init();
+    }
+    ESP_RETURN_ON_ERROR(
+        ret,
+        TAG, "Error initializing NVS"
+    );
+
+    // Configure WiFi
+    ESP_RETURN_ON_ERROR(
+        _configure_wifi(),
+        TAG, "Error configuring WiFi"
+    );
+
+    ESP_RETURN_ON_ERROR(
+        esp_now_init(),
+        TAG, "Error initializing esp-now"
+    );
+
+    // add the callbacks
+    ESP_RETURN_ON_ERROR(
+        esp_now_register_recv_cb( _espnow_recv_cb ),
+        TAG, "Error registering esp-now receive callback"
+    );
+    ESP_RETURN_ON_ERROR(
+        esp_now_register_send_cb( _espnow_send_cb ),
+        TAG, "Error registering esp-now send callback"
+    );
+
+    return ESP_OK;
+}
+
+static esp_err_t zenith_now_transport_espnow_deinitialize( zenith_now_transport_handle_t transport ) {
+    esp_now_unregister_recv_cb();
+    esp_now_unregister_send_cb();
+    espnow_instance = NULL;
+    return esp_now_deinit();
+}
+
+static esp_err_t zenith_now_transport_espnow_send( zenith_now_transport_handle_t transport, const uint8_t *dest_mac, const uint8_t *data, int len ) {
+    return esp_now_send( dest_mac, data, len );
+}
+
+static esp_err_t zenith_now_transport_espnow_add_peer( zenith_now_transport_handle_t transport, const uint8_t *mac ) {
+    if ( esp_now_is_peer_exist( mac ) )
+        return ESP_OK; // It's ok to try and add existing peers
+
+    esp_now_peer_info_t peer = {
+        .peer_addr = { 0 },
+        .channel = ZENITH_WIFI_CHANNEL,
+        .encrypt = false,
+        .ifidx = ESP_IF_WIFI_STA
+    };
+    memcpy( peer.peer_addr, mac, ESP_NOW_ETH_ALEN );
+    return esp_now_add_peer( &peer );
+}
+
+static esp_err_t zenith_now_transport_espnow_remove_peer( zenith_now_transport_handle_t transport, const uint8_t *mac ) {
+    if ( !esp_now_is_peer_exist( mac ) )
+        return ESP_OK; // It's ok to try and remove non-existant peers
+
+    return esp_now_del_peer( mac );
+}
+
+static bool zenith_now_transport_espnow_is_peer_known( zenith_now_transport_handle_t transport, const uint8_t *mac ) {
+    return esp_now_is_peer_exist( mac );
+}
+
+static esp_err_t zenith_now_transport_espnow_get_mac( zenith_now_transport_handle_t transport, uint8_t *out_mac ) {
+    return esp_wifi_get_mac( WIFI_IF_STA, out_mac );
+}
+
+static void zenith_now_transport_espnow_del( zenith_now_transport_handle_t transport ) {
+    free( __containerof( transport, zenith_now_transport_espnow_t, base ) );
+}
+
+esp_err_t zenith_now_transport_new_espnow( zenith_now_transport_handle_t *out_handle ) {
+    ESP_RETURN_ON_FALSE(
+        out_handle,
+        ESP_ERR_INVALID_ARG,
+        TAG, "out_handle is NULL"
+    );
+
+    zenith_now_transport_espnow_t *espnow = calloc( 1, sizeof( zenith_now_transport_espnow_t ) );
+    ESP_RETURN_ON_FALSE(
+        espnow,
+        ESP_ERR_NO_MEM,
+        TAG, "Error allocating memory for transport"
+    );
+
+    espnow->base.initialize = zenith_now_transport_espnow_initialize;
+    espnow->base.deinitialize = zenith_now_transport_espnow_deinitialize;
+    espnow->base.send = zenith_now_transport_espnow_send;
+    espnow->base.add_peer = zenith_now_transport_espnow_add_peer;
+    espnow->base.remove_peer = zenith_now_transport_espnow_remove_peer;
+    espnow->base.is_peer_known = zenith_now_transport_espnow_is_peer_known;
+    espnow->base.get_mac = zenith_now_transport_espnow_get_mac;
+    espnow->base.del = zenith_now_transport_espnow_del;
+
+    *out_handle = &( espnow->base );
+    return ESP_OK;
+}
@@ -0,0 +1,249 @@
+// zenith_now_transport_loopback.c
+
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_err.h"
+#include "esp_check.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "zenith_now_transport.h"
+
+static const char *TAG = "zenith-now-loopback";
+
+static const uint8_t broadcast_mac[ ZENITH_NOW_MAC_LEN ] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+
+typedef struct zenith_now_transport_loopback_s zenith_now_transport_loopback_t;
+
+struct zenith_now_transport_loopback_s {
+    zenith_now_transport_t base;
+    zenith_now_transport_loopback_config_t config;
+    zenith_now_transport_recv_cb_t recv_cb;     // NULL until initialized
+    zenith_now_transport_send_cb_t send_cb;
+    uint8_t ( *peers )[ ZENITH_NOW_MAC_LEN ];   // Peers added, like the esp-now peer list - sending to anyone else fails
+    size_t peer_count;
+    zenith_now_transport_loopback_t *next;      // Next endpoint on the bus
+    uint32_t refs;                              // Sends delivering to the endpoint right now
+    bool deleted;                               // del came while refs was set - the last of those sends frees it
+};
+
+// The bus: every endpoint in the process. The lock is created with the first endpoint, so create endpoints before
+// starting tasks that use them. The lock covers the list and every endpoint's callbacks, peers, refs and deleted.
+static zenith_now_transport_loopback_t *loopback_bus = NULL;
+static SemaphoreHandle_t loopback_bus_lock = NULL;
+
+/// @brief Gets the endpoint from its transport handle. base is the first member - no __containerof, glibc doesn't have it.
+static inline zenith_now_transport_loopback_t *_loopback( zenith_now_transport_handle_t transport ) {
+    return ( zenith_now_transport_loopback_t * ) transport;
+}
+
+/// @brief Takes an endpoint off the bus and frees it. Must be called with the bus lock held, and no refs left.
+static void _unlink_and_free( zenith_now_transport_loopback_t *loopback ) {
+    for ( zenith_now_transport_loopback_t **link = &loopback_bus; *link; link = &( *link )->next ) {
+        if ( *link == loopback ) {
+            *link = loopback->next;
+            break;
+        }
+    }
+
+    free( loopback->peers );
+    free( loopback );
+}
+
+/// @brief Finds a peer in the endpoint's peer list. Must be called with the bus lock held.
+static int _peer_index( zenith_now_transport_loopback_t *loopback, const uint8_t *mac ) {
+    for ( size_t i = 0; i < loopback->peer_count; i++ )
+        if ( memcmp( loopback->peers[ i ], mac, ZENITH_NOW_MAC_LEN ) == 0 )
+            return i;
+    return -1;
+}
+
+static esp_err_t zenith_now_transport_loopback_initialize( zenith_now_transport_handle_t transport, zenith_now_transport_recv_cb_t recv_cb, zenith_now_transport_send_cb_t send_cb ) {
+    zenith_now_transport_loopback_t *loopback = _loopback( transport );
+
+    xSemaphoreTake( loopback_bus_lock, portMAX_DELAY );
+    loopback->recv_cb = recv_cb;
+    loopback->send_cb = send_cb;
+    xSemaphoreGive( loopback_bus_lock );
+
+    return ESP_OK;
+}
+
+static esp_err_t zenith_now_transport_loopback_deinitialize( zenith_now_transport_handle_t transport ) {
+    zenith_now_transport_loopback_t *loopback = _loopback( transport );
+
+    xSemaphoreTake( loopback_bus_lock, portMAX_DELAY );
+    loopback->recv_cb = NULL;
+    loopback->send_cb = NULL;
+    xSemaphoreGive( loopback_bus_lock );
+
+    return ESP_OK;
+}
+
+/// @brief Delivers a frame to every matching endpoint, then reports the status to the sender
+/// @details Callbacks run in the sender's task, outside the bus lock, so a receiver is free to send a reply from its
+///          callback. The walk holds a ref on the endpoint whose callback is running, so deleting it meanwhile only
+///          marks it - it stays on the bus, and its next pointer stays good, until the walk lets go of it.
+static esp_err_t zenith_now_transport_loopback_send( zenith_now_transport_handle_t transport, const uint8_t *dest_mac, const uint8_t *data, int len ) {
+    zenith_now_transport_loopback_t *loopback = _loopback( transport );
+    bool broadcast = memcmp( dest_mac, broadcast_mac, ZENITH_NOW_MAC_LEN ) == 0;
+    bool delivered = false;
+
+    ESP_RETURN_ON_FALSE(
+        data && len > 0 && len <= ZENITH_NOW_TRANSPORT_MAX_DATA_LEN,
+        ESP_ERR_INVALID_ARG,
+        TAG, "Invalid frame length %d", len
+    );
+
+    xSemaphoreTake( loopback_bus_lock, portMAX_DELAY );
+    bool known = _peer_index( loopback, dest_mac ) >= 0;
+    zenith_now_transport_send_cb_t send_cb = loopback->send_cb;
+    xSemaphoreGive( loopback_bus_lock );
+
+    // Same rule as esp-now: add the peer before sending to it
+    ESP_RETURN_ON_FALSE(
+        known,
+        ESP_ERR_NOT_FOUND,
+        TAG, "Peer not added"
+    );
+
+    bool lost = loopback->config.loss_percent && ( rand() % 100 ) < loopback->config.loss_percent;
+
+    if ( !lost ) {
+        xSemaphoreTake( loopback_bus_lock, portMAX_DELAY );
+        zenith_now_transport_loopback_t *target = loopback_bus;
+        while ( target ) {
+            zenith_now_transport_recv_cb_t recv_cb = target->recv_cb;
+            if ( target == loopback || target->deleted || !recv_cb ||
+                 ( !broadcast && memcmp( target->config.mac, dest_mac, ZENITH_NOW_MAC_LEN ) != 0 ) ) {
+                target = target->next;
+                continue;
+            }
+
+            target->refs++;
+            xSemaphoreGive( loopback_bus_lock );
+            recv_cb( &target->base, loopback->config.mac, data, len );
+            delivered = true;
+            xSemaphoreTake( loopback_bus_lock, portMAX_DELAY );
+
+            zenith_now_transport_loopback_t *next = target->next;
+            if ( --target->refs == 0 && target->deleted )
+                _unlink_and_free( target );
+            target = next;
+        }
+        xSemaphoreGive( loopback_bus_lock );
+    }
+
+    // Nobody acks a broadcast at the link layer, so like esp-now it always "succeeds"
+    if ( send_cb )
+        send_cb( transport, dest_mac, ( delivered || broadcast ) ? ZENITH_NOW_SEND_SUCCESS : ZENITH_NOW_SEND_FAIL );
+
+    return ESP_OK;
+}
+
+static esp_err_t zenith_now_transport_loopback_add_peer( zenith_now_transport_handle_t transport, const uint8_t *mac ) {
+    zenith_now_transport_loopback_t *loopback = _loopback( transport );
+    esp_err_t ret = ESP_OK;
+
+    xSemaphoreTake( loopback_bus_lock, portMAX_DELAY );
+    if ( _peer_index( loopback, mac ) < 0 ) {
+        uint8_t ( *peers )[ ZENITH_NOW_MAC_LEN ] = realloc( loopback->peers, ( loopback->peer_count + 1 ) * ZENITH_NOW_MAC_LEN );
+        if ( peers ) {
+            loopback->peers = peers;
+            memcpy( loopback->peers[ loopback->peer_count++ ], mac, ZENITH_NOW_MAC_LEN );
+        } else {
+            ret = ESP_ERR_NO_MEM;
+        }
+    }
+    xSemaphoreGive( loopback_bus_lock );
+
+    return ret;
+}
+
+static esp_err_t zenith_now_transport_loopback_remove_peer( zenith_now_transport_handle_t transport, const uint8_t *mac ) {
+    zenith_now_transport_loopback_t *loopback = _loopback( transport );
+
+    xSemaphoreTake( loopback_bus_lock, portMAX_DELAY );
+    int index = _peer_index( loopback, mac );
+    if ( index >= 0 ) {
+        memmove( loopback->peers[ index ], loopback->peers[ index + 1 ], ( loopback->peer_count - index - 1 ) * ZENITH_NOW_MAC_LEN );
+        loopback->peer_count--;
+    }
+    xSemaphoreGive( loopback_bus_lock );
+
+    return ESP_OK;
+}
+
+static bool zenith_now_transport_loopback_is_peer_known( zenith_now_transport_handle_t transport, const uint8_t *mac ) {
+    zenith_now_transport_loopback_t *loopback = _loopback( transport );
+
+    xSemaphoreTake( loopback_bus_lock, portMAX_DELAY );
+    bool known = _peer_index( loopback, mac ) >= 0;
+    xSemaphoreGive( loopback_bus_lock );
+
+    return known;
+}
+
+static esp_err_t zenith_now_transport_loopback_get_mac( zenith_now_transport_handle_t transport, uint8_t *out_mac ) {
+    zenith_now_transport_loopback_t *loopback = _loopback( transport );
+    memcpy( out_mac, loopback->config.mac, ZENITH_NOW_MAC_LEN );
+    return ESP_OK;
+}
+
+static void zenith_now_transport_loopback_del( zenith_now_transport_handle_t transport ) {
+    zenith_now_transport_loopback_t *loopback = _loopback( transport );
+
+    // A send may be in this endpoint's callback - then it gets freed when that returns
+    xSemaphoreTake( loopback_bus_lock, portMAX_DELAY );
+    loopback->recv_cb = NULL;
+    loopback->send_cb = NULL;
+    loopback->deleted = true;
+    if ( !loopback->refs )
+        _unlink_and_free( loopback );
+    xSemaphoreGive( loopback_bus_lock );
+}
+
+esp_err_t zenith_now_transport_new_loopback( const zenith_now_transport_loopback_config_t *config, zenith_now_transport_handle_t *out_handle ) {
+    ESP_RETURN_ON_FALSE(
+        config && out_handle && config->loss_percent <= 100,
+        ESP_ERR_INVALID_ARG,
+        TAG, "Invalid arguments passed to new_loopback"
+    );
+
+    if ( !loopback_bus_lock ) {
+        loopback_bus_lock = xSemaphoreCreateMutex();
+        ESP_RETURN_ON_FALSE(
+            loopback_bus_lock,
+            ESP_ERR_NO_MEM,
+            TAG, "Error creating bus lock"
+        );
+    }
+
+    zenith_now_transport_loopback_t *loopback = calloc( 1, sizeof( zenith_now_transport_loopback_t ) );
+    ESP_RETURN_ON_FALSE(
+        loopback,
+        ESP_ERR_NO_MEM,
+        TAG, "Error allocating memory for transport"
+    );
+
+    memcpy( &loopback->config, config, sizeof( zenith_now_transport_loopback_config_t ) );
+
+    loopback->base.initialize = zenith_now_transport_loopback_initialize;
+    loopback->base.deinitialize = zenith_now_transport_loopback_deinitialize;
+    loopback->base.send = zenith_now_transport_loopback_send;
+    loopback->base.add_peer = zenith_now_transport_loopback_add_peer;
+    loopback->base.remove_peer = zenith_now_transport_loopback_remove_peer;
+    loopback->base.is_peer_known = zenith_now_transport_loopback_is_peer_known;
+    loopback->base.get_mac = zenith_now_transport_loopback_get_mac;
+    loopback->base.del = zenith_now_transport_loopback_del;
+
+    // Newest first, order on the bus doesn't matter
+    xSemaphoreTake( loopback_bus_lock, portMAX_DELAY );
+    loopback->next = loopback_bus;
+    loopback_bus = loopback;
+    xSemaphoreGive( loopback_bus_lock );
+
+    *out_handle = &( loopback->base );
+    return ESP_OK;
+}
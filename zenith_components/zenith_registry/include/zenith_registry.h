@@ -3,9 +3,9 @@
 #pragma once
 
 #include "freertos/FreeRTOS.h"
-#include "esp_now.h"
 #include "time.h"
 #include "zenith_data.h"
+#include "zenith_registry_gorilla.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -13,10 +13,15 @@ extern "C" {
 
 #define ZENITH_MAC_ADDR_LEN 6
 
+// Most nodes the registry takes. In practice the heap runs out first - every node gets its own ring buffers.
+#define ZENITH_REGISTRY_MAX_NODES 1024
+
 typedef uint8_t zenith_mac_address_t[ZENITH_MAC_ADDR_LEN];
 
 // Forward declaration of opaque registry handle
 typedef struct zenith_registry_s *zenith_registry_handle_t;
+// Checkpoint storage from zenith_log - see zenith_log_storage.h
+typedef struct zenith_log_storage_s *zenith_log_storage_handle_t;
 typedef float zenith_reading_datatype_t;  // Alias for now — could later become a union if needed.
 
 // Registry sensor reading types
@@ -36,20 +41,129 @@ typedef struct zenith_reading_s {
 } zenith_reading_t;
 
 
+// Reading as the ring stores it: 8 bytes instead of the 16 a zenith_reading_t takes with its 64 bit time_t.
+// The timestamp is seconds from the ring's epoch - use zenith_ring_entry_timestamp to get it back.
+typedef struct zenith_ring_entry_s {
+    zenith_reading_datatype_t value;
+    int32_t offset; // seconds from ring->epoch, +- 68 years. Readings further out are clamped.
+} zenith_ring_entry_t;
+
+// Rollups: min/max/mean/variance of the readings in fixed periods. Every ring keeps a few tiers of them, updated as readings
+// come in, so history reaches back a week in a fixed budget while the raw readings only cover the last few minutes.
+typedef enum zenith_rollup_tier_e {
+    ZENITH_ROLLUP_5MIN = 0,
+    ZENITH_ROLLUP_HOUR,
+    ZENITH_ROLLUP_DAY,
+    ZENITH_ROLLUP_TIERS
+} zenith_rollup_tier_t;
+
+// Depth of each tier, 20 bytes a bucket per ring. Define them smaller to save memory on a core with a lot of nodes -
+// checkpoints and exports only restore into a build with the same depths.
+#ifndef ZENITH_ROLLUP_5MIN_BUCKETS
+#define ZENITH_ROLLUP_5MIN_BUCKETS 24   // 2 hours
+#endif
+#ifndef ZENITH_ROLLUP_HOUR_BUCKETS
+#define ZENITH_ROLLUP_HOUR_BUCKETS 24   // A day - the last 24h min/max queries read these, and see less with fewer
+#endif
+#ifndef ZENITH_ROLLUP_DAY_BUCKETS
+#define ZENITH_ROLLUP_DAY_BUCKETS 7     // A week
+#endif
+#define ZENITH_ROLLUP_BUCKETS ( ZENITH_ROLLUP_5MIN_BUCKETS + ZENITH_ROLLUP_HOUR_BUCKETS + ZENITH_ROLLUP_DAY_BUCKETS )
+
+typedef struct zenith_rollup_bucket_s {
+    zenith_reading_datatype_t min;
+    zenith_reading_datatype_t max;
+    zenith_reading_datatype_t mean;
+    zenith_reading_datatype_t m2; // sum of squared differences from the mean - Welford's running variance
+    uint32_t count; // 0 when the period has no readings
+} zenith_rollup_bucket_t;
+
+// A ring's rollup tiers. They live next to the ring rather than in it, so copying a ring for its readings doesn't
+// drag them along, and a query that wants one tier copies just that tier.
+typedef struct zenith_rollups_s {
+    int32_t newest[ZENITH_ROLLUP_TIERS]; // timestamp / period of each tier's newest bucket
+    uint8_t head[ZENITH_ROLLUP_TIERS]; // where in the tier its newest bucket is
+    time_t start; // start of the newest 5 minute period
+    zenith_rollup_bucket_t buckets[ZENITH_ROLLUP_BUCKETS]; // the tiers back to back, each one a ring of its own
+} zenith_rollups_t;
+
+// A rollup as the query API hands it out
+typedef struct zenith_rollup_s {
+    time_t start; // start of the period
+    zenith_reading_datatype_t min;
+    zenith_reading_datatype_t max;
+    zenith_reading_datatype_t mean;
+    zenith_reading_datatype_t variance; // sample variance, 0 with a single reading
+    uint32_t count;
+} zenith_rollup_t;
+
+// Statistics over the last stretch of time, merged from the rollups - see zenith_registry_get_window_stats
+typedef struct zenith_window_stats_s {
+    time_t start; // start of the oldest period in the window
+    zenith_reading_datatype_t min;
+    zenith_reading_datatype_t max;
+    zenith_reading_datatype_t mean;
+    zenith_reading_datatype_t variance; // sample variance, 0 with a single reading
+    zenith_reading_datatype_t rate;     // change per hour - slope of the period means. 0 with readings in one period only
+    uint32_t count;
+} zenith_window_stats_t;
+
 // Ringbuffer for storing sensor readings
 #define ZENITH_RING_CAPACITY 32
 
+// Set to 1 to keep ring readings Gorilla compressed (zenith_registry_gorilla.h) instead of in an array of entries.
+// A ring then holds ZENITH_RING_BLOCKS blocks in about the same memory and drops its oldest block when it needs room.
+// How many readings that is depends on how noisy the sensor is.
+#ifndef ZENITH_REGISTRY_COMPRESSED_RINGS
+#define ZENITH_REGISTRY_COMPRESSED_RINGS 0
+#endif
+#define ZENITH_RING_BLOCKS 4
+
 typedef struct zenith_ringbuffer_s {
+    uint32_t seq; // Seqlock - odd while a reading is being added. Readers copy the ring and retry if it changed.
     zenith_sensor_type_t type;
-    zenith_reading_t entries[ZENITH_RING_CAPACITY];
-    size_t head;  // next write index
-    size_t size;  // currently used slots
+    time_t epoch; // timestamp of the first reading stored, entry offsets are relative to it
+    zenith_rollups_t *rollups; // allocated with the ring and written under its seqlock
+#if ZENITH_REGISTRY_COMPRESSED_RINGS
+    zenith_gorilla_block_t blocks[ZENITH_RING_BLOCKS];
+#else
+    zenith_ring_entry_t entries[ZENITH_RING_CAPACITY];
+#endif
+    size_t head;  // next write index - the block being written with compressed rings
+    size_t size;  // readings in the ring
 } zenith_ringbuffer_t;
 
+static inline time_t zenith_ring_entry_timestamp( const zenith_ringbuffer_t *ring, const zenith_ring_entry_t *entry ) {
+    return ring->epoch + entry->offset;
+}
+
+// Reads a ring oldest first, whichever way it stores its readings
+typedef struct zenith_ring_reader_s {
+    const zenith_ringbuffer_t *ring;
+    size_t next;    // readings handed out so far
+#if ZENITH_REGISTRY_COMPRESSED_RINGS
+    size_t block;   // blocks started
+    zenith_gorilla_reader_t gorilla;
+#endif
+} zenith_ring_reader_t;
+
+// Walks the readings of a ring in a time range, one at a time - see zenith_registry_history_open. It holds its own
+// copy of the ring, so it's about as big as one, and it points into itself: don't copy or move an open cursor.
+typedef struct zenith_registry_history_cursor_s {
+    zenith_ringbuffer_t ring;
+    zenith_ring_reader_t reader;
+    time_t t1;
+} zenith_registry_history_cursor_t;
+
+// Sensor types a node can report - one ring slot per type, so reading types must be below this. Power of two.
+#define ZENITH_REGISTRY_MAX_RINGS 8
+
+// Live data for a node. The record and its rings never move once allocated - see zenith_registry_get_node_runtime.
 typedef struct zenith_node_runtime_s {
     zenith_mac_address_t mac;
+    uint8_t events_pending; // Sensor types the READING_UPDATED waiting for the event task will report, 0 if none waits
     size_t ring_count; // number of rings allocated
-    zenith_ringbuffer_t *rings; // dynamically allocated array of rings
+    zenith_ringbuffer_t *rings[ZENITH_REGISTRY_MAX_RINGS]; // indexed by reading type, NULL until the node reports it
 } zenith_node_runtime_t;
 
 
@@ -70,9 +184,11 @@ typedef struct zenith_node_info_s {
 } zenith_node_info_t;
 
 // NVS header for the registry blob - we align by hand
+// Version 1 had a uint8_t count right after the version, and no reserved byte. It's still read, and saved as version 2.
 typedef struct zenith_registry_nvs_header_s {
     uint8_t registry_version;
-    uint8_t count;
+    uint8_t reserved;
+    uint16_t count;
 } zenith_registry_nvs_header_t;
 
 // NVS blob for the registry - we align by hand
@@ -81,6 +197,89 @@ typedef struct zenith_registry_nvs_blob_s {
     zenith_node_info_t nodes[];
 } zenith_registry_nvs_blob_t;
 
+// Checkpoint of the rings and rollups, for a warm restart. The checkpoint storage is split in two slots that are
+// written in turn, so a reset while one is written leaves the other. A slot is this header followed by count records.
+// The header goes on flash last - a slot with a valid header is complete.
+#define ZENITH_REGISTRY_CHECKPOINT_MAGIC 0x5a524350 // "ZRCP"
+#define ZENITH_REGISTRY_CHECKPOINT_VERSION 4 // 2 added the ring seqlock, 3 the rollup variance, 4 moved the rollups out of the ring
+#define ZENITH_REGISTRY_CHECKPOINT_INTERVAL_MS ( 15 * 60 * 1000 )
+
+typedef struct zenith_registry_checkpoint_header_s {
+    uint32_t magic;         // 0xffffffff in an erased slot
+    uint16_t version;
+    uint16_t record_size;   // A build with other ring sizes, or compressed rings, doesn't restore it
+    uint32_t seq;           // Bumped every checkpoint, the newest valid slot is restored
+    uint32_t count;         // Records
+    uint32_t crc;           // crc32 of the records
+    uint32_t reserved;
+    int64_t saved_at;       // time() when it was taken
+} zenith_registry_checkpoint_header_t;
+
+// One ring as it's checkpointed - the ring and its rollups as they are, and whose it is. ring.rollups is NULL.
+typedef struct zenith_registry_checkpoint_record_s {
+    zenith_mac_address_t mac;
+    uint8_t reserved[2];
+    zenith_ringbuffer_t ring;
+    zenith_rollups_t rollups;
+} zenith_registry_checkpoint_record_t;
+
+// Export stream, for backing up a core or moving its state to another one: a header, then records - every node's info,
+// every ring as a checkpoint record, and an end record with the counts. Each record has a crc32 of its own, so an import
+// checks a record before it takes it. The structs go as they are, little endian - rings only import into a build with
+// the same ring layout, which the header tells.
+#define ZENITH_REGISTRY_EXPORT_MAGIC 0x5a524558 // "ZREX"
+#define ZENITH_REGISTRY_EXPORT_VERSION 1
+
+typedef struct zenith_registry_export_header_s {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t checkpoint_version;    // ZENITH_REGISTRY_CHECKPOINT_VERSION, for the ring layout
+    uint16_t ring_record_size;      // sizeof( zenith_registry_checkpoint_record_t )
+    uint16_t node_info_size;        // sizeof( zenith_node_info_t )
+    uint32_t reserved;
+    int64_t exported_at;            // time() when it was taken
+} zenith_registry_export_header_t;
+
+typedef enum zenith_registry_export_tag_e {
+    ZENITH_REGISTRY_EXPORT_NODE = 1,    // zenith_node_info_t
+    ZENITH_REGISTRY_EXPORT_RING,        // zenith_registry_checkpoint_record_t
+    ZENITH_REGISTRY_EXPORT_END,         // zenith_registry_export_end_t, the last record
+} zenith_registry_export_tag_t;
+
+typedef struct zenith_registry_export_record_s {
+    uint8_t tag;        // zenith_registry_export_tag_t. Imports skip tags they don't know.
+    uint8_t reserved;
+    uint16_t size;      // Payload bytes after this header
+    uint32_t crc;       // crc32 of the payload
+} zenith_registry_export_record_t;
+
+typedef struct zenith_registry_export_end_s {
+    uint32_t nodes;     // Records before it, so an import can tell a whole stream from a cut off one
+    uint32_t rings;
+} zenith_registry_export_end_t;
+
+// Called with the export stream a piece at a time. An error stops the export, and zenith_registry_export returns it.
+typedef esp_err_t ( *zenith_registry_export_write_t )( const void *data, size_t len, void *context );
+
+// Import of an export stream, fed a piece at a time - see zenith_registry_import_begin. The caller keeps it, about
+// as big as a ring. Fields are private, apart from the counts.
+typedef struct zenith_registry_import_s {
+    zenith_registry_handle_t handle;
+    uint8_t stage;                          // What's being collected
+    esp_err_t error;                        // First failure - nothing is taken after it
+    size_t have;                            // Bytes of it collected
+    size_t want;
+    zenith_registry_export_record_t record; // Header of the record being collected
+    zenith_registry_export_end_t seen;      // Records taken, checked against the end record
+    uint32_t rings_kept;                    // Rings the registry already had, which stay
+    union {
+        zenith_registry_export_header_t header;
+        zenith_node_info_t node;
+        zenith_registry_checkpoint_record_t ring;
+        zenith_registry_export_end_t end;
+    } piece;
+} zenith_registry_import_t;
+
 
 // Event interface for the registry. Subscribers will be notified of changes to the registry and what ID these changes affect
 typedef enum zenith_registry_event_e {
@@ -92,12 +291,102 @@ typedef enum zenith_registry_event_e {
 
 typedef void (*zenith_registry_callback_t)( zenith_registry_event_t event, const zenith_mac_address_t mac );
 
+// Events are queued and delivered on the registry's event task, so subscribers never run on the receive task. A node
+// has at most one READING_UPDATED in the queue - readings that come in while it waits are folded into it. When the
+// queue is full, node events are dropped and READING_UPDATED waits for the node's next reading, both counted.
+#define ZENITH_REGISTRY_MAX_SUBSCRIBERS 8
+#define ZENITH_REGISTRY_EVENT_QUEUE_LEN 32
+#define ZENITH_REGISTRY_EVENT_TASK_PRIORITY ( tskIDLE_PRIORITY + 1 )
+#define ZENITH_REGISTRY_EVENT_BIT( event ) ( 1u << ( event ) )
+
+typedef struct zenith_registry_event_info_s {
+    zenith_registry_event_t event;
+    zenith_mac_address_t mac;
+    uint8_t sensor_types; // READING_UPDATED: bit per datapoint type with new readings since the last one. 0 otherwise.
+} zenith_registry_event_info_t;
+
+// Which events a subscriber gets. Zeroed, it gets every event.
+typedef struct zenith_registry_filter_s {
+    uint32_t events;        // ZENITH_REGISTRY_EVENT_BIT of the events wanted, 0 for all
+    uint8_t sensor_types;   // READING_UPDATED only with readings of one of these types, bit per datapoint type. 0 for all
+    bool match_mac;         // Only events about mac
+    zenith_mac_address_t mac;
+} zenith_registry_filter_t;
+
+typedef void (*zenith_registry_subscriber_cb_t)( const zenith_registry_event_info_t *event, void *context );
+typedef struct zenith_registry_subscriber_s *zenith_registry_subscriber_handle_t;
+
+typedef struct zenith_registry_event_stats_s {
+    uint32_t posted;            // Events queued
+    uint32_t coalesced;         // READING_UPDATED folded into one already queued
+    uint32_t dropped;           // Node events lost to a full queue
+    uint32_t deferred;          // READING_UPDATED that didn't fit in the queue - the node's next reading tries again
+    uint32_t delivered;         // Callbacks run
+    uint32_t queue_high_water;
+} zenith_registry_event_stats_t;
+
+// The node list is saved to NVS behind the callers' backs, on the registry's own task. A save waits for changes to
+// stop for ZENITH_REGISTRY_PERSIST_QUIET_MS, so a pairing storm is one write, but never waits longer than
+// ZENITH_REGISTRY_PERSIST_MAX_DELAY_MS after the first change.
+#define ZENITH_REGISTRY_PERSIST_QUIET_MS 2000
+#define ZENITH_REGISTRY_PERSIST_MAX_DELAY_MS 10000
+
+typedef struct zenith_registry_persist_stats_s {
+    uint32_t saves;             // Node list written to NVS
+    uint32_t save_failures;     // Retried on the next save
+    uint32_t changes;           // Node list changes, each would have been a save before
+    uint32_t unchanged;         // store_node_info with what was already stored, not saved at all
+    bool dirty;                 // Changes not in NVS yet
+    uint32_t checkpoints;       // Rings and rollups written to the checkpoint storage
+    uint32_t checkpoint_failures;
+    uint32_t checkpoint_bytes;  // Size of the last one
+    uint32_t rings_restored;    // From the checkpoint, by zenith_registry_restore_checkpoint
+} zenith_registry_persist_stats_t;
+
 // Registry API
+//
+// Concurrency: the writers - store_node_info, forget_node and store_datapoints - are called from one task, the receive
+// task in the core. Everything else can be called from any task. Readings never wait for a reader: each ring has a
+// seqlock, and the queries copy the ring and retry if a reading landed meanwhile, so they always see a whole one.
+// Readers only lock to look up a node, which new nodes and pairing wait for, never readings of a known node.
 
 // Registry lifecycle
 esp_err_t zenith_registry_new( zenith_registry_handle_t *out_handle );
 esp_err_t zenith_registry_delete( zenith_registry_handle_t handle );
+// Sets a subscriber that gets every event, replacing the one set before. NULL removes it. Kept for callers from before
+// zenith_registry_subscribe - the callback runs on the event task too.
 esp_err_t zenith_registry_register_callback( zenith_registry_handle_t handle, zenith_registry_callback_t callback );
+// Calls callback on the event task for every event that passes filter, NULL for all. Callbacks run one at a time and
+// hold up the rest of the queue, so hand slow work off. Don't subscribe or unsubscribe from a callback.
+esp_err_t zenith_registry_subscribe( zenith_registry_handle_t handle, const zenith_registry_filter_t *filter, zenith_registry_subscriber_cb_t callback, void *context, zenith_registry_subscriber_handle_t *out_subscriber );
+// The callback isn't running and won't be called again once this returns
+esp_err_t zenith_registry_unsubscribe( zenith_registry_handle_t handle, zenith_registry_subscriber_handle_t subscriber );
+esp_err_t zenith_registry_get_event_stats( zenith_registry_handle_t handle, zenith_registry_event_stats_t *out_stats );
+// Saves pending node list changes to NVS now, on the caller's task. zenith_registry_delete does it too. Call before a
+// planned reset, or they're lost if it comes before the persist task gets to them.
+esp_err_t zenith_registry_flush( zenith_registry_handle_t handle );
+esp_err_t zenith_registry_get_persist_stats( zenith_registry_handle_t handle, zenith_registry_persist_stats_t *out_stats );
+// Warm restart. Attach checkpoints the rings and rollups to storage every ZENITH_REGISTRY_CHECKPOINT_INTERVAL_MS that
+// data came in. The registry doesn't own the storage - it stays the caller's to delete if attach turns it down, with
+// ESP_ERR_INVALID_ARG for a storage too small to hold a checkpoint.
+esp_err_t zenith_registry_attach_checkpoint( zenith_registry_handle_t handle, zenith_log_storage_handle_t storage );
+// Restores the rings and rollups from the newest valid checkpoint on the attached storage - ESP_OK with nothing to
+// restore. Call right after attach, before any data arrives: readings already in the registry win over the checkpoint.
+// A failed restore leaves the storage attached, and checkpoints go on.
+esp_err_t zenith_registry_restore_checkpoint( zenith_registry_handle_t handle );
+// Writes a checkpoint now, on the caller's task. Erases a slot first - tens of ms per 4 KB sector on a C6.
+esp_err_t zenith_registry_checkpoint( zenith_registry_handle_t handle );
+// Backup and restore. Export streams the node list and every ring to write, on the caller's task, and allocates nothing.
+// It copies one ring at a time into record, the caller's - about 1.4 KB, too big for a console task's stack - and never
+// holds up readings. An import takes each record as soon as it's whole:
+// nodes are stored like a pairing, rings like a checkpoint restore - a ring the registry already has is newer, and
+// stays. Importing is writing, so it runs on the receive task, or while that is held off.
+esp_err_t zenith_registry_export( zenith_registry_handle_t handle, zenith_registry_checkpoint_record_t *record, zenith_registry_export_write_t write, void *context );
+esp_err_t zenith_registry_import_begin( zenith_registry_handle_t handle, zenith_registry_import_t *import );
+// Any number of bytes at a time. Fails on a record with a bad crc, or a stream from a build with another ring layout.
+esp_err_t zenith_registry_import_feed( zenith_registry_import_t *import, const void *data, size_t len );
+// ESP_OK once the whole stream is in, ESP_ERR_INVALID_STATE if it was cut off, or the error a feed failed with
+esp_err_t zenith_registry_import_end( zenith_registry_import_t *import );
 
 // Node information management 
 esp_err_t zenith_registry_store_node_info( zenith_registry_handle_t handle, const zenith_node_info_t *info );
@@ -110,12 +399,39 @@ esp_err_t zenith_registry_get_all_node_macs( zenith_registry_handle_t handle, ze
 //esp_err_t zenith_registry_get_node_mac_by_index( zenith_registry_handle_t handle, size_t index, zenith_mac_address_t out_mac );
 
 // Reading management
-esp_err_t zenith_registry_store_datapoints( zenith_registry_handle_t handle, const zenith_mac_address_t mac, const zenith_datapoint_t *datapoints, size_t count );
+// timestamps holds one timestamp per datapoint, or NULL to stamp them all with the current time
+esp_err_t zenith_registry_store_datapoints( zenith_registry_handle_t handle, const zenith_mac_address_t mac, const zenith_datapoint_t *datapoints, const time_t *timestamps, size_t count );
+
+// Stable handle to a node's live data. Valid until the registry is deleted, and the rings it points to fill in as data
+// arrives. Reading the rings through it races the writer and can see a half added reading - use the queries below.
+esp_err_t zenith_registry_get_node_runtime( zenith_registry_handle_t handle, const zenith_mac_address_t mac, const zenith_node_runtime_t **out_runtime );
 
 esp_err_t zenith_registry_get_latest_readings( zenith_registry_handle_t handle, const zenith_mac_address_t mac, zenith_reading_t *out_readings, size_t *inout_count );
+// History, oldest first. get_history copies the newest *inout_count raw readings, get_rollups the newest *inout_count
+// periods with readings in them from a rollup tier. Pass NULL for the output to get the count available.
+// The queries work on a copy of the ring, about 300 bytes of the caller's stack - the rollup queries, get_window_stats
+// and the last 24h ones on a copy of the one tier they read, under 500.
 esp_err_t zenith_registry_get_history( zenith_registry_handle_t handle, const zenith_mac_address_t mac, zenith_sensor_type_t type, zenith_reading_t *out_history, size_t *inout_count );
+// Readings with t0 <= timestamp <= t1, oldest first. The range is found by binary search on the timestamps, so a
+// chart refresh costs O(log n + k) for k readings, not a walk of the ring. Copies the oldest *inout_count of them, NULL
+// for the output counts them. Rings keep readings in the order they arrived, which is time order unless a node's
+// journal lands behind newer readings - readings out of order at the edges of the range can then be missed.
+esp_err_t zenith_registry_get_history_range( zenith_registry_handle_t handle, const zenith_mac_address_t mac, zenith_sensor_type_t type, time_t t0, time_t t1, zenith_reading_t *out_history, size_t *inout_count );
+// Same range without a buffer for all of it: open copies the ring into the cursor and finds t0, next hands out the
+// readings one at a time and returns false past t1. Nothing to close.
+esp_err_t zenith_registry_history_open( zenith_registry_handle_t handle, const zenith_mac_address_t mac, zenith_sensor_type_t type, time_t t0, time_t t1, zenith_registry_history_cursor_t *out_cursor );
+bool zenith_registry_history_next( zenith_registry_history_cursor_t *cursor, zenith_reading_t *out_reading );
+esp_err_t zenith_registry_get_rollups( zenith_registry_handle_t handle, const zenith_mac_address_t mac, zenith_sensor_type_t type, zenith_rollup_tier_t tier, zenith_rollup_t *out_rollups, size_t *inout_count );
+// Min and max from the hourly rollups: the hour now is in, so far, and the 23 whole hours before it. The window starts
+// on an hour, so it reaches between 23 and 24 hours back. The timestamp is the start of the hour it was seen in.
+// ESP_ERR_NOT_FOUND if the node has no readings of the type in that window.
 esp_err_t zenith_registry_get_max_last_24h( zenith_registry_handle_t handle, const zenith_mac_address_t mac, zenith_sensor_type_t type, zenith_reading_t *out_max_reading );
 esp_err_t zenith_registry_get_min_last_24h( zenith_registry_handle_t handle, const zenith_mac_address_t mac, zenith_sensor_type_t type, zenith_reading_t *out_min_reading );
+// Count, min, max, mean, variance and rate of change over the window_s seconds up to now, for windows up to a week.
+// Merged from the finest rollup tier that reaches back that far, so the window is rounded up to whole periods of it:
+// 5 minutes up to 2 hours, hours up to a day with the default tier depths. ESP_ERR_NOT_FOUND if there are no readings
+// in the window.
+esp_err_t zenith_registry_get_window_stats( zenith_registry_handle_t handle, const zenith_mac_address_t mac, zenith_sensor_type_t type, uint32_t window_s, zenith_window_stats_t *out_stats );
 
 esp_err_t zenith_registry_full_contents_to_log( zenith_registry_handle_t handle );
 
@@ -0,0 +1,57 @@
+// zenith_registry_gorilla.h
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Gorilla style compression for ring readings (Pelkonen et al, "Gorilla: A Fast, Scalable, In-Memory Time Series
+// Database"). Timestamps are stored as the delta of the delta to the previous one, values as the XOR with the previous
+// value. A sensor reporting on a steady interval costs a bit per timestamp, and a value that didn't change a bit too.
+//
+// Readings go into fixed size blocks. A block only ever grows - when a reading doesn't fit, the caller starts a new
+// block. Decoding always starts from the beginning of a block.
+
+#define ZENITH_GORILLA_BLOCK_BYTES 48
+
+typedef struct zenith_gorilla_block_s {
+    uint16_t count;         // readings in the block
+    uint16_t bits;          // bits of data used
+    // Encoder state, what the next reading is compared to
+    int32_t last_offset;
+    int32_t last_delta;
+    uint32_t last_value;    // bits of the float
+    uint8_t leading;        // leading zeros of the last XOR window, 0xff before the first one
+    uint8_t trailing;       // trailing zeros of the last XOR window
+    uint8_t data[ZENITH_GORILLA_BLOCK_BYTES];
+} zenith_gorilla_block_t;
+
+// Reads a block back, oldest reading first
+typedef struct zenith_gorilla_reader_s {
+    const zenith_gorilla_block_t *block;
+    uint16_t index;         // readings read
+    uint16_t bit;           // next bit to read
+    int32_t offset;
+    int32_t delta;
+    uint32_t value;
+    uint8_t leading;
+    uint8_t trailing;
+} zenith_gorilla_reader_t;
+
+void zenith_gorilla_block_reset( zenith_gorilla_block_t *block );
+
+// Appends a reading. Returns false and leaves the block alone if it doesn't fit. An empty block always takes one.
+bool zenith_gorilla_block_append( zenith_gorilla_block_t *block, int32_t offset, float value );
+
+void zenith_gorilla_reader_init( zenith_gorilla_reader_t *reader, const zenith_gorilla_block_t *block );
+
+// Reads the next reading. Returns false at the end of the block.
+bool zenith_gorilla_reader_next( zenith_gorilla_reader_t *reader, int32_t *out_offset, float *out_value );
+
+#ifdef __cplusplus
+}
+#endif
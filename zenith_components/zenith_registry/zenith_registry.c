@@ -2,30 +2,286 @@
 
 #include <string.h>
 #include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
 #include "nvs.h"
 #include "nvs_flash.h"
 #include "esp_check.h"
 #include "esp_log.h"
 #include "esp_err.h"
-#include "esp_mac.h"
+#include "esp_rom_crc.h"
 #include "time.h"
 #include "zenith_registry.h"
+#include "zenith_log.h"
 
 #define ZENITH_REGISTRY_NVS_NAMESPACE "zenith_registry"
 #define ZENITH_REGISTRY_NVS_KEY "nodes"
-#define ZENITH_REGISTRY_VERSION 1
-#define ZENITH_REGISTRY_MAX_NODES 10
+#define ZENITH_REGISTRY_VERSION 2
+#define ZENITH_REGISTRY_VERSION_1_HEADER_SIZE 2 // uint8_t version, uint8_t count
+
+#define ZENITH_REGISTRY_INDEX_NONE 0xffff       // Index slot has no node info / no runtime data
+#define ZENITH_REGISTRY_INDEX_MIN_CAPACITY 16   // Power of two
+
+#define ZENITH_REGISTRY_SECONDS_PER_HOUR 3600
+#define ZENITH_REGISTRY_SECONDS_PER_DAY 86400
+
+#define ZENITH_REGISTRY_RUNTIME_CHUNK_ITEMS 16  // Node runtime records per arena chunk - they're small
+#define ZENITH_REGISTRY_RING_CHUNK_ITEMS 4      // Rings per arena chunk - a ring is over 1 KB with its rollups
+
+#define ZENITH_REGISTRY_SNAPSHOT_SPINS 64       // Tries at copying a ring mid write before the reader sleeps a tick
+
+#define ZENITH_REGISTRY_EVENT_STOP 0xff         // Queued by zenith_registry_delete to stop the event task
+
+// Where each rollup tier lives in zenith_rollups_t. Every period has to divide the next one - see _ringbuffer_add_reading.
+typedef struct zenith_registry_rollup_tier_s {
+    uint32_t period;    // seconds
+    uint16_t first;     // first bucket
+    uint16_t buckets;
+} zenith_registry_rollup_tier_t;
+
+static const zenith_registry_rollup_tier_t s_rollup_tiers[ ZENITH_ROLLUP_TIERS ] = {
+    [ ZENITH_ROLLUP_5MIN ] = { 5 * 60, 0, ZENITH_ROLLUP_5MIN_BUCKETS },
+    [ ZENITH_ROLLUP_HOUR ] = { ZENITH_REGISTRY_SECONDS_PER_HOUR, ZENITH_ROLLUP_5MIN_BUCKETS, ZENITH_ROLLUP_HOUR_BUCKETS },
+    [ ZENITH_ROLLUP_DAY ] = { ZENITH_REGISTRY_SECONDS_PER_DAY, ZENITH_ROLLUP_5MIN_BUCKETS + ZENITH_ROLLUP_HOUR_BUCKETS, ZENITH_ROLLUP_DAY_BUCKETS },
+};
+
+#define ZENITH_REGISTRY_MAX2( a, b ) ( ( a ) > ( b ) ? ( a ) : ( b ) )
+#define ZENITH_REGISTRY_TIER_MAX_BUCKETS ZENITH_REGISTRY_MAX2( ZENITH_ROLLUP_5MIN_BUCKETS, ZENITH_REGISTRY_MAX2( ZENITH_ROLLUP_HOUR_BUCKETS, ZENITH_ROLLUP_DAY_BUCKETS ) )
+
+// One tier copied out of a ring's rollups for a query - a few hundred bytes on the caller's stack, not all of them
+typedef struct zenith_registry_tier_snapshot_s {
+    int32_t newest;
+    uint8_t head;
+    zenith_rollup_bucket_t buckets[ ZENITH_REGISTRY_TIER_MAX_BUCKETS ];
+} zenith_registry_tier_snapshot_t;
+
+// What the ring arena hands out - the ring with its rollups behind it, so they come and go together
+typedef struct zenith_registry_ring_item_s {
+    zenith_ringbuffer_t ring;
+    zenith_rollups_t rollups;
+} zenith_registry_ring_item_t;
+
+// Chunked arena. Items are handed out from fixed size chunks that never move, so pointers to them stay valid until
+// the registry is deleted. Only the table of chunk pointers is ever reallocated. Items are never freed one by one.
+typedef struct zenith_registry_arena_s {
+    size_t item_size;
+    size_t chunk_items;
+    uint8_t **chunks;
+    size_t chunk_count;
+    size_t count;       // Items handed out
+} zenith_registry_arena_t;
+
+typedef struct zenith_registry_subscriber_s {
+    bool used;
+    zenith_registry_filter_t filter;
+    zenith_registry_subscriber_cb_t callback;
+    zenith_registry_callback_t legacy; // Set instead of callback by zenith_registry_register_callback
+    void *context;
+} zenith_registry_subscriber_t;
+
+// An event as it waits in the queue
+typedef struct zenith_registry_queued_event_s {
+    uint8_t event;                  // zenith_registry_event_t, or ZENITH_REGISTRY_EVENT_STOP
+    zenith_mac_address_t mac;
+    zenith_node_runtime_t *node;    // READING_UPDATED: holds the sensor types to report, see _events_post_reading
+} zenith_registry_queued_event_t;
+
+// One slot in the mac index. A mac gets a slot when it's paired or sends data, whichever comes first.
+typedef struct zenith_registry_index_slot_s {
+    zenith_mac_address_t mac;
+    uint16_t node;      // Index into nodes, ZENITH_REGISTRY_INDEX_NONE if not paired
+    uint16_t buffer;    // Index into the runtime arena, ZENITH_REGISTRY_INDEX_NONE if no data yet
+} zenith_registry_index_slot_t;
 
 struct zenith_registry_s {
-    zenith_node_info_t nodes[ZENITH_REGISTRY_MAX_NODES];
-    uint8_t node_count;
-    zenith_node_runtime_t *runtime_buffers; // where we store the live sensor data
-    uint8_t buffer_count; // number of buffers allocated
-    zenith_registry_callback_t callback;
+    zenith_node_info_t *nodes;
+    size_t node_count;
+    size_t node_capacity;
+    zenith_registry_arena_t runtime_arena; // where we store the live sensor data, one zenith_node_runtime_t per node
+    zenith_registry_arena_t ring_arena; // the rings those point to
+    // Open addressing hash index over the macs in nodes and the runtime arena, linear probing. Never more than half full.
+    zenith_registry_index_slot_t *index;
+    size_t index_capacity;
+    size_t index_used;
+    // Event bus, see _events_task
+    SemaphoreHandle_t events_lock;  // Held while the subscribers change, and while the event task runs their callbacks
+    zenith_registry_subscriber_t subscribers[ ZENITH_REGISTRY_MAX_SUBSCRIBERS ];
+    size_t subscriber_count;        // Nothing is queued without subscribers
+    zenith_registry_subscriber_handle_t legacy_subscriber;
+    QueueHandle_t events_queue;     // NULL without the event task - events are delivered on the caller's task then
+    TaskHandle_t events_task;
+    SemaphoreHandle_t events_done;  // Given by the event task on its way out
+    zenith_registry_event_stats_t event_stats; // Counted on the receive task, delivered and high water on the event task
+    // Write-behind of the node list to NVS, see _persist_task
+    SemaphoreHandle_t nodes_lock;   // Held while the node list, the index or the arenas change, and while the persist task copies them
+    SemaphoreHandle_t save_lock;    // One save at a time, so an older copy never lands in NVS after a newer one
+    TaskHandle_t persist_task;
+    SemaphoreHandle_t persist_done; // Given by the persist task on its way out
+    volatile bool persist_stop;
+    bool dirty;                     // Node list changed since the last save. Under nodes_lock.
+    zenith_registry_persist_stats_t persist_stats;
+    // Checkpoints of the rings, written by the persist task too
+    zenith_log_storage_handle_t checkpoint_storage;
+    uint32_t checkpoint_seq;        // Of the newest checkpoint on storage
+    int checkpoint_slot;            // Where it is, -1 for none
+    TickType_t checkpoint_at;
+    volatile bool data_dirty;       // Readings came in since the last checkpoint
 };
 
 const char *TAG = "zenith_registry";
 
+_Static_assert( sizeof( zenith_registry_export_header_t ) == 24, "Export headers are streamed as is" );
+_Static_assert( sizeof( zenith_registry_export_record_t ) == 8, "Export record headers are streamed as is" );
+_Static_assert( sizeof( zenith_registry_checkpoint_record_t ) <= UINT16_MAX, "Export record sizes are 16 bit" );
+_Static_assert( ZENITH_REGISTRY_TIER_MAX_BUCKETS <= UINT8_MAX && ZENITH_ROLLUP_5MIN_BUCKETS && ZENITH_ROLLUP_HOUR_BUCKETS && ZENITH_ROLLUP_DAY_BUCKETS,
+                "Rollup tiers take 1 to 255 buckets - zenith_rollups_t.head is 8 bit" );
+
+// arena
+
+static void _arena_init( zenith_registry_arena_t *arena, size_t item_size, size_t chunk_items ) {
+    memset( arena, 0, sizeof( *arena ) );
+    arena->item_size = item_size;
+    arena->chunk_items = chunk_items;
+}
+
+static inline void *_arena_at( const zenith_registry_arena_t *arena, size_t index ) {
+    return arena->chunks[ index / arena->chunk_items ] + ( index % arena->chunk_items ) * arena->item_size;
+}
+
+// Hand out a zeroed item, adding a chunk if the last one is full
+static esp_err_t _arena_alloc( zenith_registry_arena_t *arena, size_t *out_index, void **out_item ) {
+    if ( arena->count == arena->chunk_count * arena->chunk_items ) {
+        uint8_t **chunks = realloc( arena->chunks, ( arena->chunk_count + 1 ) * sizeof( uint8_t * ) );
+        ESP_RETURN_ON_FALSE(
+            chunks,
+            ESP_ERR_NO_MEM,
+            TAG, "Failed to grow arena chunk table"
+        );
+        arena->chunks = chunks;
+
+        arena->chunks[ arena->chunk_count ] = calloc( arena->chunk_items, arena->item_size );
+        ESP_RETURN_ON_FALSE(
+            arena->chunks[ arena->chunk_count ],
+            ESP_ERR_NO_MEM,
+            TAG, "Failed to allocate arena chunk"
+        );
+        arena->chunk_count++;
+    }
+
+    *out_index = arena->count++;
+    *out_item = _arena_at( arena, *out_index );
+    return ESP_OK;
+}
+
+static void _arena_free( zenith_registry_arena_t *arena ) {
+    for ( size_t i = 0; i < arena->chunk_count; i++ )
+        free( arena->chunks[ i ] );
+    free( arena->chunks );
+    arena->chunks = NULL;
+    arena->chunk_count = 0;
+    arena->count = 0;
+}
+
+// mac index
+
+static inline bool _index_slot_empty( const zenith_registry_index_slot_t *slot ) {
+    return slot->node == ZENITH_REGISTRY_INDEX_NONE && slot->buffer == ZENITH_REGISTRY_INDEX_NONE;
+}
+
+// FNV-1a. Macs from one vendor share the first three bytes, so every byte has to count.
+static inline size_t _mac_hash( const zenith_mac_address_t mac ) {
+    uint32_t hash = 2166136261u;
+    for ( int i = 0; i < ZENITH_MAC_ADDR_LEN; i++ ) {
+        hash ^= mac[ i ];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Find the slot for a mac, or NULL
+static zenith_registry_index_slot_t *_index_find( zenith_registry_handle_t handle, const zenith_mac_address_t mac ) {
+    if ( !handle->index_capacity )
+        return NULL;
+
+    size_t mask = handle->index_capacity - 1;
+    for ( size_t i = _mac_hash( mac ) & mask; !_index_slot_empty( &handle->index[ i ] ); i = ( i + 1 ) & mask )
+        if ( memcmp( handle->index[ i ].mac, mac, ZENITH_MAC_ADDR_LEN ) == 0 )
+            return &handle->index[ i ];
+
+    return NULL;
+}
+
+// Double the index and put every slot back in
+static esp_err_t _index_grow( zenith_registry_handle_t handle ) {
+    size_t capacity = handle->index_capacity ? handle->index_capacity * 2 : ZENITH_REGISTRY_INDEX_MIN_CAPACITY;
+    zenith_registry_index_slot_t *index = malloc( capacity * sizeof( zenith_registry_index_slot_t ) );
+    ESP_RETURN_ON_FALSE(
+        index,
+        ESP_ERR_NO_MEM,
+        TAG, "Failed to allocate mac index"
+    );
+    memset( index, 0xff, capacity * sizeof( zenith_registry_index_slot_t ) ); // node and buffer ZENITH_REGISTRY_INDEX_NONE
+
+    size_t mask = capacity - 1;
+    for ( size_t j = 0; j < handle->index_capacity; j++ ) {
+        zenith_registry_index_slot_t *slot = &handle->index[ j ];
+        if ( _index_slot_empty( slot ) )
+            continue;
+        size_t i = _mac_hash( slot->mac ) & mask;
+        while ( !_index_slot_empty( &index[ i ] ) )
+            i = ( i + 1 ) & mask;
+        index[ i ] = *slot;
+    }
+
+    free( handle->index );
+    handle->index = index;
+    handle->index_capacity = capacity;
+    return ESP_OK;
+}
+
+// Find the slot for a mac, or claim an empty one for it
+static esp_err_t _index_get( zenith_registry_handle_t handle, const zenith_mac_address_t mac, zenith_registry_index_slot_t **out_slot ) {
+    *out_slot = _index_find( handle, mac );
+    if ( *out_slot )
+        return ESP_OK;
+
+    if ( ( handle->index_used + 1 ) * 2 > handle->index_capacity )
+        ESP_RETURN_ON_ERROR(
+            _index_grow( handle ),
+            TAG, "Failed to grow mac index"
+        );
+
+    size_t mask = handle->index_capacity - 1;
+    size_t i = _mac_hash( mac ) & mask;
+    while ( !_index_slot_empty( &handle->index[ i ] ) )
+        i = ( i + 1 ) & mask;
+
+    memcpy( handle->index[ i ].mac, mac, ZENITH_MAC_ADDR_LEN );
+    handle->index_used++;
+    *out_slot = &handle->index[ i ];
+    return ESP_OK;
+}
+
+// Give a slot back once it points at nothing. Later slots in the probe run move up, so lookups never need tombstones.
+static void _index_release( zenith_registry_handle_t handle, zenith_registry_index_slot_t *slot ) {
+    if ( !_index_slot_empty( slot ) )
+        return;
+
+    size_t mask = handle->index_capacity - 1;
+    size_t hole = slot - handle->index;
+    for ( size_t i = ( hole + 1 ) & mask; !_index_slot_empty( &handle->index[ i ] ); i = ( i + 1 ) & mask ) {
+        size_t home = _mac_hash( handle->index[ i ].mac ) & mask;
+        // Move it into the hole unless its home lies cyclically in ( hole, i ]
+        if ( ( ( i - home ) & mask ) >= ( ( i - hole ) & mask ) ) {
+            handle->index[ hole ] = handle->index[ i ];
+            hole = i;
+        }
+    }
+    memset( &handle->index[ hole ], 0xff, sizeof( zenith_registry_index_slot_t ) );
+    handle->index_used--;
+}
+
 // ringbuffer support
 
 // get the index of a MAC address in the runtime buffer - poor naming
@@ -35,44 +291,91 @@ static int _buffer_index_of_mac( zenith_registry_handle_t handle, const zenith_m
         abort();
     }
 
-    ESP_LOGD( TAG, "buffer_index_of_mac - Registry count: %d", handle->buffer_count );
-    ESP_LOGD( TAG, "buffer_index_of_mac - MAC: "MACSTR, MAC2STR( mac ) );
-    for ( uint8_t i = 0; i < handle->buffer_count; i++ )
-        if ( memcmp( handle->runtime_buffers[i].mac, mac, ESP_NOW_ETH_ALEN ) == 0 ) 
-            return i;
-
-    return -1; // Not found
+    zenith_registry_index_slot_t *slot = _index_find( handle, mac );
+    return ( slot && slot->buffer != ZENITH_REGISTRY_INDEX_NONE ) ? slot->buffer : -1;
 }
 
-// Get the ringbuffer for a given sensor type or create it if not found
-static esp_err_t _get_ringbuffer( zenith_node_runtime_t *node, zenith_sensor_type_t type, zenith_ringbuffer_t **ringbuffer ) {
-    // Search existing rings
-    for ( size_t i = 0; i < node->ring_count; ++i ) {
-        if ( node->rings[i].type == type ) {
-            *ringbuffer = &node->rings[i];
-            return ESP_OK; // not happy with early returns, but this is cleaner
-        }
+// Create the ringbuffer for a sensor type. Only called the first time a node reports the type - store_datapoints
+// finds existing rings straight from node->rings[ type ]. A checkpoint restore passes the record to start from.
+static esp_err_t _new_ringbuffer( zenith_registry_handle_t handle, zenith_node_runtime_t *node, uint8_t type, time_t epoch, const zenith_registry_checkpoint_record_t *from, zenith_ringbuffer_t **ringbuffer ) {
+    ESP_RETURN_ON_FALSE(
+        type < ZENITH_REGISTRY_MAX_RINGS,
+        ESP_ERR_INVALID_ARG,
+        TAG, "Sensor type %d out of range", type
+    );
+    // Readers find rings from other tasks, so the ring is set up before it's in node->rings
+    size_t ring_index;
+    zenith_registry_ring_item_t *item = NULL;
+    zenith_ringbuffer_t *new_ring = NULL;
+    xSemaphoreTake( handle->nodes_lock, portMAX_DELAY );
+    esp_err_t ret = _arena_alloc( &handle->ring_arena, &ring_index, ( void ** ) &item );
+    if ( ret == ESP_OK ) {
+        new_ring = &item->ring;
+        new_ring->rollups = &item->rollups;
     }
-
-    // Not found — allocate new ring slot
-    zenith_ringbuffer_t *new_rings = realloc( node->rings, (node->ring_count + 1) * sizeof( zenith_ringbuffer_t ) );
-    ESP_RETURN_ON_FALSE( 
-        new_rings, 
-        ESP_ERR_NO_MEM, 
-        TAG, "Failed to allocate memory for new ring" 
+    if ( ret == ESP_OK && from ) {
+        memcpy( new_ring, &from->ring, sizeof( zenith_ringbuffer_t ) );
+        memcpy( &item->rollups, &from->rollups, sizeof( zenith_rollups_t ) );
+        new_ring->rollups = &item->rollups;
+        new_ring->seq = 0;
+    } else if ( ret == ESP_OK ) {
+        new_ring->type = type;
+        new_ring->epoch = epoch;
+#if ZENITH_REGISTRY_COMPRESSED_RINGS
+        for ( size_t i = 0; i < ZENITH_RING_BLOCKS; ++i )
+            zenith_gorilla_block_reset( &new_ring->blocks[i] );
+#endif
+        zenith_rollups_t *rollups = new_ring->rollups;
+        for ( size_t tier = 0; tier < ZENITH_ROLLUP_TIERS; ++tier )
+            rollups->newest[tier] = epoch / s_rollup_tiers[tier].period; // buckets come zeroed - empty
+        rollups->start = (time_t) rollups->newest[ ZENITH_ROLLUP_5MIN ] * s_rollup_tiers[ ZENITH_ROLLUP_5MIN ].period;
+    }
+    if ( ret == ESP_OK ) {
+        node->rings[type] = new_ring;
+        node->ring_count++;
+    }
+    xSemaphoreGive( handle->nodes_lock );
+    ESP_RETURN_ON_ERROR(
+        ret,
+        TAG, "Failed to allocate memory for new ring"
     );
-    node->rings = new_rings;
-    zenith_ringbuffer_t *new_ring = &node->rings[node->ring_count];
-    node->ring_count++;
-
-    memset( new_ring, 0, sizeof( *new_ring ) );
-    new_ring->type = type;
 
     *ringbuffer = new_ring;
 
     return ESP_OK;
 }
 
+// Set up runtime data for a mac that has none. Must be called with nodes_lock held - the index and the arena change.
+static esp_err_t _new_node_runtime( zenith_registry_handle_t handle, const zenith_mac_address_t mac, int *out_index )
+{
+    ESP_RETURN_ON_FALSE(
+        handle->runtime_arena.count < ZENITH_REGISTRY_MAX_NODES,
+        ESP_ERR_NO_MEM,
+        TAG, "Max node limit reached"
+    );
+    zenith_registry_index_slot_t *slot = NULL;
+    ESP_RETURN_ON_ERROR(
+        _index_get( handle, mac, &slot ),
+        TAG, "Failed to index runtime buffer"
+    );
+
+    // Take a new runtime buffer from the arena - the existing ones stay where they are
+    size_t arena_index;
+    zenith_node_runtime_t *new_runtime = NULL;
+    esp_err_t ret = _arena_alloc( &handle->runtime_arena, &arena_index, ( void ** ) &new_runtime );
+    if ( ret != ESP_OK )
+        _index_release( handle, slot ); // Don't leave a slot pointing at nothing
+    ESP_RETURN_ON_ERROR( 
+        ret, 
+        TAG, "Failed to allocate memory for new runtime buffer" 
+    );
+
+    slot->buffer = arena_index;
+    memcpy( new_runtime->mac, mac, sizeof (zenith_mac_address_t ) );
+    *out_index = arena_index;
+    return ESP_OK;
+}
+
 // Get the node runtime buffer for a given MAC address or create it if not found
 static esp_err_t _get_node_runtime_data( zenith_registry_handle_t handle, const zenith_mac_address_t mac, zenith_node_runtime_t **out_runtime_data )
 {
@@ -84,38 +387,271 @@ static esp_err_t _get_node_runtime_data( zenith_registry_handle_t handle, const
 
     int index = _buffer_index_of_mac( handle, mac );
     if ( index < 0 ) {
-        // Reallocate the runtime buffers array to add a new one
-        zenith_node_runtime_t *new_rings = realloc( handle->runtime_buffers, ( handle->buffer_count + 1 ) * sizeof( zenith_node_runtime_t ) );
-        ESP_RETURN_ON_FALSE( 
-            new_rings, 
-            ESP_ERR_NO_MEM, 
-            TAG, "Failed to (re)allocate memory for new runtime buffer" 
-        );
-        handle->runtime_buffers = new_rings;
+        // The checkpoint walks the arena from another task
+        xSemaphoreTake( handle->nodes_lock, portMAX_DELAY );
+        esp_err_t ret = _new_node_runtime( handle, mac, &index );
+        xSemaphoreGive( handle->nodes_lock );
+        ESP_RETURN_ON_ERROR( ret, TAG, "Failed to create runtime buffer" );
+    }
+
+    *out_runtime_data = _arena_at( &handle->runtime_arena, index );
+    return ESP_OK;
+}
 
-        index = handle->buffer_count;
-        handle->buffer_count++;
+// Where a period is in a tier's window. The newest period sits at the tier's head and older ones behind it, so
+// finding one takes no division.
+static inline int32_t _rollup_index( size_t tier, uint8_t head, int32_t newest, int32_t period ) {
+    int32_t index = head - ( newest - period );
+    return index + ( index < 0 ? s_rollup_tiers[ tier ].buckets : 0 );
+}
+
+static inline zenith_rollup_bucket_t *_rollup_bucket( zenith_rollups_t *rollups, size_t tier, int32_t period ) {
+    return &rollups->buckets[ s_rollup_tiers[ tier ].first + _rollup_index( tier, rollups->head[ tier ], rollups->newest[ tier ], period ) ];
+}
 
-        // Initialize the new ring buffer
-        zenith_node_runtime_t *new_ring = &handle->runtime_buffers[index];
-        memset( new_ring, 0, sizeof( *new_ring ) );
-        memcpy( new_ring->mac, mac, sizeof (zenith_mac_address_t ) );
+// Same for a tier copied out with _rollup_snapshot
+static inline const zenith_rollup_bucket_t *_tier_bucket( const zenith_registry_tier_snapshot_t *snapshot, size_t tier, int32_t period ) {
+    return &snapshot->buckets[ _rollup_index( tier, snapshot->head, snapshot->newest, period ) ];
+}
+
+// Oldest period still in a tier's window
+static inline int32_t _rollup_oldest( size_t tier, int32_t newest ) {
+    return newest - s_rollup_tiers[ tier ].buckets + 1;
+}
+
+// Move a tier's window up to a newer period, emptying the buckets it passes. At most a tier's worth of them, and
+// only on the first reading of a period.
+static void _rollup_advance( zenith_rollups_t *rollups, size_t tier, int32_t period ) {
+    const zenith_registry_rollup_tier_t *t = &s_rollup_tiers[ tier ];
+    int32_t steps = period - rollups->newest[ tier ];
+    if ( steps > t->buckets )
+        steps = t->buckets;
+
+    uint8_t head = rollups->head[ tier ];
+    for ( ; steps > 0; --steps ) {
+        head = head + 1 == t->buckets ? 0 : head + 1;
+        rollups->buckets[ t->first + head ] = ( zenith_rollup_bucket_t ) { 0 };
     }
+    rollups->head[ tier ] = head;
+    rollups->newest[ tier ] = period;
+    if ( tier == ZENITH_ROLLUP_5MIN )
+        rollups->start = (time_t) period * s_rollup_tiers[ tier ].period;
+}
 
-    *out_runtime_data = &handle->runtime_buffers[index];
-    return ESP_OK;
+// Period of a timestamp in a tier, moving the tier's window up if it's newer than anything seen
+static int32_t _rollup_period( zenith_rollups_t *rollups, size_t tier, time_t timestamp ) {
+    int32_t period = timestamp / s_rollup_tiers[ tier ].period;
+    if ( period > rollups->newest[ tier ] )
+        _rollup_advance( rollups, tier, period );
+    return period;
 }
 
-// Add a reading to the ringbuffer
-static esp_err_t _ringbuffer_add_reading( zenith_ringbuffer_t *ring, zenith_reading_datatype_t value ) {
-    zenith_reading_t *slot = &ring->entries[ring->head];
-    slot->timestamp = time( NULL ); // Get current time in seconds since epoch
+#if ZENITH_REGISTRY_COMPRESSED_RINGS
+// Appends to the block being written. A full block moves the ring on to its oldest block, which is dropped.
+static inline void _ringbuffer_store( zenith_ringbuffer_t *ring, int32_t offset, zenith_reading_datatype_t value ) {
+    if ( !zenith_gorilla_block_append( &ring->blocks[ ring->head ], offset, value ) ) {
+        ring->head = ( ring->head + 1 ) % ZENITH_RING_BLOCKS;
+        ring->size -= ring->blocks[ ring->head ].count;
+        zenith_gorilla_block_reset( &ring->blocks[ ring->head ] );
+        zenith_gorilla_block_append( &ring->blocks[ ring->head ], offset, value );
+    }
+    ring->size++;
+}
+#else
+static inline void _ringbuffer_store( zenith_ringbuffer_t *ring, int32_t offset, zenith_reading_datatype_t value ) {
+    zenith_ring_entry_t *slot = &ring->entries[ring->head];
+    slot->offset = offset;
     slot->value = value;
 
     ring->head = (ring->head + 1) % ZENITH_RING_CAPACITY;
-    if ( ring->size < ZENITH_RING_CAPACITY ) {
-        ring->size++;
+    ring->size += ring->size < ZENITH_RING_CAPACITY;
+}
+#endif
+
+// Ring seqlock. Only the receive task writes a ring, so the writer never waits: it makes seq odd, changes the ring and
+// makes seq even again. A copy taken while seq stayed the same even number is a whole ring.
+static inline void _ring_write_begin( zenith_ringbuffer_t *ring ) {
+    __atomic_store_n( &ring->seq, ring->seq + 1, __ATOMIC_RELAXED );
+    __atomic_thread_fence( __ATOMIC_RELEASE ); // seq is odd before any of the ring changes
+}
+
+static inline void _ring_write_end( zenith_ringbuffer_t *ring ) {
+    __atomic_store_n( &ring->seq, ring->seq + 1, __ATOMIC_RELEASE );
+}
+
+// Start of a copy of a ring or its rollups: waits out a write in progress and returns the seq to check the copy with
+static uint32_t _ring_read_begin( const zenith_ringbuffer_t *ring, size_t *spins ) {
+    while ( true ) {
+        // On one core the writer can be a lower priority task we preempted mid write - spinning won't let it finish
+        if ( ( *spins )++ >= ZENITH_REGISTRY_SNAPSHOT_SPINS ) {
+            vTaskDelay( 1 );
+            *spins = 0;
+        }
+        uint32_t seq = __atomic_load_n( &ring->seq, __ATOMIC_ACQUIRE );
+        if ( !( seq & 1 ) )
+            return seq;
+    }
+}
+
+// True if a reading went in while copying, and the copy has to be taken again
+static inline bool _ring_read_retry( const zenith_ringbuffer_t *ring, uint32_t seq ) {
+    __atomic_thread_fence( __ATOMIC_ACQUIRE );
+    return __atomic_load_n( &ring->seq, __ATOMIC_RELAXED ) != seq;
+}
+
+// Copies a ring without holding up the writer, retrying until the copy is whole. The rollups come along only for
+// out_rollups - the copy's rollups pointer is the live ring's.
+static void _ring_snapshot( const zenith_ringbuffer_t *ring, zenith_ringbuffer_t *out, zenith_rollups_t *out_rollups ) {
+    size_t spins = 0;
+    uint32_t seq;
+    do {
+        seq = _ring_read_begin( ring, &spins );
+        memcpy( out, ring, sizeof( zenith_ringbuffer_t ) );
+        if ( out_rollups )
+            memcpy( out_rollups, ring->rollups, sizeof( zenith_rollups_t ) );
+    } while ( _ring_read_retry( ring, seq ) );
+}
+
+// Copies one rollup tier of a ring the same way
+static void _rollup_snapshot( const zenith_ringbuffer_t *ring, size_t tier, zenith_registry_tier_snapshot_t *out ) {
+    const zenith_rollups_t *rollups = ring->rollups;
+    const zenith_registry_rollup_tier_t *t = &s_rollup_tiers[ tier ];
+    size_t spins = 0;
+    uint32_t seq;
+    do {
+        seq = _ring_read_begin( ring, &spins );
+        out->newest = rollups->newest[ tier ];
+        out->head = rollups->head[ tier ];
+        memcpy( out->buckets, &rollups->buckets[ t->first ], t->buckets * sizeof( zenith_rollup_bucket_t ) );
+    } while ( _ring_read_retry( ring, seq ) );
+}
+
+#if !ZENITH_REGISTRY_COMPRESSED_RINGS
+// The i-th oldest entry. The oldest is size entries behind head, wrapping around the end of the array.
+static inline const zenith_ring_entry_t *_ring_entry_at( const zenith_ringbuffer_t *ring, size_t i ) {
+    return &ring->entries[ ( ring->head + ZENITH_RING_CAPACITY - ring->size + i ) % ZENITH_RING_CAPACITY ];
+}
+#endif
+
+// Starts a reader, skipping the oldest skip readings
+static void _ring_reader_init( zenith_ring_reader_t *reader, const zenith_ringbuffer_t *ring, size_t skip ) {
+    reader->ring = ring;
+    reader->next = skip < ring->size ? skip : ring->size;
+#if ZENITH_REGISTRY_COMPRESSED_RINGS
+    // The oldest block is the one after head. Whole blocks are skipped without decoding them.
+    reader->block = 0;
+    const zenith_gorilla_block_t *block = &ring->blocks[ ( ring->head + 1 ) % ZENITH_RING_BLOCKS ];
+    while ( reader->block < ZENITH_RING_BLOCKS - 1 && skip >= block->count ) {
+        skip -= block->count;
+        reader->block++;
+        block = &ring->blocks[ ( ring->head + 1 + reader->block ) % ZENITH_RING_BLOCKS ];
+    }
+    zenith_gorilla_reader_init( &reader->gorilla, block );
+
+    int32_t offset;
+    float value;
+    while ( skip-- && zenith_gorilla_reader_next( &reader->gorilla, &offset, &value ) )
+        ;
+#endif
+}
+
+static bool _ring_reader_next( zenith_ring_reader_t *reader, zenith_reading_t *out_reading ) {
+    const zenith_ringbuffer_t *ring = reader->ring;
+    if ( reader->next >= ring->size )
+        return false;
+
+#if ZENITH_REGISTRY_COMPRESSED_RINGS
+    int32_t offset;
+    while ( !zenith_gorilla_reader_next( &reader->gorilla, &offset, &out_reading->value ) ) {
+        if ( ++reader->block >= ZENITH_RING_BLOCKS )
+            return false;
+        zenith_gorilla_reader_init( &reader->gorilla, &ring->blocks[ ( ring->head + 1 + reader->block ) % ZENITH_RING_BLOCKS ] );
     }
+    out_reading->timestamp = ring->epoch + offset;
+#else
+    const zenith_ring_entry_t *entry = _ring_entry_at( ring, reader->next );
+    out_reading->value = entry->value;
+    out_reading->timestamp = zenith_ring_entry_timestamp( ring, entry );
+#endif
+    reader->next++;
+    return true;
+}
+
+// Starts a reader at the oldest reading at or after t0. Binary searches the timestamps, taking the ring to be in time
+// order - see zenith_registry_get_history_range.
+static void _ring_reader_seek( zenith_ring_reader_t *reader, const zenith_ringbuffer_t *ring, time_t t0 ) {
+#if ZENITH_REGISTRY_COMPRESSED_RINGS
+    // Blocks can only be decoded from the start, so search on the first reading of each block, oldest block first.
+    // Empty blocks only come before the others, before the ring has wrapped once.
+    size_t low = 0;
+    size_t high = ZENITH_RING_BLOCKS;
+    while ( low < high ) {
+        size_t mid = low + ( high - low ) / 2;
+        const zenith_gorilla_block_t *block = &ring->blocks[ ( ring->head + 1 + mid ) % ZENITH_RING_BLOCKS ];
+        zenith_gorilla_reader_t first;
+        int32_t offset;
+        float value;
+        zenith_gorilla_reader_init( &first, block );
+        if ( !zenith_gorilla_reader_next( &first, &offset, &value ) || ring->epoch + offset < t0 )
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    // The reading is in the newest block starting before t0, or starts the block after it
+    size_t skip = 0;
+    for ( size_t b = 0; b + 1 < low; ++b )
+        skip += ring->blocks[ ( ring->head + 1 + b ) % ZENITH_RING_BLOCKS ].count;
+#else
+    size_t low = 0;
+    size_t high = ring->size;
+    while ( low < high ) {
+        size_t mid = low + ( high - low ) / 2;
+        if ( zenith_ring_entry_timestamp( ring, _ring_entry_at( ring, mid ) ) < t0 )
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    size_t skip = low;
+#endif
+    _ring_reader_init( reader, ring, skip );
+
+    // Decodes the rest of the way into a compressed block. Entries are already there.
+    zenith_reading_t reading;
+    for ( zenith_ring_reader_t ahead = *reader; _ring_reader_next( &ahead, &reading ) && reading.timestamp < t0; )
+        *reader = ahead;
+}
+
+// Add a reading to the ringbuffer. The offset from the epoch is clamped rather than checked - it takes a reading
+// 68 years away from the first one to hit that.
+static inline esp_err_t _ringbuffer_add_reading( zenith_ringbuffer_t *ring, zenith_reading_datatype_t value, time_t timestamp ) {
+    int64_t offset = (int64_t) timestamp - (int64_t) ring->epoch;
+    offset = offset > INT32_MAX ? INT32_MAX : offset;
+    offset = offset < INT32_MIN ? INT32_MIN : offset;
+    _ring_write_begin( ring );
+    _ringbuffer_store( ring, (int32_t) offset, value );
+
+    // Nearly every reading lands in the newest 5 minute period, and so in the newest period of every tier - they nest.
+    // Only readings outside it pay for the divisions, which are 64 bit on the C6.
+    zenith_rollups_t *rollups = ring->rollups;
+    bool newest = (uint64_t) ( timestamp - rollups->start ) < s_rollup_tiers[ ZENITH_ROLLUP_5MIN ].period;
+    for ( size_t tier = 0; tier < ZENITH_ROLLUP_TIERS; ++tier ) {
+        int32_t period = newest ? rollups->newest[ tier ] : _rollup_period( rollups, tier, timestamp );
+        if ( period < _rollup_oldest( tier, rollups->newest[ tier ] ) )
+            continue; // Readings older than a tier's window still go in the ring, they just miss that tier
+
+        zenith_rollup_bucket_t *bucket = _rollup_bucket( rollups, tier, period );
+        bucket->min = ( !bucket->count || value < bucket->min ) ? value : bucket->min;
+        bucket->max = ( !bucket->count || value > bucket->max ) ? value : bucket->max;
+
+        // Welford: a running sum of squares would lose the variance to cancellation in a float
+        bucket->count++;
+        zenith_reading_datatype_t delta = value - bucket->mean;
+        bucket->mean += delta / bucket->count;
+        bucket->m2 += delta * ( value - bucket->mean );
+    }
+    _ring_write_end( ring );
+
     return ESP_OK;
 }
 
@@ -125,152 +661,1049 @@ static int _index_of_mac( zenith_registry_handle_t handle, const zenith_mac_addr
         abort();
     }
 
-    ESP_LOGD( TAG, "index_of_mac - Registry count: %d", handle->node_count );
-    ESP_LOGD( TAG, "index_of_mac - MAC: "MACSTR, MAC2STR( mac ) );
-    for ( uint8_t i = 0; i < handle->node_count; i++ )
-        if ( memcmp( handle->nodes[i].mac, mac, ESP_NOW_ETH_ALEN ) == 0 ) 
-            return i;
+    zenith_registry_index_slot_t *slot = _index_find( handle, mac );
+    return ( slot && slot->node != ZENITH_REGISTRY_INDEX_NONE ) ? slot->node : -1;
+}
+
+// Make room for one more node
+static esp_err_t _nodes_reserve( zenith_registry_handle_t handle, size_t count ) {
+    if ( count <= handle->node_capacity )
+        return ESP_OK;
+
+    size_t capacity = handle->node_capacity ? handle->node_capacity : 8;
+    while ( capacity < count )
+        capacity *= 2;
+
+    zenith_node_info_t *nodes = realloc( handle->nodes, capacity * sizeof( zenith_node_info_t ) );
+    ESP_RETURN_ON_FALSE(
+        nodes,
+        ESP_ERR_NO_MEM,
+        TAG, "Failed to allocate node list"
+    );
+    handle->nodes = nodes;
+    handle->node_capacity = capacity;
+    return ESP_OK;
+}
+
+// Append a node that isn't in the registry yet
+static esp_err_t _nodes_append( zenith_registry_handle_t handle, const zenith_node_info_t *info ) {
+    ESP_RETURN_ON_FALSE(
+        handle->node_count < ZENITH_REGISTRY_MAX_NODES,
+        ESP_ERR_NO_MEM,
+        TAG, "Max node limit reached"
+    );
+    ESP_RETURN_ON_ERROR(
+        _nodes_reserve( handle, handle->node_count + 1 ),
+        TAG, "Failed to grow node list"
+    );
+
+    zenith_registry_index_slot_t *slot = NULL;
+    ESP_RETURN_ON_ERROR(
+        _index_get( handle, info->mac, &slot ),
+        TAG, "Failed to index node"
+    );
+
+    slot->node = handle->node_count;
+    handle->nodes[ handle->node_count++ ] = *info;
+    return ESP_OK;
+}
+
+static esp_err_t zenith_registry_load_from_nvs( zenith_registry_handle_t handle )
+{
+    esp_err_t ret = ESP_OK;
+
+    zenith_registry_nvs_blob_t *blob = NULL;
+
+    nvs_handle_t nvs;
+    //create if not exists
+    ESP_GOTO_ON_ERROR( 
+        nvs_open( ZENITH_REGISTRY_NVS_NAMESPACE, NVS_READWRITE, &nvs ),
+        end, TAG, "Failed to open NVS namespace %s", ZENITH_REGISTRY_NVS_NAMESPACE
+    );
+
+    size_t required_size = 0;
+    ESP_GOTO_ON_ERROR(
+        nvs_get_blob( nvs, ZENITH_REGISTRY_NVS_KEY, NULL, &required_size ),
+        end, TAG, "Failed to get size of NVS key %s", ZENITH_REGISTRY_NVS_KEY
+    );
+
+
+    ESP_GOTO_ON_FALSE(
+        required_size >= sizeof( zenith_registry_nvs_header_t ),
+        ESP_OK,
+        end, TAG, "NVS key %s is too small", ZENITH_REGISTRY_NVS_KEY
+    );
+
+    blob = malloc( required_size );
+    ESP_GOTO_ON_FALSE(
+        blob,
+        ESP_ERR_NO_MEM,
+        end, TAG, "Failed to allocate memory for NVS key %s", ZENITH_REGISTRY_NVS_KEY
+    );
+
+    ESP_GOTO_ON_FALSE(
+        nvs_get_blob( nvs, ZENITH_REGISTRY_NVS_KEY, blob, &required_size ) == ESP_OK,
+        ESP_OK,
+        end, TAG, "Failed to get NVS key %s", ZENITH_REGISTRY_NVS_KEY
+    );
+
+    // Version 1 counted nodes in a single byte
+    const uint8_t *raw = ( const uint8_t * ) blob;
+    size_t count = 0;
+    const zenith_node_info_t *nodes = NULL;
+    if ( blob->header.registry_version == 1 ) {
+        count = raw[ 1 ];
+        nodes = ( const zenith_node_info_t * ) ( raw + ZENITH_REGISTRY_VERSION_1_HEADER_SIZE );
+        required_size -= ZENITH_REGISTRY_VERSION_1_HEADER_SIZE;
+    } else {
+        ESP_GOTO_ON_FALSE(
+            blob->header.registry_version == ZENITH_REGISTRY_VERSION && required_size >= sizeof( zenith_registry_nvs_header_t ),
+            ESP_OK,
+            end, TAG, "NVS key %s has invalid version %d", ZENITH_REGISTRY_NVS_KEY, blob->header.registry_version
+        );
+        count = blob->header.count;
+        nodes = blob->nodes;
+        required_size -= sizeof( zenith_registry_nvs_header_t );
+    }
+
+    ESP_GOTO_ON_FALSE(
+        count <= ZENITH_REGISTRY_MAX_NODES && count * sizeof( zenith_node_info_t ) <= required_size,
+        ESP_OK,
+        end, TAG, "NVS key %s has invalid node count %u", ZENITH_REGISTRY_NVS_KEY, ( unsigned ) count
+    );
+
+    ESP_GOTO_ON_ERROR(
+        _nodes_reserve( handle, count ),
+        end, TAG, "Failed to allocate %u nodes", ( unsigned ) count
+    );
+    for ( size_t i = 0; i < count; i++ )
+        ESP_GOTO_ON_ERROR(
+            _nodes_append( handle, &nodes[ i ] ),
+            end, TAG, "Failed to load node %u", ( unsigned ) i
+        );
+    ESP_LOGD( TAG, "Loaded %u nodes from NVS", ( unsigned ) handle->node_count );
+    handle->dirty = blob->header.registry_version == 1; // Saved as version 2 once the persist task is up
+
+end:
+    nvs_close( nvs );
+
+    if ( blob)
+        free( blob );
+    
+    if ( ret == ESP_ERR_NVS_NOT_FOUND )
+        ret = ESP_OK; // No data yet — not an error
+    
+    return ret;
+}
+
+// Writes the node list to NVS if it changed since the last save. The list is only locked while it's copied, so
+// pairing carries on during the NVS write.
+static esp_err_t zenith_registry_save_to_nvs( zenith_registry_handle_t handle )
+{
+    esp_err_t ret = ESP_OK;
+    xSemaphoreTake( handle->save_lock, portMAX_DELAY );
+    xSemaphoreTake( handle->nodes_lock, portMAX_DELAY );
+
+    if ( !handle->dirty ) {
+        xSemaphoreGive( handle->nodes_lock );
+        xSemaphoreGive( handle->save_lock );
+        return ESP_OK;
+    }
+
+    size_t blob_size = sizeof( zenith_registry_nvs_header_t ) + handle->node_count * sizeof( zenith_node_info_t );
+    zenith_registry_nvs_blob_t *blob = malloc( blob_size );
+    if ( blob ) {
+        blob->header.registry_version = ZENITH_REGISTRY_VERSION;
+        blob->header.reserved = 0;
+        blob->header.count = handle->node_count;
+        memcpy( blob->nodes, handle->nodes, handle->node_count * sizeof( zenith_node_info_t ) );
+        handle->dirty = false; // Changes from here on go in the next save
+    }
+    xSemaphoreGive( handle->nodes_lock );
+
+    nvs_handle_t nvs = 0;
+    ESP_GOTO_ON_FALSE(
+        blob,
+        ESP_ERR_NO_MEM,
+        end,
+        TAG, "Failed to allocate memory for NVS key %s", ZENITH_REGISTRY_NVS_KEY
+    );
+
+    ESP_GOTO_ON_ERROR(
+        nvs_open( ZENITH_REGISTRY_NVS_NAMESPACE, NVS_READWRITE, &nvs ),
+        end, 
+        TAG, "Failed to open NVS namespace %s", ZENITH_REGISTRY_NVS_NAMESPACE
+    );
+
+    ESP_GOTO_ON_ERROR(
+        nvs_set_blob( nvs, ZENITH_REGISTRY_NVS_KEY, blob, blob_size ),
+        end, 
+        TAG, "Failed to set NVS key %s", ZENITH_REGISTRY_NVS_KEY
+    );
+
+    ESP_GOTO_ON_ERROR(
+        nvs_commit( nvs ),
+        end,
+        TAG, "Failed to commit NVS key %s", ZENITH_REGISTRY_NVS_KEY
+    );
+    
+end:
+    if ( nvs )
+        nvs_close( nvs );
+    if ( blob )
+        free( blob );
+
+    xSemaphoreTake( handle->nodes_lock, portMAX_DELAY );
+    if ( ret == ESP_OK ) {
+        handle->persist_stats.saves++;
+    } else {
+        handle->persist_stats.save_failures++;
+        handle->dirty = true;
+    }
+    xSemaphoreGive( handle->nodes_lock );
+    xSemaphoreGive( handle->save_lock );
+
+    return ret;
+}
+
+static esp_err_t _checkpoint_write( zenith_registry_handle_t handle );
+
+// Saves the node list in the background. Sleeps until the list changes, then waits for
+// ZENITH_REGISTRY_PERSIST_QUIET_MS without changes - but no more than ZENITH_REGISTRY_PERSIST_MAX_DELAY_MS in all -
+// so a burst of pairings is saved once. With checkpoint storage attached it also wakes up every
+// ZENITH_REGISTRY_CHECKPOINT_INTERVAL_MS to checkpoint the rings, if there's new data.
+static void _persist_task( void *arg ) {
+    zenith_registry_handle_t handle = arg;
+
+    while ( !handle->persist_stop ) {
+        TickType_t wait = portMAX_DELAY;
+        if ( handle->checkpoint_storage ) {
+            TickType_t since = xTaskGetTickCount() - handle->checkpoint_at;
+            wait = since >= pdMS_TO_TICKS( ZENITH_REGISTRY_CHECKPOINT_INTERVAL_MS ) ? 0 : pdMS_TO_TICKS( ZENITH_REGISTRY_CHECKPOINT_INTERVAL_MS ) - since;
+        }
+        if ( ulTaskNotifyTake( pdTRUE, wait ) == 0 ) {
+            if ( handle->data_dirty )
+                _checkpoint_write( handle );
+            handle->checkpoint_at = xTaskGetTickCount();
+            continue;
+        }
+        if ( !handle->dirty )
+            continue; // Woken to pick up the checkpoint storage, or to stop
+
+        TickType_t first = xTaskGetTickCount();
+        while ( !handle->persist_stop ) {
+            TickType_t waited = xTaskGetTickCount() - first;
+            if ( waited >= pdMS_TO_TICKS( ZENITH_REGISTRY_PERSIST_MAX_DELAY_MS ) )
+                break;
+            TickType_t wait = pdMS_TO_TICKS( ZENITH_REGISTRY_PERSIST_MAX_DELAY_MS ) - waited;
+            if ( wait > pdMS_TO_TICKS( ZENITH_REGISTRY_PERSIST_QUIET_MS ) )
+                wait = pdMS_TO_TICKS( ZENITH_REGISTRY_PERSIST_QUIET_MS );
+            if ( ulTaskNotifyTake( pdTRUE, wait ) == 0 )
+                break; // Quiet
+        }
+
+        // A failed save leaves the list dirty. Come round again and retry after the quiet time.
+        if ( zenith_registry_save_to_nvs( handle ) != ESP_OK && !handle->persist_stop )
+            xTaskNotifyGive( xTaskGetCurrentTaskHandle() );
+    }
+
+    xSemaphoreGive( handle->persist_done );
+    vTaskDelete( NULL );
+}
+
+// Marks the node list as changed. Must be called with nodes_lock held.
+static void _persist_mark_dirty( zenith_registry_handle_t handle ) {
+    handle->dirty = true;
+    handle->persist_stats.changes++;
+    if ( handle->persist_task )
+        xTaskNotifyGive( handle->persist_task );
+}
+
+// checkpoint
+
+// Slots are half the storage each, in whole sectors
+static inline size_t _checkpoint_slot_size( zenith_log_storage_handle_t storage ) {
+    return storage->size / 2 / ZENITH_LOG_SEGMENT_SIZE * ZENITH_LOG_SEGMENT_SIZE;
+}
+
+static inline const zenith_registry_checkpoint_header_t *_checkpoint_header( zenith_log_storage_handle_t storage, int slot ) {
+    return ( const zenith_registry_checkpoint_header_t * ) ( storage->data + slot * _checkpoint_slot_size( storage ) );
+}
+
+// Checks a slot's header and crc. The crc is a sequential read over the mapped slot.
+static bool _checkpoint_valid( zenith_log_storage_handle_t storage, int slot ) {
+    const zenith_registry_checkpoint_header_t *header = _checkpoint_header( storage, slot );
+    if ( header->magic != ZENITH_REGISTRY_CHECKPOINT_MAGIC || header->version != ZENITH_REGISTRY_CHECKPOINT_VERSION
+            || header->record_size != sizeof( zenith_registry_checkpoint_record_t ) )
+        return false;
+    if ( header->count > ( _checkpoint_slot_size( storage ) - sizeof( *header ) ) / sizeof( zenith_registry_checkpoint_record_t ) )
+        return false;
+    return header->crc == esp_rom_crc32_le( 0, ( const uint8_t * ) ( header + 1 ), header->count * sizeof( zenith_registry_checkpoint_record_t ) );
+}
+
+// A ring from flash is trusted as far as its crc goes - these are the fields the ring code indexes with
+static bool _checkpoint_ring_valid( const zenith_registry_checkpoint_record_t *record ) {
+    const zenith_ringbuffer_t *ring = &record->ring;
+    if ( ring->type >= ZENITH_REGISTRY_MAX_RINGS )
+        return false;
+    for ( size_t tier = 0; tier < ZENITH_ROLLUP_TIERS; ++tier )
+        if ( record->rollups.head[ tier ] >= s_rollup_tiers[ tier ].buckets )
+            return false;
+#if ZENITH_REGISTRY_COMPRESSED_RINGS
+    for ( size_t i = 0; i < ZENITH_RING_BLOCKS; ++i )
+        if ( ring->blocks[ i ].bits > sizeof( ring->blocks[ i ].data ) * 8 )
+            return false;
+    return ring->head < ZENITH_RING_BLOCKS;
+#else
+    return ring->head < ZENITH_RING_CAPACITY && ring->size <= ZENITH_RING_CAPACITY;
+#endif
+}
+
+// Takes a ring from a checkpoint or an import, unless the node has one of the type already - its readings came in
+// since, so they're newer. out_node is where the ring went, NULL when it wasn't taken.
+static esp_err_t _restore_ring( zenith_registry_handle_t handle, const zenith_registry_checkpoint_record_t *record, zenith_node_runtime_t **out_node ) {
+    zenith_node_runtime_t *node = NULL;
+    zenith_ringbuffer_t *ring = NULL;
+    *out_node = NULL;
+    ESP_RETURN_ON_ERROR(
+        _get_node_runtime_data( handle, record->mac, &node ),
+        TAG, "Failed to restore node "MACSTR, MAC2STR( record->mac )
+    );
+    if ( node->rings[ record->ring.type ] )
+        return ESP_OK;
+    ESP_RETURN_ON_ERROR(
+        _new_ringbuffer( handle, node, record->ring.type, record->ring.epoch, record, &ring ),
+        TAG, "Failed to restore ring of "MACSTR, MAC2STR( record->mac )
+    );
+    *out_node = node;
+    return ESP_OK;
+}
+
+// Finds the newest valid slot, so the next checkpoint goes in the other one
+static void _checkpoint_find( zenith_registry_handle_t handle, zenith_log_storage_handle_t storage ) {
+    handle->checkpoint_slot = -1;
+    for ( int slot = 0; slot < 2; ++slot ) {
+        if ( !_checkpoint_valid( storage, slot ) )
+            continue;
+        uint32_t seq = _checkpoint_header( storage, slot )->seq;
+        if ( handle->checkpoint_slot < 0 || ( int32_t ) ( seq - handle->checkpoint_seq ) > 0 ) {
+            handle->checkpoint_slot = slot;
+            handle->checkpoint_seq = seq;
+        }
+    }
+}
+
+// Restores the rings from the newest valid slot. Under save_lock, so a checkpoint can't move it meanwhile.
+static esp_err_t _checkpoint_restore( zenith_registry_handle_t handle ) {
+    zenith_log_storage_handle_t storage = handle->checkpoint_storage;
+    if ( handle->checkpoint_slot < 0 ) {
+        ESP_LOGI( TAG, "No checkpoint to restore" );
+        return ESP_OK;
+    }
+
+    const zenith_registry_checkpoint_header_t *header = _checkpoint_header( storage, handle->checkpoint_slot );
+    const zenith_registry_checkpoint_record_t *records = ( const zenith_registry_checkpoint_record_t * ) ( header + 1 );
+    uint32_t restored = 0;
+    for ( uint32_t i = 0; i < header->count; ++i ) {
+        const zenith_registry_checkpoint_record_t *record = &records[ i ];
+        if ( !_checkpoint_ring_valid( record ) )
+            continue;
+
+        zenith_node_runtime_t *node = NULL;
+        ESP_RETURN_ON_ERROR( _restore_ring( handle, record, &node ), TAG, "Failed to restore checkpoint" );
+        restored += node != NULL;
+    }
+
+    handle->persist_stats.rings_restored = restored;
+    ESP_LOGI( TAG, "Restored %u rings from checkpoint %u, saved at %lld",
+              ( unsigned ) restored, ( unsigned ) handle->checkpoint_seq, ( long long ) header->saved_at );
+    return ESP_OK;
+}
+
+// Writes every ring to the slot the newest checkpoint isn't in: erase, records, then the header
+static esp_err_t _checkpoint_write( zenith_registry_handle_t handle ) {
+    zenith_log_storage_handle_t storage = handle->checkpoint_storage;
+    ESP_RETURN_ON_FALSE(
+        storage,
+        ESP_ERR_INVALID_STATE,
+        TAG, "No checkpoint storage attached"
+    );
+
+    esp_err_t ret = ESP_OK;
+    uint32_t crc = 0;
+    size_t written = 0;
+    xSemaphoreTake( handle->save_lock, portMAX_DELAY );
+    handle->data_dirty = false; // Readings from here on go in the next one
+
+    // Rings that don't fit in a slot are left out - there's room for a few hundred in the core's partition
+    int slot = handle->checkpoint_slot == 0 ? 1 : 0;
+    size_t slot_size = _checkpoint_slot_size( storage );
+    size_t capacity = ( slot_size - sizeof( zenith_registry_checkpoint_header_t ) ) / sizeof( zenith_registry_checkpoint_record_t );
+    size_t count = handle->ring_arena.count < capacity ? handle->ring_arena.count : capacity;
+    if ( count < handle->ring_arena.count )
+        ESP_LOGW( TAG, "Checkpoint only has room for %u of %u rings", ( unsigned ) count, ( unsigned ) handle->ring_arena.count );
+
+    size_t offset = slot * slot_size;
+    size_t len = sizeof( zenith_registry_checkpoint_header_t ) + count * sizeof( zenith_registry_checkpoint_record_t );
+    size_t erase_len = ( len + ZENITH_LOG_SEGMENT_SIZE - 1 ) / ZENITH_LOG_SEGMENT_SIZE * ZENITH_LOG_SEGMENT_SIZE;
+    zenith_registry_checkpoint_record_t *record = malloc( sizeof( zenith_registry_checkpoint_record_t ) );
+    ESP_GOTO_ON_FALSE(
+        record,
+        ESP_ERR_NO_MEM,
+        end,
+        TAG, "Failed to allocate checkpoint record"
+    );
+    ESP_GOTO_ON_ERROR(
+        storage->erase( storage, offset, erase_len ),
+        end,
+        TAG, "Failed to erase checkpoint slot %d", slot
+    );
+
+    // Rings are looked up under the lock, since new ones can be allocated meanwhile, and copied with the seqlock
+    memset( record, 0, sizeof( *record ) );
+    for ( size_t n = 0; n < handle->runtime_arena.count && written < count; ++n ) {
+        for ( size_t type = 0; type < ZENITH_REGISTRY_MAX_RINGS && written < count; ++type ) {
+            xSemaphoreTake( handle->nodes_lock, portMAX_DELAY );
+            const zenith_node_runtime_t *node = _arena_at( &handle->runtime_arena, n );
+            const zenith_ringbuffer_t *ring = node->rings[ type ];
+            memcpy( record->mac, node->mac, sizeof( zenith_mac_address_t ) );
+            xSemaphoreGive( handle->nodes_lock );
+            if ( !ring )
+                continue;
+            _ring_snapshot( ring, &record->ring, &record->rollups );
+            record->ring.rollups = NULL; // Means nothing on the next boot
+
+            size_t record_offset = offset + sizeof( zenith_registry_checkpoint_header_t ) + written * sizeof( zenith_registry_checkpoint_record_t );
+            ESP_GOTO_ON_ERROR(
+                storage->write( storage, record_offset, record, sizeof( *record ) ),
+                end,
+                TAG, "Failed to write checkpoint record"
+            );
+            crc = esp_rom_crc32_le( crc, ( const uint8_t * ) record, sizeof( *record ) );
+            written++;
+        }
+    }
+
+    zenith_registry_checkpoint_header_t header = {
+        .magic = ZENITH_REGISTRY_CHECKPOINT_MAGIC,
+        .version = ZENITH_REGISTRY_CHECKPOINT_VERSION,
+        .record_size = sizeof( zenith_registry_checkpoint_record_t ),
+        .seq = handle->checkpoint_seq + 1,
+        .count = written,
+        .crc = crc,
+        .saved_at = time( NULL ),
+    };
+    ESP_GOTO_ON_ERROR(
+        storage->write( storage, offset, &header, sizeof( header ) ),
+        end,
+        TAG, "Failed to write checkpoint header"
+    );
+    handle->checkpoint_slot = slot;
+    handle->checkpoint_seq = header.seq;
+
+end:
+    free( record );
+    xSemaphoreTake( handle->nodes_lock, portMAX_DELAY );
+    if ( ret == ESP_OK ) {
+        handle->persist_stats.checkpoints++;
+        handle->persist_stats.checkpoint_bytes = sizeof( zenith_registry_checkpoint_header_t ) + written * sizeof( zenith_registry_checkpoint_record_t );
+    } else {
+        handle->persist_stats.checkpoint_failures++;
+        handle->data_dirty = true;
+    }
+    xSemaphoreGive( handle->nodes_lock );
+    xSemaphoreGive( handle->save_lock );
+    return ret;
+}
+
+// events
+
+static bool _events_filter_matches( const zenith_registry_filter_t *filter, const zenith_registry_event_info_t *info ) {
+    if ( filter->events && !( filter->events & ZENITH_REGISTRY_EVENT_BIT( info->event ) ) )
+        return false;
+    if ( filter->match_mac && memcmp( filter->mac, info->mac, sizeof( zenith_mac_address_t ) ) != 0 )
+        return false;
+    return info->event != ZENITH_REGISTRY_EVENT_READING_UPDATED || !filter->sensor_types || ( filter->sensor_types & info->sensor_types );
+}
+
+// Runs the callbacks of the subscribers that want the event
+static void _events_deliver( zenith_registry_handle_t handle, const zenith_registry_event_info_t *info ) {
+    xSemaphoreTake( handle->events_lock, portMAX_DELAY );
+    for ( size_t i = 0; i < ZENITH_REGISTRY_MAX_SUBSCRIBERS; ++i ) {
+        zenith_registry_subscriber_t *subscriber = &handle->subscribers[ i ];
+        if ( !subscriber->used || !_events_filter_matches( &subscriber->filter, info ) )
+            continue;
+        if ( subscriber->legacy )
+            subscriber->legacy( info->event, info->mac );
+        else
+            subscriber->callback( info, subscriber->context );
+        handle->event_stats.delivered++;
+    }
+    xSemaphoreGive( handle->events_lock );
+}
+
+// Delivers the queued events, one at a time and in order, until zenith_registry_delete queues the stop
+static void _events_task( void *arg ) {
+    zenith_registry_handle_t handle = arg;
+    zenith_registry_queued_event_t queued;
+
+    while ( xQueueReceive( handle->events_queue, &queued, portMAX_DELAY ) == pdTRUE && queued.event != ZENITH_REGISTRY_EVENT_STOP ) {
+        uint32_t waiting = 1 + uxQueueMessagesWaiting( handle->events_queue );
+        if ( waiting > handle->event_stats.queue_high_water )
+            handle->event_stats.queue_high_water = waiting;
+
+        zenith_registry_event_info_t info = { .event = queued.event };
+        memcpy( info.mac, queued.mac, sizeof( zenith_mac_address_t ) );
+        // Taking the types lets the next reading queue a new event - it's news to the subscribers from here on
+        if ( queued.event == ZENITH_REGISTRY_EVENT_READING_UPDATED )
+            info.sensor_types = __atomic_exchange_n( &queued.node->events_pending, 0, __ATOMIC_ACQ_REL );
+        _events_deliver( handle, &info );
+    }
+
+    xSemaphoreGive( handle->events_done );
+    vTaskDelete( NULL );
+}
+
+// Queues a node event. Never blocks - a full queue drops it.
+static void _events_post( zenith_registry_handle_t handle, zenith_registry_event_t event, const zenith_mac_address_t mac ) {
+    if ( !handle->subscriber_count )
+        return;
+
+    if ( !handle->events_queue ) {
+        zenith_registry_event_info_t info = { .event = event };
+        memcpy( info.mac, mac, sizeof( zenith_mac_address_t ) );
+        _events_deliver( handle, &info );
+        return;
+    }
+
+    zenith_registry_queued_event_t queued = { .event = event };
+    memcpy( queued.mac, mac, sizeof( zenith_mac_address_t ) );
+    if ( xQueueSend( handle->events_queue, &queued, 0 ) == pdTRUE )
+        handle->event_stats.posted++;
+    else
+        handle->event_stats.dropped++;
+}
+
+// Queues a READING_UPDATED, unless the node already has one waiting - then the sensor types are added to that one
+static void _events_post_reading( zenith_registry_handle_t handle, zenith_node_runtime_t *node, uint8_t sensor_types ) {
+    if ( !handle->subscriber_count )
+        return;
+
+    if ( !handle->events_queue ) {
+        zenith_registry_event_info_t info = { .event = ZENITH_REGISTRY_EVENT_READING_UPDATED, .sensor_types = sensor_types };
+        memcpy( info.mac, node->mac, sizeof( zenith_mac_address_t ) );
+        _events_deliver( handle, &info );
+        return;
+    }
+
+    if ( __atomic_fetch_or( &node->events_pending, sensor_types, __ATOMIC_ACQ_REL ) ) {
+        handle->event_stats.coalesced++;
+        return;
+    }
+
+    zenith_registry_queued_event_t queued = { .event = ZENITH_REGISTRY_EVENT_READING_UPDATED, .node = node };
+    memcpy( queued.mac, node->mac, sizeof( zenith_mac_address_t ) );
+    if ( xQueueSend( handle->events_queue, &queued, 0 ) == pdTRUE ) {
+        handle->event_stats.posted++;
+    } else {
+        // Nothing of this node's is queued, so the next reading can try again
+        __atomic_store_n( &node->events_pending, 0, __ATOMIC_RELEASE );
+        handle->event_stats.deferred++;
+    }
+}
+
+esp_err_t zenith_registry_new( zenith_registry_handle_t *out_handle )
+{
+    ESP_RETURN_ON_FALSE( out_handle, ESP_ERR_INVALID_ARG, TAG, "out_handle is NULL" );
+
+    zenith_registry_handle_t handle = NULL;
+    handle = calloc( 1, sizeof( struct zenith_registry_s ) );
+    ESP_RETURN_ON_FALSE( handle, ESP_ERR_NO_MEM, TAG, "Failed to allocate registry handle" );
+    _arena_init( &handle->runtime_arena, sizeof( zenith_node_runtime_t ), ZENITH_REGISTRY_RUNTIME_CHUNK_ITEMS );
+    _arena_init( &handle->ring_arena, sizeof( zenith_registry_ring_item_t ), ZENITH_REGISTRY_RING_CHUNK_ITEMS );
+
+    handle->nodes_lock = xSemaphoreCreateMutex();
+    handle->save_lock = xSemaphoreCreateMutex();
+    handle->persist_done = xSemaphoreCreateBinary();
+    handle->events_lock = xSemaphoreCreateMutex();
+    handle->events_done = xSemaphoreCreateBinary();
+    if ( !handle->nodes_lock || !handle->save_lock || !handle->persist_done || !handle->events_lock || !handle->events_done ) {
+        ESP_LOGE( TAG, "Failed to create registry locks" );
+        zenith_registry_delete( handle );
+        return ESP_ERR_NO_MEM;
+    }
+
+    if ( zenith_registry_load_from_nvs( handle ) != ESP_OK ) 
+        ESP_LOGD( TAG, "Failed to load registry from NVS" );
+
+    // Without the task every change is saved right away, like before there was one
+    if ( xTaskCreate( _persist_task, "zr_persist", 4096, handle, tskIDLE_PRIORITY, &handle->persist_task ) != pdPASS ) {
+        ESP_LOGW( TAG, "Failed to create persist task, saving synchronously" );
+        handle->persist_task = NULL;
+    } else if ( handle->dirty ) {
+        xTaskNotifyGive( handle->persist_task );
+    }
+
+    // Without the event task, or room for its queue, subscribers are called on the receive task like the old callback
+    handle->events_queue = xQueueCreate( ZENITH_REGISTRY_EVENT_QUEUE_LEN, sizeof( zenith_registry_queued_event_t ) );
+    if ( !handle->events_queue || xTaskCreate( _events_task, "zr_events", 4096, handle, ZENITH_REGISTRY_EVENT_TASK_PRIORITY, &handle->events_task ) != pdPASS ) {
+        ESP_LOGW( TAG, "Failed to create event task, delivering events synchronously" );
+        if ( handle->events_queue )
+            vQueueDelete( handle->events_queue );
+        handle->events_queue = NULL;
+        handle->events_task = NULL;
+    }
+    
+    *out_handle = handle;
+    return ESP_OK;
+}
+
+esp_err_t zenith_registry_delete( zenith_registry_handle_t handle )
+{
+    if ( handle ) {
+        if ( handle->events_task ) {
+            zenith_registry_queued_event_t stop = { .event = ZENITH_REGISTRY_EVENT_STOP };
+            xQueueSend( handle->events_queue, &stop, portMAX_DELAY ); // Events queued before it are still delivered
+            xSemaphoreTake( handle->events_done, portMAX_DELAY );
+        }
+        if ( handle->events_queue )
+            vQueueDelete( handle->events_queue );
+        if ( handle->events_lock )
+            vSemaphoreDelete( handle->events_lock );
+        if ( handle->events_done )
+            vSemaphoreDelete( handle->events_done );
+        if ( handle->persist_task ) {
+            handle->persist_stop = true;
+            xTaskNotifyGive( handle->persist_task );
+            xSemaphoreTake( handle->persist_done, portMAX_DELAY );
+        }
+        if ( handle->nodes_lock && handle->save_lock )
+            zenith_registry_save_to_nvs( handle );
+        if ( handle->nodes_lock )
+            vSemaphoreDelete( handle->nodes_lock );
+        if ( handle->save_lock )
+            vSemaphoreDelete( handle->save_lock );
+        if ( handle->persist_done )
+            vSemaphoreDelete( handle->persist_done );
+        _arena_free( &handle->ring_arena );
+        _arena_free( &handle->runtime_arena );
+        free( handle->nodes );
+        free( handle->index );
+        free( handle );
+    }
+    return ESP_OK;
+}
+
+// Takes a free subscriber slot and fills it in from wanted
+static esp_err_t _subscribe( zenith_registry_handle_t handle, const zenith_registry_subscriber_t *wanted, zenith_registry_subscriber_handle_t *out_subscriber ) {
+    zenith_registry_subscriber_t *subscriber = NULL;
+    xSemaphoreTake( handle->events_lock, portMAX_DELAY );
+    for ( size_t i = 0; i < ZENITH_REGISTRY_MAX_SUBSCRIBERS && !subscriber; ++i ) {
+        if ( handle->subscribers[ i ].used )
+            continue;
+        subscriber = &handle->subscribers[ i ];
+        *subscriber = *wanted;
+        subscriber->used = true;
+        handle->subscriber_count++;
+    }
+    xSemaphoreGive( handle->events_lock );
+    ESP_RETURN_ON_FALSE(
+        subscriber,
+        ESP_ERR_NO_MEM,
+        TAG, "All %d subscriber slots taken", ZENITH_REGISTRY_MAX_SUBSCRIBERS
+    );
+
+    *out_subscriber = subscriber;
+    return ESP_OK;
+}
+
+esp_err_t zenith_registry_register_callback( zenith_registry_handle_t handle, zenith_registry_callback_t callback )
+{
+    ESP_RETURN_ON_FALSE( handle, ESP_ERR_INVALID_ARG, TAG, "handle is NULL" );
+
+    if ( handle->legacy_subscriber ) {
+        zenith_registry_unsubscribe( handle, handle->legacy_subscriber );
+        handle->legacy_subscriber = NULL;
+    }
+    if ( !callback )
+        return ESP_OK;
+
+    zenith_registry_subscriber_t wanted = { .legacy = callback };
+    return _subscribe( handle, &wanted, &handle->legacy_subscriber );
+}
+
+esp_err_t zenith_registry_subscribe( zenith_registry_handle_t handle, const zenith_registry_filter_t *filter, zenith_registry_subscriber_cb_t callback, void *context, zenith_registry_subscriber_handle_t *out_subscriber )
+{
+    ESP_RETURN_ON_FALSE(
+        handle && callback && out_subscriber,
+        ESP_ERR_INVALID_ARG,
+        TAG, "Invalid args to subscribe"
+    );
+
+    zenith_registry_subscriber_t wanted = {
+        .filter = filter ? *filter : ( zenith_registry_filter_t ) { 0 },
+        .callback = callback,
+        .context = context,
+    };
+    return _subscribe( handle, &wanted, out_subscriber );
+}
+
+esp_err_t zenith_registry_unsubscribe( zenith_registry_handle_t handle, zenith_registry_subscriber_handle_t subscriber )
+{
+    ESP_RETURN_ON_FALSE(
+        handle && subscriber && subscriber >= handle->subscribers && subscriber < handle->subscribers + ZENITH_REGISTRY_MAX_SUBSCRIBERS,
+        ESP_ERR_INVALID_ARG,
+        TAG, "Invalid args to unsubscribe"
+    );
+
+    // The event task holds the lock while it runs callbacks, so this waits for one that's running to return
+    xSemaphoreTake( handle->events_lock, portMAX_DELAY );
+    if ( subscriber->used ) {
+        subscriber->used = false;
+        handle->subscriber_count--;
+    }
+    xSemaphoreGive( handle->events_lock );
+    return ESP_OK;
+}
+
+esp_err_t zenith_registry_get_event_stats( zenith_registry_handle_t handle, zenith_registry_event_stats_t *out_stats )
+{
+    ESP_RETURN_ON_FALSE( handle && out_stats, ESP_ERR_INVALID_ARG, TAG, "Invalid args to get_event_stats" );
+    *out_stats = handle->event_stats;
+    return ESP_OK;
+}
+
+esp_err_t zenith_registry_flush( zenith_registry_handle_t handle )
+{
+    ESP_RETURN_ON_FALSE( handle, ESP_ERR_INVALID_ARG, TAG, "handle is NULL" );
+    return zenith_registry_save_to_nvs( handle );
+}
+
+esp_err_t zenith_registry_attach_checkpoint( zenith_registry_handle_t handle, zenith_log_storage_handle_t storage )
+{
+    ESP_RETURN_ON_FALSE(
+        handle && storage && !handle->checkpoint_storage && _checkpoint_slot_size( storage ) > sizeof( zenith_registry_checkpoint_header_t ) + sizeof( zenith_registry_checkpoint_record_t ),
+        ESP_ERR_INVALID_ARG,
+        TAG, "Invalid args to attach_checkpoint"
+    );
+
+    // The persist task starts checkpointing once checkpoint_storage is set, so that comes last
+    handle->checkpoint_at = xTaskGetTickCount();
+    _checkpoint_find( handle, storage );
+    handle->checkpoint_storage = storage;
+    if ( handle->persist_task )
+        xTaskNotifyGive( handle->persist_task ); // Picks up the checkpoint interval
+    return ESP_OK;
+}
+
+esp_err_t zenith_registry_restore_checkpoint( zenith_registry_handle_t handle )
+{
+    ESP_RETURN_ON_FALSE( handle, ESP_ERR_INVALID_ARG, TAG, "handle is NULL" );
+    ESP_RETURN_ON_FALSE(
+        handle->checkpoint_storage,
+        ESP_ERR_INVALID_STATE,
+        TAG, "No checkpoint storage attached"
+    );
 
-    return -1; // Not found
+    xSemaphoreTake( handle->save_lock, portMAX_DELAY );
+    esp_err_t ret = _checkpoint_restore( handle );
+    xSemaphoreGive( handle->save_lock );
+    return ret;
 }
 
-static esp_err_t zenith_registry_load_from_nvs( zenith_registry_handle_t handle )
+esp_err_t zenith_registry_checkpoint( zenith_registry_handle_t handle )
 {
-    esp_err_t ret = ESP_OK;
-
-    zenith_registry_nvs_blob_t *blob = NULL;
+    ESP_RETURN_ON_FALSE( handle, ESP_ERR_INVALID_ARG, TAG, "handle is NULL" );
+    return _checkpoint_write( handle );
+}
 
-    nvs_handle_t nvs;
-    //create if not exists
-    ESP_GOTO_ON_ERROR( 
-        nvs_open( ZENITH_REGISTRY_NVS_NAMESPACE, NVS_READWRITE, &nvs ),
-        end, TAG, "Failed to open NVS namespace %s", ZENITH_REGISTRY_NVS_NAMESPACE
-    );
+esp_err_t zenith_registry_get_persist_stats( zenith_registry_handle_t handle, zenith_registry_persist_stats_t *out_stats )
+{
+    ESP_RETURN_ON_FALSE( handle && out_stats, ESP_ERR_INVALID_ARG, TAG, "Invalid args to get_persist_stats" );
 
-    size_t required_size = 0;
-    ESP_GOTO_ON_ERROR(
-        nvs_get_blob( nvs, ZENITH_REGISTRY_NVS_KEY, NULL, &required_size ),
-        end, TAG, "Failed to get size of NVS key %s", ZENITH_REGISTRY_NVS_KEY
-    );
+    xSemaphoreTake( handle->nodes_lock, portMAX_DELAY );
+    *out_stats = handle->persist_stats;
+    out_stats->dirty = handle->dirty;
+    xSemaphoreGive( handle->nodes_lock );
+    return ESP_OK;
+}
 
+// export
+
+// Stages of an import - what it's collecting
+typedef enum zenith_registry_import_stage_e {
+    ZENITH_REGISTRY_IMPORT_HEADER,
+    ZENITH_REGISTRY_IMPORT_RECORD,  // a record header
+    ZENITH_REGISTRY_IMPORT_PAYLOAD,
+    ZENITH_REGISTRY_IMPORT_SKIP,    // the payload of a record with a tag it doesn't know
+    ZENITH_REGISTRY_IMPORT_DONE,
+} zenith_registry_import_stage_t;
+
+// Writes a record header with the payload's crc, then the payload
+static esp_err_t _export_record( zenith_registry_export_write_t write, void *context, uint8_t tag, const void *payload, size_t size ) {
+    zenith_registry_export_record_t record = {
+        .tag = tag,
+        .size = size,
+        .crc = esp_rom_crc32_le( 0, payload, size ),
+    };
+    esp_err_t ret = write( &record, sizeof( record ), context );
+    return ret == ESP_OK ? write( payload, size, context ) : ret;
+}
 
-    ESP_GOTO_ON_FALSE(
-        required_size >= sizeof( zenith_registry_nvs_header_t ),
-        ESP_OK,
-        end, TAG, "NVS key %s is too small", ZENITH_REGISTRY_NVS_KEY
-    );
+// Payload size of the tags the import knows, 0 for the rest
+static size_t _import_payload_size( uint8_t tag ) {
+    switch ( tag ) {
+        case ZENITH_REGISTRY_EXPORT_NODE: return sizeof( zenith_node_info_t );
+        case ZENITH_REGISTRY_EXPORT_RING: return sizeof( zenith_registry_checkpoint_record_t );
+        case ZENITH_REGISTRY_EXPORT_END: return sizeof( zenith_registry_export_end_t );
+        default: return 0;
+    }
+}
 
-    blob = malloc( required_size );
-    ESP_GOTO_ON_FALSE(
-        blob,
-        ESP_ERR_NO_MEM,
-        end, TAG, "Failed to allocate memory for NVS key %s", ZENITH_REGISTRY_NVS_KEY
+static esp_err_t _import_payload( zenith_registry_import_t *import ) {
+    ESP_RETURN_ON_FALSE(
+        import->record.crc == esp_rom_crc32_le( 0, ( const uint8_t * ) &import->piece, import->record.size ),
+        ESP_ERR_INVALID_CRC,
+        TAG, "Import record %u has a bad crc", ( unsigned ) ( import->seen.nodes + import->seen.rings )
     );
 
-    ESP_GOTO_ON_FALSE(
-        nvs_get_blob( nvs, ZENITH_REGISTRY_NVS_KEY, blob, &required_size ) == ESP_OK,
-        ESP_OK,
-        end, TAG, "Failed to get NVS key %s", ZENITH_REGISTRY_NVS_KEY
-    );
+    zenith_registry_handle_t handle = import->handle;
+    switch ( import->record.tag ) {
+        case ZENITH_REGISTRY_EXPORT_NODE:
+            ESP_RETURN_ON_ERROR(
+                zenith_registry_store_node_info( handle, &import->piece.node ),
+                TAG, "Failed to import node "MACSTR, MAC2STR( import->piece.node.mac )
+            );
+            import->seen.nodes++;
+            break;
+
+        case ZENITH_REGISTRY_EXPORT_RING: {
+            const zenith_registry_checkpoint_record_t *record = &import->piece.ring;
+            zenith_node_runtime_t *node = NULL;
+            ESP_RETURN_ON_FALSE(
+                _checkpoint_ring_valid( record ),
+                ESP_ERR_INVALID_ARG,
+                TAG, "Import has a broken ring of "MACSTR, MAC2STR( record->mac )
+            );
+            ESP_RETURN_ON_ERROR( _restore_ring( handle, record, &node ), TAG, "Failed to import ring" );
+
+            if ( node ) {
+                handle->data_dirty = true; // Goes in the next checkpoint
+                _events_post_reading( handle, node, 1u << record->ring.type );
+            } else {
+                import->rings_kept++;
+            }
+            import->seen.rings++;
+            break;
+        }
 
-    ESP_GOTO_ON_FALSE(
-        blob->header.registry_version == ZENITH_REGISTRY_VERSION,
-        ESP_OK,
-        end, TAG, "NVS key %s has invalid version %d", ZENITH_REGISTRY_NVS_KEY, blob->header.registry_version
-    );
+        case ZENITH_REGISTRY_EXPORT_END:
+            ESP_RETURN_ON_FALSE(
+                import->piece.end.nodes == import->seen.nodes && import->piece.end.rings == import->seen.rings,
+                ESP_ERR_INVALID_SIZE,
+                TAG, "Import has %u nodes and %u rings, the export %u and %u",
+                ( unsigned ) import->seen.nodes, ( unsigned ) import->seen.rings,
+                ( unsigned ) import->piece.end.nodes, ( unsigned ) import->piece.end.rings
+            );
+            import->stage = ZENITH_REGISTRY_IMPORT_DONE;
+            break;
+    }
+    return ESP_OK;
+}
 
-    ESP_GOTO_ON_FALSE(
-        blob->header.count <= ZENITH_REGISTRY_MAX_NODES,
-        ESP_OK,
-        end, TAG, "NVS key %s has too many nodes %d", ZENITH_REGISTRY_NVS_KEY, blob->header.count
-    );
+// Deals with a piece the import has all of, and sets up the next one
+static esp_err_t _import_piece( zenith_registry_import_t *import ) {
+    import->have = 0;
+    switch ( import->stage ) {
+        case ZENITH_REGISTRY_IMPORT_HEADER: {
+            const zenith_registry_export_header_t *header = &import->piece.header;
+            ESP_RETURN_ON_FALSE(
+                header->magic == ZENITH_REGISTRY_EXPORT_MAGIC && header->version == ZENITH_REGISTRY_EXPORT_VERSION,
+                ESP_ERR_INVALID_VERSION,
+                TAG, "Not a registry export, or one of another version"
+            );
+            ESP_RETURN_ON_FALSE(
+                header->checkpoint_version == ZENITH_REGISTRY_CHECKPOINT_VERSION
+                    && header->ring_record_size == sizeof( zenith_registry_checkpoint_record_t )
+                    && header->node_info_size == sizeof( zenith_node_info_t ),
+                ESP_ERR_INVALID_VERSION,
+                TAG, "Export is from a build with another ring layout"
+            );
+            import->stage = ZENITH_REGISTRY_IMPORT_RECORD;
+            import->want = sizeof( zenith_registry_export_record_t );
+            break;
+        }
 
-    memcpy( handle->nodes, blob->nodes, blob->header.count * sizeof( zenith_node_info_t ) );
-    handle->node_count = blob->header.count;
-    ESP_LOGD( TAG, "Loaded %d nodes from NVS", handle->node_count );
+        case ZENITH_REGISTRY_IMPORT_RECORD: {
+            size_t size = _import_payload_size( import->record.tag );
+            ESP_RETURN_ON_FALSE(
+                !size || import->record.size == size,
+                ESP_ERR_INVALID_SIZE,
+                TAG, "Import record of %u bytes for tag %u", ( unsigned ) import->record.size, ( unsigned ) import->record.tag
+            );
+            if ( !import->record.size ) {
+                import->want = sizeof( zenith_registry_export_record_t ); // Nothing to skip, on to the next record
+                break;
+            }
+            import->stage = size ? ZENITH_REGISTRY_IMPORT_PAYLOAD : ZENITH_REGISTRY_IMPORT_SKIP;
+            import->want = import->record.size;
+            break;
+        }
 
-end:
-    nvs_close( nvs );
+        case ZENITH_REGISTRY_IMPORT_PAYLOAD:
+        case ZENITH_REGISTRY_IMPORT_SKIP:
+            if ( import->stage == ZENITH_REGISTRY_IMPORT_PAYLOAD )
+                ESP_RETURN_ON_ERROR( _import_payload( import ), TAG, "Failed to import record" );
+            if ( import->stage != ZENITH_REGISTRY_IMPORT_DONE ) {
+                import->stage = ZENITH_REGISTRY_IMPORT_RECORD;
+                import->want = sizeof( zenith_registry_export_record_t );
+            }
+            break;
 
-    if ( blob)
-        free( blob );
-    
-    if ( ret == ESP_ERR_NVS_NOT_FOUND )
-        ret = ESP_OK; // No data yet — not an error
-    
-    return ret;
+        default:
+            break;
+    }
+    return ESP_OK;
 }
 
-static esp_err_t zenith_registry_save_to_nvs( zenith_registry_handle_t handle )
+esp_err_t zenith_registry_export( zenith_registry_handle_t handle, zenith_registry_checkpoint_record_t *record, zenith_registry_export_write_t write, void *context )
 {
-    esp_err_t ret = ESP_OK;
-    size_t blob_size = sizeof( zenith_registry_nvs_header_t ) + handle->node_count * sizeof( zenith_node_info_t );
-
-    zenith_registry_nvs_blob_t *blob = NULL;
-    blob = malloc( blob_size );
     ESP_RETURN_ON_FALSE(
-        blob,
-        ESP_ERR_NO_MEM,
-        TAG, "Failed to allocate memory for NVS key %s", ZENITH_REGISTRY_NVS_KEY
+        handle && record && write,
+        ESP_ERR_INVALID_ARG,
+        TAG, "Invalid args to export"
     );
 
-    blob->header.registry_version = ZENITH_REGISTRY_VERSION;
-    blob->header.count = handle->node_count;
-    memcpy( blob->nodes, handle->nodes, handle->node_count * sizeof( zenith_node_info_t ) );
+    zenith_registry_export_header_t header = {
+        .magic = ZENITH_REGISTRY_EXPORT_MAGIC,
+        .version = ZENITH_REGISTRY_EXPORT_VERSION,
+        .checkpoint_version = ZENITH_REGISTRY_CHECKPOINT_VERSION,
+        .ring_record_size = sizeof( zenith_registry_checkpoint_record_t ),
+        .node_info_size = sizeof( zenith_node_info_t ),
+        .exported_at = time( NULL ),
+    };
+    ESP_RETURN_ON_ERROR( write( &header, sizeof( header ), context ), TAG, "Failed to write export header" );
+
+    // One node at a time under the lock, so pairing only waits for a copy. A node forgotten meanwhile can move another
+    // one past i - the import takes a node twice just fine.
+    zenith_registry_export_end_t end = { 0 };
+    for ( size_t i = 0; ; ++i ) {
+        zenith_node_info_t info;
+        xSemaphoreTake( handle->nodes_lock, portMAX_DELAY );
+        bool more = i < handle->node_count;
+        if ( more )
+            info = handle->nodes[ i ];
+        xSemaphoreGive( handle->nodes_lock );
+        if ( !more )
+            break;
+        ESP_RETURN_ON_ERROR(
+            _export_record( write, context, ZENITH_REGISTRY_EXPORT_NODE, &info, sizeof( info ) ),
+            TAG, "Failed to export node"
+        );
+        end.nodes++;
+    }
 
-    nvs_handle_t nvs;
-    ESP_GOTO_ON_ERROR(
-        nvs_open( ZENITH_REGISTRY_NVS_NAMESPACE, NVS_READWRITE, &nvs ),
-        end, 
-        TAG, "Failed to open NVS namespace %s", ZENITH_REGISTRY_NVS_NAMESPACE
-    );
+    // Rings the same way as a checkpoint - looked up under the lock, copied with the seqlock into the caller's record
+    memset( record, 0, sizeof( *record ) );
+    for ( size_t n = 0; ; ++n ) {
+        xSemaphoreTake( handle->nodes_lock, portMAX_DELAY );
+        bool more = n < handle->runtime_arena.count;
+        const zenith_ringbuffer_t *rings[ ZENITH_REGISTRY_MAX_RINGS ];
+        if ( more ) {
+            const zenith_node_runtime_t *node = _arena_at( &handle->runtime_arena, n );
+            memcpy( record->mac, node->mac, sizeof( zenith_mac_address_t ) );
+            memcpy( rings, node->rings, sizeof( rings ) );
+        }
+        xSemaphoreGive( handle->nodes_lock );
+        if ( !more )
+            break;
+
+        for ( size_t type = 0; type < ZENITH_REGISTRY_MAX_RINGS; ++type ) {
+            if ( !rings[ type ] )
+                continue;
+            _ring_snapshot( rings[ type ], &record->ring, &record->rollups );
+            // Neither means anything on another core. An import starts the seqlock over, so the same registry
+            // exports the same bytes again after a round trip.
+            record->ring.rollups = NULL;
+            record->ring.seq = 0;
+            ESP_RETURN_ON_ERROR(
+                _export_record( write, context, ZENITH_REGISTRY_EXPORT_RING, record, sizeof( *record ) ),
+                TAG, "Failed to export ring"
+            );
+            end.rings++;
+        }
+    }
 
-    ESP_GOTO_ON_ERROR(
-        nvs_set_blob( nvs, ZENITH_REGISTRY_NVS_KEY, blob, blob_size ),
-        end, 
-        TAG, "Failed to set NVS key %s", ZENITH_REGISTRY_NVS_KEY
-    );
+    return _export_record( write, context, ZENITH_REGISTRY_EXPORT_END, &end, sizeof( end ) );
+}
 
-    ESP_GOTO_ON_ERROR(
-        nvs_commit( nvs ),
-        end,
-        TAG, "Failed to commit NVS key %s", ZENITH_REGISTRY_NVS_KEY
+esp_err_t zenith_registry_import_begin( zenith_registry_handle_t handle, zenith_registry_import_t *import )
+{
+    ESP_RETURN_ON_FALSE(
+        handle && import,
+        ESP_ERR_INVALID_ARG,
+        TAG, "Invalid args to import_begin"
     );
-    
-end:
-    nvs_close( nvs );
-    if ( blob )
-        free( blob );
 
-    return ret;
+    memset( import, 0, sizeof( *import ) );
+    import->handle = handle;
+    import->stage = ZENITH_REGISTRY_IMPORT_HEADER;
+    import->want = sizeof( zenith_registry_export_header_t );
+    return ESP_OK;
 }
 
-esp_err_t zenith_registry_new( zenith_registry_handle_t *out_handle )
+esp_err_t zenith_registry_import_feed( zenith_registry_import_t *import, const void *data, size_t len )
 {
-    ESP_RETURN_ON_FALSE( out_handle, ESP_ERR_INVALID_ARG, TAG, "out_handle is NULL" );
+    ESP_RETURN_ON_FALSE(
+        import && import->handle && ( data || !len ),
+        ESP_ERR_INVALID_ARG,
+        TAG, "Invalid args to import_feed"
+    );
+    if ( import->error != ESP_OK )
+        return import->error;
 
-    zenith_registry_handle_t handle = NULL;
-    handle = calloc( 1, sizeof( struct zenith_registry_s ) );
-    ESP_RETURN_ON_FALSE( handle, ESP_ERR_NO_MEM, TAG, "Failed to allocate registry handle" );
+    esp_err_t ret = ESP_OK;
+    const uint8_t *bytes = data;
+    while ( len ) {
+        ESP_GOTO_ON_FALSE(
+            import->stage != ZENITH_REGISTRY_IMPORT_DONE,
+            ESP_ERR_INVALID_SIZE,
+            fail,
+            TAG, "Import data after the end record"
+        );
 
-    if ( zenith_registry_load_from_nvs( handle ) != ESP_OK ) 
-        ESP_LOGD( TAG, "Failed to load registry from NVS" );
-    
-    *out_handle = handle;
+        // Record headers collect apart from payloads, which need to know their header
+        size_t n = import->want - import->have < len ? import->want - import->have : len;
+        uint8_t *to = import->stage == ZENITH_REGISTRY_IMPORT_RECORD ? ( uint8_t * ) &import->record : ( uint8_t * ) &import->piece;
+        if ( import->stage != ZENITH_REGISTRY_IMPORT_SKIP )
+            memcpy( to + import->have, bytes, n );
+        import->have += n;
+        bytes += n;
+        len -= n;
+
+        if ( import->have == import->want )
+            ESP_GOTO_ON_ERROR( _import_piece( import ), fail, TAG, "Import failed" );
+    }
     return ESP_OK;
-}
 
-esp_err_t zenith_registry_delete( zenith_registry_handle_t handle )
-{
-    if ( handle )
-        free( handle );
-    return ESP_OK;
+fail:
+    import->error = ret;
+    return ret;
 }
 
-esp_err_t zenith_registry_register_callback( zenith_registry_handle_t handle, zenith_registry_callback_t callback )
+esp_err_t zenith_registry_import_end( zenith_registry_import_t *import )
 {
-    ESP_RETURN_ON_FALSE( handle, ESP_ERR_INVALID_ARG, TAG, "handle is NULL" );
-    handle->callback = callback;
+    ESP_RETURN_ON_FALSE( import && import->handle, ESP_ERR_INVALID_ARG, TAG, "Invalid args to import_end" );
+    if ( import->error != ESP_OK )
+        return import->error;
+
+    ESP_RETURN_ON_FALSE(
+        import->stage == ZENITH_REGISTRY_IMPORT_DONE,
+        ESP_ERR_INVALID_STATE,
+        TAG, "Import cut off after %u nodes and %u rings", ( unsigned ) import->seen.nodes, ( unsigned ) import->seen.rings
+    );
+    ESP_LOGI( TAG, "Imported %u nodes and %u rings, kept %u rings the registry had",
+              ( unsigned ) import->seen.nodes, ( unsigned ) ( import->seen.rings - import->rings_kept ), ( unsigned ) import->rings_kept );
     return ESP_OK;
 }
 
@@ -283,23 +1716,35 @@ esp_err_t zenith_registry_store_node_info( zenith_registry_handle_t handle, cons
     );
 
     zenith_registry_event_t event = ZENITH_REGISTRY_EVENT_NODE_ADDED;
+    esp_err_t ret = ESP_OK;
+
+    xSemaphoreTake( handle->nodes_lock, portMAX_DELAY );
 
     // Search for existing
     int index = _index_of_mac( handle, info->mac );
 
     if ( index >= 0 ) {
-        handle->nodes[ index ] = *info;
         event = ZENITH_REGISTRY_EVENT_NODE_UPDATED;
+        // Known nodes re-pair on every boot - nothing to save if nothing changed
+        if ( memcmp( &handle->nodes[ index ], info, sizeof( zenith_node_info_t ) ) == 0 ) {
+            handle->persist_stats.unchanged++;
+        } else {
+            handle->nodes[ index ] = *info;
+            _persist_mark_dirty( handle );
+        }
     } else {
-        ESP_RETURN_ON_FALSE( handle->node_count < ZENITH_REGISTRY_MAX_NODES, ESP_ERR_NO_MEM, TAG, "Max node limit reached" );
-        handle->nodes[handle->node_count++] = *info;
+        ret = _nodes_append( handle, info );
+        if ( ret == ESP_OK )
+            _persist_mark_dirty( handle );
     }
 
-    ESP_RETURN_ON_ERROR( zenith_registry_save_to_nvs( handle ), TAG, "Failed to save updated node list to NVS" );
+    xSemaphoreGive( handle->nodes_lock );
+    ESP_RETURN_ON_ERROR( ret, TAG, "Failed to add node" );
 
-    if ( handle->callback ) {
-        handle->callback( event, info->mac );
-    }
+    if ( !handle->persist_task )
+        ESP_RETURN_ON_ERROR( zenith_registry_save_to_nvs( handle ), TAG, "Failed to save updated node list to NVS" );
+
+    _events_post( handle, event, info->mac );
 
     return ESP_OK;
 }
@@ -312,13 +1757,13 @@ esp_err_t zenith_registry_get_node_info( zenith_registry_handle_t handle, const
         TAG, "Invalid args to get_node_info" 
     );
 
+    xSemaphoreTake( handle->nodes_lock, portMAX_DELAY );
     int index = _index_of_mac( handle, mac );
-    if ( index >= 0 ) {
-        out_info = &handle->nodes[index];
-        return ESP_OK;
-    }
+    if ( index >= 0 )
+        *out_info = handle->nodes[index];
+    xSemaphoreGive( handle->nodes_lock );
 
-    return ESP_ERR_NOT_FOUND;
+    return index >= 0 ? ESP_OK : ESP_ERR_NOT_FOUND;
 }
 
 esp_err_t zenith_registry_forget_node( zenith_registry_handle_t handle, const zenith_mac_address_t mac )
@@ -329,34 +1774,44 @@ esp_err_t zenith_registry_forget_node( zenith_registry_handle_t handle, const ze
         TAG, "Invalid args to remove_node" 
     );
 
+    xSemaphoreTake( handle->nodes_lock, portMAX_DELAY );
     int index = _index_of_mac( handle, mac ); 
 
     if ( index >= 0 ) {
         ESP_LOGD( TAG, "Forget node %d", index );   
 
+        zenith_registry_index_slot_t *slot = _index_find( handle, mac );
+        slot->node = ZENITH_REGISTRY_INDEX_NONE;
+        _index_release( handle, slot ); // Runtime data stays, so the slot usually does too
+
         // Copy last node to current index
-        if ( index != handle->node_count - 1 )
+        if ( index != handle->node_count - 1 ) {
             handle->nodes[index] = handle->nodes[handle->node_count - 1]; 
+            _index_find( handle, handle->nodes[index].mac )->node = index;
+        }
 
         // Clear last node
         handle->nodes[handle->node_count - 1] = (zenith_node_info_t){0}; 
         handle->node_count--;
-        zenith_registry_save_to_nvs( handle );
+        _persist_mark_dirty( handle );
+        xSemaphoreGive( handle->nodes_lock );
 
-        if ( handle->callback ) {
-            handle->callback( ZENITH_REGISTRY_EVENT_NODE_REMOVED, mac );
-        }
+        if ( !handle->persist_task )
+            zenith_registry_save_to_nvs( handle );
+
+        _events_post( handle, ZENITH_REGISTRY_EVENT_NODE_REMOVED, mac );
 
         return ESP_OK;
 
     } else {
+        xSemaphoreGive( handle->nodes_lock );
         ESP_LOGD( TAG, "Forget node %d not found", index );   
         return ESP_ERR_NOT_FOUND;
     }
    
 }
 
-esp_err_t zenith_registry_store_datapoints( zenith_registry_handle_t handle, const zenith_mac_address_t mac, const zenith_datapoint_t *datapoints, size_t count ) {
+esp_err_t zenith_registry_store_datapoints( zenith_registry_handle_t handle, const zenith_mac_address_t mac, const zenith_datapoint_t *datapoints, const time_t *timestamps, size_t count ) {
     ESP_RETURN_ON_FALSE( 
         handle && mac && datapoints, 
         ESP_ERR_INVALID_ARG, 
@@ -375,25 +1830,322 @@ esp_err_t zenith_registry_store_datapoints( zenith_registry_handle_t handle, con
         TAG, "Failed to allocate node runtime" 
     );
 
+    time_t now = timestamps ? 0 : time( NULL ); // Get current time in seconds since epoch, if the caller has no timestamps
+    uint8_t sensor_types = 0;
+
     for ( size_t i = 0; i < count; ++i ) {
         const zenith_datapoint_t *dp = &datapoints[i];
-        zenith_ringbuffer_t *ring = NULL;
-        ESP_RETURN_ON_ERROR(
-            _get_ringbuffer( node, dp->reading_type, &ring ),
-            TAG, "Failed to get ringbuffer for sensor type %d", dp->reading_type
-        );
-        ESP_RETURN_ON_FALSE( 
-            ring, 
-            ESP_ERR_NO_MEM, 
-            TAG, "Failed to allocate ring for sensor type %d", dp->reading_type 
-        );
-        _ringbuffer_add_reading( ring, dp->value );
+        // Out of range types land on NULL too, and get turned away by _new_ringbuffer
+        zenith_ringbuffer_t *ring = node->rings[ dp->reading_type & ( ZENITH_REGISTRY_MAX_RINGS - 1 ) ];
+        time_t timestamp = timestamps ? timestamps[i] : now;
+        if ( dp->reading_type >= ZENITH_REGISTRY_MAX_RINGS || !ring )
+            ESP_RETURN_ON_ERROR(
+                _new_ringbuffer( handle, node, dp->reading_type, timestamp, NULL, &ring ),
+                TAG, "Failed to get ringbuffer for sensor type %d", dp->reading_type
+            );
+        _ringbuffer_add_reading( ring, dp->value, timestamp );
+        sensor_types |= 1u << dp->reading_type;
+    }
+    handle->data_dirty = true;
+
+    _events_post_reading( handle, node, sensor_types );
+
+    return ESP_OK;
+}
+
+esp_err_t zenith_registry_get_node_runtime( zenith_registry_handle_t handle, const zenith_mac_address_t mac, const zenith_node_runtime_t **out_runtime )
+{
+    ESP_RETURN_ON_FALSE( 
+        handle && mac && out_runtime, 
+        ESP_ERR_INVALID_ARG, 
+        TAG, "Invalid args to get_node_runtime" 
+    );
+
+    xSemaphoreTake( handle->nodes_lock, portMAX_DELAY );
+    int index = _buffer_index_of_mac( handle, mac );
+    if ( index >= 0 )
+        *out_runtime = _arena_at( &handle->runtime_arena, index );
+    xSemaphoreGive( handle->nodes_lock );
+
+    return index >= 0 ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+// A node's ring for a sensor type, for the queries to copy. The lookup is locked - the index and arenas can grow
+// under a reader on another task - the copy isn't.
+static const zenith_ringbuffer_t *_find_ring( zenith_registry_handle_t handle, const zenith_mac_address_t mac, zenith_sensor_type_t type ) {
+    if ( type >= ZENITH_REGISTRY_MAX_RINGS )
+        return NULL;
+
+    const zenith_ringbuffer_t *ring = NULL;
+    xSemaphoreTake( handle->nodes_lock, portMAX_DELAY );
+    int index = _buffer_index_of_mac( handle, mac );
+    if ( index >= 0 )
+        ring = ( ( zenith_node_runtime_t * ) _arena_at( &handle->runtime_arena, index ) )->rings[ type ];
+    xSemaphoreGive( handle->nodes_lock );
+    return ring;
+}
+
+// Copies a node's ring for a sensor type, without its rollups
+static esp_err_t _get_ring( zenith_registry_handle_t handle, const zenith_mac_address_t mac, zenith_sensor_type_t type, zenith_ringbuffer_t *out_ring ) {
+    const zenith_ringbuffer_t *ring = _find_ring( handle, mac, type );
+    if ( !ring )
+        return ESP_ERR_NOT_FOUND;
+
+    _ring_snapshot( ring, out_ring, NULL );
+    return ESP_OK;
+}
+
+// Copies one rollup tier of a node's ring for a sensor type
+static esp_err_t _get_tier( zenith_registry_handle_t handle, const zenith_mac_address_t mac, zenith_sensor_type_t type, size_t tier, zenith_registry_tier_snapshot_t *out_tier ) {
+    const zenith_ringbuffer_t *ring = _find_ring( handle, mac, type );
+    if ( !ring )
+        return ESP_ERR_NOT_FOUND;
+
+    _rollup_snapshot( ring, tier, out_tier );
+    return ESP_OK;
+}
+
+// Walks the hourly rollups of the current hour and the 23 before it - ZENITH_ROLLUP_HOUR_BUCKETS at most, however long
+// the ring is
+static esp_err_t _get_extreme_last_24h( zenith_registry_handle_t handle, const zenith_mac_address_t mac, zenith_sensor_type_t type, bool max, zenith_reading_t *out_reading ) {
+    ESP_RETURN_ON_FALSE(
+        handle && mac && out_reading,
+        ESP_ERR_INVALID_ARG,
+        TAG, "Invalid args to get_%s_last_24h", max ? "max" : "min"
+    );
+
+    zenith_registry_tier_snapshot_t hours;
+    esp_err_t ret = _get_tier( handle, mac, type, ZENITH_ROLLUP_HOUR, &hours );
+    if ( ret != ESP_OK )
+        return ret;
+
+    // The current hour and the 23 before it, as far as they're still in the tier's window
+    int32_t last = time( NULL ) / ZENITH_REGISTRY_SECONDS_PER_HOUR;
+    int32_t first = last - 24 + 1;
+    if ( first < _rollup_oldest( ZENITH_ROLLUP_HOUR, hours.newest ) )
+        first = _rollup_oldest( ZENITH_ROLLUP_HOUR, hours.newest );
+    if ( last > hours.newest )
+        last = hours.newest;
+
+    bool found = false;
+    for ( int32_t h = first; h <= last; ++h ) {
+        const zenith_rollup_bucket_t *bucket = _tier_bucket( &hours, ZENITH_ROLLUP_HOUR, h );
+        if ( !bucket->count )
+            continue; // no readings that hour
+
+        zenith_reading_datatype_t value = max ? bucket->max : bucket->min;
+        if ( !found || ( max ? value > out_reading->value : value < out_reading->value ) ) {
+            out_reading->value = value;
+            out_reading->timestamp = (time_t) h * ZENITH_REGISTRY_SECONDS_PER_HOUR;
+            found = true;
+        }
+    }
+
+    return found ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t zenith_registry_get_window_stats( zenith_registry_handle_t handle, const zenith_mac_address_t mac, zenith_sensor_type_t type, uint32_t window_s, zenith_window_stats_t *out_stats )
+{
+    ESP_RETURN_ON_FALSE(
+        handle && mac && out_stats && window_s,
+        ESP_ERR_INVALID_ARG,
+        TAG, "Invalid args to get_window_stats"
+    );
+
+    // Finest tier that reaches back far enough
+    size_t tier = 0;
+    while ( tier < ZENITH_ROLLUP_TIERS && (uint64_t) s_rollup_tiers[ tier ].period * s_rollup_tiers[ tier ].buckets < window_s )
+        ++tier;
+    ESP_RETURN_ON_FALSE(
+        tier < ZENITH_ROLLUP_TIERS,
+        ESP_ERR_INVALID_ARG,
+        TAG, "Window of %u s is longer than the rollups reach", ( unsigned ) window_s
+    );
+    uint32_t period = s_rollup_tiers[ tier ].period;
+
+    zenith_registry_tier_snapshot_t snapshot;
+    esp_err_t ret = _get_tier( handle, mac, type, tier, &snapshot );
+    if ( ret != ESP_OK )
+        return ret;
+
+    // Periods both in the window and still in the tier
+    int32_t last = time( NULL ) / period;
+    int32_t first = last - (int32_t) ( ( window_s + period - 1 ) / period ) + 1;
+    int32_t window_first = first;
+    if ( first < _rollup_oldest( tier, snapshot.newest ) )
+        first = _rollup_oldest( tier, snapshot.newest );
+    if ( last > snapshot.newest )
+        last = snapshot.newest;
+
+    // Merges the buckets' Welford states (Chan et al). Period midpoints and means go along for the rate, in hours from
+    // the start of the window to keep the floats small.
+    zenith_window_stats_t stats = { .start = (time_t) window_first * period };
+    zenith_reading_datatype_t m2 = 0;
+    float hours_mean = 0;
+    size_t periods = 0;
+    for ( int32_t p = first; p <= last; ++p ) {
+        const zenith_rollup_bucket_t *bucket = _tier_bucket( &snapshot, tier, p );
+        if ( !bucket->count )
+            continue;
+
+        stats.min = ( !stats.count || bucket->min < stats.min ) ? bucket->min : stats.min;
+        stats.max = ( !stats.count || bucket->max > stats.max ) ? bucket->max : stats.max;
+        uint32_t count = stats.count + bucket->count;
+        zenith_reading_datatype_t delta = bucket->mean - stats.mean;
+        stats.mean += delta * bucket->count / count;
+        m2 += bucket->m2 + delta * delta * ( (float) stats.count * bucket->count / count );
+        float hours = ( ( p - window_first ) * (float) period + period / 2.0f ) / ZENITH_REGISTRY_SECONDS_PER_HOUR;
+        hours_mean += ( hours - hours_mean ) * bucket->count / count;
+        stats.count = count;
+        periods++;
+    }
+    if ( !stats.count )
+        return ESP_ERR_NOT_FOUND;
+    stats.variance = stats.count > 1 ? m2 / ( stats.count - 1 ) : 0;
+
+    // Least squares line through the period means, each weighted by its readings
+    float sxy = 0;
+    float sxx = 0;
+    for ( int32_t p = first; periods > 1 && p <= last; ++p ) {
+        const zenith_rollup_bucket_t *bucket = _tier_bucket( &snapshot, tier, p );
+        float dx = ( ( p - window_first ) * (float) period + period / 2.0f ) / ZENITH_REGISTRY_SECONDS_PER_HOUR - hours_mean;
+        sxy += bucket->count * dx * ( bucket->mean - stats.mean );
+        sxx += bucket->count * dx * dx;
+    }
+    stats.rate = sxx > 0 ? sxy / sxx : 0;
+
+    *out_stats = stats;
+    return ESP_OK;
+}
+
+esp_err_t zenith_registry_get_max_last_24h( zenith_registry_handle_t handle, const zenith_mac_address_t mac, zenith_sensor_type_t type, zenith_reading_t *out_max_reading )
+{
+    return _get_extreme_last_24h( handle, mac, type, true, out_max_reading );
+}
+
+esp_err_t zenith_registry_get_min_last_24h( zenith_registry_handle_t handle, const zenith_mac_address_t mac, zenith_sensor_type_t type, zenith_reading_t *out_min_reading )
+{
+    return _get_extreme_last_24h( handle, mac, type, false, out_min_reading );
+}
+
+esp_err_t zenith_registry_get_history( zenith_registry_handle_t handle, const zenith_mac_address_t mac, zenith_sensor_type_t type, zenith_reading_t *out_history, size_t *inout_count )
+{
+    ESP_RETURN_ON_FALSE(
+        handle && mac && inout_count,
+        ESP_ERR_INVALID_ARG,
+        TAG, "Invalid args to get_history"
+    );
+
+    zenith_ringbuffer_t snapshot;
+    const zenith_ringbuffer_t *ring = &snapshot;
+    esp_err_t ret = _get_ring( handle, mac, type, &snapshot );
+    if ( ret != ESP_OK )
+        return ret;
+
+    size_t count = ring->size;
+    if ( out_history ) {
+        count = *inout_count < count ? *inout_count : count;
+        zenith_ring_reader_t reader;
+        _ring_reader_init( &reader, ring, ring->size - count );
+        for ( size_t i = 0; i < count && _ring_reader_next( &reader, &out_history[i] ); ++i )
+            ;
+    }
+
+    *inout_count = count;
+    return ESP_OK;
+}
+
+esp_err_t zenith_registry_history_open( zenith_registry_handle_t handle, const zenith_mac_address_t mac, zenith_sensor_type_t type, time_t t0, time_t t1, zenith_registry_history_cursor_t *out_cursor )
+{
+    ESP_RETURN_ON_FALSE(
+        handle && mac && out_cursor && t0 <= t1,
+        ESP_ERR_INVALID_ARG,
+        TAG, "Invalid args to history_open"
+    );
+
+    esp_err_t ret = _get_ring( handle, mac, type, &out_cursor->ring );
+    if ( ret != ESP_OK )
+        return ret;
+
+    _ring_reader_seek( &out_cursor->reader, &out_cursor->ring, t0 );
+    out_cursor->t1 = t1;
+    return ESP_OK;
+}
+
+bool zenith_registry_history_next( zenith_registry_history_cursor_t *cursor, zenith_reading_t *out_reading )
+{
+    if ( !cursor || !out_reading || !_ring_reader_next( &cursor->reader, out_reading ) )
+        return false;
+
+    // Past the range - stays that way, so next can be called again
+    if ( out_reading->timestamp > cursor->t1 ) {
+        cursor->reader.next = cursor->ring.size;
+        return false;
     }
+    return true;
+}
+
+esp_err_t zenith_registry_get_history_range( zenith_registry_handle_t handle, const zenith_mac_address_t mac, zenith_sensor_type_t type, time_t t0, time_t t1, zenith_reading_t *out_history, size_t *inout_count )
+{
+    ESP_RETURN_ON_FALSE(
+        handle && mac && inout_count && t0 <= t1,
+        ESP_ERR_INVALID_ARG,
+        TAG, "Invalid args to get_history_range"
+    );
+
+    zenith_registry_history_cursor_t cursor;
+    esp_err_t ret = zenith_registry_history_open( handle, mac, type, t0, t1, &cursor );
+    if ( ret != ESP_OK )
+        return ret;
+
+    size_t count = 0;
+    zenith_reading_t reading;
+    while ( ( !out_history || count < *inout_count ) && zenith_registry_history_next( &cursor, out_history ? &out_history[ count ] : &reading ) )
+        count++;
+
+    *inout_count = count;
+    return ESP_OK;
+}
+
+esp_err_t zenith_registry_get_rollups( zenith_registry_handle_t handle, const zenith_mac_address_t mac, zenith_sensor_type_t type, zenith_rollup_tier_t tier, zenith_rollup_t *out_rollups, size_t *inout_count )
+{
+    ESP_RETURN_ON_FALSE(
+        handle && mac && inout_count && tier < ZENITH_ROLLUP_TIERS,
+        ESP_ERR_INVALID_ARG,
+        TAG, "Invalid args to get_rollups"
+    );
 
-    if ( handle->callback ) {
-        handle->callback( ZENITH_REGISTRY_EVENT_READING_UPDATED, mac );
+    zenith_registry_tier_snapshot_t snapshot;
+    esp_err_t ret = _get_tier( handle, mac, type, tier, &snapshot );
+    if ( ret != ESP_OK )
+        return ret;
+
+    // Newest first, to keep the newest when the caller has less room than the tier has periods
+    size_t available = out_rollups ? *inout_count : SIZE_MAX;
+    size_t count = 0;
+    int32_t oldest = _rollup_oldest( tier, snapshot.newest );
+    int32_t p = snapshot.newest;
+    for ( ; p >= oldest && count < available; --p )
+        count += _tier_bucket( &snapshot, tier, p )->count != 0;
+
+    if ( out_rollups ) {
+        size_t i = 0;
+        for ( ++p; i < count; ++p ) {
+            const zenith_rollup_bucket_t *bucket = _tier_bucket( &snapshot, tier, p );
+            if ( !bucket->count )
+                continue;
+            out_rollups[i++] = ( zenith_rollup_t ) {
+                .start = (time_t) p * s_rollup_tiers[ tier ].period,
+                .min = bucket->min,
+                .max = bucket->max,
+                .mean = bucket->mean,
+                .variance = bucket->count > 1 ? bucket->m2 / ( bucket->count - 1 ) : 0,
+                .count = bucket->count,
+            };
+        }
     }
 
+    *inout_count = count;
     return ESP_OK;
 }
 
@@ -405,7 +2157,9 @@ esp_err_t zenith_registry_get_node_count( zenith_registry_handle_t handle, size_
         TAG, "Invalid args to get_node_count" 
     );
 
+    xSemaphoreTake( handle->nodes_lock, portMAX_DELAY );
     *out_count = handle->node_count;
+    xSemaphoreGive( handle->nodes_lock );
     return ESP_OK;
 }
 
@@ -417,57 +2171,115 @@ esp_err_t zenith_registry_get_all_node_macs( zenith_registry_handle_t handle, ze
         TAG, "Invalid args to get_node_macs" 
     );
 
+    esp_err_t ret = ESP_OK;
+    xSemaphoreTake( handle->nodes_lock, portMAX_DELAY );
     if ( out_macs == NULL ) {
         // return required size
         *inout_count = handle->node_count;
-        return ESP_OK;
-    }
-
-    if ( *inout_count < handle->node_count ) {
+    } else if ( *inout_count < handle->node_count ) {
         ESP_LOGE( TAG, "Not enough space for node macs" );
-        return ESP_ERR_NO_MEM;
-    }
-
-    for ( size_t i = 0; i < handle->node_count; i++ ) {
-        memcpy( out_macs[i], handle->nodes[i].mac, ESP_NOW_ETH_ALEN );
+        ret = ESP_ERR_NO_MEM;
+    } else {
+        for ( size_t i = 0; i < handle->node_count; i++ ) {
+            memcpy( out_macs[i], handle->nodes[i].mac, ESP_NOW_ETH_ALEN );
+        }
+        *inout_count = handle->node_count;
     }
+    xSemaphoreGive( handle->nodes_lock );
 
-    *inout_count = handle->node_count;
-    return ESP_OK;
+    return ret;
 }
 
+// Called from the console while data comes in. Printing is slow, so nothing is locked while it prints - each node is
+// copied under the lock and each ring with the seqlock.
 esp_err_t zenith_registry_full_contents_to_log( zenith_registry_handle_t handle ) {
+    zenith_ringbuffer_t *ring = malloc( sizeof( zenith_ringbuffer_t ) );
+    ESP_RETURN_ON_FALSE( ring, ESP_ERR_NO_MEM, TAG, "Failed to allocate ring copy" );
+
+    size_t node_count = 0;
+    zenith_registry_get_node_count( handle, &node_count );
     printf( "---- Zenith Registry Dump ----\n" );
-    printf( "Nodes: %u\n", (unsigned) handle->node_count );
+    printf( "Nodes: %u\n", (unsigned) node_count );
     printf( "------------------------------\n" );
     
     printf( "Node information:" );
-    for ( size_t i = 0; i < handle->node_count; ++i ) {
-        zenith_node_info_t *node = &handle->nodes[ i ];
-        printf( " Node %zu — MAC: "MACSTR"\n", i, MAC2STR( node->mac ) );
+    for ( size_t i = 0; ; ++i ) {
+        zenith_node_info_t node;
+        xSemaphoreTake( handle->nodes_lock, portMAX_DELAY );
+        bool have = i < handle->node_count;
+        if ( have )
+            node = handle->nodes[ i ];
+        xSemaphoreGive( handle->nodes_lock );
+        if ( !have )
+            break;
+        printf( " Node %zu — MAC: "MACSTR"\n", i, MAC2STR( node.mac ) );
     }
 
     printf( "Runtime data:\n" );
-    for ( size_t i = 0; i < handle->buffer_count; ++i ) {
-        zenith_node_runtime_t *node = &handle->runtime_buffers[ i ];
-        printf( " Node %zu — MAC: "MACSTR", Rings: %zu\n", i, MAC2STR( node->mac ), node->ring_count );
-
-        for ( size_t j = 0; j < node->ring_count; ++j ) {
-            zenith_ringbuffer_t *ring = &node->rings[j];
+    size_t readings = 0;
+    for ( size_t i = 0; ; ++i ) {
+        zenith_node_runtime_t node;
+        xSemaphoreTake( handle->nodes_lock, portMAX_DELAY );
+        bool have = i < handle->runtime_arena.count;
+        if ( have )
+            node = *( zenith_node_runtime_t * ) _arena_at( &handle->runtime_arena, i );
+        xSemaphoreGive( handle->nodes_lock );
+        if ( !have )
+            break;
+        printf( " Node %zu — MAC: "MACSTR", Rings: %zu\n", i, MAC2STR( node.mac ), node.ring_count );
+
+        for ( size_t j = 0; j < ZENITH_REGISTRY_MAX_RINGS; ++j ) {
+            if ( !node.rings[j] )
+                continue;
+            _ring_snapshot( node.rings[j], ring, NULL );
             printf( "   Sensor Type: %u — Readings: %u\n",
                       (unsigned) ring->type, (unsigned) ring->size );
 
-            for ( size_t k = 0; k < ring->size; ++k ) {
-                zenith_reading_t *r = &ring->entries[ k ];
-                if ( r->timestamp == 0 ) {
+            zenith_ring_reader_t reader;
+            zenith_reading_t r;
+            _ring_reader_init( &reader, ring, 0 );
+            for ( size_t k = 0; _ring_reader_next( &reader, &r ); ++k ) {
+                if ( r.timestamp == 0 ) {
                     continue; // skip uninitialized entries
                 }
 
-                printf( "     [%zu] ts=%llu, value=%.2f\n", k, r->timestamp, r->value );
+                printf( "     [%zu] ts=%llu, value=%.2f\n", k, (unsigned long long) r.timestamp, r.value );
             }
+            readings += ring->size;
         }
     }
 
+    free( ring );
+
+    // Reading storage only, against what the same readings would take as zenith_reading_t
+    xSemaphoreTake( handle->nodes_lock, portMAX_DELAY );
+    size_t ring_count = handle->ring_arena.count;
+    xSemaphoreGive( handle->nodes_lock );
+    size_t ring_bytes = ring_count * sizeof( zenith_ringbuffer_t );
+#if ZENITH_REGISTRY_COMPRESSED_RINGS
+    size_t storage_bytes = ring_count * sizeof( ( ( zenith_ringbuffer_t * ) 0 )->blocks );
+#else
+    size_t storage_bytes = ring_count * sizeof( ( ( zenith_ringbuffer_t * ) 0 )->entries );
+#endif
+    printf( "------------------------------\n" );
+    printf( "Rings: %zu, %zu bytes — %zu readings in %zu bytes, %.1f bytes per reading vs %zu unpacked\n",
+              ring_count, ring_bytes, readings, storage_bytes, readings ? (double) storage_bytes / readings : 0.0, sizeof( zenith_reading_t ) );
+
+    zenith_registry_persist_stats_t persist;
+    zenith_registry_get_persist_stats( handle, &persist );
+    printf( "NVS: %u saves for %u changes, %u unchanged re-pairs skipped, %u failed saves%s\n",
+              (unsigned) persist.saves, (unsigned) persist.changes, (unsigned) persist.unchanged, (unsigned) persist.save_failures,
+              persist.dirty ? ", changes pending" : "" );
+    if ( handle->checkpoint_storage )
+        printf( "Checkpoints: %u written, %u failed, last %u bytes, %u rings restored at boot\n",
+                  (unsigned) persist.checkpoints, (unsigned) persist.checkpoint_failures, (unsigned) persist.checkpoint_bytes,
+                  (unsigned) persist.rings_restored );
+
+    zenith_registry_event_stats_t events;
+    zenith_registry_get_event_stats( handle, &events );
+    printf( "Events: %u subscribers, %u queued, %u readings coalesced, %u deferred, %u dropped, %u callbacks, queue high water %u of %d\n",
+              (unsigned) handle->subscriber_count, (unsigned) events.posted, (unsigned) events.coalesced, (unsigned) events.deferred,
+              (unsigned) events.dropped, (unsigned) events.delivered, (unsigned) events.queue_high_water, ZENITH_REGISTRY_EVENT_QUEUE_LEN );
     printf( "------------------------------\n" );
     return ESP_OK;
 }
\ No newline at end of file
@@ -0,0 +1,173 @@
+// zenith_registry_gorilla.c
+
+#include <string.h>
+#include "zenith_registry_gorilla.h"
+
+// Timestamp delta of delta buckets: control bits, value bits. Anything bigger takes the full 32 bits.
+#define GORILLA_DOD_ZERO_BITS 1                 // '0'
+#define GORILLA_DOD_7_BITS ( 2 + 7 )            // '10' + [-64, 63]
+#define GORILLA_DOD_9_BITS ( 3 + 9 )            // '110' + [-256, 255]
+#define GORILLA_DOD_12_BITS ( 4 + 12 )          // '1110' + [-2048, 2047]
+#define GORILLA_DOD_32_BITS ( 4 + 32 )          // '1111' + 32 bits
+
+// Value XOR: '0' same value, '10' + bits in the last window, '11' + 5 bits leading + 6 bits length + bits
+#define GORILLA_NO_WINDOW 0xff
+
+// Writes the low n bits of value, n <= 32. The caller has checked there's room, and unused data is zero.
+static inline void _put( zenith_gorilla_block_t *block, uint32_t value, uint8_t n ) {
+    while ( n ) {
+        uint8_t room = 8 - ( block->bits & 7 );
+        uint8_t take = n < room ? n : room;
+        uint8_t chunk = ( value >> ( n - take ) ) & ( ( 1u << take ) - 1 );
+        block->data[ block->bits >> 3 ] |= chunk << ( room - take );
+        block->bits += take;
+        n -= take;
+    }
+}
+
+static inline uint32_t _get( zenith_gorilla_reader_t *reader, uint8_t n ) {
+    uint32_t value = 0;
+    while ( n ) {
+        uint8_t room = 8 - ( reader->bit & 7 );
+        uint8_t take = n < room ? n : room;
+        uint8_t byte = reader->block->data[ reader->bit >> 3 ];
+        value = ( value << take ) | ( ( byte >> ( room - take ) ) & ( ( 1u << take ) - 1 ) );
+        reader->bit += take;
+        n -= take;
+    }
+    return value;
+}
+
+static inline uint32_t _float_bits( float value ) {
+    uint32_t bits;
+    memcpy( &bits, &value, sizeof( bits ) );
+    return bits;
+}
+
+static inline uint8_t _dod_bits( int32_t dod ) {
+    if ( dod == 0 )
+        return GORILLA_DOD_ZERO_BITS;
+    if ( dod >= -64 && dod <= 63 )
+        return GORILLA_DOD_7_BITS;
+    if ( dod >= -256 && dod <= 255 )
+        return GORILLA_DOD_9_BITS;
+    if ( dod >= -2048 && dod <= 2047 )
+        return GORILLA_DOD_12_BITS;
+    return GORILLA_DOD_32_BITS;
+}
+
+void zenith_gorilla_block_reset( zenith_gorilla_block_t *block ) {
+    memset( block, 0, sizeof( *block ) );
+    block->leading = GORILLA_NO_WINDOW;
+}
+
+bool zenith_gorilla_block_append( zenith_gorilla_block_t *block, int32_t offset, float value ) {
+    uint32_t value_bits = _float_bits( value );
+
+    if ( block->count == 0 ) {
+        // First reading goes in as is
+        _put( block, (uint32_t) offset, 32 );
+        _put( block, value_bits, 32 );
+        block->last_offset = offset;
+        block->last_delta = 0;
+        block->last_value = value_bits;
+        block->count = 1;
+        return true;
+    }
+
+    // Unsigned math so a huge jump wraps the same way on both ends
+    uint32_t delta = (uint32_t) offset - (uint32_t) block->last_offset;
+    int32_t dod = (int32_t) ( delta - (uint32_t) block->last_delta );
+    uint8_t dod_bits = _dod_bits( dod );
+
+    uint32_t xor = value_bits ^ block->last_value;
+    uint8_t leading = 0, trailing = 0, value_length = 1;
+    bool reuse = false;
+    if ( xor ) {
+        leading = __builtin_clz( xor );
+        trailing = __builtin_ctz( xor );
+        reuse = block->leading != GORILLA_NO_WINDOW && leading >= block->leading && trailing >= block->trailing;
+        value_length = reuse ? 2 + ( 32 - block->leading - block->trailing ) : 2 + 5 + 6 + ( 32 - leading - trailing );
+    }
+
+    if ( block->bits + dod_bits + value_length > ZENITH_GORILLA_BLOCK_BYTES * 8 )
+        return false;
+
+    switch ( dod_bits ) {
+        case GORILLA_DOD_ZERO_BITS: _put( block, 0x0, 1 ); break;
+        case GORILLA_DOD_7_BITS:    _put( block, 0x2, 2 ); _put( block, (uint32_t) dod & 0x7f, 7 ); break;
+        case GORILLA_DOD_9_BITS:    _put( block, 0x6, 3 ); _put( block, (uint32_t) dod & 0x1ff, 9 ); break;
+        case GORILLA_DOD_12_BITS:   _put( block, 0xe, 4 ); _put( block, (uint32_t) dod & 0xfff, 12 ); break;
+        default:                    _put( block, 0xf, 4 ); _put( block, (uint32_t) dod, 32 ); break;
+    }
+
+    if ( !xor ) {
+        _put( block, 0x0, 1 );
+    } else if ( reuse ) {
+        _put( block, 0x2, 2 );
+        _put( block, xor >> block->trailing, 32 - block->leading - block->trailing );
+    } else {
+        uint8_t length = 32 - leading - trailing;
+        _put( block, 0x3, 2 );
+        _put( block, leading, 5 );
+        _put( block, length, 6 );
+        _put( block, xor >> trailing, length );
+        block->leading = leading;
+        block->trailing = trailing;
+    }
+
+    block->last_offset = offset;
+    block->last_delta = (int32_t) delta;
+    block->last_value = value_bits;
+    block->count++;
+    return true;
+}
+
+void zenith_gorilla_reader_init( zenith_gorilla_reader_t *reader, const zenith_gorilla_block_t *block ) {
+    memset( reader, 0, sizeof( *reader ) );
+    reader->block = block;
+}
+
+// Sign extends the low n bits
+static inline int32_t _signed( uint32_t value, uint8_t n ) {
+    return (int32_t) ( value << ( 32 - n ) ) >> ( 32 - n );
+}
+
+bool zenith_gorilla_reader_next( zenith_gorilla_reader_t *reader, int32_t *out_offset, float *out_value ) {
+    if ( reader->index >= reader->block->count )
+        return false;
+
+    if ( reader->index == 0 ) {
+        reader->offset = (int32_t) _get( reader, 32 );
+        reader->value = _get( reader, 32 );
+    } else {
+        int32_t dod;
+        if ( !_get( reader, 1 ) )
+            dod = 0;
+        else if ( !_get( reader, 1 ) )
+            dod = _signed( _get( reader, 7 ), 7 );
+        else if ( !_get( reader, 1 ) )
+            dod = _signed( _get( reader, 9 ), 9 );
+        else if ( !_get( reader, 1 ) )
+            dod = _signed( _get( reader, 12 ), 12 );
+        else
+            dod = (int32_t) _get( reader, 32 );
+
+        reader->delta = (int32_t) ( (uint32_t) reader->delta + (uint32_t) dod );
+        reader->offset = (int32_t) ( (uint32_t) reader->offset + (uint32_t) reader->delta );
+
+        if ( _get( reader, 1 ) ) {
+            if ( _get( reader, 1 ) ) {
+                reader->leading = _get( reader, 5 );
+                reader->trailing = 32 - reader->leading - _get( reader, 6 );
+            }
+            uint8_t length = 32 - reader->leading - reader->trailing;
+            reader->value ^= _get( reader, length ) << reader->trailing;
+        }
+    }
+
+    reader->index++;
+    *out_offset = reader->offset;
+    memcpy( out_value, &reader->value, sizeof( *out_value ) );
+    return true;
+}
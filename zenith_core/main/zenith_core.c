@@ -3,6 +3,7 @@
 #include "string.h"
 #include "esp_log.h"
 #include "esp_mac.h"
+#include "esp_system.h"
 #include "nvs_flash.h"
 #include "esp_err.h"
 #include "esp_check.h"
@@ -12,12 +13,15 @@
 #include "zenith_now.h"
 #include "zenith_blink.h"
 #include "zenith_registry.h"
+#include "zenith_log.h"
 
 #include "zenith_ui_core.h"
 #include "zenith_registry.h"
 #include "zenith_data.h"
 #include "cmd_system.h"
+#include "zenith_core_rx.h"
 #include "argtable3/argtable3.h"
+#include "mbedtls/base64.h"
 
 
 
@@ -26,6 +30,7 @@
 static const char *TAG = "zenith-core";
 
 zenith_registry_handle_t node_registry = NULL;
+zenith_log_handle_t node_log = NULL;
 //zenith_datapoints_handle_t datapoints_handles[ZENITH_REGISTRY_MAX_NODES];
 
 esp_err_t initialize_nvs(void){
@@ -40,73 +45,11 @@ esp_err_t initialize_nvs(void){
     return err;
 }
 
-
-/// @brief Receive callback function for Zenith Core
-/// @param mac Mac address of the sender of the packet received
-/// @param packet The packet received
-static void core_rx_callback(const uint8_t *mac, const zenith_now_packet_t *packet)
-{
-    ESP_RETURN_VOID_ON_FALSE(
-        mac && packet,
-        TAG, "NULL pointer passed to core_rx_callback"
-    );
-
-    ESP_RETURN_VOID_ON_FALSE(
-        packet->header.version == ZENITH_NOW_VERSION,
-        TAG, "Version mismatch: %d != %d", packet->header.version, ZENITH_NOW_VERSION
-    );
-
-    switch ( packet->header.type )
-    {
-        case ZENITH_PACKET_PAIRING:
-            ESP_LOGI( TAG, "Received pairing request from mac: "MACSTR, MAC2STR( mac ) );
-            // Check if any flags or versions or whatnot that are set in the pairing payload and if all is ok:
-
-            // Store the node in registry
-            zenith_node_info_t node_info;
-            memcpy(&node_info.mac, mac, sizeof( zenith_mac_address_t ) );
-
-            ESP_ERROR_CHECK(
-                zenith_registry_store_node_info( node_registry, &node_info )
-            );
-
-            // Send ack
-            ESP_ERROR_CHECK( 
-                zenith_now_send_ack( mac, ZENITH_PACKET_PAIRING ) 
-            );
-
-            // Do the pairing complete blink
-            ESP_ERROR_CHECK( 
-                zenith_blink( BLINK_PAIRING_COMPLETE ) 
-            );
-
-            break;
-
-        case ZENITH_PACKET_DATA:
-            zenith_blink( BLINK_DATA_RECEIVE );
-            ESP_ERROR_CHECK( 
-                zenith_now_send_ack( mac, packet->header.type ) 
-            );
-            
-            zenith_datapoints_t *data = ( zenith_datapoints_t * )packet->payload;
-            
-            ESP_LOGI( TAG, "Received data from mac: "MACSTR, MAC2STR( mac ) );
-            ESP_LOGI( TAG, "number_of_datapoints: %d", data->num_datapoints );          
-            for ( int i = 0; i < data->num_datapoints; ++i ) {
-                ESP_LOGI( TAG, "datapoint %d: type: %d value: %.2f", i, data->datapoints[i].reading_type, data->datapoints[i].value );
-            }
-            
-            ESP_ERROR_CHECK( zenith_registry_store_datapoints( node_registry, mac, data->datapoints, data->num_datapoints ) );
-            //ESP_ERROR_CHECK( zenith_registry_full_contents_to_log( node_registry ) );
-
-            //ESP_LOGI( TAG, "Free heap: %u bytes", heap_caps_get_free_size( MALLOC_CAP_DEFAULT ) );
-            //UBaseType_t high_water_mark = uxTaskGetStackHighWaterMark( NULL );
-            //ESP_LOGI( TAG, "Stack high water mark: %u words (%u bytes)", high_water_mark, high_water_mark * sizeof( StackType_t ) );
-            break;
-        default:
-            ESP_LOGI( TAG, "default unhandled type %d from mac: "MACSTR, packet->header.type, MAC2STR( mac ) );
-            break;
-        }
+/// @brief Runs on esp_restart, so the restart command doesn't lose node list changes or readings still in RAM
+static void core_shutdown_handler( void ) {
+    zenith_registry_flush( node_registry );
+    if ( node_log )
+        zenith_log_flush( node_log );
 }
 
 #define PROMPT_STR CONFIG_IDF_TARGET
@@ -118,13 +61,55 @@ static struct {
 
 typedef enum dump_component_e {
     DUMP_TARGET_REGISTRY=0,
+    DUMP_TARGET_NOW,
+    DUMP_TARGET_LOG,
     DUMP_TARGET_MAX
 } dump_component_t;
 
 static const char* s_dump_component_names[] = {
     "registry",
+    "now",
+    "log",
 };
 
+/// @brief Prints the zenith_now statistics to the console
+static void dump_zenith_now_stats( void ) {
+    zenith_now_stats_t stats;
+    ESP_ERROR_CHECK( zenith_now_get_stats( &stats ) );
+
+    printf( "---- Zenith Now Stats ----\n" );
+    printf( "RX pool size:       %u\n", (unsigned) stats.rx_pool_size );
+    printf( "RX pool in use:     %u\n", (unsigned) stats.rx_pool_in_use );
+    printf( "RX pool high water: %u\n", (unsigned) stats.rx_pool_high_water );
+    printf( "RX pool exhausted:  %u\n", (unsigned) stats.rx_pool_exhausted );
+    printf( "RX duplicates:      %u\n", (unsigned) stats.rx_duplicates );
+    printf( "TX failed:          %u\n", (unsigned) stats.tx_failed );
+    printf( "ACKs sent:          %u\n", (unsigned) stats.acks_sent );
+    printf( "ACK latency:        avg %u us, max %u us\n", (unsigned) stats.ack_latency_avg_us, (unsigned) stats.ack_latency_max_us );
+    printf( "Event queue:        %u / %u high water\n", (unsigned) stats.event_queue_high_water, (unsigned) stats.event_queue_size );
+    printf( "Events per wake-up: %u.%u\n", (unsigned) stats.event_batch_avg_x10 / 10, (unsigned) stats.event_batch_avg_x10 % 10 );
+    printf( "Queue drops:        %u RX, %u TX status\n", (unsigned) stats.rx_queue_dropped, (unsigned) stats.tx_status_dropped );
+    printf( "--------------------------\n" );
+}
+
+/// @brief Prints the flash log statistics to the console
+static void dump_zenith_log_stats( void ) {
+    if ( !node_log ) {
+        printf( "No flash log\n" );
+        return;
+    }
+
+    zenith_log_stats_t stats;
+    ESP_ERROR_CHECK( zenith_log_get_stats( node_log, &stats ) );
+
+    printf( "---- Zenith Log Stats ----\n" );
+    printf( "Segments:           %u / %u used\n", (unsigned) stats.segments_used, (unsigned) stats.segments );
+    printf( "Records:            %u on flash, %u pending\n", (unsigned) stats.records, (unsigned) stats.records_pending );
+    printf( "Torn chunks:        %u\n", (unsigned) stats.chunks_torn );
+    printf( "Erases:             %u\n", (unsigned) stats.erases );
+    printf( "Timestamps:         %u - %u\n", (unsigned) stats.oldest_timestamp, (unsigned) stats.newest_timestamp );
+    printf( "--------------------------\n" );
+}
 
 static int command_dump_component(int argc, char **argv) {
     int nerrors = arg_parse( argc, argv, (void **) &dump_component_args );
@@ -152,9 +137,15 @@ static int command_dump_component(int argc, char **argv) {
         case DUMP_TARGET_REGISTRY:
             ESP_ERROR_CHECK( zenith_registry_full_contents_to_log( node_registry ) );
             break;
+        case DUMP_TARGET_NOW:
+            dump_zenith_now_stats();
+            break;
+        case DUMP_TARGET_LOG:
+            dump_zenith_log_stats();
+            break;
         default:
             if ( target == DUMP_TARGET_MAX ) {
-                printf( "Invalid dump target '%s', choose from registry|(more-to-come)\n", target_str );
+                printf( "Invalid dump target '%s', choose from registry|now|log\n", target_str );
                 return 1;
             }
             ESP_LOGW( TAG, "Implementation missing for target %s", target_str );
@@ -164,15 +155,144 @@ static int command_dump_component(int argc, char **argv) {
     return 0;
 }
 
+// Registry backup over the console. export prints the registry's export stream in base64 lines between two markers,
+// import takes them back a line at a time - zenith_core/tools/registry_backup.py does both ends from a PC.
+#define EXPORT_LINE_BYTES 96        // Stream bytes per base64 line, 128 characters
+#define EXPORT_BEGIN "---- registry export begin ----"
+#define EXPORT_END "---- registry export end"
+#define IMPORT_LINE_BYTES 768       // Decoded bytes of the longest import line the 1024 character command line takes
+
+typedef struct export_line_s {
+    uint8_t bytes[ EXPORT_LINE_BYTES ];
+    size_t len;
+    size_t total;
+} export_line_t;
+
+static zenith_registry_import_t s_import; // About as big as a ring, too much for the console task's stack
+static zenith_registry_checkpoint_record_t s_export_record; // Same for the ring an export is copying
+static bool s_importing = false;
+
+static void export_print_line( export_line_t *line ) {
+    unsigned char text[ EXPORT_LINE_BYTES / 3 * 4 + 1 ];
+    size_t text_len = 0;
+    mbedtls_base64_encode( text, sizeof( text ), &text_len, line->bytes, line->len );
+    printf( "%.*s\n", ( int ) text_len, text );
+    line->len = 0;
+}
+
+/// @brief zenith_registry_export_write_t for the console - cuts the stream into lines
+static esp_err_t export_write( const void *data, size_t len, void *context ) {
+    export_line_t *line = context;
+    const uint8_t *bytes = data;
+    line->total += len;
+    while ( len ) {
+        size_t n = EXPORT_LINE_BYTES - line->len < len ? EXPORT_LINE_BYTES - line->len : len;
+        memcpy( line->bytes + line->len, bytes, n );
+        line->len += n;
+        bytes += n;
+        len -= n;
+        if ( line->len == EXPORT_LINE_BYTES )
+            export_print_line( line );
+    }
+    return ESP_OK;
+}
+
+static int command_export( int argc, char **argv ) {
+    export_line_t line = { 0 };
+    printf( EXPORT_BEGIN "\n" );
+    esp_err_t ret = zenith_registry_export( node_registry, &s_export_record, export_write, &line );
+    if ( line.len )
+        export_print_line( &line );
+    printf( EXPORT_END ", %u bytes ----\n", ( unsigned ) line.total );
+    if ( ret != ESP_OK ) {
+        printf( "Export failed: %s\n", esp_err_to_name( ret ) );
+        return 1;
+    }
+    return 0;
+}
+
+static struct {
+    struct arg_str *action;
+    struct arg_str *data;
+    struct arg_end *end;
+} import_args;
+
+static int command_import( int argc, char **argv ) {
+    int nerrors = arg_parse( argc, argv, (void **) &import_args );
+    if ( nerrors ) {
+        arg_print_errors( stderr, import_args.end, argv[0] );
+        return 1;
+    }
+
+    const char *action = import_args.action->sval[0];
+    esp_err_t ret = ESP_OK;
+    if ( strcmp( action, "begin" ) == 0 ) {
+        ret = zenith_registry_import_begin( node_registry, &s_import );
+        s_importing = ret == ESP_OK;
+    } else if ( strcmp( action, "data" ) == 0 && s_importing && import_args.data->count == 1 ) {
+        static uint8_t bytes[ IMPORT_LINE_BYTES ];
+        size_t len = 0;
+        const char *text = import_args.data->sval[0];
+        if ( mbedtls_base64_decode( bytes, sizeof( bytes ), &len, ( const unsigned char * ) text, strlen( text ) ) != 0 ) {
+            printf( "import failed: not base64, or over %u bytes\n", ( unsigned ) IMPORT_LINE_BYTES );
+            return 1;
+        }
+        // The registry has one writer - readings wait while a line goes in
+        zenith_core_rx_lock();
+        ret = zenith_registry_import_feed( &s_import, bytes, len );
+        zenith_core_rx_unlock();
+    } else if ( strcmp( action, "end" ) == 0 && s_importing ) {
+        ret = zenith_registry_import_end( &s_import );
+        s_importing = false;
+        if ( ret == ESP_OK )
+            printf( "import ok: %u nodes, %u rings, %u rings kept\n", ( unsigned ) s_import.seen.nodes,
+                    ( unsigned ) ( s_import.seen.rings - s_import.rings_kept ), ( unsigned ) s_import.rings_kept );
+    } else {
+        printf( "import failed: use import begin, import data <base64>, import end\n" );
+        return 1;
+    }
+
+    if ( ret != ESP_OK ) {
+        printf( "import failed: %s\n", esp_err_to_name( ret ) );
+        return 1;
+    }
+    if ( strcmp( action, "end" ) != 0 )
+        printf( "import ok\n" );
+    return 0;
+}
+
+static void register_backup( void )
+{
+    const esp_console_cmd_t export_cmd = {
+        .command = "export",
+        .help = "Prints the node list and every ring, base64 encoded, for zenith_core/tools/registry_backup.py.",
+        .hint = NULL,
+        .func = &command_export,
+    };
+    ESP_ERROR_CHECK( esp_console_cmd_register( &export_cmd ) );
+
+    import_args.action = arg_str1( NULL, NULL, "action", "begin|data|end" );
+    import_args.data = arg_str0( NULL, NULL, "base64", "A line of an export, with data" );
+    import_args.end = arg_end( 2 );
+    const esp_console_cmd_t import_cmd = {
+        .command = "import",
+        .help = "Takes back what export printed: import begin, then import data with every line, then import end.",
+        .hint = NULL,
+        .func = &command_import,
+        .argtable = &import_args
+    };
+    ESP_ERROR_CHECK( esp_console_cmd_register( &import_cmd ) );
+}
+
 
 static void register_dump(void)
 {
-    dump_component_args.component = arg_str1( NULL, NULL, "target", "To be implemented. The target that you want to dump. Currently just dumps registry" );
+    dump_component_args.component = arg_str1( NULL, NULL, "target", "The target that you want to dump: registry|now|log" );
     dump_component_args.end = arg_end(1);
 
     const esp_console_cmd_t cmd = {
         .command = "dump",
-        .help = "Dumps information and statistics from various compontents. Currently only supported component is registry.",
+        .help = "Dumps information and statistics from various compontents. Supported components are registry, now (zenith_now statistics) and log (flash log statistics).",
         .hint = NULL,
         .func = &command_dump_component,
         .argtable = &dump_component_args
@@ -188,7 +308,30 @@ void app_main( void )
     // Initialize default NVS partition
     ESP_ERROR_CHECK( initialize_nvs() );
     ESP_ERROR_CHECK( zenith_registry_new( &node_registry ) );
-    ESP_ERROR_CHECK( zenith_registry_full_contents_to_log( node_registry ) );
+
+    // Rings and rollups from before the reboot, so the UI has history right away
+    zenith_log_storage_handle_t checkpoint_storage = NULL;
+    if ( zenith_log_storage_new_partition( "checkpoint", &checkpoint_storage ) != ESP_OK
+            || zenith_registry_attach_checkpoint( node_registry, checkpoint_storage ) != ESP_OK ) {
+        ESP_LOGW( TAG, "No registry checkpoints, history starts empty after every reboot" );
+        zenith_log_storage_delete( checkpoint_storage );
+    } else if ( zenith_registry_restore_checkpoint( node_registry ) != ESP_OK ) {
+        ESP_LOGW( TAG, "Registry checkpoint not restored, history starts empty this time" );
+    }
+    // Counts only - printing every restored reading would hold up pairing and ingest for seconds. "dump" has them all.
+    size_t node_count = 0;
+    zenith_registry_persist_stats_t persist_stats = { 0 };
+    ESP_ERROR_CHECK( zenith_registry_get_node_count( node_registry, &node_count ) );
+    ESP_ERROR_CHECK( zenith_registry_get_persist_stats( node_registry, &persist_stats ) );
+    ESP_LOGI( TAG, "Registry has %u nodes, %u rings restored from the checkpoint", ( unsigned ) node_count, ( unsigned ) persist_stats.rings_restored );
+
+    // History on flash - the core runs fine without it, just without history from before the last reboot
+    zenith_log_storage_handle_t log_storage = NULL;
+    if ( zenith_log_storage_new_partition( "history", &log_storage ) != ESP_OK || zenith_log_new( log_storage, &node_log ) != ESP_OK ) {
+        ESP_LOGW( TAG, "No flash log, readings are kept in RAM only" );
+        zenith_log_storage_delete( log_storage );
+        node_log = NULL;
+    }
     /* size_t count;
     ESP_ERROR_CHECK( zenith_registry_get_node_count( node_registry, &count ) ); 
     ESP_LOGI( TAG, "Registry has %d values", count);*/
@@ -218,9 +361,14 @@ void app_main( void )
     // Initialize blinker
     ESP_ERROR_CHECK( init_zenith_blink( WS2812_GPIO ) );
 
+    ESP_ERROR_CHECK( esp_register_shutdown_handler( core_shutdown_handler ) );
+
     // Initialize Zenith Now
+    zenith_core_rx_init( node_registry, node_log );
     zenith_now_config_t zn_config = {
         .rx_cb = core_rx_callback,
+        .auto_ack = CORE_RX_AUTO_ACK,
+        .rx_worker = CORE_RX_WORKER,
     };
     zenith_now_init( &zn_config );
 
@@ -237,6 +385,7 @@ void app_main( void )
     esp_console_register_help_command();
     register_system_common();
     register_dump();
+    register_backup();
     esp_console_dev_usb_serial_jtag_config_t hw_config = ESP_CONSOLE_DEV_USB_SERIAL_JTAG_CONFIG_DEFAULT();
     ESP_ERROR_CHECK(
         esp_console_new_repl_usb_serial_jtag( &hw_config, &repl_config, &repl) 
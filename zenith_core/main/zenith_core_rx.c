@@ -0,0 +1,152 @@
+// zenith_core_rx.c
+#include <stdio.h>
+#include "string.h"
+#include "esp_log.h"
+#include "esp_err.h"
+#include "esp_check.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "zenith_now.h"
+#include "zenith_registry.h"
+#include "zenith_log.h"
+#include "zenith_data.h"
+#include "zenith_core_rx.h"
+
+#ifdef CONFIG_IDF_TARGET_LINUX
+#define CORE_BLINK( blink_type ) // No LED on the linux target
+#else
+#include "zenith_blink.h"
+#define CORE_BLINK( blink_type ) zenith_blink( blink_type )
+#endif
+
+static const char *TAG = "zenith-core-rx";
+
+static zenith_registry_handle_t node_registry = NULL;
+static zenith_log_handle_t node_log = NULL;
+static SemaphoreHandle_t rx_lock = NULL;   // Held while a packet is handled, so other tasks can hold off registry writes
+
+/// @brief Sets the registry core_rx_callback stores nodes and readings in
+/// @param registry the registry
+/// @param log the flash log readings are also appended to, or NULL
+void zenith_core_rx_init( zenith_registry_handle_t registry, zenith_log_handle_t log ) {
+    node_registry = registry;
+    node_log = log;
+    if ( !rx_lock )
+        rx_lock = xSemaphoreCreateMutex();
+    if ( !rx_lock )
+        ESP_LOGE( TAG, "Could not create the rx lock, zenith_core_rx_lock won't hold anything off" );
+}
+
+void zenith_core_rx_lock( void ) {
+    if ( rx_lock )
+        xSemaphoreTake( rx_lock, portMAX_DELAY );
+}
+
+void zenith_core_rx_unlock( void ) {
+    if ( rx_lock )
+        xSemaphoreGive( rx_lock );
+}
+
+/// @brief Handles a packet for core_rx_callback, with the rx lock held
+static void core_rx_handle_packet( const uint8_t *mac, const zenith_now_packet_t *packet )
+{
+    ESP_RETURN_VOID_ON_FALSE(
+        mac && packet,
+        TAG, "NULL pointer passed to core_rx_callback"
+    );
+
+    // Older nodes on the same major version are still welcome - zenith_now_decode_data deals with their payloads
+    ESP_RETURN_VOID_ON_FALSE(
+        ZENITH_NOW_VERSION_MAJOR( packet->header.version ) == ZENITH_NOW_MAJOR_VERSION,
+        TAG, "Version mismatch: %d != %d", packet->header.version, ZENITH_NOW_VERSION
+    );
+
+    switch ( packet->header.type )
+    {
+        case ZENITH_PACKET_PAIRING:
+            ESP_LOGI( TAG, "Received pairing request from mac: "MACSTR, MAC2STR( mac ) );
+            // Check if any flags or versions or whatnot that are set in the pairing payload and if all is ok:
+
+            // Store the node in registry
+            zenith_node_info_t node_info;
+            memcpy(&node_info.mac, mac, sizeof( zenith_mac_address_t ) );
+
+            // A full registry is no reason to take the core down. The node gets no ack, so it keeps asking instead of
+            // sending data we can't keep.
+            ESP_RETURN_VOID_ON_ERROR(
+                zenith_registry_store_node_info( node_registry, &node_info ),
+                TAG, "Could not store node "MACSTR, MAC2STR( mac )
+            );
+
+            // Only a stored node gets its ack, accepting whatever encoding flags we both support. CORE_RX_AUTO_ACK leaves
+            // pairing to us for that.
+            if ( !zenith_now_auto_acks( ZENITH_PACKET_PAIRING ) ) {
+                uint8_t pairing_flags = 0;
+                if ( packet->header.payload_size >= sizeof( zenith_now_payload_pairing_t ) )
+                    pairing_flags = ( ( zenith_now_payload_pairing_t * ) packet->payload )->flags;
+                ESP_RETURN_VOID_ON_ERROR(
+                    zenith_now_send_pairing_ack( mac, pairing_flags ),
+                    TAG, "Could not ack pairing from "MACSTR, MAC2STR( mac )
+                );
+            }
+
+            // Do the pairing complete blink
+            CORE_BLINK( BLINK_PAIRING_COMPLETE );
+
+            break;
+
+        case ZENITH_PACKET_DATA:
+            CORE_BLINK( BLINK_DATA_RECEIVE );
+            // The radio can be too busy to take the ack - the node retransmits and we ack the duplicate
+            if ( !zenith_now_auto_acks( ZENITH_PACKET_DATA ) && zenith_now_send_ack( mac, packet->header.type ) != ESP_OK )
+                ESP_LOGW( TAG, "Could not ack data from "MACSTR, MAC2STR( mac ) );
+            
+            // A packet can hold a whole batch of samples journaled by the node - each keeps its own timestamp
+            zenith_datapoint_t datapoints[ ZENITH_DATAPOINTS_MAX_PER_PACKET ];
+            time_t timestamps[ ZENITH_DATAPOINTS_MAX_PER_PACKET ];
+            size_t count = ZENITH_DATAPOINTS_MAX_PER_PACKET;
+            ESP_RETURN_VOID_ON_ERROR(
+                zenith_now_decode_data( packet, time( NULL ), datapoints, timestamps, &count ),
+                TAG, "Malformed data packet from mac: "MACSTR, MAC2STR( mac )
+            );
+            
+            ESP_LOGI( TAG, "Received data from mac: "MACSTR, MAC2STR( mac ) );
+            ESP_LOGI( TAG, "number_of_datapoints: %d", count );          
+            for ( int i = 0; i < count; ++i ) {
+                ESP_LOGI( TAG, "datapoint %d: type: %d value: %.2f ts: %lld", i, datapoints[i].reading_type, datapoints[i].value, (long long) timestamps[i] );
+            }
+            
+            ESP_RETURN_VOID_ON_ERROR(
+                zenith_registry_store_datapoints( node_registry, mac, datapoints, timestamps, count ),
+                TAG, "Could not store data from "MACSTR, MAC2STR( mac )
+            );
+
+            // The registry only keeps recent history in RAM - the log keeps it across reboots
+            for ( int i = 0; node_log && i < count; ++i ) {
+                if ( zenith_log_append( node_log, mac, datapoints[i].reading_type, timestamps[i], datapoints[i].value ) != ESP_OK ) {
+                    ESP_LOGW( TAG, "Could not log data from "MACSTR, MAC2STR( mac ) );
+                    break;
+                }
+            }
+            //ESP_ERROR_CHECK( zenith_registry_full_contents_to_log( node_registry ) );
+
+            //ESP_LOGI( TAG, "Free heap: %u bytes", heap_caps_get_free_size( MALLOC_CAP_DEFAULT ) );
+            //UBaseType_t high_water_mark = uxTaskGetStackHighWaterMark( NULL );
+            //ESP_LOGI( TAG, "Stack high water mark: %u words (%u bytes)", high_water_mark, high_water_mark * sizeof( StackType_t ) );
+            break;
+        default:
+            ESP_LOGI( TAG, "default unhandled type %d from mac: "MACSTR, packet->header.type, MAC2STR( mac ) );
+            break;
+        }
+}
+
+/// @brief Receive callback function for Zenith Core
+/// @param mac Mac address of the sender of the packet received
+/// @param packet The packet received
+void core_rx_callback(const uint8_t *mac, const zenith_now_packet_t *packet)
+{
+    zenith_core_rx_lock();
+    core_rx_handle_packet( mac, packet );
+    zenith_core_rx_unlock();
+}
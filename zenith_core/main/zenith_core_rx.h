@@ -0,0 +1,34 @@
+// zenith_core_rx.h
+#pragma once
+
+#include "zenith_now.h"
+#include "zenith_registry.h"
+#include "zenith_log.h"
+
+/**
+ * @brief Sets the registry the core stores into, and the flash log readings are appended to. Call before zenith_now_init.
+ * @param log the flash log, or NULL to keep readings in the registry only
+ */
+void zenith_core_rx_init( zenith_registry_handle_t registry, zenith_log_handle_t log );
+
+/**
+ * @brief Holds off core_rx_callback, so another task can write to the registry - the console's import does. Packets
+ *        wait in zenith_now's queue meanwhile - data already acked with CORE_RX_AUTO_ACK, pairing not - so keep it short.
+ */
+void zenith_core_rx_lock( void );
+void zenith_core_rx_unlock( void );
+
+/**
+ * @brief How the core runs zenith_now: data acked as soon as it's dequeued, and core_rx_callback on the worker task so
+ *        the registry and the logging don't hold up acks to other nodes. Pairing is acked by core_rx_callback, once the
+ *        node is in the registry - a node paired by an ack the registry then turned down would never be heard of.
+ */
+#define CORE_RX_AUTO_ACK ( ZENITH_NOW_AUTO_ACK_DATA )
+#define CORE_RX_WORKER true
+
+/**
+ * @brief The core's zenith_now receive callback - pairs nodes, acks and stores their data
+ * @details Leaves the acks to zenith_now for the packet types it auto acks.
+ *          Kept apart from zenith_core.c so it can run without the screen and LED, like in zenith_swarm on the linux target.
+ */
+void core_rx_callback( const uint8_t *mac, const zenith_now_packet_t *packet );
@@ -0,0 +1,202 @@
+#!/usr/bin/env python3
+# registry_backup.py
+#
+# Backs up the registry of a Zenith Core over its console, and restores it, on this or another core. The core's
+# export command prints the registry export stream (zenith_registry_export) as base64 lines, and import takes them back.
+#
+#   registry_backup.py backup /dev/ttyACM0 core.zrex
+#   registry_backup.py restore /dev/ttyACM0 core.zrex
+#   registry_backup.py info core.zrex
+#
+# backup and restore need pyserial, which ESP-IDF's python environment has.
+
+import argparse
+import base64
+import binascii
+import struct
+import sys
+import time
+import zlib
+
+EXPORT_MAGIC = 0x5A524558  # "ZREX"
+EXPORT_VERSION = 1
+HEADER = struct.Struct("<IHHHHIq")   # zenith_registry_export_header_t
+RECORD = struct.Struct("<BBHI")      # zenith_registry_export_record_t
+END = struct.Struct("<II")           # zenith_registry_export_end_t
+TAG_NODE, TAG_RING, TAG_END = 1, 2, 3
+
+EXPORT_BEGIN = "---- registry export begin ----"
+EXPORT_END = "---- registry export end"
+IMPORT_LINE_BYTES = 512  # Well inside the core's 1024 character command line once it's base64
+TIMEOUT_S = 10
+
+
+class BackupError(Exception):
+    pass
+
+
+def parse(stream):
+    """Checks an export stream the way the core's import does. Returns the header, the records and the end counts."""
+    if len(stream) < HEADER.size:
+        raise BackupError("too short for an export header")
+    magic, version, checkpoint_version, ring_record_size, node_info_size, _, exported_at = HEADER.unpack_from(stream)
+    if magic != EXPORT_MAGIC or version != EXPORT_VERSION:
+        raise BackupError("not a registry export, or one of another version")
+    header = {
+        "checkpoint_version": checkpoint_version,
+        "ring_record_size": ring_record_size,
+        "node_info_size": node_info_size,
+        "exported_at": exported_at,
+    }
+
+    records = []
+    offset = HEADER.size
+    while offset < len(stream):
+        if offset + RECORD.size > len(stream):
+            raise BackupError("cut off in a record header at byte %d" % offset)
+        tag, _, size, crc = RECORD.unpack_from(stream, offset)
+        payload = stream[offset + RECORD.size:offset + RECORD.size + size]
+        if len(payload) != size:
+            raise BackupError("cut off in a record at byte %d" % offset)
+        if tag in (TAG_NODE, TAG_RING, TAG_END) and zlib.crc32(payload) != crc:
+            raise BackupError("record at byte %d has a bad crc" % offset)
+        offset += RECORD.size + size
+        if tag == TAG_END:
+            nodes, rings = END.unpack(payload)
+            found = (sum(t == TAG_NODE for t, _ in records), sum(t == TAG_RING for t, _ in records))
+            if found != (nodes, rings):
+                raise BackupError("has %d nodes and %d rings, the end record says %d and %d" % (found + (nodes, rings)))
+            if offset != len(stream):
+                raise BackupError("data after the end record")
+            return header, records, (nodes, rings)
+        records.append((tag, payload))
+    raise BackupError("no end record, the export was cut off")
+
+
+def mac_str(payload):
+    return ":".join("%02x" % b for b in payload[:6])
+
+
+class Console:
+    """The core's console, a line at a time"""
+
+    def __init__(self, port):
+        try:
+            import serial
+        except ImportError:
+            raise BackupError("needs pyserial - pip install pyserial, or use ESP-IDF's python")
+        self.serial = serial.Serial(port, 115200, timeout=0.5)
+        self.serial.reset_input_buffer()
+
+    def command(self, line):
+        self.serial.write(line.encode() + b"\r\n")
+
+    def read_line(self, deadline):
+        while time.monotonic() < deadline:
+            line = self.serial.readline()
+            if line:
+                return line.decode(errors="replace").strip()
+        raise BackupError("no answer from the core")
+
+    def wait_for(self, *answers):
+        """Waits for a line with one of answers in it, skipping the echo, the prompt and log lines"""
+        deadline = time.monotonic() + TIMEOUT_S
+        while True:
+            line = self.read_line(deadline)
+            for answer in answers:
+                if answer in line:
+                    return line
+
+
+def backup(port, path):
+    console = Console(port)
+    console.command("export")
+    console.wait_for(EXPORT_BEGIN)
+
+    # Log lines from other tasks can land between the base64 ones - they're never valid base64 of a whole line
+    stream = bytearray()
+    deadline = time.monotonic() + TIMEOUT_S
+    while True:
+        line = console.read_line(deadline)
+        deadline = time.monotonic() + TIMEOUT_S
+        if EXPORT_END in line:
+            break
+        try:
+            stream += base64.b64decode(line, validate=True)
+        except binascii.Error:
+            continue
+
+    expected = int(line.split(",")[1].split()[0])
+    if len(stream) != expected:
+        raise BackupError("got %d bytes, the core sent %d" % (len(stream), expected))
+    _, _, (nodes, rings) = parse(bytes(stream))
+    with open(path, "wb") as f:
+        f.write(stream)
+    print("Saved %d nodes and %d rings, %d bytes, to %s" % (nodes, rings, len(stream), path))
+
+
+def restore(port, path):
+    with open(path, "rb") as f:
+        stream = f.read()
+    parse(stream)  # Don't start an import that can't finish
+
+    console = Console(port)
+    lines = ["import begin"]
+    for offset in range(0, len(stream), IMPORT_LINE_BYTES):
+        lines.append("import data " + base64.b64encode(stream[offset:offset + IMPORT_LINE_BYTES]).decode())
+    lines.append("import end")
+
+    for i, line in enumerate(lines):
+        console.command(line)
+        answer = console.wait_for("import ok", "import failed")
+        if "import failed" in answer:
+            raise BackupError("core says: " + answer[answer.index("import failed"):])
+        print("\r%d / %d lines" % (i + 1, len(lines)), end="", flush=True)
+    print("\n" + answer[answer.index("import ok"):])
+
+
+def info(path):
+    with open(path, "rb") as f:
+        stream = f.read()
+    header, records, (nodes, rings) = parse(stream)
+    print("Export of %s, %d bytes" % (time.strftime("%Y-%m-%d %H:%M:%S", time.gmtime(header["exported_at"])), len(stream)))
+    print("Checkpoint version %d, %d byte rings, %d byte node info" %
+          (header["checkpoint_version"], header["ring_record_size"], header["node_info_size"]))
+    print("%d nodes, %d rings" % (nodes, rings))
+
+    rings_of = {}
+    for tag, payload in records:
+        if tag == TAG_RING:
+            rings_of[mac_str(payload)] = rings_of.get(mac_str(payload), 0) + 1
+    for tag, payload in records:
+        if tag == TAG_NODE:
+            print("  %s  %d rings" % (mac_str(payload), rings_of.pop(mac_str(payload), 0)))
+    for mac, count in rings_of.items():
+        print("  %s  %d rings, not paired" % (mac, count))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Back up and restore the registry of a Zenith Core over its console")
+    commands = parser.add_subparsers(dest="command", required=True)
+    for name in ("backup", "restore"):
+        command = commands.add_parser(name)
+        command.add_argument("port", help="the core's USB serial port, like /dev/ttyACM0")
+        command.add_argument("file")
+    commands.add_parser("info").add_argument("file")
+    args = parser.parse_args()
+
+    try:
+        if args.command == "backup":
+            backup(args.port, args.file)
+        elif args.command == "restore":
+            restore(args.port, args.file)
+        else:
+            info(args.file)
+    except (BackupError, OSError) as e:
+        print("%s failed: %s" % (args.command, e), file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
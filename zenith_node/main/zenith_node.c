@@ -2,7 +2,9 @@
 #define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE
 
 #include <stdio.h>
+#include <stddef.h>
 #include <string.h>
+#include <time.h>
 #include "esp_log.h"
 #include "esp_err.h"
 #include "esp_check.h"
@@ -26,7 +28,11 @@
 /* zenith specific variables */
 static const char *TAG = "zenith-node";
 RTC_DATA_ATTR static uint8_t paired_core[ ESP_NOW_ETH_ALEN ] = { 0 }; // peers mac address
-RTC_DATA_ATTR uint8_t failed_sends = 0;
+RTC_DATA_ATTR static uint8_t core_pairing_flags = 0; // pairing flags the core accepted
+RTC_DATA_ATTR static uint8_t core_version = 0; // protocol version the core paired with
+
+// Samples waiting to be sent to the core. Kept in RTC memory so we only need the radio every few wakes.
+RTC_DATA_ATTR static node_journal_t journal = { 0 };
 
 
 bool saved_peer( void ){
@@ -43,17 +49,11 @@ void pair_with_core( void ){
         zenith_now_add_peer( broadcast ) 
     ); 
 
-    // Create pairing packet
-    zenith_now_packet_t data_packet = { 
-        .header.type = ZENITH_PACKET_PAIRING,
-        .header.version = ZENITH_NOW_VERSION,
-    }; 
-
     // initialize counter for pairing retries
     uint8_t peering_tries = 0; 
     do {
-        // If we miss 5 pairing requests, enter deeps sleep
-        if (peering_tries++ >= 5)
+        // If we miss NODE_PAIRING_TRIES pairing requests, enter deeps sleep
+        if (peering_tries++ >= NODE_PAIRING_TRIES)
             esp_deep_sleep(NODE_SLEEP_NO_PEER); 
         
         // Blink to show we are trying to pair
@@ -63,9 +63,9 @@ void pair_with_core( void ){
 
         // Send the pairing request
         ESP_ERROR_CHECK(
-            zenith_now_send_packet( broadcast, &data_packet )
+            zenith_now_send_pairing( broadcast )
         ); 
-    } while ( zenith_now_wait_for_ack( ZENITH_PACKET_PAIRING, 5000 ) != ESP_OK ); // Wait 5 seconds for ack, and retry if we timed out
+    } while ( zenith_now_wait_for_ack( ZENITH_PACKET_PAIRING, NODE_PAIRING_TIMEOUT_MS ) != ESP_OK ); // Wait for ack, and retry if we timed out
 
     // Remove broadcast peer
     ESP_ERROR_CHECK(
@@ -118,12 +118,9 @@ esp_err_t init_sensor( zenith_sensor_handle_t *sensor, i2c_master_bus_handle_t i
     return ESP_OK;
 }
 
-/// @brief Reads the sensor and sends the data to the paired_core
-/// @return Allways returns ESP_OK
-void send_data( zenith_sensor_handle_t sensor ) {
-    
-    // Initialize data packet
-
+/// @brief Reads the sensor and appends the sample to the RTC journal
+/// @details The journal survives deep sleep. If it is full because the core has been unreachable, the oldest sample is dropped.
+void journal_sample( zenith_sensor_handle_t sensor ) {
     zenith_datapoints_t *sensor_data = NULL;
 
     ESP_ERROR_CHECK( 
@@ -132,26 +129,78 @@ void send_data( zenith_sensor_handle_t sensor ) {
     
     ESP_LOGI( TAG, "%d sensor data read", sensor_data->num_datapoints );
 
-    // check this one!!
-    //zenith_datapoints_to_zenith_now( &sensor_data, &data );
+    // RTC time keeps running through deep sleep
+    if ( node_journal_add( &journal, time( NULL ), sensor_data->datapoints, sensor_data->num_datapoints ) )
+        ESP_LOGW( TAG, "Journal full, dropped oldest sample" );
+
+    free( sensor_data );
+}
+
+/// @brief Waits for the ack of a data packet, retransmitting it if the ack doesn't show up
+/// @details Cores before 1.5 don't ack by sequence number, so for them we can only wait for any data ack.
+///          node_flush_ack_result decides when to resend and when to give up.
+static void wait_for_data_ack( node_flush_packet_t *flush_packet ) {
+    const zenith_now_packet_t *packet = flush_packet->builder.packet;
+    bool sequenced = ZENITH_NOW_VERSION_MINOR( core_version ) >= ZENITH_NOW_SEQUENCE_MINOR_VERSION;
+
+    while ( true ) {
+        esp_err_t ret = sequenced
+            ? zenith_now_wait_for_ack_sequence( paired_core, packet->header.sequence, NODE_ACK_TIMEOUT_MS )
+            : zenith_now_wait_for_ack( ZENITH_PACKET_DATA, NODE_ACK_TIMEOUT_MS );
+        if ( !node_flush_ack_result( flush_packet, ret ) )
+            return;
+
+        if ( ret == ESP_ERR_ZENITH_NOW_SEND_FAILED )
+            ESP_LOGW( TAG, "Packet %u failed to send, resending", packet->header.sequence );
+        else
+            ESP_LOGW( TAG, "No ack for packet %u, retransmitting", packet->header.sequence );
+
+        // Same buffer, same sequence number - if the core got it already it just acks it again
+        ESP_ERROR_CHECK(
+            zenith_now_send_packet( paired_core, packet )
+        );
+    }
+}
+
+/// @brief Sends the journal to the paired_core, as few packets as possible
+/// @details A 1.5+ core acks by sequence number, so we send up to NODE_MAX_IN_FLIGHT packets before waiting for the
+///          acks, and retransmit only the ones that went missing. Samples are only removed from the journal once the
+///          core has acked the packet carrying them.
+void flush_journal( void ) {
+    static node_flush_t flush; // Too big for the main task's stack
 
     // Healing: Ensure peer is in our list of peers
     ESP_ERROR_CHECK( 
         zenith_now_add_peer( paired_core ) 
     );
 
-    // Send data
-    ESP_ERROR_CHECK( 
-        zenith_now_send_data( paired_core, sensor_data ) 
-    ); 
-    // If we don't get ack, increase number of failed sends
-    failed_sends = ( zenith_now_wait_for_ack( ZENITH_PACKET_DATA, 2000 ) == ESP_OK ) ? 0 : failed_sends + 1; 
+    uint8_t max_in_flight = node_flush_max_in_flight( core_version );
+    bool compact = core_pairing_flags & ZENITH_NOW_PAIRING_FLAG_COMPACT;
 
-    // On 5 failed sends we forget our peer
-    if ( failed_sends >= 5 ) { 
-        memset( paired_core, 0, ESP_NOW_ETH_ALEN ); // Clear peer address
-        failed_sends = 0; // Clear failed sends
+    while ( journal.count > 0 ) {
+        ESP_ERROR_CHECK(
+            node_flush_build( &flush, &journal, max_in_flight, compact, time( NULL ) )
+        );
+
+        // Send as many packets as we are allowed to have in flight
+        for ( uint8_t i = 0; i < flush.count; i++ ) {
+            ESP_LOGI( TAG, "Sending %d of %d journaled samples as packet %u", flush.packets[ i ].batched, journal.count, flush.packets[ i ].builder.packet->header.sequence );
+            ESP_ERROR_CHECK( 
+                zenith_now_send_packet( paired_core, flush.packets[ i ].builder.packet ) 
+            ); 
+        }
+
+        // Collect the acks - the samples of every packet that didn't make it are kept for the next try
+        for ( uint8_t i = 0; i < flush.count; i++ )
+            wait_for_data_ack( &flush.packets[ i ] );
+
+        if ( !node_flush_finish( &flush, &journal ) )
+            break;
     }
+
+    // On NODE_MAX_FAILED_FLUSHES failed flushes we forget our peer
+    if ( node_flush_forget_core( &journal ) )
+        memset( paired_core, 0, ESP_NOW_ETH_ALEN ); // Clear peer address
 }
 
 
@@ -165,11 +214,14 @@ void node_rx_callback( const uint8_t *mac, const zenith_now_packet_t *packet ) {
             switch ( ack->ack_for_type ) {
 
                 case ZENITH_PACKET_PAIRING:                    
+                    // Cores older than 1.4 don't send flags, and get the float encoding
+                    core_pairing_flags = ( packet->header.payload_size > offsetof( zenith_now_payload_ack_t, flags ) ) ? ack->flags : 0;
+                    core_version = packet->header.version;
                     memcpy( paired_core, mac, ESP_NOW_ETH_ALEN ); // Store peer mac in RTC memory
                     break;
 
                 case ZENITH_PACKET_DATA:
-                    failed_sends = 0; // Extra handling of late ack. Need a bit of luck for this to trigger after the send times out and before the deep_sleep starts.
+                    journal.failed_flushes = 0; // Extra handling of late ack. Need a bit of luck for this to trigger after the send times out and before the deep_sleep starts.
                     break;
             }
             break;
@@ -196,26 +248,33 @@ void app_main( void ){
         init_sensor( &sensor, i2c_bus ) 
     );
 
-    // Initialize blink LED
-    ESP_ERROR_CHECK( 
-        init_zenith_blink( GPIO_NUM_8 ) 
-    ); 
+    // Sample into the journal - no radio needed for this
+    journal_sample( sensor );
+    journal.wakes_since_flush++;
 
-    // Set up zenith-now
-    zenith_now_config_t zenith_now_config = {
-        .rx_cb = node_rx_callback,
-        .tx_cb = NULL,
-    };
-    ESP_ERROR_CHECK( 
-        zenith_now_init( &zenith_now_config )
-    ); 
-    // Check for paired core and pair if not
-    if ( !saved_peer() ) 
-        pair_with_core(); 
+    // Only bring up the radio when we have to pair or it's time to flush
+    if ( !saved_peer() || node_journal_should_flush( &journal, NODE_FLUSH_EVERY_N_WAKES ) ) {
+        // Initialize blink LED
+        ESP_ERROR_CHECK( 
+            init_zenith_blink( GPIO_NUM_8 ) 
+        ); 
 
-    // Send sensor data
-    send_data( sensor ); 
+        // Set up zenith-now
+        zenith_now_config_t zenith_now_config = {
+            .rx_cb = node_rx_callback,
+            .tx_cb = NULL,
+        };
+        ESP_ERROR_CHECK( 
+            zenith_now_init( &zenith_now_config )
+        ); 
+        // Check for paired core and pair if not
+        if ( !saved_peer() ) 
+            pair_with_core(); 
+
+        // Send the journaled sensor data
+        flush_journal(); 
+    }
 
     // Enter deep sleep
-    esp_deep_sleep( 30 * 1000 * 1000 );  // DEBUG! 30 seconds
+    esp_deep_sleep( NODE_SLEEP_TIME );
 }
\ No newline at end of file
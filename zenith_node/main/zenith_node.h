@@ -1,6 +1,11 @@
 #pragma once
 
+#include <time.h>
+#include "zenith_data.h"
+#include "zenith_node_flush.h" // Journal, flush and retry limits
+
 #define NODE_SLEEP_NO_PEER 3e8 //1000us * 1000ms * 60s * 5m
+#define NODE_SLEEP_TIME ( 30 * 1000 * 1000 ) // DEBUG! 30 seconds between samples
 
 #define I2C_MASTER_SCL_IO    20
 #define I2C_MASTER_SDA_IO    19
@@ -0,0 +1,163 @@
+// zenith_node_flush.c
+//
+// Journal and flush state machine shared by zenith_node and zenith_swarm. No radio, no waiting - the caller sends the
+// packets, waits for the acks however it likes, and reports back through node_flush_ack_result.
+
+#include <string.h>
+#include "esp_log.h"
+#include "esp_err.h"
+#include "esp_check.h"
+
+#include "zenith_now.h"
+#include "zenith_node_flush.h"
+
+static const char *TAG = "zenith-node-flush";
+
+bool node_journal_add( node_journal_t *journal, time_t timestamp, const zenith_datapoint_t *datapoints, uint8_t num_datapoints ) {
+    bool dropped = false;
+
+    if ( journal->count >= NODE_JOURNAL_CAPACITY ) {
+        memmove( &journal->entries[ 0 ], &journal->entries[ 1 ], ( NODE_JOURNAL_CAPACITY - 1 ) * sizeof( node_journal_entry_t ) );
+        journal->count = NODE_JOURNAL_CAPACITY - 1;
+        dropped = true;
+    }
+
+    node_journal_entry_t *entry = &journal->entries[ journal->count++ ];
+    entry->timestamp = timestamp;
+    entry->num_datapoints = ( num_datapoints < NODE_JOURNAL_MAX_DATAPOINTS ) ? num_datapoints : NODE_JOURNAL_MAX_DATAPOINTS;
+    memcpy( entry->datapoints, datapoints, entry->num_datapoints * sizeof( zenith_datapoint_t ) );
+
+    return dropped;
+}
+
+bool node_journal_should_flush( const node_journal_t *journal, uint8_t every_n_wakes ) {
+    return journal->count >= NODE_JOURNAL_CAPACITY || journal->wakes_since_flush >= every_n_wakes;
+}
+
+uint8_t node_flush_max_in_flight( uint8_t core_version ) {
+    return ( ZENITH_NOW_VERSION_MINOR( core_version ) >= ZENITH_NOW_SEQUENCE_MINOR_VERSION ) ? NODE_MAX_IN_FLIGHT : 1;
+}
+
+/// @brief Adds as many journaled samples as will fit to a data packet, oldest first
+/// @param start index of the first journal entry to add
+/// @param batched number of samples added
+static esp_err_t _fill_packet( zenith_now_packet_builder_t *builder, const node_journal_t *journal, uint8_t start, time_t now, uint8_t *batched ) {
+    for ( *batched = 0; start + *batched < journal->count; ( *batched )++ ) {
+        const node_journal_entry_t *entry = &journal->entries[ start + *batched ];
+
+        // Don't start a record that won't fit completely
+        if ( !zenith_now_builder_record_fits( builder, entry->num_datapoints ) )
+            break;
+
+        time_t age = now - entry->timestamp;
+        if ( age < 0 )
+            age = 0;
+        else if ( age > UINT16_MAX )
+            age = UINT16_MAX;
+
+        ESP_RETURN_ON_ERROR(
+            zenith_now_builder_begin_record( builder, ( uint16_t ) age ),
+            TAG, "Error starting record"
+        );
+        for ( uint8_t i = 0; i < entry->num_datapoints; i++ )
+            ESP_RETURN_ON_ERROR(
+                zenith_now_builder_add_datapoint( builder, entry->datapoints[ i ].reading_type, entry->datapoints[ i ].value ),
+                TAG, "Error adding datapoint"
+            );
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t node_flush_build( node_flush_t *flush, const node_journal_t *journal, uint8_t max_in_flight, bool compact, time_t now ) {
+    uint8_t queued = 0;
+
+    if ( max_in_flight > NODE_MAX_IN_FLIGHT )
+        max_in_flight = NODE_MAX_IN_FLIGHT;
+
+    for ( flush->count = 0; flush->count < max_in_flight && queued < journal->count; flush->count++ ) {
+        node_flush_packet_t *packet = &flush->packets[ flush->count ];
+        ESP_RETURN_ON_ERROR(
+            zenith_now_builder_init( &packet->builder, packet->buffer, sizeof( packet->buffer ), ZENITH_PACKET_DATA ),
+            TAG, "Error building data packet"
+        );
+        // Fixed-point deltas fit a lot more samples per packet, but only if the core agreed to it when we paired
+        if ( compact )
+            ESP_RETURN_ON_ERROR(
+                zenith_now_builder_set_encoding( &packet->builder, ZENITH_NOW_DATA_ENCODING_COMPACT ),
+                TAG, "Error setting compact encoding"
+            );
+
+        ESP_RETURN_ON_ERROR(
+            _fill_packet( &packet->builder, journal, queued, now, &packet->batched ),
+            TAG, "Error filling data packet"
+        );
+        packet->retransmits = 0;
+        packet->send_fail_retries = 0;
+        packet->state = NODE_FLUSH_PACKET_IN_FLIGHT;
+        queued += packet->batched;
+    }
+
+    return ESP_OK;
+}
+
+bool node_flush_ack_result( node_flush_packet_t *packet, esp_err_t result ) {
+    if ( result == ESP_OK ) {
+        packet->state = NODE_FLUSH_PACKET_ACKED;
+        return false;
+    }
+
+    // When the MAC layer reports the send failed there is no point waiting out the timeout - resend right away.
+    // That keeps the radio on for a lot less on a bad link.
+    if ( result == ESP_ERR_ZENITH_NOW_SEND_FAILED ) {
+        if ( packet->send_fail_retries < NODE_MAX_SEND_FAIL_RETRIES ) {
+            packet->send_fail_retries++;
+            return true;
+        }
+    } else if ( packet->retransmits < NODE_MAX_RETRANSMITS ) {
+        packet->retransmits++;
+        return true;
+    }
+
+    packet->state = NODE_FLUSH_PACKET_GAVE_UP;
+    return false;
+}
+
+bool node_flush_finish( node_flush_t *flush, node_journal_t *journal ) {
+    uint8_t kept = 0;
+    uint8_t offset = 0;
+    bool all_acked = true;
+
+    // Keep the samples of every packet that didn't make it, in order
+    for ( uint8_t i = 0; i < flush->count; i++ ) {
+        node_flush_packet_t *packet = &flush->packets[ i ];
+        if ( packet->state != NODE_FLUSH_PACKET_ACKED ) {
+            all_acked = false;
+            memmove( &journal->entries[ kept ], &journal->entries[ offset ], packet->batched * sizeof( node_journal_entry_t ) );
+            kept += packet->batched;
+        }
+        offset += packet->batched;
+    }
+    memmove( &journal->entries[ kept ], &journal->entries[ offset ], ( journal->count - offset ) * sizeof( node_journal_entry_t ) );
+    journal->count -= offset - kept;
+    flush->count = 0;
+
+    if ( journal->count == 0 )
+        journal->wakes_since_flush = 0;
+
+    if ( !all_acked ) {
+        journal->failed_flushes++;
+        return false;
+    }
+
+    journal->failed_flushes = 0;
+    return true;
+}
+
+bool node_flush_forget_core( node_journal_t *journal ) {
+    if ( journal->failed_flushes < NODE_MAX_FAILED_FLUSHES )
+        return false;
+
+    journal->failed_flushes = 0;
+    return true;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+// The node's journal and flush state machine, without the waiting. zenith_node runs it with blocking waits for the
+// acks, and zenith_swarm steps it from its driver loop - so the packing, pipelining, retry and give up decisions are
+// the same code in both.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include "esp_err.h"
+#include "zenith_now.h"
+#include "zenith_data.h"
+
+#define NODE_JOURNAL_CAPACITY 16        // Samples kept in RTC memory between flushes
+#define NODE_JOURNAL_MAX_DATAPOINTS 3   // Datapoints per sample - temperature, humidity and pressure
+#define NODE_FLUSH_EVERY_N_WAKES 10     // Bring up the radio and flush the journal every N wakes
+#define NODE_MAX_IN_FLIGHT 4            // Data packets sent before waiting for acks (1.5+ cores)
+#define NODE_ACK_TIMEOUT_MS 2000        // How long to wait for a data ack
+#define NODE_MAX_RETRANSMITS 2          // Retransmits of an unacked data packet before giving up this wake
+#define NODE_MAX_SEND_FAIL_RETRIES 3    // Immediate resends when the MAC layer drops a packet, 0 to disable
+#define NODE_MAX_FAILED_FLUSHES 5       // Flushes in a row that leave samples behind before we forget the core
+#define NODE_PAIRING_TRIES 5            // Pairing requests before sleeping NODE_SLEEP_NO_PEER
+#define NODE_PAIRING_TIMEOUT_MS 5000    // How long to wait for a pairing ack
+
+/// @brief One journaled sample: all datapoints read in a single wake
+typedef struct node_journal_entry_s {
+    time_t timestamp;   // When the sample was taken (RTC time)
+    uint8_t num_datapoints;
+    zenith_datapoint_t datapoints[ NODE_JOURNAL_MAX_DATAPOINTS ];
+} node_journal_entry_t;
+
+/// @brief Samples waiting for the core. The node keeps it in RTC memory so it only needs the radio every few wakes.
+typedef struct node_journal_s {
+    node_journal_entry_t entries[ NODE_JOURNAL_CAPACITY ];
+    uint8_t count;
+    uint8_t wakes_since_flush;
+    uint8_t failed_flushes;     // Flushes in a row that left samples behind
+} node_journal_t;
+
+typedef enum node_flush_packet_state_e {
+    NODE_FLUSH_PACKET_IN_FLIGHT = 0,    // Sent, waiting for the ack
+    NODE_FLUSH_PACKET_ACKED,
+    NODE_FLUSH_PACKET_GAVE_UP,          // Out of retries - its samples stay in the journal
+} node_flush_packet_state_t;
+
+/// @brief One data packet of a flush round
+typedef struct node_flush_packet_s {
+    uint8_t buffer[ ZENITH_NOW_MAX_PACKET_SIZE ];
+    zenith_now_packet_builder_t builder;    // builder.packet and builder.length is what goes on the air
+    uint8_t batched;                        // Journal entries it carries
+    uint8_t retransmits;
+    uint8_t send_fail_retries;
+    node_flush_packet_state_t state;
+} node_flush_packet_t;
+
+/// @brief The packets of one flush round, in journal order
+typedef struct node_flush_s {
+    node_flush_packet_t packets[ NODE_MAX_IN_FLIGHT ];
+    uint8_t count;
+} node_flush_t;
+
+/// @brief Appends a sample to the journal, dropping the oldest one when it's full
+/// @return true if the oldest sample was dropped
+bool node_journal_add( node_journal_t *journal, time_t timestamp, const zenith_datapoint_t *datapoints, uint8_t num_datapoints );
+
+/// @brief Checks if it's time to bring up the radio and flush the journal
+bool node_journal_should_flush( const node_journal_t *journal, uint8_t every_n_wakes );
+
+/// @brief How many packets we may have in flight with this core. Cores before 1.5 don't ack by sequence number.
+uint8_t node_flush_max_in_flight( uint8_t core_version );
+
+/// @brief Packs the journal into up to max_in_flight data packets, oldest samples first. Nothing is sent.
+/// @param compact the core agreed to ZENITH_NOW_PAIRING_FLAG_COMPACT when we paired
+/// @param now current time, used to calculate the age of each sample
+esp_err_t node_flush_build( node_flush_t *flush, const node_journal_t *journal, uint8_t max_in_flight, bool compact, time_t now );
+
+/// @brief Records how waiting for a packet's ack went
+/// @param result ESP_OK if acked, ESP_ERR_ZENITH_NOW_SEND_FAILED if the MAC layer dropped it, anything else is a timeout
+/// @return true if the packet should be sent again - same buffer, same sequence number
+bool node_flush_ack_result( node_flush_packet_t *packet, esp_err_t result );
+
+/// @brief Ends a flush round: removes the samples of acked packets from the journal and keeps the rest
+/// @return true if every packet was acked, so the next round can go out right away
+bool node_flush_finish( node_flush_t *flush, node_journal_t *journal );
+
+/// @brief Checks if we've failed NODE_MAX_FAILED_FLUSHES flushes in a row, and starts counting again if so
+/// @return true if it's time to forget the core and pair again
+bool node_flush_forget_core( node_journal_t *journal );
@@ -0,0 +1,521 @@
+// zenith_swarm.c
+//
+// Load generator for the core. Runs the core's receive pipeline (zenith_now + core_rx_callback + registry) on the
+// linux target, and hammers it with SWARM_NODES simulated nodes over the loopback transport. Every node pairs,
+// journals samples, flushes them and retransmits with zenith_node's own journal and flush code (zenith_node_flush.c).
+// Only the waiting is the swarm's own: the node blocks for each ack, a swarm node is stepped from the driver loop.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <math.h>
+#include <time.h>
+#include <malloc.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_err.h"
+#include "esp_check.h"
+#include "nvs_flash.h"
+
+#include "zenith_now.h"
+#include "zenith_data.h"
+#include "zenith_registry.h"
+#include "zenith_log.h"
+#include "zenith_core_rx.h"
+#include "zenith_swarm.h"
+
+static const char *TAG = "zenith-swarm";
+
+static const uint8_t broadcast_mac[ ZENITH_NOW_MAC_LEN ] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+static const uint8_t core_mac[ ZENITH_NOW_MAC_LEN ] = { 0x02, 'Z', 'C', 0x00, 0x00, 0x01 };
+
+typedef struct swarm_stats_s {
+    uint32_t packets_sent;          // Data packets, retransmits included
+    uint32_t packets_acked;
+    uint32_t samples_acked;
+    uint32_t retransmits;           // After an ack timeout
+    uint32_t send_fail_retries;     // After the link reported a failed send
+    uint32_t flushes_failed;        // Gave up on a packet, samples kept for the next flush
+    uint32_t pairings;
+    uint32_t pairing_timeouts;
+    uint32_t cores_forgotten;       // NODE_MAX_FAILED_FLUSHES failed flushes in a row
+    uint32_t flush_rounds;
+    int64_t ack_wait_us;            // Nodes waiting for data acks - radio on, nothing else to do
+} swarm_stats_t;
+
+static struct {
+    SemaphoreHandle_t lock;         // Protects the callback fields of the nodes
+    swarm_node_t *nodes;
+    swarm_stats_t stats;
+    uint32_t latency_histogram[ SWARM_LATENCY_BUCKETS ];
+    uint32_t latency_count;
+    int64_t latency_max_us;
+} swarm = { 0 };
+
+static int64_t _now_us( void ) {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ( int64_t ) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/// @brief An interval with SWARM_JITTER_PERCENT random jitter, in microseconds
+static int64_t _jittered_us( uint32_t interval_ms ) {
+    int jitter = ( rand() % ( 2 * SWARM_JITTER_PERCENT + 1 ) ) - SWARM_JITTER_PERCENT;
+    return ( int64_t ) interval_ms * ( 100 + jitter ) * 10;
+}
+
+/// @brief Node macs are locally administered, with the node index in the last three bytes
+static swarm_node_t *_node_from_mac( const uint8_t *mac ) {
+    uint32_t index = ( mac[ 3 ] << 16 ) | ( mac[ 4 ] << 8 ) | mac[ 5 ];
+    return index < SWARM_NODES ? &swarm.nodes[ index ] : NULL;
+}
+
+static void _record_latency( int64_t latency_us ) {
+    int64_t bucket = latency_us / SWARM_LATENCY_BUCKET_US;
+    if ( bucket >= SWARM_LATENCY_BUCKETS )
+        bucket = SWARM_LATENCY_BUCKETS - 1;
+    if ( bucket < 0 )
+        bucket = 0;
+    swarm.latency_histogram[ bucket ]++;
+    swarm.latency_count++;
+    if ( latency_us > swarm.latency_max_us )
+        swarm.latency_max_us = latency_us;
+}
+
+/// @brief Upper bound of the histogram bucket the percentile falls in
+static int64_t _latency_percentile( double percentile ) {
+    if ( !swarm.latency_count )
+        return 0;
+
+    uint64_t target = ( uint64_t ) ceil( swarm.latency_count * percentile / 100.0 );
+    uint64_t seen = 0;
+    for ( uint32_t i = 0; i < SWARM_LATENCY_BUCKETS; i++ ) {
+        seen += swarm.latency_histogram[ i ];
+        if ( seen >= target )
+            return ( int64_t ) ( i + 1 ) * SWARM_LATENCY_BUCKET_US;
+    }
+    return swarm.latency_max_us;
+}
+
+/// @brief Receive callback of every node endpoint. Runs in the core's zenith_now task, so keep it short.
+static void _node_recv_cb( zenith_now_transport_handle_t transport, const uint8_t *src_mac, const uint8_t *data, int len ) {
+    int64_t now = _now_us();
+    uint8_t own_mac[ ZENITH_NOW_MAC_LEN ];
+    transport->get_mac( transport, own_mac );
+    swarm_node_t *node = _node_from_mac( own_mac );
+
+    // Nodes hear each other's pairing broadcasts - only acks from the core matter
+    if ( !node || len < ( int ) ( sizeof( zenith_now_packet_header_t ) + offsetof( zenith_now_payload_ack_t, sequence ) ) )
+        return;
+
+    const zenith_now_packet_t *packet = ( const zenith_now_packet_t * ) data;
+    if ( packet->header.type != ZENITH_PACKET_ACK )
+        return;
+    const zenith_now_payload_ack_t *ack = ( const zenith_now_payload_ack_t * ) packet->payload;
+
+    xSemaphoreTake( swarm.lock, portMAX_DELAY );
+    switch ( ack->ack_for_type ) {
+        case ZENITH_PACKET_PAIRING:
+            if ( node->state == SWARM_NODE_PAIRING ) {
+                memcpy( node->paired_core, src_mac, ZENITH_NOW_MAC_LEN );
+                node->core_pairing_flags = ack->flags;
+                node->core_version = packet->header.version;
+                node->pairing_acked = true;
+            }
+            break;
+
+        case ZENITH_PACKET_DATA:
+            if ( node->state != SWARM_NODE_WAITING_ACK )
+                break;
+            // One ack covers every packet in its window
+            for ( uint8_t i = 0; i < node->in_flight; i++ ) {
+                uint16_t behind = ack->sequence - node->sequences[ i ];
+                if ( !node->data_acked[ i ] && behind < ZENITH_NOW_SEQUENCE_WINDOW && ( ack->window & ( 1UL << behind ) ) ) {
+                    node->data_acked[ i ] = true;
+                    node->acked_us[ i ] = now;
+                }
+            }
+            break;
+
+        default:
+            break;
+    }
+    xSemaphoreGive( swarm.lock );
+}
+
+/// @brief Send callback of every node endpoint. Loopback reports the status from inside send(), in the driver task.
+static void _node_send_cb( zenith_now_transport_handle_t transport, const uint8_t *dest_mac, zenith_now_send_status_t status ) {
+    if ( status == ZENITH_NOW_SEND_SUCCESS || memcmp( dest_mac, broadcast_mac, ZENITH_NOW_MAC_LEN ) == 0 )
+        return;
+
+    uint8_t own_mac[ ZENITH_NOW_MAC_LEN ];
+    transport->get_mac( transport, own_mac );
+    swarm_node_t *node = _node_from_mac( own_mac );
+    if ( !node )
+        return;
+
+    xSemaphoreTake( swarm.lock, portMAX_DELAY );
+    node->link_failed = true;
+    xSemaphoreGive( swarm.lock );
+}
+
+static void _node_send_pairing( swarm_node_t *node, int64_t now ) {
+    zenith_now_packet_builder_t builder;
+    zenith_now_payload_pairing_t pairing = {
+        .flags = ZENITH_NOW_PAIRING_FLAGS_SUPPORTED,
+    };
+    ESP_ERROR_CHECK( zenith_now_builder_init( &builder, node->pairing_packet, sizeof( node->pairing_packet ), ZENITH_PACKET_PAIRING ) );
+    // zenith_now numbers packets from one counter per process - each simulated node needs its own
+    builder.packet->header.sequence = node->next_sequence++;
+    ESP_ERROR_CHECK( zenith_now_builder_append( &builder, &pairing, sizeof( pairing ) ) );
+
+    node->transport->send( node->transport, broadcast_mac, node->pairing_packet, builder.length );
+    node->deadline_us = now + NODE_PAIRING_TIMEOUT_MS * 1000LL;
+    node->state = SWARM_NODE_PAIRING;
+}
+
+/// @brief Takes a fake sample into the journal - same as journal_sample
+static void _node_sample( swarm_node_t *node ) {
+    zenith_datapoint_t datapoints[] = {
+        { ZENITH_DATAPOINT_TEMPERATURE, 18.0f + ( rand() % 800 ) / 100.0f },
+        { ZENITH_DATAPOINT_HUMIDITY, 30.0f + ( rand() % 4000 ) / 100.0f },
+        { ZENITH_DATAPOINT_PRESSURE, 990.0f + ( rand() % 4000 ) / 100.0f },
+    };
+    node_journal_add( &node->journal, time( NULL ), datapoints, sizeof( datapoints ) / sizeof( datapoints[ 0 ] ) );
+    node->journal.wakes_since_flush++;
+}
+
+/// @brief Sends one packet of the flush round, and notes if the link dropped it
+static void _node_send_flush_packet( swarm_node_t *node, uint8_t index ) {
+    const zenith_now_packet_builder_t *builder = &node->flush.packets[ index ].builder;
+    bool link_failed;
+
+    xSemaphoreTake( swarm.lock, portMAX_DELAY );
+    node->link_failed = false;
+    xSemaphoreGive( swarm.lock );
+
+    swarm.stats.packets_sent++;
+    node->transport->send( node->transport, node->paired_core, ( const uint8_t * ) builder->packet, builder->length );
+
+    xSemaphoreTake( swarm.lock, portMAX_DELAY );
+    link_failed = node->link_failed;
+    xSemaphoreGive( swarm.lock );
+    node->send_failed[ index ] = link_failed;
+}
+
+/// @brief Packs the journal into a flush round and sends it - like one pass of flush_journal's loop
+static void _node_send_round( swarm_node_t *node, int64_t now ) {
+    ESP_ERROR_CHECK(
+        node_flush_build( &node->flush, &node->journal, node_flush_max_in_flight( node->core_version ),
+                          node->core_pairing_flags & ZENITH_NOW_PAIRING_FLAG_COMPACT, time( NULL ) )
+    );
+
+    // Before sending - the acks can come back before send() returns
+    xSemaphoreTake( swarm.lock, portMAX_DELAY );
+    for ( uint8_t i = 0; i < node->flush.count; i++ ) {
+        node->flush.packets[ i ].builder.packet->header.sequence = node->next_sequence++;
+        node->sequences[ i ] = node->flush.packets[ i ].builder.packet->header.sequence;
+        node->data_acked[ i ] = false;
+    }
+    node->in_flight = node->flush.count;
+    node->state = SWARM_NODE_WAITING_ACK;
+    xSemaphoreGive( swarm.lock );
+    swarm.stats.flush_rounds++;
+
+    for ( uint8_t i = 0; i < node->flush.count; i++ ) {
+        node->sent_us[ i ] = now;
+        _node_send_flush_packet( node, i );
+    }
+    node->waiting = 0;
+    node->deadline_us = now + NODE_ACK_TIMEOUT_MS * 1000LL;
+}
+
+/// @brief Waits for the acks of the flush round one packet at a time, like wait_for_data_ack, without blocking
+static void _node_step_flush( swarm_node_t *node, int64_t now, const bool *data_acked, const int64_t *acked_us ) {
+    node_flush_packet_t *packet = &node->flush.packets[ node->waiting ];
+    esp_err_t result;
+
+    if ( data_acked[ node->waiting ] )
+        result = ESP_OK;
+    else if ( SWARM_NODE_FAIL_FAST && node->send_failed[ node->waiting ] )
+        result = ESP_ERR_ZENITH_NOW_SEND_FAILED;
+    else if ( now >= node->deadline_us )
+        result = ESP_ERR_TIMEOUT;
+    else {
+        node->next_step_us = now + 1000;
+        return;
+    }
+    // Every wait starts with a fresh NODE_ACK_TIMEOUT_MS, like a call to zenith_now_wait_for_ack_sequence
+    swarm.stats.ack_wait_us += now - ( node->deadline_us - NODE_ACK_TIMEOUT_MS * 1000LL );
+
+    if ( result == ESP_OK ) {
+        _record_latency( acked_us[ node->waiting ] - node->sent_us[ node->waiting ] );
+        swarm.stats.packets_acked++;
+        swarm.stats.samples_acked += packet->batched;
+    }
+
+    if ( node_flush_ack_result( packet, result ) ) {
+        if ( result == ESP_ERR_ZENITH_NOW_SEND_FAILED )
+            swarm.stats.send_fail_retries++;
+        else
+            swarm.stats.retransmits++;
+        _node_send_flush_packet( node, node->waiting );
+        node->deadline_us = now + NODE_ACK_TIMEOUT_MS * 1000LL;
+        node->next_step_us = now + 1000;
+        return;
+    }
+
+    // On to the next packet of the round - its ack may be in already
+    if ( ++node->waiting < node->flush.count ) {
+        node->deadline_us = now + NODE_ACK_TIMEOUT_MS * 1000LL;
+        node->next_step_us = now;
+        return;
+    }
+
+    if ( node_flush_finish( &node->flush, &node->journal ) ) {
+        if ( node->journal.count > 0 ) {
+            _node_send_round( node, now );
+            node->next_step_us = now + 1000;
+            return;
+        }
+    } else {
+        swarm.stats.flushes_failed++;
+    }
+
+    xSemaphoreTake( swarm.lock, portMAX_DELAY );
+    node->in_flight = 0;
+    node->state = SWARM_NODE_SLEEPING;
+    xSemaphoreGive( swarm.lock );
+    node->next_step_us = now + _jittered_us( SWARM_SAMPLE_INTERVAL_MS );
+
+    if ( node_flush_forget_core( &node->journal ) ) {
+        swarm.stats.cores_forgotten++;
+        node->state = SWARM_NODE_UNPAIRED;
+        node->next_step_us = now;
+    }
+}
+
+/// @brief Runs one step of a node's wake cycle
+static void _node_step( swarm_node_t *node, int64_t now ) {
+    bool pairing_acked;
+    bool data_acked[ NODE_MAX_IN_FLIGHT ];
+    int64_t acked_us[ NODE_MAX_IN_FLIGHT ];
+
+    xSemaphoreTake( swarm.lock, portMAX_DELAY );
+    pairing_acked = node->pairing_acked;
+    memcpy( data_acked, node->data_acked, sizeof( data_acked ) );
+    memcpy( acked_us, node->acked_us, sizeof( acked_us ) );
+    node->pairing_acked = false;
+    xSemaphoreGive( swarm.lock );
+
+    switch ( node->state ) {
+        case SWARM_NODE_UNPAIRED:
+            if ( node->pairing_tries++ >= NODE_PAIRING_TRIES ) {
+                node->pairing_tries = 0;
+                node->next_step_us = now + SWARM_NO_PEER_BACKOFF_MS * 1000LL;
+                break;
+            }
+            _node_send_pairing( node, now );
+            node->next_step_us = now + 1000;
+            break;
+
+        case SWARM_NODE_PAIRING:
+            if ( pairing_acked ) {
+                swarm.stats.pairings++;
+                node->pairing_tries = 0;
+                node->transport->add_peer( node->transport, node->paired_core );
+                node->state = SWARM_NODE_SLEEPING;
+                node->next_step_us = now + _jittered_us( SWARM_SAMPLE_INTERVAL_MS );
+            } else if ( now >= node->deadline_us ) {
+                swarm.stats.pairing_timeouts++;
+                node->state = SWARM_NODE_UNPAIRED;
+                node->next_step_us = now;
+            } else {
+                node->next_step_us = now + 1000;
+            }
+            break;
+
+        case SWARM_NODE_SLEEPING:
+            _node_sample( node );
+            if ( node_journal_should_flush( &node->journal, SWARM_FLUSH_EVERY_N_SAMPLES ) ) {
+                _node_send_round( node, now );
+                node->next_step_us = now + 1000;
+            } else {
+                node->next_step_us = now + _jittered_us( SWARM_SAMPLE_INTERVAL_MS );
+            }
+            break;
+
+        case SWARM_NODE_WAITING_ACK:
+            _node_step_flush( node, now, data_acked, acked_us );
+            break;
+    }
+}
+
+static void _report( const char *title, int64_t elapsed_us, const swarm_stats_t *last, int64_t interval_us ) {
+    const swarm_stats_t *stats = &swarm.stats;
+    zenith_now_stats_t now_stats = { 0 };
+    zenith_now_get_stats( &now_stats );
+    struct mallinfo2 heap = mallinfo2();
+
+    uint32_t paired = 0;
+    for ( uint32_t i = 0; i < SWARM_NODES; i++ )
+        if ( swarm.nodes[ i ].state >= SWARM_NODE_SLEEPING )
+            paired++;
+
+    double interval_s = interval_us / 1e6;
+    printf( "---- %s @ %.1f s ----\n", title, elapsed_us / 1e6 );
+    printf( "Nodes paired:       %u / %u\n", (unsigned) paired, (unsigned) SWARM_NODES );
+    printf( "Data sent:          %.1f packets/s (%u total)\n", ( stats->packets_sent - last->packets_sent ) / interval_s, (unsigned) stats->packets_sent );
+    printf( "Data acked:         %.1f packets/s, %.1f samples/s (%u total)\n",
+            ( stats->packets_acked - last->packets_acked ) / interval_s, ( stats->samples_acked - last->samples_acked ) / interval_s, (unsigned) stats->packets_acked );
+    printf( "ACK latency:        p50 %lld us, p90 %lld us, p99 %lld us, p99.9 %lld us, max %lld us\n",
+            (long long) _latency_percentile( 50 ), (long long) _latency_percentile( 90 ), (long long) _latency_percentile( 99 ),
+            (long long) _latency_percentile( 99.9 ), (long long) swarm.latency_max_us );
+    printf( "Retransmits:        %u timeout, %u send fail\n", (unsigned) stats->retransmits, (unsigned) stats->send_fail_retries );
+    printf( "Ack waits:          %.1f ms per flush round, %.1f s over %u rounds\n",
+            stats->flush_rounds ? stats->ack_wait_us / 1e3 / stats->flush_rounds : 0.0, stats->ack_wait_us / 1e6, (unsigned) stats->flush_rounds );
+    printf( "Flushes failed:     %u, cores forgotten %u\n", (unsigned) stats->flushes_failed, (unsigned) stats->cores_forgotten );
+    printf( "Pairings:           %u, timed out %u\n", (unsigned) stats->pairings, (unsigned) stats->pairing_timeouts );
+    printf( "Core RX pool:       high water %u / %u, exhausted %u\n", (unsigned) now_stats.rx_pool_high_water, (unsigned) now_stats.rx_pool_size, (unsigned) now_stats.rx_pool_exhausted );
+    printf( "Core duplicates:    %u, tx failed %u\n", (unsigned) now_stats.rx_duplicates, (unsigned) now_stats.tx_failed );
+    printf( "Core ACK latency:   avg %u us, max %u us over %u acks\n", (unsigned) now_stats.ack_latency_avg_us, (unsigned) now_stats.ack_latency_max_us, (unsigned) now_stats.acks_sent );
+    printf( "Core event queue:   high water %u / %u, %u.%u events per wake-up, dropped %u RX %u TX status\n",
+            (unsigned) now_stats.event_queue_high_water, (unsigned) now_stats.event_queue_size,
+            (unsigned) now_stats.event_batch_avg_x10 / 10, (unsigned) now_stats.event_batch_avg_x10 % 10,
+            (unsigned) now_stats.rx_queue_dropped, (unsigned) now_stats.tx_status_dropped );
+    printf( "Heap in use:        %zu bytes\n", heap.uordblks );
+}
+
+static esp_err_t _start_core( void ) {
+    esp_err_t err = nvs_flash_init();
+    if ( err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND ) {
+        ESP_ERROR_CHECK( nvs_flash_erase() );
+        err = nvs_flash_init();
+    }
+    ESP_RETURN_ON_ERROR(
+        err,
+        TAG, "Error initializing NVS"
+    );
+
+    zenith_registry_handle_t registry = NULL;
+    ESP_RETURN_ON_ERROR(
+        zenith_registry_new( &registry ),
+        TAG, "Error creating registry"
+    );
+
+    zenith_log_handle_t log = NULL;
+#if SWARM_LOG
+    zenith_log_storage_handle_t log_storage = NULL;
+    ESP_RETURN_ON_ERROR(
+        zenith_log_storage_new_file( SWARM_LOG_PATH, SWARM_LOG_SIZE, &log_storage ),
+        TAG, "Error opening log file"
+    );
+    ESP_RETURN_ON_ERROR(
+        zenith_log_new( log_storage, &log ),
+        TAG, "Error opening log"
+    );
+#endif
+    zenith_core_rx_init( registry, log );
+
+    zenith_now_transport_loopback_config_t loopback_config = { .loss_percent = 0 };
+    memcpy( loopback_config.mac, core_mac, ZENITH_NOW_MAC_LEN );
+    zenith_now_transport_handle_t transport = NULL;
+    ESP_RETURN_ON_ERROR(
+        zenith_now_transport_new_loopback( &loopback_config, &transport ),
+        TAG, "Error creating core transport"
+    );
+
+    zenith_now_config_t zn_config = {
+        .rx_cb = core_rx_callback,
+        .rx_pool_size = SWARM_CORE_RX_POOL_SIZE,
+        .event_queue_size = SWARM_CORE_EVENT_QUEUE_SIZE,
+        .max_peers = SWARM_NODES,
+        .transport = transport,
+#if SWARM_CORE_AUTO_ACK
+        .auto_ack = CORE_RX_AUTO_ACK,
+        .rx_worker = CORE_RX_WORKER,
+#endif
+    };
+    return zenith_now_init( &zn_config );
+}
+
+static esp_err_t _start_nodes( void ) {
+    swarm.nodes = calloc( SWARM_NODES, sizeof( swarm_node_t ) );
+    ESP_RETURN_ON_FALSE(
+        swarm.nodes,
+        ESP_ERR_NO_MEM,
+        TAG, "Error allocating %d nodes", SWARM_NODES
+    );
+
+    int64_t now = _now_us();
+    for ( uint32_t i = 0; i < SWARM_NODES; i++ ) {
+        swarm_node_t *node = &swarm.nodes[ i ];
+        zenith_now_transport_loopback_config_t loopback_config = {
+            .mac = { 0x02, 'Z', 'N', ( i >> 16 ) & 0xff, ( i >> 8 ) & 0xff, i & 0xff },
+            .loss_percent = SWARM_LOSS_PERCENT,
+        };
+        memcpy( node->mac, loopback_config.mac, ZENITH_NOW_MAC_LEN );
+
+        ESP_RETURN_ON_ERROR(
+            zenith_now_transport_new_loopback( &loopback_config, &node->transport ),
+            TAG, "Error creating transport for node %u", (unsigned) i
+        );
+        ESP_RETURN_ON_ERROR(
+            node->transport->initialize( node->transport, _node_recv_cb, _node_send_cb ),
+            TAG, "Error initializing transport for node %u", (unsigned) i
+        );
+        ESP_RETURN_ON_ERROR(
+            node->transport->add_peer( node->transport, broadcast_mac ),
+            TAG, "Error adding broadcast peer for node %u", (unsigned) i
+        );
+
+        // Spread the first wake over a whole interval, so they don't all pair at once
+        node->state = SWARM_NODE_UNPAIRED;
+        node->next_step_us = now + ( rand() % ( SWARM_SAMPLE_INTERVAL_MS * 1000 ) );
+    }
+
+    return ESP_OK;
+}
+
+void app_main( void ) {
+    // Per packet logging from the core would drown the report
+    esp_log_level_set( "*", ESP_LOG_WARN );
+    esp_log_level_set( TAG, ESP_LOG_INFO );
+
+    swarm.lock = xSemaphoreCreateMutex();
+    ESP_ERROR_CHECK( swarm.lock ? ESP_OK : ESP_ERR_NO_MEM );
+    ESP_ERROR_CHECK( _start_core() );
+    ESP_ERROR_CHECK( _start_nodes() );
+
+    ESP_LOGI( TAG, "Running %d nodes for %d s, sampling every %d ms +-%d%%, flushing every %d samples, %d%% loss, %s, %s",
+              SWARM_NODES, SWARM_DURATION_S, SWARM_SAMPLE_INTERVAL_MS, SWARM_JITTER_PERCENT, SWARM_FLUSH_EVERY_N_SAMPLES, SWARM_LOSS_PERCENT,
+              SWARM_CORE_AUTO_ACK ? "auto ack" : "acks from core_rx_callback",
+              SWARM_NODE_FAIL_FAST ? "failed sends end the ack wait" : "acks waited out after failed sends" );
+
+    int64_t start = _now_us();
+    int64_t end = start + SWARM_DURATION_S * 1000000LL;
+    int64_t last_report = start;
+    swarm_stats_t last_stats = swarm.stats;
+
+    for ( int64_t now = start; now < end; now = _now_us() ) {
+        for ( uint32_t i = 0; i < SWARM_NODES; i++ )
+            if ( now >= swarm.nodes[ i ].next_step_us )
+                _node_step( &swarm.nodes[ i ], now );
+
+        if ( now - last_report >= SWARM_REPORT_INTERVAL_S * 1000000LL ) {
+            _report( "Progress", now - start, &last_stats, now - last_report );
+            last_stats = swarm.stats;
+            last_report = now;
+        }
+
+        // Lets the core's task run
+        vTaskDelay( 1 );
+    }
+
+    swarm_stats_t zero = { 0 };
+    _report( "Final", _now_us() - start, &zero, _now_us() - start );
+    exit( 0 );
+}
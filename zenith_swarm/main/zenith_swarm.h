@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "zenith_now.h"
+#include "zenith_node_flush.h" // The node's journal and flush state machine - swarm nodes run the real thing
+
+#define SWARM_NODES 500                     // Simulated nodes
+#define SWARM_SAMPLE_INTERVAL_MS 100        // Time between samples on each node. Real nodes sleep NODE_SLEEP_TIME
+#define SWARM_JITTER_PERCENT 20             // Random +- on every interval, so nodes drift apart like real ones do
+#define SWARM_FLUSH_EVERY_N_SAMPLES NODE_FLUSH_EVERY_N_WAKES // Samples journaled before a node sends them
+#define SWARM_LOSS_PERCENT 0                // Frames lost on every node's link
+#define SWARM_NODE_FAIL_FAST 1              // 1 = a failed send ends the ack wait, like zenith_now_wait_for_ack_sequence. 0 = wait out NODE_ACK_TIMEOUT_MS
+#define SWARM_DURATION_S 60                 // Length of the run
+#define SWARM_REPORT_INTERVAL_S 5           // Time between progress reports
+#define SWARM_NO_PEER_BACKOFF_MS 30000      // Real nodes deep sleep NODE_SLEEP_NO_PEER after NODE_PAIRING_TRIES failed pairings
+#define SWARM_CORE_RX_POOL_SIZE 0           // 0 = ZENITH_NOW_DEFAULT_RX_POOL_SIZE, same as the core
+#define SWARM_CORE_EVENT_QUEUE_SIZE 0       // 0 = sized to the pool, same as the core
+#define SWARM_CORE_AUTO_ACK 1               // 1 = run zenith_now like the core does (auto ack + worker), 0 = ack from core_rx_callback
+#define SWARM_LOG 1                         // 1 = append readings to a flash log like the core does, 0 = registry only
+#define SWARM_LOG_PATH "zenith_swarm.log"   // File standing in for the core's history partition
+#define SWARM_LOG_SIZE ( 1024 * 1024 )      // Same as the history partition
+
+#define SWARM_LATENCY_BUCKET_US 50          // ACK latency histogram resolution
+#define SWARM_LATENCY_BUCKETS 20000         // 20000 * 50 us = 1 s. Slower acks land in the last bucket
+
+/// @brief Where a simulated node is in its wake cycle
+typedef enum swarm_node_state_e {
+    SWARM_NODE_UNPAIRED = 0,    // Next step broadcasts a pairing request
+    SWARM_NODE_PAIRING,         // Waiting for the pairing ack
+    SWARM_NODE_SLEEPING,        // Paired, next step takes a sample
+    SWARM_NODE_WAITING_ACK,     // Flush round in flight, waiting for the ack of packet `waiting`
+} swarm_node_state_t;
+
+/// @brief One simulated node
+typedef struct swarm_node_s {
+    zenith_now_transport_handle_t transport;
+    uint8_t mac[ ZENITH_NOW_MAC_LEN ];
+    swarm_node_state_t state;
+    int64_t next_step_us;           // When the driver runs the node next
+
+    // What a real node keeps in RTC memory
+    uint8_t paired_core[ ZENITH_NOW_MAC_LEN ];
+    uint8_t core_pairing_flags;
+    uint8_t core_version;
+    uint8_t pairing_tries;
+    uint16_t next_sequence;
+    node_journal_t journal;
+
+    // The flush round in flight. Packets are waited for in order, one deadline at a time, like flush_journal does.
+    node_flush_t flush;
+    uint8_t waiting;                // Packet whose ack we are waiting for
+    int64_t deadline_us;
+    int64_t sent_us[ NODE_MAX_IN_FLIGHT ];
+    bool send_failed[ NODE_MAX_IN_FLIGHT ]; // The link dropped the last send of the packet
+
+    // Pairing request in flight
+    uint8_t pairing_packet[ ZENITH_NOW_MAX_PACKET_SIZE ];
+
+    // Set by the transport callbacks, which run in the core's task. Protected by the swarm lock.
+    uint16_t sequences[ NODE_MAX_IN_FLIGHT ];   // Of the packets in flight - the callbacks don't touch the flush
+    uint8_t in_flight;
+    bool pairing_acked;
+    bool data_acked[ NODE_MAX_IN_FLIGHT ];
+    bool link_failed;
+    int64_t acked_us[ NODE_MAX_IN_FLIGHT ];
+} swarm_node_t;